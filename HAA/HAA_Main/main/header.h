@@ -166,6 +166,8 @@
 #define INITIAL_STATE                       "s"
 #define EXEC_ACTIONS_ON_BOOT                "xa"
 #define KILLSWITCH                          "ks"
+#define EVENT_INTERVAL_SET                  "ei"
+#define EVENT_DEDUPE_SET                    "ed"
 #define IO_CONFIG_ARRAY                     "io"
 #define IO_GPIO_MODE                        io_value[0]
 #define IO_GPIO_PULL_UP_DOWN                io_value[1]
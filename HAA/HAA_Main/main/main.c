@@ -10216,6 +10216,31 @@ void normal_mode_init() {
         //INFO("<%i> KS 0b%i%i", ch_group->serv_index, ch_group->main_enabled, ch_group->child_enabled);
     }
     
+    void set_event_policy(ch_group_t* ch_group, cJSON_rsf* json_context, const unsigned int chs) {
+        if (cJSON_rsf_GetObjectItemCaseSensitive(json_context, EVENT_INTERVAL_SET) != NULL) {
+            // Clamped before conversion, so negative, NaN or huge values are safe
+            const float event_interval_set = cJSON_rsf_GetObjectItemCaseSensitive(json_context, EVENT_INTERVAL_SET)->valuefloat * 1000.f;
+            unsigned int event_interval = 0;
+            if (event_interval_set >= HOMEKIT_EVENT_INTERVAL_MAX) {
+                event_interval = HOMEKIT_EVENT_INTERVAL_MAX;
+            } else if (event_interval_set > 0) {
+                event_interval = event_interval_set;
+            }
+            
+            for (unsigned int i = 0; i < chs; i++) {
+                ch_group->ch[i]->min_event_interval = event_interval;
+            }
+        }
+        
+        if (cJSON_rsf_GetObjectItemCaseSensitive(json_context, EVENT_DEDUPE_SET) != NULL) {
+            const bool event_dedupe = (bool) cJSON_rsf_GetObjectItemCaseSensitive(json_context, EVENT_DEDUPE_SET)->valuefloat;
+            
+            for (unsigned int i = 0; i < chs; i++) {
+                ch_group->ch[i]->event_dedupe = event_dedupe;
+            }
+        }
+    }
+    
     void set_accessory_ir_protocol(ch_group_t* ch_group, cJSON_rsf* json_context) {
         if (cJSON_rsf_GetObjectItemCaseSensitive(json_context, IRRF_ACTION_PROTOCOL) != NULL) {
             ch_group->ir_protocol = uni_strdup(cJSON_rsf_GetObjectItemCaseSensitive(json_context, IRRF_ACTION_PROTOCOL)->valuestring, &unistrings);
@@ -12887,6 +12912,8 @@ void normal_mode_init() {
         ch_group->ch[5] = NEW_HOMEKIT_CHARACTERISTIC(CUSTOM_CONSUMP_RESET_DATE, 0);
         ch_group->ch[6] = NEW_HOMEKIT_CHARACTERISTIC(CUSTOM_CONSUMP_RESET, "", .setter_ex=hkc_custom_consumption_reset_setter);
         
+        set_event_policy(ch_group, json_context, 4);
+        
         if (ch_group->homekit_enabled) {
             accessories[accessory]->services[service] = calloc(1, sizeof(homekit_service_t));
             accessories[accessory]->services[service]->id = ((service - 1) * 50) + 8;
@@ -13153,6 +13180,8 @@ void normal_mode_init() {
         
         ch_group->ch[0]->value.float_value = set_initial_state(ch_group, 0, json_context, 0, CH_TYPE_FLOAT);
         
+        set_event_policy(ch_group, json_context, 1);
+        
         if (tg_serv != 0) {
             ch_group->ch[ch_group->chs - 1] = ch_group_find_by_serv(get_absolut_index(service_numerator, tg_serv))->ch[tg_ch];
         }
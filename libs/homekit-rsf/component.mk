@@ -28,11 +28,20 @@ EXTRA_WOLFSSL_CFLAGS = \
 	-DWOLFCRYPT_ONLY \
 	-DTFM_TIMING_RESISTANT
 
+# HOMEKIT_SMALL leaves out fast Curve25519 and Ed25519 math. HOMEKIT_SMALL_ED25519 only leaves
+# out Ed25519 base point tables, which are most of the size, and keeps Pair Verify X25519 fast.
 ifeq ($(HOMEKIT_SMALL),1)
 EXTRA_WOLFSSL_CFLAGS += \
 	-DCURVE25519_SMALL \
 	-DED25519_SMALL
+else ifeq ($(HOMEKIT_SMALL_ED25519),1)
+EXTRA_WOLFSSL_CFLAGS += \
+	-DED25519_SMALL
 endif
 
 wolfssl_CFLAGS += $(EXTRA_WOLFSSL_CFLAGS)
 homekit_CFLAGS += $(EXTRA_WOLFSSL_CFLAGS)
+
+ifeq ($(HOMEKIT_CHACHA20POLY1305_INTERNAL),1)
+homekit_CFLAGS += -DHOMEKIT_CHACHA20POLY1305_INTERNAL
+endif
@@ -56,7 +56,9 @@ void homekit_server_init(homekit_server_config_t *config);
 void homekit_set_max_clients(const unsigned int clients);
 #endif // HOMEKIT_CHANGE_MAX_CLIENTS
 
-// Remove oldest client to free some DRAM
+// Evict least recently active client to free some DRAM: unverified clients first, then verified
+// ones without event subscriptions, then subscribers other than hub receiving events.
+// Can be called from any task, server task closes client.
 void homekit_remove_oldest_client();
 
 // Reset HomeKit accessory server, removing all pairings
@@ -65,6 +67,46 @@ void homekit_server_reset();
 void homekit_remove_extra_pairing(const unsigned int last_keep);
 unsigned int homekit_pairing_count();
 
+// Bytes waiting in clients send queues, and events not sent to slow clients
+void homekit_get_send_queue_stats(uint32_t *queued, uint32_t *event_drops);
+
+// Notifies merged into an already pending event, events sent to clients,
+// and notifies not sent by characteristic event_dedupe policy
+void homekit_get_notify_stats(uint32_t *coalesced, uint32_t *emitted, uint32_t *suppressed);
+
+// Pair Verify ephemeral keys taken from idle-time pool, and generated on demand
+void homekit_get_curve25519_pool_stats(uint32_t *hits, uint32_t *misses);
+
+#define HOMEKIT_CLIENT_EVICTION_MAX_CLIENTS         (0)     // New client found server full
+#define HOMEKIT_CLIENT_EVICTION_HEAP                (1)     // Predicted heap of new client did not fit
+#define HOMEKIT_CLIENT_EVICTION_LOW_DRAM            (2)     // Free heap went low, or homekit_remove_oldest_client()
+#define HOMEKIT_CLIENT_EVICTION_REASONS             (3)
+
+// Clients evicted by reason, and new clients refused because heap was short and no client could be evicted
+void homekit_get_client_eviction_stats(uint32_t evictions[HOMEKIT_CLIENT_EVICTION_REASONS], uint32_t *refused);
+
+#define HOMEKIT_ENDPOINT_UNKNOWN                    (0)
+#define HOMEKIT_ENDPOINT_PAIR_SETUP                 (1)
+#define HOMEKIT_ENDPOINT_PAIR_VERIFY                (2)
+#define HOMEKIT_ENDPOINT_IDENTIFY                   (3)
+#define HOMEKIT_ENDPOINT_GET_ACCESSORIES            (4)
+#define HOMEKIT_ENDPOINT_GET_CHARACTERISTICS        (5)
+#define HOMEKIT_ENDPOINT_UPDATE_CHARACTERISTICS     (6)
+#define HOMEKIT_ENDPOINT_PAIRINGS                   (7)
+#define HOMEKIT_ENDPOINT_PREPARE                    (8)
+#define HOMEKIT_ENDPOINT_RESOURCE                   (9)
+#define HOMEKIT_ENDPOINTS_COUNT                     (10)
+
+typedef struct {
+    uint32_t count;
+    uint32_t time_total;    // Microseconds
+    uint32_t time_max;      // Microseconds
+} homekit_request_stats_t;
+
+// Requests handled by endpoint, and lowest free heap seen when a request handler returns
+void homekit_get_request_stats(const unsigned int endpoint, homekit_request_stats_t *stats);
+uint32_t homekit_get_request_heap_min();
+
 void homekit_mdns_announce_start();
 void homekit_mdns_announce_stop();
 
@@ -75,6 +117,17 @@ bool homekit_is_paired();
 #ifdef HOMEKIT_GET_CLIENTS_INFO
 int32_t homekit_get_unique_client_ipaddr();
 int homekit_get_client_count();
+
+typedef struct {
+    int32_t socket;
+    uint32_t idle_time;         // Milliseconds since client was accepted or last sent data
+    uint32_t send_queue_size;
+    bool verified: 1;
+    bool subscribed: 1;         // Receives events of some characteristic
+} homekit_client_info_t;
+
+// Returns -1 if there is no client at index, newest client is index 0
+int homekit_get_client_info(const unsigned int index, homekit_client_info_t *info);
 #endif
 
 // Client related stuff
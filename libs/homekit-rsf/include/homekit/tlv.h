@@ -1,6 +1,9 @@
 #ifndef __TLV_H__
 #define __TLV_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #define TLVType_Method              (0x00)
 #define TLVType_Identifier          (0x01)
 #define TLVType_Salt                (0x02)
@@ -15,6 +18,7 @@
 #define TLVType_Permissions         (0x0B)
 #define TLVType_FragmentData        (0x0C)
 #define TLVType_FragmentLast        (0x0D)
+#define TLVType_SessionID           (0x0E)
 #define TLVType_Flags               (0x13)
 #define TLVType_Separator           (0xFF)
 
@@ -23,6 +27,7 @@
 #define TLVMethod_AddPairing        (3)
 #define TLVMethod_RemovePairing     (4)
 #define TLVMethod_ListPairings      (5)
+#define TLVMethod_PairResume        (6)
 
 typedef unsigned char byte;
 
@@ -56,4 +61,39 @@ int tlv_format(const tlv_values_t *values, byte *buffer, size_t *size);
 
 int tlv_parse(const byte *buffer, size_t length, tlv_values_t *values);
 
+
+// Zero-copy TLV8 reader. Items point into parsed buffer, which is modified: fragments
+// of an item bigger than 255 bytes are joined in place.
+#define TLV_VIEW_ITEMS_MAX          (8)
+
+typedef struct {
+    byte type;
+    byte *value;
+    size_t size;
+} tlv_item_t;
+
+typedef struct {
+    tlv_item_t items[TLV_VIEW_ITEMS_MAX];
+    unsigned int count;
+} tlv_view_t;
+
+int tlv_view_parse(byte *buffer, size_t length, tlv_view_t *view);
+const tlv_item_t *tlv_view_get(const tlv_view_t *view, byte type);
+int tlv_view_get_integer(const tlv_view_t *view, byte type, int def);
+
+// TLV8 writer into a caller buffer. Items bigger than 255 bytes are fragmented.
+// On overflow, error is set and next writes are ignored.
+#define TLV_ENCODED_SIZE(size)      ((size) ? (size) + 2 * (((size) + 254) / 255) : 2)
+
+typedef struct {
+    byte *buffer;
+    size_t size;
+    size_t pos;
+    bool error;
+} tlv_writer_t;
+
+void tlv_writer_init(tlv_writer_t *writer, byte *buffer, size_t size);
+void tlv_write(tlv_writer_t *writer, byte type, const byte *value, size_t size);
+void tlv_write_integer(tlv_writer_t *writer, byte type, size_t size, int value);
+
 #endif // __TLV_H__
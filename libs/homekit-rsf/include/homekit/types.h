@@ -165,11 +165,6 @@ typedef struct {
 } homekit_valid_values_ranges_t;
 #endif //HOMEKIT_DISABLE_VALUE_RANGES
 
-typedef struct _homekit_characteristic_subscription {
-    void *context;
-    struct _homekit_characteristic_subscription *next;
-} homekit_characteristic_subscription_t;
-
 
 struct _homekit_characteristic {
     homekit_service_t *service;
@@ -199,7 +194,18 @@ struct _homekit_characteristic {
     homekit_valid_values_ranges_t valid_values_ranges;
 #endif //HOMEKIT_DISABLE_VALUE_RANGES
     
-    homekit_characteristic_subscription_t* subscriptions;
+    // Bitmask of client slots subscribed to events (max 32 clients)
+    uint32_t subscriptions;
+    
+    // Dense index (1..count) assigned by homekit_accessories_init() to characteristics
+    // with notify permission, used for pending notifications
+    uint16_t ordinal;
+    
+    // Event policy. Minimum time between events in ms (max HOMEKIT_EVENT_INTERVAL_MAX), latest value
+    // is sent when it is over. With event_dedupe, an event is not sent to clients which already got same
+    // value (only bool and number formats)
+    uint16_t min_event_interval: 15;
+    bool event_dedupe: 1;
     
     homekit_value_t (*getter_ex)(const homekit_characteristic_t *ch);
     void (*setter_ex)(homekit_characteristic_t *ch, const homekit_value_t value);
@@ -224,6 +230,8 @@ struct _homekit_accessory {
     homekit_service_t **services;
 };
 
+#define HOMEKIT_EVENT_INTERVAL_MAX      (0x7FFF)
+
 // Macro to define accessory
 #define HOMEKIT_ACCESSORY(...) \
     &(homekit_accessory_t) { \
@@ -315,23 +323,27 @@ homekit_service_t *homekit_service_by_type(homekit_accessory_t *accessory, const
 homekit_characteristic_t *homekit_service_characteristic_by_type(homekit_service_t *service, const char *type);
 // Find characteristic by accessory ID and characteristic ID. Returns NULL if not found
 homekit_characteristic_t *homekit_characteristic_by_aid_and_iid(homekit_accessory_t **accessories, int aid, int iid);
+// Number of distinct characteristics with notify permission indexed by last homekit_accessories_init()
+unsigned int homekit_characteristics_count();
+// Find characteristic by ordinal (1..count). Returns NULL if not found
+homekit_characteristic_t *homekit_characteristic_by_ordinal(unsigned int ordinal);
 
 void homekit_characteristic_notify(homekit_characteristic_t *ch);
 void homekit_characteristic_add_notify_subscription(
     homekit_characteristic_t *ch,
-    void *context
+    const unsigned int client_slot
 );
 void homekit_characteristic_remove_notify_subscription(
     homekit_characteristic_t *ch,
-    void *context
+    const unsigned int client_slot
 );
 void homekit_accessories_clear_notify_subscriptions(
     homekit_accessory_t **accessories,
-    void *context
+    const unsigned int client_slot
 );
 bool homekit_characteristic_has_notify_subscription(
     const homekit_characteristic_t *ch,
-    void *context
+    const unsigned int client_slot
 );
 
 
@@ -275,6 +275,8 @@ homekit_characteristic_t* homekit_characteristic_clone(homekit_characteristic_t*
 #endif //HOMEKIT_DISABLE_VALUE_RANGES
     
     //clone->subscriptions = ch->subscriptions;
+    clone->min_event_interval = ch->min_event_interval;
+    clone->event_dedupe = ch->event_dedupe;
     clone->getter_ex = ch->getter_ex;
     clone->setter_ex = ch->setter_ex;
 
@@ -367,6 +369,147 @@ homekit_accessory_t* homekit_accessory_clone(homekit_accessory_t* ac) {
     return clone;
 }
 
+// Sorted (aid, iid) index of all characteristics, built by homekit_accessories_init().
+// Same characteristic can be shared by several accessories, so aid is stored too.
+typedef struct {
+    uint16_t aid;
+    uint16_t iid;
+    homekit_characteristic_t *ch;
+} characteristic_index_t;
+
+static homekit_accessory_t **index_accessories = NULL;
+static characteristic_index_t *index_characteristics = NULL;
+static unsigned int index_count = 0;
+
+// First index entry of each aid, so a lookup only searches characteristics of its accessory.
+// Only built when aids are dense enough for table to be smaller than index.
+static uint16_t *index_aid_start = NULL;
+static unsigned int index_max_aid = 0;
+
+// Distinct characteristics by ordinal - 1
+static homekit_characteristic_t **ordinal_characteristics = NULL;
+static unsigned int ordinal_count = 0;
+
+static int characteristic_index_compare(const void *a, const void *b) {
+    const characteristic_index_t *ia = a;
+    const characteristic_index_t *ib = b;
+    
+    if (ia->aid != ib->aid)
+        return ia->aid - ib->aid;
+    
+    return ia->iid - ib->iid;
+}
+
+static void characteristic_index_build(homekit_accessory_t **accessories) {
+    if (index_characteristics) {
+        free(index_characteristics);
+        index_characteristics = NULL;
+    }
+    if (index_aid_start) {
+        free(index_aid_start);
+        index_aid_start = NULL;
+    }
+    index_accessories = NULL;
+    index_count = 0;
+    index_max_aid = 0;
+    
+    unsigned int count = 0;
+    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
+        for (homekit_service_t **service_it = (*accessory_it)->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                count++;
+            }
+        }
+    }
+    
+    if (!count)
+        return;
+    
+    index_characteristics = malloc(sizeof(characteristic_index_t) * count);
+    if (!index_characteristics)
+        return;
+    
+    unsigned int i = 0;
+    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
+        homekit_accessory_t *accessory = *accessory_it;
+        
+        for (homekit_service_t **service_it = accessory->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                index_characteristics[i].aid = accessory->id;
+                index_characteristics[i].iid = (*ch_it)->id;
+                index_characteristics[i].ch = *ch_it;
+                i++;
+            }
+        }
+    }
+    
+    qsort(index_characteristics, count, sizeof(characteristic_index_t), characteristic_index_compare);
+    
+    const unsigned int max_aid = index_characteristics[count - 1].aid;
+    if (max_aid <= count && count < UINT16_MAX) {
+        index_aid_start = malloc(sizeof(uint16_t) * (max_aid + 2));
+        if (index_aid_start) {
+            unsigned int aid = 0;
+            for (i = 0; i < count; i++) {
+                while (aid <= index_characteristics[i].aid) {
+                    index_aid_start[aid++] = i;
+                }
+            }
+            while (aid <= max_aid + 1) {
+                index_aid_start[aid++] = count;
+            }
+            
+            index_max_aid = max_aid;
+        }
+    }
+    
+    index_accessories = accessories;
+    index_count = count;
+}
+
+static void characteristic_ordinals_build() {
+    if (ordinal_characteristics) {
+        free(ordinal_characteristics);
+        ordinal_characteristics = NULL;
+    }
+    ordinal_count = 0;
+    
+    for (unsigned int i = 0; i < index_count; i++) {
+        index_characteristics[i].ch->ordinal = 0;
+    }
+    
+    // Shared characteristics appear several times in index, but get only one ordinal.
+    // Clients can subscribe only to characteristics with notify permission.
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < index_count; i++) {
+        homekit_characteristic_t *ch = index_characteristics[i].ch;
+        if (!ch->ordinal && (ch->permissions & HOMEKIT_PERMISSIONS_NOTIFY) && count < UINT16_MAX) {
+            ch->ordinal = ++count;
+        }
+    }
+    
+    if (!count)
+        return;
+    
+    ordinal_characteristics = malloc(sizeof(homekit_characteristic_t*) * count);
+    if (!ordinal_characteristics) {
+        for (unsigned int i = 0; i < index_count; i++) {
+            index_characteristics[i].ch->ordinal = 0;
+        }
+        
+        return;
+    }
+    
+    for (unsigned int i = 0; i < index_count; i++) {
+        homekit_characteristic_t *ch = index_characteristics[i].ch;
+        if (ch->ordinal) {
+            ordinal_characteristics[ch->ordinal - 1] = ch;
+        }
+    }
+    
+    ordinal_count = count;
+}
+
 void homekit_accessories_init(homekit_accessory_t **accessories) {
     unsigned int aid = 1;
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
@@ -403,6 +546,9 @@ void homekit_accessories_init(homekit_accessory_t **accessories) {
             }
         }
     }
+    
+    characteristic_index_build(accessories);
+    characteristic_ordinals_build();
 }
 
 homekit_accessory_t *homekit_accessory_by_id(homekit_accessory_t **accessories, int aid) {
@@ -438,7 +584,45 @@ homekit_characteristic_t *homekit_service_characteristic_by_type(homekit_service
     return NULL;
 }
 
+unsigned int homekit_characteristics_count() {
+    return ordinal_count;
+}
+
+homekit_characteristic_t *homekit_characteristic_by_ordinal(unsigned int ordinal) {
+    if (ordinal == 0 || ordinal > ordinal_count)
+        return NULL;
+    
+    return ordinal_characteristics[ordinal - 1];
+}
+
 homekit_characteristic_t *homekit_characteristic_by_aid_and_iid(homekit_accessory_t **accessories, int aid, int iid) {
+    if (accessories == index_accessories) {
+        int low = 0;
+        int high = index_count - 1;
+        if (index_aid_start) {
+            if (aid < 0 || aid > (int) index_max_aid)
+                return NULL;
+            
+            low = index_aid_start[aid];
+            high = index_aid_start[aid + 1] - 1;
+        }
+        
+        while (low <= high) {
+            const int mid = (low + high) / 2;
+            const characteristic_index_t *item = &index_characteristics[mid];
+            
+            if (item->aid < aid || (item->aid == aid && item->iid < iid)) {
+                low = mid + 1;
+            } else if (item->aid == aid && item->iid == iid) {
+                return item->ch;
+            } else {
+                high = mid - 1;
+            }
+        }
+        
+        return NULL;
+    }
+    
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
         homekit_accessory_t *accessory = *accessory_it;
 
@@ -486,69 +670,35 @@ homekit_characteristic_t *homekit_characteristic_find_by_type(homekit_accessory_
 
 void homekit_characteristic_add_notify_subscription(
     homekit_characteristic_t *ch,
-    void *context
+    const unsigned int client_slot
 ) {
-    homekit_characteristic_subscription_t *new_subscription = malloc(sizeof(homekit_characteristic_subscription_t));
-    new_subscription->context = context;
-    new_subscription->next = NULL;
-
-    if (!ch->subscriptions) {
-        ch->subscriptions = new_subscription;
-    } else {
-        homekit_characteristic_subscription_t *subscription = ch->subscriptions;
-        if (subscription->context == context) {
-            free(new_subscription);
-            return;
-        }
-
-        while (subscription->next) {
-            if (subscription->next->context == context) {
-                free(new_subscription);
-                return;
-            }
-            subscription = subscription->next;
-        }
-
-        subscription->next = new_subscription;
-    }
+    ch->subscriptions |= (1U << client_slot);
 }
 
 
 void homekit_characteristic_remove_notify_subscription(
     homekit_characteristic_t *ch,
-    void *context
+    const unsigned int client_slot
 ) {
-    while (ch->subscriptions) {
-        if (ch->subscriptions->context != context) {
-            break;
-        }
-
-        homekit_characteristic_subscription_t *c = ch->subscriptions;
-        ch->subscriptions = ch->subscriptions->next;
-        free(c);
-    }
-
-    if (!ch->subscriptions)
-        return;
-
-    homekit_characteristic_subscription_t *subscription = ch->subscriptions;
-    while (subscription->next) {
-        if (subscription->next->context == context) {
-            homekit_characteristic_subscription_t *c = subscription->next;
-            subscription->next = subscription->next->next;
-            free(c);
-        } else {
-            subscription = subscription->next;
-        }
-    }
+    ch->subscriptions &= ~(1U << client_slot);
 }
 
 
 // Removes particular subscription from all characteristics
 void homekit_accessories_clear_notify_subscriptions(
     homekit_accessory_t **accessories,
-    void *context
+    const unsigned int client_slot
 ) {
+    const uint32_t mask = ~(1U << client_slot);
+    
+    if (accessories == index_accessories) {
+        for (unsigned int i = 0; i < index_count; i++) {
+            index_characteristics[i].ch->subscriptions &= mask;
+        }
+        
+        return;
+    }
+    
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
         homekit_accessory_t *accessory = *accessory_it;
 
@@ -556,9 +706,7 @@ void homekit_accessories_clear_notify_subscriptions(
             homekit_service_t *service = *service_it;
 
             for (homekit_characteristic_t **ch_it = service->characteristics; *ch_it; ch_it++) {
-                homekit_characteristic_t *ch = *ch_it;
-
-                homekit_characteristic_remove_notify_subscription(ch, context);
+                (*ch_it)->subscriptions &= mask;
             }
         }
     }
@@ -567,16 +715,7 @@ void homekit_accessories_clear_notify_subscriptions(
 
 bool homekit_characteristic_has_notify_subscription(
     const homekit_characteristic_t *ch,
-    void *context
+    const unsigned int client_slot
 ) {
-    homekit_characteristic_subscription_t *subscription = ch->subscriptions;
-    while (subscription) {
-        if (subscription->context == context)
-            return true;
-
-        subscription = subscription->next;
-    }
-
-    return false;
+    return ch->subscriptions & (1U << client_slot);
 }
-
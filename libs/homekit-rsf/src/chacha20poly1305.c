@@ -0,0 +1,324 @@
+#ifdef HOMEKIT_CHACHA20POLY1305_INTERNAL
+
+#include <string.h>
+#include "chacha20poly1305.h"
+
+// Words of byte buffers are read and written only through this type
+typedef uint32_t __attribute__((__may_alias__)) word_t;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define is_word_aligned(p)      (!((uintptr_t) (p) & 3))
+#else
+#define is_word_aligned(p)      (0)
+#endif
+
+static inline uint32_t load32_le(const uint8_t *p) {
+    if (is_word_aligned(p)) {
+        return *(const word_t *) p;
+    }
+
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void store32_le(uint8_t *p, uint32_t v) {
+    if (is_word_aligned(p)) {
+        *(word_t *) p = v;
+        return;
+    }
+
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void secure_zero(void *data, size_t size) {
+    volatile uint8_t *p = data;
+    while (size--) {
+        *p++ = 0;
+    }
+}
+
+
+// ChaCha20
+
+#define ROTL32(v, n)    (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+    a += b; d = ROTL32(d ^ a, 16); \
+    c += d; b = ROTL32(b ^ c, 12); \
+    a += b; d = ROTL32(d ^ a, 8); \
+    c += d; b = ROTL32(b ^ c, 7);
+
+static void chacha20_init(uint32_t *state, const uint8_t *key, const uint8_t *nonce) {
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+
+    for (unsigned int i = 0; i < 8; i++) {
+        state[4 + i] = load32_le(key + 4 * i);
+    }
+
+    state[12] = 0;
+    state[13] = load32_le(nonce);
+    state[14] = load32_le(nonce + 4);
+    state[15] = load32_le(nonce + 8);
+}
+
+// State is kept in locals, so the compiler can hold as much of it as possible in registers
+static void chacha20_block(uint32_t *state, uint32_t *keystream) {
+    uint32_t x0 = state[0], x1 = state[1], x2 = state[2], x3 = state[3];
+    uint32_t x4 = state[4], x5 = state[5], x6 = state[6], x7 = state[7];
+    uint32_t x8 = state[8], x9 = state[9], x10 = state[10], x11 = state[11];
+    uint32_t x12 = state[12], x13 = state[13], x14 = state[14], x15 = state[15];
+
+    for (unsigned int i = 0; i < 10; i++) {
+        QUARTERROUND(x0, x4, x8, x12)
+        QUARTERROUND(x1, x5, x9, x13)
+        QUARTERROUND(x2, x6, x10, x14)
+        QUARTERROUND(x3, x7, x11, x15)
+        QUARTERROUND(x0, x5, x10, x15)
+        QUARTERROUND(x1, x6, x11, x12)
+        QUARTERROUND(x2, x7, x8, x13)
+        QUARTERROUND(x3, x4, x9, x14)
+    }
+
+    keystream[0] = x0 + state[0];
+    keystream[1] = x1 + state[1];
+    keystream[2] = x2 + state[2];
+    keystream[3] = x3 + state[3];
+    keystream[4] = x4 + state[4];
+    keystream[5] = x5 + state[5];
+    keystream[6] = x6 + state[6];
+    keystream[7] = x7 + state[7];
+    keystream[8] = x8 + state[8];
+    keystream[9] = x9 + state[9];
+    keystream[10] = x10 + state[10];
+    keystream[11] = x11 + state[11];
+    keystream[12] = x12 + state[12];
+    keystream[13] = x13 + state[13];
+    keystream[14] = x14 + state[14];
+    keystream[15] = x15 + state[15];
+
+    state[12]++;
+}
+
+static void chacha20_xor(uint32_t *state, const uint8_t *input, uint8_t *output, size_t size) {
+    uint32_t keystream[16];
+
+    while (size > 0) {
+        chacha20_block(state, keystream);
+
+        size_t block_size = size < 64 ? size : 64;
+
+        unsigned int i = 0;
+        if (is_word_aligned(input) && is_word_aligned(output)) {
+            for (; i + 4 <= block_size; i += 4) {
+                *(word_t *) (output + i) = *(const word_t *) (input + i) ^ keystream[i >> 2];
+            }
+        }
+
+        for (; i < block_size; i++) {
+            output[i] = input[i] ^ (keystream[i >> 2] >> ((i & 3) << 3));
+        }
+
+        input += block_size;
+        output += block_size;
+        size -= block_size;
+    }
+
+    secure_zero(keystream, sizeof(keystream));
+}
+
+
+// Poly1305 with 26-bit limbs, so limb products fit 64 bits with room for sums
+
+typedef struct {
+    uint32_t r[5];
+    uint32_t s[4];      // r[1..4] * 5
+    uint32_t h[5];
+    uint32_t pad[4];
+} poly1305_t;
+
+static void poly1305_init(poly1305_t *poly, const uint32_t *key) {
+    poly->r[0] = key[0] & 0x3ffffff;
+    poly->r[1] = ((key[0] >> 26) | (key[1] << 6)) & 0x3ffff03;
+    poly->r[2] = ((key[1] >> 20) | (key[2] << 12)) & 0x3ffc0ff;
+    poly->r[3] = ((key[2] >> 14) | (key[3] << 18)) & 0x3f03fff;
+    poly->r[4] = (key[3] >> 8) & 0x00fffff;
+
+    for (unsigned int i = 0; i < 4; i++) {
+        poly->s[i] = poly->r[i + 1] * 5;
+        poly->pad[i] = key[4 + i];
+    }
+
+    memset(poly->h, 0, sizeof(poly->h));
+}
+
+// Message is zero padded to full blocks, as AEAD construction does with AAD and ciphertext
+static void poly1305_update(poly1305_t *poly, const uint8_t *message, size_t size) {
+    const uint32_t r0 = poly->r[0], r1 = poly->r[1], r2 = poly->r[2], r3 = poly->r[3], r4 = poly->r[4];
+    const uint32_t s1 = poly->s[0], s2 = poly->s[1], s3 = poly->s[2], s4 = poly->s[3];
+    uint32_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+
+    uint32_t last[4];
+
+    while (size > 0) {
+        if (size < 16) {
+            memset(last, 0, sizeof(last));
+            memcpy(last, message, size);
+            message = (const uint8_t *) last;
+            size = 16;
+        }
+
+        const uint32_t t0 = load32_le(message);
+        const uint32_t t1 = load32_le(message + 4);
+        const uint32_t t2 = load32_le(message + 8);
+        const uint32_t t3 = load32_le(message + 12);
+
+        h0 += t0 & 0x3ffffff;
+        h1 += ((t0 >> 26) | (t1 << 6)) & 0x3ffffff;
+        h2 += ((t1 >> 20) | (t2 << 12)) & 0x3ffffff;
+        h3 += ((t2 >> 14) | (t3 << 18)) & 0x3ffffff;
+        h4 += (t3 >> 8) | (1 << 24);
+
+        const uint64_t d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3 + (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+        uint64_t d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4 + (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+        uint64_t d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0 + (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+        uint64_t d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1 + (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+        uint64_t d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2 + (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+        h0 = (uint32_t) d0 & 0x3ffffff;
+        d1 += (uint32_t) (d0 >> 26);
+        h1 = (uint32_t) d1 & 0x3ffffff;
+        d2 += (uint32_t) (d1 >> 26);
+        h2 = (uint32_t) d2 & 0x3ffffff;
+        d3 += (uint32_t) (d2 >> 26);
+        h3 = (uint32_t) d3 & 0x3ffffff;
+        d4 += (uint32_t) (d3 >> 26);
+        h4 = (uint32_t) d4 & 0x3ffffff;
+        h0 += (uint32_t) (d4 >> 26) * 5;
+        h1 += h0 >> 26;
+        h0 &= 0x3ffffff;
+
+        message += 16;
+        size -= 16;
+    }
+
+    poly->h[0] = h0;
+    poly->h[1] = h1;
+    poly->h[2] = h2;
+    poly->h[3] = h3;
+    poly->h[4] = h4;
+}
+
+static void poly1305_final(poly1305_t *poly, uint8_t *tag) {
+    uint32_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+
+    h2 += h1 >> 26; h1 &= 0x3ffffff;
+    h3 += h2 >> 26; h2 &= 0x3ffffff;
+    h4 += h3 >> 26; h3 &= 0x3ffffff;
+    h0 += (h4 >> 26) * 5; h4 &= 0x3ffffff;
+    h1 += h0 >> 26; h0 &= 0x3ffffff;
+
+    // h - p, selected without branches if h >= p
+    uint32_t g0 = h0 + 5;
+    uint32_t g1 = h1 + (g0 >> 26); g0 &= 0x3ffffff;
+    uint32_t g2 = h2 + (g1 >> 26); g1 &= 0x3ffffff;
+    uint32_t g3 = h3 + (g2 >> 26); g2 &= 0x3ffffff;
+    uint32_t g4 = h4 + (g3 >> 26) - (1 << 26); g3 &= 0x3ffffff;
+
+    const uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    uint64_t f;
+    f = (uint64_t) (h0 | (h1 << 26)) + poly->pad[0];
+    store32_le(tag, f);
+    f = (uint64_t) ((h1 >> 6) | (h2 << 20)) + poly->pad[1] + (f >> 32);
+    store32_le(tag + 4, f);
+    f = (uint64_t) ((h2 >> 12) | (h3 << 14)) + poly->pad[2] + (f >> 32);
+    store32_le(tag + 8, f);
+    f = (uint64_t) ((h3 >> 18) | (h4 << 8)) + poly->pad[3] + (f >> 32);
+    store32_le(tag + 12, f);
+
+    secure_zero(poly, sizeof(*poly));
+}
+
+
+// AEAD
+
+static void chacha20poly1305_tag(
+    uint32_t *state,
+    const uint8_t *aad, size_t aad_size,
+    const uint8_t *ciphertext, size_t size,
+    uint8_t *tag
+) {
+    uint32_t poly_key[16];
+    chacha20_block(state, poly_key);
+
+    poly1305_t poly;
+    poly1305_init(&poly, poly_key);
+    secure_zero(poly_key, sizeof(poly_key));
+
+    poly1305_update(&poly, aad, aad_size);
+    poly1305_update(&poly, ciphertext, size);
+
+    uint32_t lengths[4] = { 0 };
+    store32_le((uint8_t *) &lengths[0], aad_size);
+    store32_le((uint8_t *) &lengths[2], size);
+    poly1305_update(&poly, (const uint8_t *) lengths, sizeof(lengths));
+
+    poly1305_final(&poly, tag);
+}
+
+void chacha20poly1305_encrypt(
+    const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *aad, size_t aad_size,
+    const uint8_t *input, size_t size,
+    uint8_t *output, uint8_t *tag
+) {
+    uint32_t state[16];
+    chacha20_init(state, key, nonce);
+
+    // Block 0 makes Poly1305 key, so message is encrypted from block 1
+    state[12] = 1;
+    chacha20_xor(state, input, output, size);
+
+    state[12] = 0;
+    chacha20poly1305_tag(state, aad, aad_size, output, size, tag);
+
+    secure_zero(state, sizeof(state));
+}
+
+int chacha20poly1305_decrypt(
+    const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *aad, size_t aad_size,
+    const uint8_t *input, size_t size,
+    const uint8_t *tag, uint8_t *output
+) {
+    uint32_t state[16];
+    chacha20_init(state, key, nonce);
+
+    uint8_t expected_tag[CHACHA20POLY1305_TAG_SIZE];
+    chacha20poly1305_tag(state, aad, aad_size, input, size, expected_tag);
+
+    uint8_t diff = 0;
+    for (unsigned int i = 0; i < CHACHA20POLY1305_TAG_SIZE; i++) {
+        diff |= expected_tag[i] ^ tag[i];
+    }
+
+    if (!diff) {
+        chacha20_xor(state, input, output, size);
+    }
+
+    secure_zero(state, sizeof(state));
+
+    return diff ? -1 : 0;
+}
+
+#endif // HOMEKIT_CHACHA20POLY1305_INTERNAL
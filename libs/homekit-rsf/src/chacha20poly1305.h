@@ -0,0 +1,30 @@
+#ifndef __HOMEKIT_CHACHA20POLY1305__
+#define __HOMEKIT_CHACHA20POLY1305__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ChaCha20-Poly1305 AEAD (RFC 8439) written for 32-bit cores without SIMD.
+// Used by crypto.c instead of wolfCrypt when HOMEKIT_CHACHA20POLY1305_INTERNAL is defined.
+// Output can be the same buffer as input. Word aligned buffers are processed a word at a time.
+
+#define CHACHA20POLY1305_KEY_SIZE       (32)
+#define CHACHA20POLY1305_NONCE_SIZE     (12)
+#define CHACHA20POLY1305_TAG_SIZE       (16)
+
+void chacha20poly1305_encrypt(
+    const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *aad, size_t aad_size,
+    const uint8_t *input, size_t size,
+    uint8_t *output, uint8_t *tag
+);
+
+// Returns -1 and leaves output untouched if tag does not match
+int chacha20poly1305_decrypt(
+    const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *aad, size_t aad_size,
+    const uint8_t *input, size_t size,
+    const uint8_t *tag, uint8_t *output
+);
+
+#endif // __HOMEKIT_CHACHA20POLY1305__
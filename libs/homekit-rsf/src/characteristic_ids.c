@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+#include "characteristic_ids.h"
+
+
+// Decimal digits only, as strtol() would also take spaces and signs
+static bool parse_id(char *s, int *id) {
+    if (*s < '0' || *s > '9')
+        return false;
+
+    char *end;
+    long value = strtol(s, &end, 10);
+    if (*end || value > INT32_MAX)
+        return false;
+
+    *id = value;
+    return true;
+}
+
+int characteristic_ids_parse(char *s, homekit_accessory_t **accessories, characteristic_id_t **ids,
+                             void *(*alloc)(size_t size, void *arg), void *arg) {
+    unsigned int count = 1;
+    for (const char *c = s; *c; c++) {
+        if (*c == ',')
+            count++;
+    }
+
+    *ids = alloc(count * sizeof(characteristic_id_t), arg);
+    if (!*ids)
+        return CHARACTERISTIC_IDS_NO_MEMORY;
+
+    char *id;
+    for (unsigned int i = 0; (id = strsep(&s, ",")); i++) {
+        characteristic_id_t *ch_id = &(*ids)[i];
+
+        char *dot = strchr(id, '.');
+        if (!dot)
+            return CHARACTERISTIC_IDS_MALFORMED;
+
+        *dot = 0;
+        if (!parse_id(id, &ch_id->aid) || !parse_id(dot+1, &ch_id->iid))
+            return CHARACTERISTIC_IDS_MALFORMED;
+
+        ch_id->ch = homekit_characteristic_by_aid_and_iid(accessories, ch_id->aid, ch_id->iid);
+    }
+
+    return count;
+}
+
+bool characteristic_ids_readable(const characteristic_id_t *ids, const unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        if (!ids[i].ch || !(ids[i].ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef __HOMEKIT_CHARACTERISTIC_IDS__
+#define __HOMEKIT_CHARACTERISTIC_IDS__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <homekit/types.h>
+
+#define CHARACTERISTIC_IDS_MALFORMED    (-1)
+#define CHARACTERISTIC_IDS_NO_MEMORY    (-2)
+
+typedef struct {
+    homekit_characteristic_t *ch;   // NULL when there is no such characteristic
+    int aid;
+    int iid;
+} characteristic_id_t;
+
+// Parses "id" query param of GET /characteristics, a comma separated list of "aid.iid", in place,
+// and resolves every id once, so response status is known before writing it. Duplicates are kept.
+// Ids array is taken from alloc(), and is released together by its owner.
+// Returns number of ids, CHARACTERISTIC_IDS_MALFORMED or CHARACTERISTIC_IDS_NO_MEMORY.
+int characteristic_ids_parse(char *s, homekit_accessory_t **accessories, characteristic_id_t **ids,
+                             void *(*alloc)(size_t size, void *arg), void *arg);
+
+// False when any id is missing or not readable, and response must be 207 with a status per id
+bool characteristic_ids_readable(const characteristic_id_t *ids, const unsigned int count);
+
+#endif // __HOMEKIT_CHARACTERISTIC_IDS__
@@ -0,0 +1,39 @@
+#include "client_eviction.h"
+
+
+static unsigned int client_eviction_rank(const client_eviction_t *client) {
+    if (!client->verified) {
+        return 0;
+    }
+    
+    return client->subscribed ? 2 : 1;
+}
+
+
+int client_eviction_candidate(const client_eviction_t *clients, const unsigned int count) {
+    int hub = -1;
+    for (unsigned int i = 0; i < count; i++) {
+        if (clients[i].verified && clients[i].subscribed &&
+            (hub < 0 || (int32_t) (clients[i].last_activity - clients[hub].last_activity) > 0)) {
+            hub = i;
+        }
+    }
+    
+    int candidate = -1;
+    unsigned int candidate_rank = 0;
+    
+    for (unsigned int i = 0; i < count; i++) {
+        if ((int) i == hub || clients[i].pinned) {
+            continue;
+        }
+        
+        const unsigned int rank = client_eviction_rank(&clients[i]);
+        if (candidate < 0 || rank < candidate_rank ||
+            (rank == candidate_rank && (int32_t) (clients[i].last_activity - clients[candidate].last_activity) < 0)) {
+            candidate = i;
+            candidate_rank = rank;
+        }
+    }
+    
+    return candidate;
+}
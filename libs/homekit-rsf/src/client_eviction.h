@@ -0,0 +1,20 @@
+#ifndef __HOMEKIT_CLIENT_EVICTION__
+#define __HOMEKIT_CLIENT_EVICTION__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// What server knows about a client when it must make room for another one
+typedef struct {
+    uint32_t last_activity;     // Ticks when client was accepted or last sent data
+    bool verified: 1;           // Pair Verify done
+    bool subscribed: 1;         // Subscribed to events of any characteristic
+    bool pinned: 1;             // Never evicted: client doing Pair Setup, or already disconnecting
+} client_eviction_t;
+
+// Index of least recently active client of lowest rank: unverified clients, then verified ones
+// without subscriptions, then other subscribers. Hub receiving events, taken as most recently
+// active subscribed client, is never chosen. Returns -1 when only clients which must stay are left.
+int client_eviction_candidate(const client_eviction_t *clients, const unsigned int count);
+
+#endif // __HOMEKIT_CLIENT_EVICTION__
@@ -1,11 +1,17 @@
+#ifndef HOMEKIT_CRYPTO_EXTERNAL
+
 #include <string.h>
 
 // #include "user_settings.h"
 #include <wolfssl/ssl.h>
 #include <wolfssl/wolfcrypt/hmac.h>
 #include <wolfssl/wolfcrypt/ed25519.h>
+#include <wolfssl/wolfcrypt/ge_operations.h>
 #include <wolfssl/wolfcrypt/curve25519.h>
 #include <wolfssl/wolfcrypt/sha512.h>
+#include <wolfssl/wolfcrypt/hash.h>
+#include <wolfssl/wolfcrypt/chacha.h>
+#include <wolfssl/wolfcrypt/poly1305.h>
 #include <wolfssl/wolfcrypt/chacha20_poly1305.h>
 #include <wolfssl/wolfcrypt/srp.h>
 #include <wolfssl/wolfcrypt/error-crypt.h>
@@ -13,6 +19,15 @@
 #include "port.h"
 #include "debug.h"
 
+#ifdef HOMEKIT_CHACHA20POLY1305_INTERNAL
+#include "chacha20poly1305.h"
+#endif
+
+// wolfSSL 3.13 defines fe_init() in both fe_low_mem.c and fe_operations.c with this mix
+#if defined(CURVE25519_SMALL) && !defined(ED25519_SMALL)
+#error "CURVE25519_SMALL needs ED25519_SMALL"
+#endif
+
 // 3072-bit group N (per RFC5054, Appendix A)
 const byte N[] = {
   0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xc9, 0x0f, 0xda, 0xa2,
@@ -220,6 +235,11 @@ int crypto_srp_get_proof(Srp *srp, byte *proof, size_t *proof_size) {
 }
 
 
+int crypto_sha512(const byte *data, size_t size, byte *hash) {
+    return wc_Sha512Hash(data, size, hash);
+}
+
+
 int crypto_hkdf(
     const byte *key, size_t key_size,
     const byte *salt, size_t salt_size,
@@ -262,6 +282,34 @@ int crypto_srp_hkdf(
 }
 
 
+static int aead_encrypt(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    const byte *message, size_t message_size,
+    byte *encrypted, byte *tag
+) {
+#ifdef HOMEKIT_CHACHA20POLY1305_INTERNAL
+    chacha20poly1305_encrypt(key, nonce, aad, aad_size, message, message_size, encrypted, tag);
+    return 0;
+#else
+    return wc_ChaCha20Poly1305_Encrypt(key, nonce, aad, aad_size, message, message_size, encrypted, tag);
+#endif
+}
+
+
+static int aead_decrypt(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    const byte *message, size_t message_size, const byte *tag,
+    byte *decrypted
+) {
+#ifdef HOMEKIT_CHACHA20POLY1305_INTERNAL
+    if (chacha20poly1305_decrypt(key, nonce, aad, aad_size, message, message_size, tag, decrypted))
+        return MAC_CMP_FAILED_E;
+    return 0;
+#else
+    return wc_ChaCha20Poly1305_Decrypt(key, nonce, aad, aad_size, message, message_size, tag, decrypted);
+#endif
+}
+
 int crypto_chacha20poly1305_decrypt(
     const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
     const byte *message, size_t message_size,
@@ -283,7 +331,7 @@ int crypto_chacha20poly1305_decrypt(
 
     *decrypted_size = len;
 
-    return wc_ChaCha20Poly1305_Decrypt(
+    return aead_decrypt(
         key, nonce, aad, aad_size,
         message, len, &message[len],
         decrypted
@@ -306,7 +354,7 @@ int crypto_chacha20poly1305_encrypt(
 
     *encrypted_size = len;
 
-    return wc_ChaCha20Poly1305_Encrypt(
+    return aead_encrypt(
         key, nonce, aad, aad_size,
         message, message_size,
         encrypted, encrypted+message_size
@@ -314,6 +362,80 @@ int crypto_chacha20poly1305_encrypt(
 }
 
 
+int crypto_chacha20poly1305_encrypt_in_place(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    byte *data, size_t data_size, byte *tag
+) {
+    return aead_encrypt(
+        key, nonce, aad, aad_size,
+        data, data_size,
+        data, tag
+    );
+}
+
+
+int crypto_chacha20poly1305_decrypt_in_place(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    byte *data, size_t data_size, const byte *tag
+) {
+    // Tag is checked on ciphertext before it is overwritten
+    return aead_decrypt(
+        key, nonce, aad, aad_size,
+        data, data_size, tag,
+        data
+    );
+}
+
+
+// Tag of an empty message without AAD. wolfSSL AEAD functions reject empty input.
+int crypto_chacha20poly1305_tag(const byte *key, const byte *nonce, byte *tag) {
+#ifdef HOMEKIT_CHACHA20POLY1305_INTERNAL
+    chacha20poly1305_encrypt(key, nonce, NULL, 0, NULL, 0, NULL, tag);
+    return 0;
+#else
+    byte poly1305_key[CHACHA20_POLY1305_AEAD_KEYSIZE];
+    byte lengths[16];
+    ChaCha chacha;
+    Poly1305 poly1305;
+    
+    memset(poly1305_key, 0, sizeof(poly1305_key));
+    memset(lengths, 0, sizeof(lengths));
+    
+    int r = wc_Chacha_SetKey(&chacha, key, CHACHA20_POLY1305_AEAD_KEYSIZE);
+    if (!r)
+        r = wc_Chacha_SetIV(&chacha, nonce, 0);
+    if (!r)
+        r = wc_Chacha_Process(&chacha, poly1305_key, poly1305_key, sizeof(poly1305_key));
+    if (!r)
+        r = wc_Poly1305SetKey(&poly1305, poly1305_key, sizeof(poly1305_key));
+    if (!r)
+        r = wc_Poly1305Update(&poly1305, lengths, sizeof(lengths));
+    if (!r)
+        r = wc_Poly1305Final(&poly1305, tag);
+    
+    return r;
+#endif
+}
+
+
+int crypto_chacha20poly1305_verify_tag(const byte *key, const byte *nonce, const byte *tag, size_t tag_size) {
+    if (tag_size != CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE)
+        return -2;
+    
+    byte expected_tag[CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE];
+    int r = crypto_chacha20poly1305_tag(key, nonce, expected_tag);
+    if (r)
+        return r;
+    
+    byte diff = 0;
+    for (unsigned int i = 0; i < CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE; i++) {
+        diff |= expected_tag[i] ^ tag[i];
+    }
+    
+    return diff ? MAC_CMP_FAILED_E : 0;
+}
+
+
 ed25519_key *crypto_ed25519_new() {
     ed25519_key *key = malloc(sizeof(ed25519_key));
     int r = wc_ed25519_init(key);
@@ -415,6 +537,109 @@ int crypto_ed25519_sign(
 }
 
 
+static void secure_zero(void *data, size_t size) {
+    volatile byte *p = data;
+    while (size--) {
+        *p++ = 0;
+    }
+}
+
+
+typedef struct _ed25519_expanded_key {
+    byte az[WC_SHA512_DIGEST_SIZE];     // Clamped scalar, and nonce prefix
+    byte public_key[ED25519_PUB_KEY_SIZE];
+} ed25519_expanded_key;
+
+
+void crypto_ed25519_expanded_free(ed25519_expanded_key *expanded_key) {
+    if (expanded_key) {
+        secure_zero(expanded_key, sizeof(ed25519_expanded_key));
+        free(expanded_key);
+    }
+}
+
+
+ed25519_expanded_key *crypto_ed25519_expand(const ed25519_key *key) {
+    ed25519_expanded_key *expanded_key = malloc(sizeof(ed25519_expanded_key));
+    if (!expanded_key) {
+        return NULL;
+    }
+    
+    int r = wc_Sha512Hash(key->k, ED25519_KEY_SIZE, expanded_key->az);
+    if (r) {
+        DEBUG("Failed to expand key (code %d)", r);
+        crypto_ed25519_expanded_free(expanded_key);
+        return NULL;
+    }
+    
+    expanded_key->az[0]  &= 248;
+    expanded_key->az[31] &= 63;
+    expanded_key->az[31] |= 64;
+    
+    memcpy(expanded_key->public_key, key->p, ED25519_PUB_KEY_SIZE);
+    
+    return expanded_key;
+}
+
+
+// Same steps as wc_ed25519_sign_msg(), without hashing seed again
+int crypto_ed25519_sign_expanded(
+    const ed25519_expanded_key *expanded_key,
+    const byte *message, size_t message_size,
+    byte *signature
+) {
+    if (!expanded_key) {
+        return BAD_FUNC_ARG;
+    }
+    
+    byte nonce[WC_SHA512_DIGEST_SIZE];
+    byte hram[WC_SHA512_DIGEST_SIZE];
+    ge_p3 R;
+    wc_Sha512 sha;
+    
+    int r = wc_InitSha512(&sha);
+    if (!r) {
+        r = wc_Sha512Update(&sha, expanded_key->az + ED25519_KEY_SIZE, ED25519_KEY_SIZE);
+    }
+    if (!r) {
+        r = wc_Sha512Update(&sha, message, message_size);
+    }
+    if (!r) {
+        r = wc_Sha512Final(&sha, nonce);
+    }
+    if (r) {
+        return r;
+    }
+    
+    sc_reduce(nonce);
+    ge_scalarmult_base(&R, nonce);
+    ge_p3_tobytes(signature, &R);
+    
+    r = wc_InitSha512(&sha);
+    if (!r) {
+        r = wc_Sha512Update(&sha, signature, ED25519_SIG_SIZE / 2);
+    }
+    if (!r) {
+        r = wc_Sha512Update(&sha, expanded_key->public_key, ED25519_PUB_KEY_SIZE);
+    }
+    if (!r) {
+        r = wc_Sha512Update(&sha, message, message_size);
+    }
+    if (!r) {
+        r = wc_Sha512Final(&sha, hram);
+    }
+    
+    if (!r) {
+        sc_reduce(hram);
+        sc_muladd(signature + (ED25519_SIG_SIZE / 2), hram, expanded_key->az, nonce);
+    }
+    
+    secure_zero(nonce, sizeof(nonce));
+    
+    return r;
+}
+
+
 int crypto_ed25519_verify(
     const ed25519_key *key,
     const byte *message, size_t message_size,
@@ -511,3 +736,4 @@ int crypto_curve25519_shared_secret(const curve25519_key *private_key, const cur
     return r;
 }
 
+#endif // HOMEKIT_CRYPTO_EXTERNAL
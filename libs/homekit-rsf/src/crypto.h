@@ -5,7 +5,15 @@
 
 typedef unsigned char byte;
 
+// Crypto backend used by HomeKit server. crypto.c implements it with wolfCrypt;
+// define HOMEKIT_CRYPTO_EXTERNAL to leave it out and link another implementation.
+// See crypto_backend.h for what an implementation must provide.
+
 #define HKDF_HASH_SIZE 32  // CHACHA20_POLY1305_AEAD_KEYSIZE
+#define CHACHA20POLY1305_TAG_SIZE 16  // CHACHA20_POLY1305_AEAD_AUTHTAG_SIZE
+#define SHA512_HASH_SIZE 64
+
+int crypto_sha512(const byte *data, size_t size, byte *hash);
 
 int crypto_hkdf(
     const byte *key, size_t key_size,
@@ -52,6 +60,17 @@ int crypto_chacha20poly1305_decrypt(
     const byte *message, size_t message_size,
     byte *decrypted, size_t *descrypted_size
 );
+// In place: data is replaced by its ciphertext or plaintext, tag is kept apart
+int crypto_chacha20poly1305_encrypt_in_place(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    byte *data, size_t data_size, byte *tag
+);
+int crypto_chacha20poly1305_decrypt_in_place(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    byte *data, size_t data_size, const byte *tag
+);
+int crypto_chacha20poly1305_tag(const byte *key, const byte *nonce, byte *tag);
+int crypto_chacha20poly1305_verify_tag(const byte *key, const byte *nonce, const byte *tag, size_t tag_size);
 
 // ED25519
 struct _ed25519_key;
@@ -90,6 +109,22 @@ int crypto_ed25519_verify(
     const byte *signature, size_t signature_size
 );
 
+// Private key expanded from its seed once, for a key that signs many times
+#define ED25519_SIGNATURE_SIZE 64
+
+struct _ed25519_expanded_key;
+typedef struct _ed25519_expanded_key ed25519_expanded_key;
+
+ed25519_expanded_key *crypto_ed25519_expand(const ed25519_key *key);
+void crypto_ed25519_expanded_free(ed25519_expanded_key *expanded_key);
+
+// Writes ED25519_SIGNATURE_SIZE bytes
+int crypto_ed25519_sign_expanded(
+    const ed25519_expanded_key *expanded_key,
+    const byte *message, size_t message_size,
+    byte *signature
+);
+
 
 // CURVE25519
 struct _curve25519_key;
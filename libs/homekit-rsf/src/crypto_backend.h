@@ -0,0 +1,61 @@
+#ifndef __CRYPTO_BACKEND_H__
+#define __CRYPTO_BACKEND_H__
+
+#include "crypto.h"
+
+// Contract of a crypto backend, the implementation of crypto.h used by HomeKit server.
+// crypto.c is the wolfCrypt backend. With HOMEKIT_CRYPTO_EXTERNAL defined it is left
+// out, and project must link other backend providing every symbol listed below.
+//
+// - Functions returning int return 0 on success and nonzero on any error.
+// - Srp, ed25519_key, ed25519_expanded_key and curve25519_key are opaque to server:
+//   *_new(), *_generate() and crypto_ed25519_expand() allocate them and return NULL
+//   on error. They are released with matching *_free().
+// - size_t * arguments are in/out: capacity of buffer on call, bytes written on return.
+//   A buffer too small is an error, and backend may set size needed.
+// - crypto_chacha20poly1305_encrypt() appends CHACHA20POLY1305_TAG_SIZE bytes to
+//   ciphertext, and decrypt() expects them. Its in place versions keep tag apart.
+// - crypto_chacha20poly1305_decrypt*() and *_verify*() must fail when tag or signature
+//   does not match.
+// - crypto_ed25519_export_key() writes private key followed by public key (64 bytes),
+//   crypto_ed25519_import_key() reads same format.
+// - Keys and SRP state are used only from server task: backend needs no locking.
+
+#define HOMEKIT_CRYPTO_BACKEND(X) \
+    X(crypto_sha512) \
+    X(crypto_hkdf) \
+    X(crypto_srp_new) \
+    X(crypto_srp_free) \
+    X(crypto_srp_init) \
+    X(crypto_srp_get_salt) \
+    X(crypto_srp_get_public_key) \
+    X(crypto_srp_compute_key) \
+    X(crypto_srp_verify) \
+    X(crypto_srp_get_proof) \
+    X(crypto_srp_hkdf) \
+    X(crypto_chacha20poly1305_encrypt) \
+    X(crypto_chacha20poly1305_decrypt) \
+    X(crypto_chacha20poly1305_encrypt_in_place) \
+    X(crypto_chacha20poly1305_decrypt_in_place) \
+    X(crypto_chacha20poly1305_tag) \
+    X(crypto_chacha20poly1305_verify_tag) \
+    X(crypto_ed25519_new) \
+    X(crypto_ed25519_generate) \
+    X(crypto_ed25519_free) \
+    X(crypto_ed25519_import_key) \
+    X(crypto_ed25519_export_key) \
+    X(crypto_ed25519_import_public_key) \
+    X(crypto_ed25519_export_public_key) \
+    X(crypto_ed25519_sign) \
+    X(crypto_ed25519_verify) \
+    X(crypto_ed25519_expand) \
+    X(crypto_ed25519_expanded_free) \
+    X(crypto_ed25519_sign_expanded) \
+    X(crypto_curve25519_new) \
+    X(crypto_curve25519_generate) \
+    X(crypto_curve25519_free) \
+    X(crypto_curve25519_import_public) \
+    X(crypto_curve25519_export_public) \
+    X(crypto_curve25519_shared_secret)
+
+#endif // __CRYPTO_BACKEND_H__
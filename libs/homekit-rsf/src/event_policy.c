@@ -0,0 +1,57 @@
+#include "event_policy.h"
+
+
+event_policy_t event_policy_check(event_state_t *state, homekit_characteristic_t *ch,
+                                  const uint32_t interval, const uint32_t now) {
+    // Trailing edge: value is read again when interval is over
+    if (ch->min_event_interval && state->clients && (now - state->time) < interval) {
+        return event_policy_defer;
+    }
+    
+    if (ch->event_dedupe && event_value_is_comparable(&ch->value) &&
+        !(ch->subscriptions & ~state->clients) && homekit_value_equal(&state->value, &ch->value)) {
+        return event_policy_suppress;
+    }
+    
+    return event_policy_send;
+}
+
+
+homekit_value_t *event_policy_render(event_state_t *state, homekit_value_t *value) {
+    if (!event_value_is_comparable(value)) {
+        return value;
+    }
+    
+    homekit_value_t snapshot = *value;
+    if (!homekit_value_equal(&state->value, &snapshot)) {
+        state->value = snapshot;
+        state->clients = 0;
+    }
+    
+    return &state->value;
+}
+
+
+uint32_t event_policy_clients_up_to_date(const event_state_t *state, const homekit_characteristic_t *ch) {
+    if (ch->event_dedupe && event_value_is_comparable(&ch->value)) {
+        return state->clients | ~ch->subscriptions;
+    }
+    
+    return ~ch->subscriptions;
+}
+
+
+void event_policy_sent(event_state_t *state, const uint32_t clients, const uint32_t now) {
+    if (clients) {
+        state->clients |= clients;
+        state->time = now;
+    }
+}
+
+
+void event_policy_clear_client(event_state_t *states, const unsigned int count, const unsigned int client_slot) {
+    const uint32_t mask = ~(1U << client_slot);
+    for (unsigned int i = 0; i < count; i++) {
+        states[i].clients &= mask;
+    }
+}
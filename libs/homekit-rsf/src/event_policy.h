@@ -0,0 +1,38 @@
+#ifndef __HOMEKIT_EVENT_POLICY__
+#define __HOMEKIT_EVENT_POLICY__
+
+#include <stdint.h>
+#include <homekit/types.h>
+
+// Event policy state of a characteristic with min_event_interval or event_dedupe
+typedef struct {
+    homekit_value_t value;      // Last value sent, only for bool and number formats
+    uint32_t clients;           // Client slots which got value
+    uint32_t time;              // Ticks when value was last sent
+} event_state_t;
+
+typedef enum {
+    event_policy_send = 0,
+    event_policy_defer,         // Interval is not over: keep notification pending, latest value is sent later
+    event_policy_suppress,      // Every subscribed client already got same value
+} event_policy_t;
+
+#define event_value_is_comparable(value)    ((value)->format <= HOMEKIT_FORMAT_FLOAT)
+
+// Decides what to do with a pending notification of ch. interval is ch->min_event_interval in ticks.
+event_policy_t event_policy_check(event_state_t *state, homekit_characteristic_t *ch,
+                                  const uint32_t interval, const uint32_t now);
+
+// Value to put in event. A copy is kept, because value can be changed by other tasks, and clients
+// which got previous value are forgotten when it differs.
+homekit_value_t *event_policy_render(event_state_t *state, homekit_value_t *value);
+
+// Clients which do not need rendered value of ch: already got it, or not subscribed
+uint32_t event_policy_clients_up_to_date(const event_state_t *state, const homekit_characteristic_t *ch);
+
+// Records clients which got rendered value
+void event_policy_sent(event_state_t *state, const uint32_t clients, const uint32_t now);
+
+void event_policy_clear_client(event_state_t *states, const unsigned int count, const unsigned int client_slot);
+
+#endif // __HOMEKIT_EVENT_POLICY__
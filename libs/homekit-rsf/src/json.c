@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <math.h>
 #include "json.h"
 #include "debug.h"
 
@@ -15,6 +16,9 @@
 #define JSON_NESTING_OBJECT (0)
 #define JSON_NESTING_ARRAY  (1)
 
+#define JSON_FLOAT_PRECISION    (7)     // Same output as "%1.7g"
+#define JSON_NUMBER_SIZE        (24)
+
 
 void json_init(json_stream *json, void *context) {
     json->pos = 0;
@@ -31,6 +35,8 @@ void json_buffer_free(json_stream *json) {
 
 void json_flush(json_stream *json) {
     if (!json->pos || json->error) {
+        // Pending data is discarded on error, so following writes cannot overflow buffer
+        json->pos = 0;
         return;
     }
     
@@ -46,7 +52,7 @@ void json_flush(json_stream *json) {
 
 void json_put(json_stream *json, char c) {
     json->buffer[json->pos++] = c;
-    if (json->pos >= HOMEKIT_JSON_BUFFER_SIZE - 1) {
+    if (json->pos >= json->size - 1) {
         json_flush(json);
     }
 }
@@ -54,14 +60,14 @@ void json_put(json_stream *json, char c) {
 void json_write(json_stream *json, const char *data, size_t size) {
     while (size) {
         size_t chunk_size = size;
-        if (size > HOMEKIT_JSON_BUFFER_SIZE - json->pos) {
-            chunk_size = HOMEKIT_JSON_BUFFER_SIZE - json->pos;
+        if (size > json->size - json->pos) {
+            chunk_size = json->size - json->pos;
         }
         
         memcpy((char*) json->buffer + json->pos, data, chunk_size);
         
         json->pos += chunk_size;
-        if (json->pos >= HOMEKIT_JSON_BUFFER_SIZE - 1) {
+        if (json->pos >= json->size - 1) {
             json_flush(json);
         }
         
@@ -182,6 +188,127 @@ void json_array_end(json_stream *json) {
     }
 }
 
+static size_t json_format_integer(char *buffer, long int x) {
+    char digits[JSON_NUMBER_SIZE];
+    size_t len = 0;
+    size_t digits_len = 0;
+    
+    unsigned long int value = x;
+    if (x < 0) {
+        buffer[len++] = '-';
+        value = -value;
+    }
+    
+    do {
+        digits[digits_len++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    
+    while (digits_len) {
+        buffer[len++] = digits[--digits_len];
+    }
+    
+    return len;
+}
+
+// Rounds |x| to JSON_FLOAT_PRECISION significant digits using exact integer math,
+// as printf does. Returns false when the result needs exponent notation.
+static bool json_float_digits(float x, uint32_t *digits, int *exponent) {
+    static const uint64_t pow10[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000, 10000000000ULL
+    };
+    
+    int e2;
+    const uint32_t mantissa = (uint32_t) (frexpf(x, &e2) * (1 << 24));
+    const int shift = 24 - e2;
+    
+    int e10 = 0;
+    double power = 1;
+    while (e10 < JSON_FLOAT_PRECISION && x >= power * 10) {
+        power *= 10;
+        e10++;
+    }
+    while (e10 >= -4 && x < power) {
+        power /= 10;
+        e10--;
+    }
+    
+    for (unsigned int i = 0; i < 3; i++) {
+        if (e10 < -4 || e10 >= JSON_FLOAT_PRECISION) {
+            return false;
+        }
+        
+        uint64_t n = mantissa * pow10[JSON_FLOAT_PRECISION - 1 - e10];
+        if (shift > 0) {
+            const uint64_t rest = n & ((1ULL << shift) - 1);
+            const uint64_t half = 1ULL << (shift - 1);
+            n >>= shift;
+            if (rest > half || (rest == half && (n & 1))) {
+                n++;
+            }
+        } else {
+            n <<= -shift;
+        }
+        
+        if (n >= pow10[JSON_FLOAT_PRECISION]) {
+            e10++;
+        } else if (n < pow10[JSON_FLOAT_PRECISION - 1]) {
+            e10--;
+        } else {
+            *digits = n;
+            *exponent = e10;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+static size_t json_format_float(char *buffer, float x) {
+    uint32_t digits;
+    int exponent;
+    
+    if (x == 0 || isnan(x) || isinf(x) || !json_float_digits(fabsf(x), &digits, &exponent)) {
+        return snprintf(buffer, JSON_NUMBER_SIZE, "%1.7g", x);
+    }
+    
+    char text[JSON_FLOAT_PRECISION];
+    for (int i = JSON_FLOAT_PRECISION - 1; i >= 0; i--) {
+        text[i] = '0' + (digits % 10);
+        digits /= 10;
+    }
+    
+    int text_len = JSON_FLOAT_PRECISION;
+    while (text_len > 1 && text_len > exponent + 1 && text[text_len - 1] == '0') {
+        text_len--;
+    }
+    
+    size_t len = 0;
+    if (x < 0) {
+        buffer[len++] = '-';
+    }
+    
+    if (exponent >= 0) {
+        memcpy(buffer + len, text, exponent + 1);
+        len += exponent + 1;
+        if (text_len > exponent + 1) {
+            buffer[len++] = '.';
+            memcpy(buffer + len, text + exponent + 1, text_len - exponent - 1);
+            len += text_len - exponent - 1;
+        }
+    } else {
+        buffer[len++] = '0';
+        buffer[len++] = '.';
+        for (int i = exponent + 1; i < 0; i++) {
+            buffer[len++] = '0';
+        }
+        memcpy(buffer + len, text, text_len);
+        len += text_len;
+    }
+    
+    return len;
+}
+
 void json_integer(json_stream *json, long int x) {
     if (json->error)
         json->state = JSON_STATE_ERROR;
@@ -189,14 +316,9 @@ void json_integer(json_stream *json, long int x) {
         return;
 
     void _do_write() {
-        size_t len = snprintf(NULL, 0, "%ld", x);
-        char *buffer = malloc(len + 1);
-        if (buffer) {
-            snprintf(buffer, len + 1, "%ld", x);
-            
-            json_write(json, buffer, len);
-            free(buffer);
-        }
+        char buffer[JSON_NUMBER_SIZE];
+        size_t len = json_format_integer(buffer, x);
+        json_write(json, buffer, len);
     }
 
     switch (json->state) {
@@ -228,15 +350,9 @@ void json_float(json_stream *json, float x) {
         return;
 
     void _do_write() {
-        //snprintf(NULL, 0, "%1.15g", x);
-        size_t len = snprintf(NULL, 0, "%1.7g", x);
-        char *buffer = malloc(len + 1);
-        if (buffer) {
-            snprintf(buffer, len + 1, "%1.7g", x);
-            
-            json_write(json, buffer, len);
-            free(buffer);
-        }
+        char buffer[JSON_NUMBER_SIZE];
+        size_t len = json_format_float(buffer, x);
+        json_write(json, buffer, len);
     }
 
     switch (json->state) {
@@ -20,6 +20,7 @@ typedef int (*json_flush_callback)(uint8_t *buffer, size_t size, void *context);
 typedef struct _json_stream {
     uint8_t* buffer;
     size_t pos;
+    size_t size;            // Buffer capacity, set with buffer
 
     uint8_t state: 7;
     bool error: 1;
@@ -37,6 +38,7 @@ void json_init(json_stream *json, void *context);
 void json_buffer_free(json_stream *json);
 
 void json_flush(json_stream *json);
+void json_write(json_stream *json, const char *data, size_t size);
 
 void json_object_start(json_stream *json);
 void json_object_end(json_stream *json);
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include "json_reader.h"
+
+
+void json_reader_init(json_reader_t *reader, char *data) {
+    reader->pos = data;
+    reader->expect_comma = false;
+    reader->error = !data;
+}
+
+
+static void skip_whitespace(json_reader_t *reader) {
+    while (*reader->pos == ' ' || *reader->pos == '\t' || *reader->pos == '\n' || *reader->pos == '\r')
+        reader->pos++;
+}
+
+
+static int read_hex4(const char *s) {
+    int code = 0;
+    for (unsigned int i = 0; i < 4; i++) {
+        char c = s[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9')
+            code |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            code |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            code |= c - 'A' + 10;
+        else
+            return -1;
+    }
+
+    return code;
+}
+
+
+// Unescaped text is never longer than escaped one, so it is written over it
+static char *read_string(json_reader_t *reader) {
+    char *in = reader->pos + 1;
+    char *start = in;
+    char *out = in;
+
+    while (*in != '"') {
+        if (!*in) {
+            reader->error = true;
+            return NULL;
+        }
+
+        if (*in != '\\') {
+            *out++ = *in++;
+            continue;
+        }
+
+        in++;
+        switch (*in++) {
+            case '"':  *out++ = '"';  break;
+            case '\\': *out++ = '\\'; break;
+            case '/':  *out++ = '/';  break;
+            case 'b':  *out++ = '\b'; break;
+            case 'f':  *out++ = '\f'; break;
+            case 'n':  *out++ = '\n'; break;
+            case 'r':  *out++ = '\r'; break;
+            case 't':  *out++ = '\t'; break;
+            case 'u': {
+                int code = read_hex4(in);
+                if (code < 0) {
+                    reader->error = true;
+                    return NULL;
+                }
+                in += 4;
+
+                if (code >= 0xD800 && code < 0xDC00 && in[0] == '\\' && in[1] == 'u') {
+                    int low = read_hex4(in + 2);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        in += 6;
+                    }
+                }
+
+                if (code < 0x80) {
+                    *out++ = code;
+                } else if (code < 0x800) {
+                    *out++ = 0xC0 | (code >> 6);
+                    *out++ = 0x80 | (code & 0x3F);
+                } else if (code < 0x10000) {
+                    *out++ = 0xE0 | (code >> 12);
+                    *out++ = 0x80 | ((code >> 6) & 0x3F);
+                    *out++ = 0x80 | (code & 0x3F);
+                } else {
+                    *out++ = 0xF0 | (code >> 18);
+                    *out++ = 0x80 | ((code >> 12) & 0x3F);
+                    *out++ = 0x80 | ((code >> 6) & 0x3F);
+                    *out++ = 0x80 | (code & 0x3F);
+                }
+                break;
+            }
+            default:
+                reader->error = true;
+                return NULL;
+        }
+    }
+
+    reader->pos = in + 1;
+    *out = 0;
+
+    return start;
+}
+
+
+static bool read_number(json_reader_t *reader, float *number) {
+    char *end = reader->pos;
+    while ((*end >= '0' && *end <= '9') || *end == '-' || *end == '+' || *end == '.' || *end == 'e' || *end == 'E')
+        end++;
+
+    // strtof() would also take hex, inf and nan, so it only sees number characters
+    char c = *end;
+    *end = 0;
+    char *parsed_end;
+    *number = strtof(reader->pos, &parsed_end);
+    *end = c;
+
+    if (parsed_end == reader->pos || parsed_end != end) {
+        reader->error = true;
+        return false;
+    }
+
+    reader->pos = end;
+    return true;
+}
+
+
+static bool read_literal(json_reader_t *reader, const char *literal, size_t size) {
+    if (strncmp(reader->pos, literal, size)) {
+        reader->error = true;
+        return false;
+    }
+
+    reader->pos += size;
+    return true;
+}
+
+
+bool json_reader_value(json_reader_t *reader, json_value_t *value) {
+    if (reader->error)
+        return false;
+
+    skip_whitespace(reader);
+
+    switch (*reader->pos) {
+        case '{':
+        case '[':
+            value->type = (*reader->pos == '{') ? JSON_VALUE_OBJECT : JSON_VALUE_ARRAY;
+            reader->pos++;
+            reader->expect_comma = false;
+            return true;
+
+        case '"':
+            value->type = JSON_VALUE_STRING;
+            value->string = read_string(reader);
+            break;
+
+        case 't':
+            value->type = JSON_VALUE_TRUE;
+            read_literal(reader, "true", 4);
+            break;
+
+        case 'f':
+            value->type = JSON_VALUE_FALSE;
+            read_literal(reader, "false", 5);
+            break;
+
+        case 'n':
+            value->type = JSON_VALUE_NULL;
+            read_literal(reader, "null", 4);
+            break;
+
+        default:
+            if (*reader->pos != '-' && (*reader->pos < '0' || *reader->pos > '9')) {
+                reader->error = true;
+                break;
+            }
+
+            value->type = JSON_VALUE_NUMBER;
+            read_number(reader, &value->number);
+            break;
+    }
+
+    reader->expect_comma = true;
+
+    return !reader->error;
+}
+
+
+static bool next_member(json_reader_t *reader, char close) {
+    if (reader->error)
+        return false;
+
+    skip_whitespace(reader);
+
+    if (*reader->pos == close) {
+        reader->pos++;
+        reader->expect_comma = true;
+        return false;
+    }
+
+    if (reader->expect_comma) {
+        if (*reader->pos != ',') {
+            reader->error = true;
+            return false;
+        }
+
+        reader->pos++;
+        skip_whitespace(reader);
+    }
+
+    return true;
+}
+
+
+char *json_reader_next_key(json_reader_t *reader) {
+    if (!next_member(reader, '}'))
+        return NULL;
+
+    if (*reader->pos != '"') {
+        reader->error = true;
+        return NULL;
+    }
+
+    char *key = read_string(reader);
+    if (!key)
+        return NULL;
+
+    skip_whitespace(reader);
+    if (*reader->pos != ':') {
+        reader->error = true;
+        return NULL;
+    }
+
+    reader->pos++;
+    reader->expect_comma = false;
+
+    return key;
+}
+
+
+bool json_reader_next_item(json_reader_t *reader) {
+    return next_member(reader, ']');
+}
+
+
+bool json_reader_skip(json_reader_t *reader) {
+    unsigned int depth = 1;
+
+    while (depth && !reader->error) {
+        switch (*reader->pos) {
+            case 0:
+                reader->error = true;
+                break;
+
+            case '"':
+                read_string(reader);
+                break;
+
+            case '{':
+            case '[':
+                depth++;
+                reader->pos++;
+                break;
+
+            case '}':
+            case ']':
+                depth--;
+                reader->pos++;
+                break;
+
+            default:
+                reader->pos++;
+        }
+    }
+
+    reader->expect_comma = true;
+
+    return !reader->error;
+}
+
+
+bool json_reader_end(json_reader_t *reader) {
+    if (reader->error)
+        return false;
+
+    skip_whitespace(reader);
+
+    return !*reader->pos;
+}
@@ -0,0 +1,50 @@
+#ifndef __HOMEKIT_JSON_READER__
+#define __HOMEKIT_JSON_READER__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Pull reader over a NUL terminated JSON text. It works in place: strings are
+// unescaped inside the buffer and returned NUL terminated, so nothing is allocated.
+
+typedef enum {
+    JSON_VALUE_NULL = 0,
+    JSON_VALUE_FALSE,
+    JSON_VALUE_TRUE,
+    JSON_VALUE_NUMBER,
+    JSON_VALUE_STRING,
+    JSON_VALUE_OBJECT,
+    JSON_VALUE_ARRAY,
+} json_value_type_t;
+
+typedef struct {
+    json_value_type_t type;
+    float number;
+    char *string;
+} json_value_t;
+
+typedef struct {
+    char *pos;
+    bool expect_comma: 1;
+    bool error: 1;
+} json_reader_t;
+
+void json_reader_init(json_reader_t *reader, char *data);
+
+// Reads a value. Objects and arrays are only opened: walk them with
+// json_reader_next_key() or json_reader_next_item(), or call json_reader_skip().
+bool json_reader_value(json_reader_t *reader, json_value_t *value);
+
+// Returns next member name of opened object, or NULL when it is closed or on error
+char *json_reader_next_key(json_reader_t *reader);
+
+// Returns true if opened array has one more item to read
+bool json_reader_next_item(json_reader_t *reader);
+
+// Skips rest of an opened object or array
+bool json_reader_skip(json_reader_t *reader);
+
+// True when only whitespace is left
+bool json_reader_end(json_reader_t *reader);
+
+#endif // __HOMEKIT_JSON_READER__
@@ -20,7 +20,7 @@ void pairing_free(pairing_t *pairing) {
         free(pairing->device_id);
     }
 
-    if (pairing->device_key) {
+    if (pairing->device_key && !pairing->device_key_shared) {
         crypto_ed25519_free(pairing->device_key);
     }
 
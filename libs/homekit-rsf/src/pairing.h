@@ -1,6 +1,7 @@
 #ifndef __PAIRING_H__
 #define __PAIRING_H__
 
+#include <stdbool.h>
 #include "crypto.h"
 
 typedef enum {
@@ -12,6 +13,7 @@ typedef struct {
     char *device_id;
     ed25519_key *device_key;
     pairing_permissions_t permissions;
+    bool device_key_shared;     // device_key belongs to storage pairings cache
 } pairing_t;
 
 pairing_t *pairing_new();
@@ -3,7 +3,7 @@
 #include "query_params.h"
 
 
-query_param_t *query_params_parse(const char *s) {
+query_param_t *query_params_parse(char *s, void *(*alloc)(size_t size, void *arg), void *arg) {
     query_param_t *params = NULL;
 
     unsigned int i = 0;
@@ -11,27 +11,40 @@ query_param_t *query_params_parse(const char *s) {
         unsigned int pos = i;
         while (s[i] && s[i] != '=' && s[i] != '&' && s[i] != '#') i++;
         if (i == pos) {
+            if (!s[i] || s[i] == '#')
+                break;
             i++;
             continue;
         }
 
-        query_param_t *param = malloc(sizeof(query_param_t));
-        param->name = strndup(s+pos, i-pos);
+        query_param_t *param = alloc(sizeof(query_param_t), arg);
+        if (!param)
+            break;
+
+        param->name = s+pos;
         param->value = NULL;
         param->next = params;
         params = param;
 
-        if (s[i] == '=') {
+        char c = s[i];
+        s[i] = 0;
+
+        if (c == '=') {
             i++;
             pos = i;
             while (s[i] && s[i] != '&' && s[i] != '#') i++;
             if (i != pos) {
-                param->value = strndup(s+pos, i-pos);
+                param->value = s+pos;
             }
+
+            c = s[i];
+            s[i] = 0;
         }
 
-        if (!s[i] || s[i] == '#')
+        if (!c || c == '#')
             break;
+
+        i++;
     }
 
     return params;
@@ -47,18 +60,3 @@ query_param_t *query_params_find(query_param_t *params, const char *name) {
 
     return NULL;
 }
-
-
-void query_params_free(query_param_t *params) {
-    while (params) {
-        query_param_t *next = params->next;
-        if (params->name)
-            free(params->name);
-        if (params->value)
-            free(params->value);
-        free(params);
-
-        params = next;
-    }
-}
-
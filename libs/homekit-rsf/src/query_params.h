@@ -1,6 +1,8 @@
 #ifndef __HOMEKIT_QUERY_PARAMS__
 #define __HOMEKIT_QUERY_PARAMS__
 
+#include <stddef.h>
+
 typedef struct _query_param {
     char *name;
     char *value;
@@ -8,8 +10,9 @@ typedef struct _query_param {
     struct _query_param *next;
 } query_param_t;
 
-query_param_t *query_params_parse(const char *s);
+// Parses query string in place, so names and values point into s.
+// Params are taken from alloc(), and are released together by its owner.
+query_param_t *query_params_parse(char *s, void *(*alloc)(size_t size, void *arg), void *arg);
 query_param_t *query_params_find(query_param_t *params, const char *name);
-void query_params_free(query_param_t *params);
 
 #endif // __HOMEKIT_QUERY_PARAMS__
@@ -34,10 +34,6 @@
 
 #endif
 
-#include <cJSON_rsf.h>
-#include <wolfssl/wolfcrypt/hash.h>
-#include <wolfssl/wolfcrypt/coding.h>
-
 #include <timers_helper.h>
 
 #include "base64.h"
@@ -45,7 +41,11 @@
 #include "pairing.h"
 #include "storage.h"
 #include "query_params.h"
+#include "characteristic_ids.h"
+#include "client_eviction.h"
+#include "event_policy.h"
 #include "json.h"
+#include "json_reader.h"
 #include "debug.h"
 #include "port.h"
 
@@ -68,24 +68,48 @@
 #define HOMEKIT_MIN_FREEHEAP                    (14848)
 #endif
 
-#ifndef HOMEKIT_NETWORK_FIRST_MIN_FREEHEAP
-#define HOMEKIT_NETWORK_FIRST_MIN_FREEHEAP      (25600)
+#ifndef HOMEKIT_CLIENT_NETWORK_COST
+#define HOMEKIT_CLIENT_NETWORK_COST             (1536)      // lwIP socket, PCB and buffered segments of a connection
 #endif
 
 #ifndef HOMEKIT_NETWORK_MIN_FREEHEAP
 #define HOMEKIT_NETWORK_MIN_FREEHEAP            (20480)
 #endif
 
-#ifndef HOMEKIT_NETWORK_PAUSE_COUNT
-#define HOMEKIT_NETWORK_PAUSE_COUNT             (5)
+#ifndef HOMEKIT_PAIR_RESUME_SESSIONS
+#define HOMEKIT_PAIR_RESUME_SESSIONS            (8)
+#endif
+
+#ifndef HOMEKIT_SEND_QUEUE_CLIENT_SIZE
+#define HOMEKIT_SEND_QUEUE_CLIENT_SIZE          (4096)  // Events are dropped for a client while its queue is over half of it
+#endif
+
+#ifndef HOMEKIT_SEND_QUEUE_CLIENT_MAX
+#define HOMEKIT_SEND_QUEUE_CLIENT_MAX           (32768) // A client whose queue would be bigger is disconnected
+#endif
+
+#ifndef HOMEKIT_SEND_QUEUE_BUDGET
+#define HOMEKIT_SEND_QUEUE_BUDGET               (8192)  // Events are not queued while all clients queues, responses included, are bigger
+#endif
+
+#ifndef HOMEKIT_IDLE_TIMEOUT
+#define HOMEKIT_IDLE_TIMEOUT                    (1000)  // Milliseconds server blocks while idle, in case a wakeup is lost
+#endif
+
+#ifndef HOMEKIT_CURVE25519_POOL_SIZE
+#define HOMEKIT_CURVE25519_POOL_SIZE            (2)
 #endif
 
-#ifndef HOMEKIT_NETWORK_MIN_FREEHEAP_CRITIC
-#define HOMEKIT_NETWORK_MIN_FREEHEAP_CRITIC     (16896)
+#ifndef HOMEKIT_SRP_PRECOMPUTE
+#define HOMEKIT_SRP_PRECOMPUTE                  (1)     // Prepare next Pair Setup SRP keys while unpaired and idle
 #endif
 
-#ifndef HOMEKIT_NETWORK_PAUSE_COUNT_CRITIC
-#define HOMEKIT_NETWORK_PAUSE_COUNT_CRITIC      (10)
+#ifndef HOMEKIT_PAIR_RESUME_TIMEOUT
+#define HOMEKIT_PAIR_RESUME_TIMEOUT             (3600)  // Seconds
+#endif
+
+#ifndef HOMEKIT_REQUEST_ARENA_SIZE
+#define HOMEKIT_REQUEST_ARENA_SIZE              (768)   // Request body and query params, bigger ones spill to heap
 #endif
 
 #ifdef HOMEKIT_DEBUG
@@ -118,18 +142,6 @@ typedef struct _client_context_t client_context_t;
 #endif
 
 
-#define HOMEKIT_ENDPOINT_UNKNOWN                    (0)
-#define HOMEKIT_ENDPOINT_PAIR_SETUP                 (1)
-#define HOMEKIT_ENDPOINT_PAIR_VERIFY                (2)
-#define HOMEKIT_ENDPOINT_IDENTIFY                   (3)
-#define HOMEKIT_ENDPOINT_GET_ACCESSORIES            (4)
-#define HOMEKIT_ENDPOINT_GET_CHARACTERISTICS        (5)
-#define HOMEKIT_ENDPOINT_UPDATE_CHARACTERISTICS     (6)
-#define HOMEKIT_ENDPOINT_PAIRINGS                   (7)
-#define HOMEKIT_ENDPOINT_PREPARE                    (8)
-#define HOMEKIT_ENDPOINT_RESOURCE                   (9)
-
-
 typedef struct {
     Srp *srp;
     byte *public_key;
@@ -149,37 +161,117 @@ typedef struct {
     size_t accessory_public_key_size;
 } pair_verify_context_t;
 
-typedef struct _notification {
-    homekit_characteristic_t* ch;
-    struct _notification* next;
-} notification_t;
+#define PAIR_VERIFY_KEYS_SIZE                   (4 * 32)    // Heap buffers of pair_verify_context_t: secret, session key and both public keys
 
-#define BUFFER_DATA_SIZE        (HOMEKIT_JSON_BUFFER_SIZE)  // Used by JSON buffer too. Must be 2 bytes reserved for client_send_chunk() end
+#define PAIR_RESUME_SESSION_ID_SIZE             (8)
+#define PAIR_RESUME_SECRET_SIZE                 (32)
+#define PAIR_RESUME_PUBLIC_KEY_SIZE             (32)    // Curve25519 public key of device
+
+typedef struct {
+    byte session_id[PAIR_RESUME_SESSION_ID_SIZE];
+    byte secret[PAIR_RESUME_SECRET_SIZE];
+    
+    TickType_t last_used;
+    
+    uint8_t pairing_id;
+    byte permissions: 7;
+    bool active: 1;
+} pair_resume_session_t;
+
+typedef struct _request_spill {
+    struct _request_spill* next;
+    byte data[];
+} request_spill_t;
+
+typedef struct _client_frame {
+    struct _client_frame* next;
+    uint16_t size;
+    uint16_t sent;
+    byte data[];
+} client_frame_t;
+
+#define BUFFER_DATA_SIZE        (HOMEKIT_JSON_BUFFER_SIZE)
 
 typedef struct {
     char *accessory_id;
     ed25519_key* accessory_key;
+    ed25519_expanded_key* accessory_signing_key;    // accessory_key expanded, for Pair Setup and Pair Verify signs
     
     homekit_server_config_t* config;
     
     pairing_context_t* pairing_context;
+#if HOMEKIT_SRP_PRECOMPUTE > 0
+    pairing_context_t* srp_precomputed;     // Salt, verifier and server keys for next Pair Setup M1
+#endif
     
     client_context_t* clients;
     
-    notification_t* notifications;
+    // One byte per characteristic ordinal, so any task can set it with a single store.
+    // Server task moves set bytes to notify_batch bitmap before rendering them.
+    volatile uint8_t* notify_pending;
+    uint8_t* notify_batch;
+    uint16_t notify_count;
+    volatile bool notify_pending_any;
+    bool notify_deferred;       // Some pending notifications wait for their min_event_interval
+    
+    event_state_t* event_states;    // By ordinal - 1, only when any characteristic has an event policy
+    
+    uint32_t events_coalesced;  // Notifies merged into an already pending event
+    uint32_t events_emitted;    // Events sent to clients
+    uint32_t events_suppressed; // Notifies not sent because subscribed clients already got same value
+    
+    homekit_request_stats_t request_stats[HOMEKIT_ENDPOINTS_COUNT];
+    uint32_t request_heap_min;  // Lowest free heap seen when a request handler returns
+    
+    pair_resume_session_t pair_resume_sessions[HOMEKIT_PAIR_RESUME_SESSIONS];
+    
+#if HOMEKIT_CURVE25519_POOL_SIZE > 0
+    curve25519_key* curve25519_pool[HOMEKIT_CURVE25519_POOL_SIZE];     // Pre-generated Pair Verify ephemeral keys
+    uint32_t curve25519_pool_hits;
+    uint32_t curve25519_pool_misses;
+#endif
+    
+#ifdef HOMEKIT_ACCESSORIES_TEMPLATE
+    struct _accessories_template* accessories_template;
+#endif
+    
+    uint32_t client_slots;      // Bitmask of client slots in use
+    
+    uint32_t client_evictions[HOMEKIT_CLIENT_EVICTION_REASONS];
+    uint32_t clients_refused;   // New clients closed because heap was short and no client could be evicted
+    volatile bool evict_requested;  // Set by homekit_remove_oldest_client(), served by server task
+    
+    uint32_t send_queue_size;   // Bytes queued by all clients
+    uint32_t event_drops;
     
     int32_t listen_fd;
     int32_t max_fd;
     
-    uint8_t client_count: 5;
+#if LWIP_NETIF_LOOPBACK
+    int32_t wakeup_fd;          // Loopback UDP socket used to wake up select() when a notification is added
+    volatile bool wakeup_pending;
+#endif
+    
+    uint8_t client_count: 6;    // Up to 32 clients, one per slot
     bool paired: 1;
     bool is_pairing: 1;
     bool pending_close: 1;
     
     json_stream json;
     
-    byte data[BUFFER_DATA_SIZE + 16 + 2];   // Used by JSON buffer too. Must be 2 bytes reserved for client_send_chunk() end; there are 18.
-    byte encrypted[BUFFER_DATA_SIZE + 16 + 2];
+    client_context_t* frame_context;        // Client whose data is staged in data buffer
+    uint16_t frame_size;
+    
+    client_context_t* request_arena_owner;  // Client whose request is using arena, until its message is complete
+    uint16_t request_arena_used;
+    uint16_t request_arena_last;            // Offset of last allocation, which can grow in place
+    
+    // Received frames are decrypted in place here, and responses are staged and encrypted in place
+    // as 2 bytes AAD length, payload and 16 bytes tag. JSON of responses is written into staging too.
+    byte data_align[2] __attribute__((aligned(4)));     // Payload at data + 2 is word aligned
+    byte data[2 + BUFFER_DATA_SIZE + 16];
+    
+    byte request_arena[HOMEKIT_REQUEST_ARENA_SIZE] __attribute__((aligned(sizeof(void*))));
     
     fd_set fds;
 } homekit_server_t;
@@ -196,6 +288,7 @@ struct _client_context_t {
     uint8_t endpoint: 4;
     bool encrypted: 1;
     bool disconnect: 1;
+    uint8_t slot: 5;        // Index used by characteristic subscriptions bitmask
     
     http_parser *parser;
 
@@ -207,6 +300,13 @@ struct _client_context_t {
     int32_t count_writes;
     
     pair_verify_context_t *verify_context;
+    
+    client_frame_t *send_queue;     // Encrypted frames waiting for socket to be writable
+    uint32_t send_queue_size;
+    
+    request_spill_t *request_spill; // Request allocations which did not fit in arena
+    
+    TickType_t last_activity;       // When client was accepted or last sent data
 
     struct _client_context_t *next;
 };
@@ -231,12 +331,41 @@ int homekit_get_client_count() {
     
     return -1;
 }
+
+static uint32_t homekit_server_subscribed_clients();
+
+int homekit_get_client_info(const unsigned int index, homekit_client_info_t *info) {
+    if (homekit_server) {
+        client_context_t *context = homekit_server->clients;
+        for (unsigned int i = 0; context && i < index; i++) {
+            context = context->next;
+        }
+        
+        if (context) {
+            info->socket = context->socket;
+            info->idle_time = (xTaskGetTickCount() - context->last_activity) * portTICK_PERIOD_MS;
+            info->send_queue_size = context->send_queue_size;
+            info->verified = context->encrypted;
+            info->subscribed = (homekit_server_subscribed_clients() & (1U << context->slot)) != 0;
+            return 0;
+        }
+    }
+    
+    return -1;
+}
 #endif
 
 void client_context_free(client_context_t *c);
 void pairing_context_free(pairing_context_t *context);
 void homekit_server_on_reset(client_context_t *context);
 int client_send_chunk(byte *data, size_t size, void *arg);
+static inline void homekit_server_close_clients();
+
+#if LWIP_NETIF_LOOPBACK
+static void homekit_server_wakeup();
+#else
+#define homekit_server_wakeup()
+#endif
 
 #ifdef HOMEKIT_CHANGE_MAX_CLIENTS
 void homekit_set_max_clients(const unsigned int clients) {
@@ -251,8 +380,31 @@ homekit_server_t *server_new() {
     
     FD_ZERO(&homekit_server->fds);
     
-    homekit_server->json.buffer = homekit_server->data;
-    homekit_server->json.on_flush = client_send_chunk;
+#if LWIP_NETIF_LOOPBACK
+    homekit_server->wakeup_fd = -1;
+#endif
+    
+    const unsigned int notify_count = homekit_characteristics_count();
+    if (notify_count) {
+        homekit_server->notify_pending = calloc(notify_count + 1, sizeof(uint8_t));
+        homekit_server->notify_batch = calloc((notify_count >> 3) + 1, sizeof(uint8_t));
+        if (!homekit_server->notify_pending || !homekit_server->notify_batch) {
+            HOMEKIT_ERROR("Ev table DRAM");
+        } else {
+            homekit_server->notify_count = notify_count;
+        }
+        
+        for (unsigned int ordinal = 1; ordinal <= homekit_server->notify_count; ordinal++) {
+            homekit_characteristic_t *ch = homekit_characteristic_by_ordinal(ordinal);
+            if (ch->min_event_interval || ch->event_dedupe) {
+                homekit_server->event_states = calloc(notify_count, sizeof(event_state_t));
+                if (!homekit_server->event_states) {
+                    HOMEKIT_ERROR("Ev policy DRAM");
+                }
+                break;
+            }
+        }
+    }
     
     return homekit_server;
 }
@@ -266,10 +418,18 @@ void server_free() {
     if (homekit_server->accessory_key) {
         crypto_ed25519_free(homekit_server->accessory_key);
     }
+    
+    crypto_ed25519_expanded_free(homekit_server->accessory_signing_key);
 
     if (homekit_server->pairing_context) {
         pairing_context_free(homekit_server->pairing_context);
     }
+    
+#if HOMEKIT_SRP_PRECOMPUTE > 0
+    if (homekit_server->srp_precomputed) {
+        pairing_context_free(homekit_server->srp_precomputed);
+    }
+#endif
 
     if (homekit_server->clients) {
         client_context_t *client = homekit_server->clients;
@@ -285,9 +445,10 @@ void server_free() {
 }
 */
 
-void tlv_debug(const tlv_values_t *values) {
+void tlv_debug(const tlv_view_t *view) {
     HOMEKIT_DEBUG_LOG("Got following TLV Values:");
-    for (tlv_t *t=values->head; t; t=t->next) {
+    for (unsigned int i = 0; i < view->count; i++) {
+        const tlv_item_t *t = &view->items[i];
         char *escaped_payload = binary_to_string(t->value, t->size);
         HOMEKIT_DEBUG_LOG("Type 0x%02X, Length: %d, Value: %s", t->type, t->size, escaped_payload);
         free(escaped_payload);
@@ -361,6 +522,185 @@ void pair_verify_context_free(pair_verify_context_t **context) {
     *context = NULL;
 }
 
+#if HOMEKIT_CURVE25519_POOL_SIZE > 0
+static curve25519_key *curve25519_pool_take() {
+    for (unsigned int i = 0; i < HOMEKIT_CURVE25519_POOL_SIZE; i++) {
+        curve25519_key *key = homekit_server->curve25519_pool[i];
+        if (key) {
+            homekit_server->curve25519_pool[i] = NULL;
+            homekit_server->curve25519_pool_hits++;
+            return key;
+        }
+    }
+    
+    homekit_server->curve25519_pool_misses++;
+    
+    return crypto_curve25519_generate();
+}
+
+static bool curve25519_pool_full() {
+    for (unsigned int i = 0; i < HOMEKIT_CURVE25519_POOL_SIZE; i++) {
+        if (!homekit_server->curve25519_pool[i]) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Generates one key per call, to keep server loop responsive
+static void curve25519_pool_fill() {
+    for (unsigned int i = 0; i < HOMEKIT_CURVE25519_POOL_SIZE; i++) {
+        if (!homekit_server->curve25519_pool[i]) {
+            homekit_server->curve25519_pool[i] = crypto_curve25519_generate();
+            return;
+        }
+    }
+}
+#else
+#define curve25519_pool_take()          crypto_curve25519_generate()
+#endif // HOMEKIT_CURVE25519_POOL_SIZE
+
+void homekit_get_send_queue_stats(uint32_t *queued, uint32_t *event_drops) {
+    if (homekit_server) {
+        *queued = homekit_server->send_queue_size;
+        *event_drops = homekit_server->event_drops;
+        return;
+    }
+    
+    *queued = 0;
+    *event_drops = 0;
+}
+
+void homekit_get_notify_stats(uint32_t *coalesced, uint32_t *emitted, uint32_t *suppressed) {
+    if (homekit_server) {
+        *coalesced = homekit_server->events_coalesced;
+        *emitted = homekit_server->events_emitted;
+        *suppressed = homekit_server->events_suppressed;
+        return;
+    }
+    
+    *coalesced = 0;
+    *emitted = 0;
+    *suppressed = 0;
+}
+
+void homekit_get_request_stats(const unsigned int endpoint, homekit_request_stats_t *stats) {
+    if (homekit_server && endpoint < HOMEKIT_ENDPOINTS_COUNT) {
+        *stats = homekit_server->request_stats[endpoint];
+        return;
+    }
+    
+    memset(stats, 0, sizeof(*stats));
+}
+
+uint32_t homekit_get_request_heap_min() {
+    if (homekit_server) {
+        return homekit_server->request_heap_min;
+    }
+    
+    return 0;
+}
+
+static void event_states_clear_client(const unsigned int client_slot) {
+    if (homekit_server->event_states) {
+        event_policy_clear_client(homekit_server->event_states, homekit_server->notify_count, client_slot);
+    }
+}
+
+void homekit_get_curve25519_pool_stats(uint32_t *hits, uint32_t *misses) {
+#if HOMEKIT_CURVE25519_POOL_SIZE > 0
+    if (homekit_server) {
+        *hits = homekit_server->curve25519_pool_hits;
+        *misses = homekit_server->curve25519_pool_misses;
+        return;
+    }
+#endif
+    
+    *hits = 0;
+    *misses = 0;
+}
+
+static void pair_resume_sessions_clear() {
+    memset(homekit_server->pair_resume_sessions, 0, sizeof(homekit_server->pair_resume_sessions));
+}
+
+static void pair_resume_sessions_remove(const int pairing_id) {
+    for (unsigned int i = 0; i < HOMEKIT_PAIR_RESUME_SESSIONS; i++) {
+        pair_resume_session_t *session = &homekit_server->pair_resume_sessions[i];
+        if (session->active && session->pairing_id == pairing_id) {
+            memset(session, 0, sizeof(*session));
+        }
+    }
+}
+
+static bool pair_resume_session_expired(const pair_resume_session_t *session) {
+    return (xTaskGetTickCount() - session->last_used) > (HOMEKIT_PAIR_RESUME_TIMEOUT * 1000 / portTICK_PERIOD_MS);
+}
+
+static pair_resume_session_t *pair_resume_session_find(const byte *session_id) {
+    for (unsigned int i = 0; i < HOMEKIT_PAIR_RESUME_SESSIONS; i++) {
+        pair_resume_session_t *session = &homekit_server->pair_resume_sessions[i];
+        if (session->active && !memcmp(session->session_id, session_id, PAIR_RESUME_SESSION_ID_SIZE)) {
+            if (pair_resume_session_expired(session)) {
+                memset(session, 0, sizeof(*session));
+                return NULL;
+            }
+            
+            return session;
+        }
+    }
+    
+    return NULL;
+}
+
+// Takes a free slot, or the least recently used one
+static pair_resume_session_t *pair_resume_session_new() {
+    pair_resume_session_t *oldest = NULL;
+    const TickType_t now = xTaskGetTickCount();
+    
+    for (unsigned int i = 0; i < HOMEKIT_PAIR_RESUME_SESSIONS; i++) {
+        pair_resume_session_t *session = &homekit_server->pair_resume_sessions[i];
+        if (!session->active) {
+            return session;
+        }
+        
+        if (!oldest || (now - session->last_used) > (now - oldest->last_used)) {
+            oldest = session;
+        }
+    }
+    
+    return oldest;
+}
+
+static void pair_resume_session_add(const byte *secret, const size_t secret_size, const int pairing_id, const byte permissions) {
+    if (secret_size != PAIR_RESUME_SECRET_SIZE) {
+        return;
+    }
+    
+    // Session ID is derived by controller in the same way
+    byte session_id[HKDF_HASH_SIZE];
+    size_t session_id_size = sizeof(session_id);
+    const byte salt[] = "Pair-Verify-ResumeSessionID-Salt";
+    const byte info[] = "Pair-Verify-ResumeSessionID-Info";
+    if (crypto_hkdf(
+            secret, secret_size,
+            salt, sizeof(salt)-1,
+            info, sizeof(info)-1,
+            session_id, &session_id_size
+        )) {
+        return;
+    }
+    
+    pair_resume_session_t *session = pair_resume_session_new();
+    memcpy(session->session_id, session_id, PAIR_RESUME_SESSION_ID_SIZE);
+    memcpy(session->secret, secret, PAIR_RESUME_SECRET_SIZE);
+    session->last_used = xTaskGetTickCount();
+    session->pairing_id = pairing_id;
+    session->permissions = permissions;
+    session->active = true;
+}
+
 
 client_context_t *client_context_new() {
     client_context_t *c = calloc(1, sizeof(client_context_t));
@@ -376,19 +716,103 @@ client_context_t *client_context_new() {
 }
 
 
+// Request scoped memory. Allocations come from arena owned by one client at a time,
+// or from heap blocks of that client, and all of them are released by request_reset().
+// Allocations are aligned to pointer size, which is 4 on device and 8 on host build.
+#define request_align(size)     (((size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+static void *request_alloc(client_context_t *context, size_t size) {
+    if (!homekit_server->request_arena_owner || homekit_server->request_arena_owner == context) {
+        if (homekit_server->request_arena_used + request_align(size) <= HOMEKIT_REQUEST_ARENA_SIZE) {
+            homekit_server->request_arena_owner = context;
+            homekit_server->request_arena_last = homekit_server->request_arena_used;
+            homekit_server->request_arena_used += request_align(size);
+            return homekit_server->request_arena + homekit_server->request_arena_last;
+        }
+    }
+    
+    request_spill_t *spill = malloc(sizeof(request_spill_t) + size);
+    if (!spill) {
+        return NULL;
+    }
+    
+    spill->next = context->request_spill;
+    context->request_spill = spill;
+    
+    return spill->data;
+}
+
+static void *request_realloc(client_context_t *context, void *ptr, size_t old_size, size_t size) {
+    if (!ptr) {
+        return request_alloc(context, size);
+    }
+    
+    if (homekit_server->request_arena_owner == context &&
+        ptr == homekit_server->request_arena + homekit_server->request_arena_last) {
+        if (homekit_server->request_arena_last + request_align(size) <= HOMEKIT_REQUEST_ARENA_SIZE) {
+            homekit_server->request_arena_used = homekit_server->request_arena_last + request_align(size);
+            return ptr;
+        }
+        
+    } else if (context->request_spill && ptr == context->request_spill->data) {
+        request_spill_t *spill = realloc(context->request_spill, sizeof(request_spill_t) + size);
+        if (!spill) {
+            return NULL;
+        }
+        
+        context->request_spill = spill;
+        return spill->data;
+    }
+    
+    void *new_ptr = request_alloc(context, size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, old_size);
+    }
+    
+    return new_ptr;
+}
+
+static char *request_strndup(client_context_t *context, const char *s, size_t size) {
+    char *copy = request_alloc(context, size + 1);
+    if (copy) {
+        memcpy(copy, s, size);
+        copy[size] = 0;
+    }
+    
+    return copy;
+}
+
+static void *request_params_alloc(size_t size, void *arg) {
+    return request_alloc(arg, size);
+}
+
+static void request_reset(client_context_t *context) {
+    if (homekit_server->request_arena_owner == context) {
+        homekit_server->request_arena_owner = NULL;
+        homekit_server->request_arena_used = 0;
+        homekit_server->request_arena_last = 0;
+    }
+    
+    while (context->request_spill) {
+        request_spill_t *spill = context->request_spill;
+        context->request_spill = spill->next;
+        free(spill);
+    }
+    
+    context->endpoint_params = NULL;
+    context->body = NULL;
+    context->body_length = 0;
+}
+
 void client_context_free(client_context_t *c) {
     if (c->verify_context)
         pair_verify_context_free(&c->verify_context);
     
-    if (c->endpoint_params)
-        query_params_free(c->endpoint_params);
+    request_reset(c);
     
     if (c->parser)
         free(c->parser);
     
-    if (c->body)
-        free(c->body);
-    
     free(c);
 }
 
@@ -413,43 +837,354 @@ void pairing_context_free(pairing_context_t *context) {
     free(context);
 }
 
-static int homekit_low_dram() {
-    const uint_fast32_t free_heap = xPortGetFreeHeapSize();
-    if (free_heap < HOMEKIT_MIN_FREEHEAP) {
-        HOMEKIT_ERROR("DRAM Free HEAP %"HK_LONGINT_F, free_heap);
-        return true;
-    }
-    
-    return false;
-}
+// Generates salt, verifier and server key pair. It only depends on setup code,
+// so it can be done before Pair Setup M1 arrives
+static int pairing_context_srp_init(pairing_context_t *pairing_context) {
+    int r = crypto_srp_init(pairing_context->srp, "Pair-Setup", "021-82-017");
+    if (r) {
+        return r;
+    }
+    
+    if (pairing_context->public_key) {
+        free(pairing_context->public_key);
+        pairing_context->public_key = NULL;
+    }
+    pairing_context->public_key_size = 0;
+    crypto_srp_get_public_key(pairing_context->srp, NULL, &pairing_context->public_key_size);
+    
+    pairing_context->public_key = malloc(pairing_context->public_key_size);
+    if (!pairing_context->public_key) {
+        return -1;
+    }
+    
+    return crypto_srp_get_public_key(pairing_context->srp, pairing_context->public_key, &pairing_context->public_key_size);
+}
+
+#if HOMEKIT_SRP_PRECOMPUTE > 0
+static void srp_precompute() {
+    pairing_context_t *pairing_context = pairing_context_new();
+    if (!pairing_context) {
+        return;
+    }
+    
+    int r = pairing_context_srp_init(pairing_context);
+    if (r) {
+        ERROR("SRP precompute (%d)", r);
+        pairing_context_free(pairing_context);
+        return;
+    }
+    
+    homekit_server->srp_precomputed = pairing_context;
+}
+#endif // HOMEKIT_SRP_PRECOMPUTE
+
+static int homekit_low_dram() {
+    const uint_fast32_t free_heap = xPortGetFreeHeapSize();
+    if (free_heap < HOMEKIT_MIN_FREEHEAP) {
+        HOMEKIT_ERROR("DRAM Free HEAP %"HK_LONGINT_F, free_heap);
+        return true;
+    }
+    
+    return false;
+}
+
+void homekit_disconnect_client(client_context_t* context) {
+    context->disconnect = true;
+    homekit_server->pending_close = true;
+}
+
+// Clients subscribed to events of any characteristic
+static uint32_t homekit_server_subscribed_clients() {
+    uint32_t clients = 0;
+    for (unsigned int ordinal = 1; ordinal <= homekit_server->notify_count; ordinal++) {
+        clients |= homekit_characteristic_by_ordinal(ordinal)->subscriptions;
+    }
+    
+    return clients;
+}
+
+// Chosen by client_eviction_candidate(). Client doing Pair Setup, keep and clients already
+// disconnecting are never evicted.
+static client_context_t *homekit_server_eviction_candidate(const client_context_t *keep) {
+    unsigned int count = 0;
+    for (client_context_t *context = homekit_server->clients; context; context = context->next) {
+        count++;
+    }
+    
+    if (!count) {
+        return NULL;
+    }
+    
+    const uint32_t subscribed = homekit_server_subscribed_clients();
+    client_eviction_t clients[count];
+    
+    unsigned int i = 0;
+    for (client_context_t *context = homekit_server->clients; context; context = context->next, i++) {
+        clients[i].last_activity = context->last_activity;
+        clients[i].verified = context->encrypted;
+        clients[i].subscribed = (subscribed & (1U << context->slot)) != 0;
+        clients[i].pinned = context == keep || context->disconnect ||
+            (homekit_server->pairing_context && homekit_server->pairing_context->client == context);
+    }
+    
+    int candidate = client_eviction_candidate(clients, count);
+    if (candidate < 0) {
+        return NULL;
+    }
+    
+    client_context_t *context = homekit_server->clients;
+    while (candidate--) {
+        context = context->next;
+    }
+    
+    return context;
+}
+
+// Only max_clients can take server below HOMEKIT_MIN_CLIENTS
+static bool homekit_server_evict_client(const client_context_t *keep, const unsigned int reason) {
+    if (reason != HOMEKIT_CLIENT_EVICTION_MAX_CLIENTS && homekit_server->client_count <= HOMEKIT_MIN_CLIENTS) {
+        return false;
+    }
+    
+    client_context_t *context = homekit_server_eviction_candidate(keep);
+    if (!context) {
+        return false;
+    }
+    
+    CLIENT_INFO(context, "Evicting (%i) idle %"HK_LONGINT_F" ms", reason,
+                (uint_fast32_t) ((xTaskGetTickCount() - context->last_activity) * portTICK_PERIOD_MS));
+    homekit_server->client_evictions[reason]++;
+    homekit_disconnect_client(context);
+    
+    return true;
+}
+
+// Client list is only walked by server task, so other tasks leave a request
+void IRAM homekit_remove_oldest_client() {
+    if (homekit_server) {
+        homekit_server->evict_requested = true;
+        homekit_server_wakeup();
+    }
+}
+
+void homekit_get_client_eviction_stats(uint32_t evictions[HOMEKIT_CLIENT_EVICTION_REASONS], uint32_t *refused) {
+    for (unsigned int i = 0; i < HOMEKIT_CLIENT_EVICTION_REASONS; i++) {
+        evictions[i] = homekit_server ? homekit_server->client_evictions[i] : 0;
+    }
+    
+    *refused = homekit_server ? homekit_server->clients_refused : 0;
+}
+
+// Heap taken by a client through a Pair Verify and its send queue, admitting it only if it fits
+static inline uint32_t homekit_client_heap_cost() {
+    return sizeof(client_context_t) + sizeof(http_parser) + sizeof(pair_verify_context_t) + PAIR_VERIFY_KEYS_SIZE
+           + HOMEKIT_CLIENT_NETWORK_COST + (HOMEKIT_SEND_QUEUE_CLIENT_SIZE / 2);
+}
+
+
+typedef enum {
+    characteristic_format_type   = (1 << 1),
+    characteristic_format_meta   = (1 << 2),
+    characteristic_format_perms  = (1 << 3),
+    characteristic_format_events = (1 << 4),
+#ifdef HOMEKIT_ACCESSORIES_TEMPLATE
+    characteristic_format_template = (1 << 5),
+#endif
+} characteristic_format_t;
+
+#ifdef HOMEKIT_ACCESSORIES_TEMPLATE
+// Pre-serialized "GET /accessories" document. Everything is immutable after
+// homekit_accessories_init() except characteristic values and client "ev" flags,
+// so only those are rendered per request, at slots placed in static JSON text.
+typedef struct {
+    uint32_t offset: 31;
+    bool events: 1;
+    homekit_characteristic_t *ch;
+} accessories_template_slot_t;
+
+typedef struct _accessories_template {
+    char *data;
+    size_t size;
+    
+    accessories_template_slot_t *slots;
+    unsigned int slot_count;
+} accessories_template_t;
+
+#define ACCESSORIES_TEMPLATE_SLOTS_STEP     (16)
+
+static int accessories_template_append(byte *data, size_t size, void *arg) {
+    accessories_template_t *template = arg;
+    
+    char *new_data = realloc(template->data, template->size + size);
+    if (!new_data) {
+        return -1;
+    }
+    
+    template->data = new_data;
+    memcpy(template->data + template->size, data, size);
+    template->size += size;
+    
+    return 0;
+}
+
+static void accessories_template_add_slot(json_stream *json, const homekit_characteristic_t *ch, const bool events) {
+    accessories_template_t *template = json->context;
+    
+    if (json->error) {
+        return;
+    }
+    
+    if (template->slot_count % ACCESSORIES_TEMPLATE_SLOTS_STEP == 0) {
+        accessories_template_slot_t *new_slots = realloc(template->slots, sizeof(accessories_template_slot_t) * (template->slot_count + ACCESSORIES_TEMPLATE_SLOTS_STEP));
+        if (!new_slots) {
+            json->error = true;
+            return;
+        }
+        
+        template->slots = new_slots;
+    }
+    
+    accessories_template_slot_t *slot = &template->slots[template->slot_count++];
+    slot->offset = template->size + json->pos;
+    slot->events = events;
+    slot->ch = (homekit_characteristic_t*) ch;
+}
+
+static void accessories_template_free(accessories_template_t *template) {
+    if (template->data) {
+        free(template->data);
+    }
+    
+    if (template->slots) {
+        free(template->slots);
+    }
+    
+    free(template);
+}
+#endif // HOMEKIT_ACCESSORIES_TEMPLATE
+
+
+void write_characteristic_value_json(json_stream *json, const homekit_characteristic_t *ch, const homekit_value_t *value) {
+    homekit_value_t v = value ? *value : ch->getter_ex ? ch->getter_ex(ch) : ch->value;
+    
+    if (v.is_null) {
+        json_string(json, "value"); json_null(json);
+    } else if (v.format != ch->format) {
+        HOMEKIT_ERROR("Ch value format is different from ch format");
+    } else {
+        switch(v.format) {
+            case HOMEKIT_FORMAT_BOOL: {
+                json_string(json, "value"); json_boolean(json, v.bool_value);
+                break;
+            }
+            case HOMEKIT_FORMAT_UINT8:
+            case HOMEKIT_FORMAT_UINT16:
+            case HOMEKIT_FORMAT_UINT32:
+            case HOMEKIT_FORMAT_UINT64:
+            case HOMEKIT_FORMAT_INT: {
+                if (ch->max_value) {
+                    int max_value = (int) *ch->max_value;
+                    if (v.int_value > max_value) {
+                        v.int_value = max_value;
+                    }
+                }
+                
+                if (ch->min_value) {
+                    int min_value = (int) *ch->min_value;
+                    if (v.int_value < min_value) {
+                        v.int_value = min_value;
+                    }
+                }
+                
+                json_string(json, "value"); json_integer(json, v.int_value);
+                break;
+            }
+            case HOMEKIT_FORMAT_FLOAT: {
+                // Check for 'nan' float value
+                if (v.float_value != v.float_value) {
+                    v.float_value = 0;
+                }
+                
+                if (ch->max_value) {
+                    int max_value = (int) *ch->max_value;
+                    if (v.float_value > max_value) {
+                        v.float_value = max_value;
+                    }
+                }
+                
+                if (ch->min_value) {
+                    int min_value = (int) *ch->min_value;
+                    if (v.float_value < min_value) {
+                        v.float_value = min_value;
+                    }
+                }
+                
+                json_string(json, "value"); json_float(json, v.float_value);
+                break;
+            }
+            case HOMEKIT_FORMAT_STRING: {
+                json_string(json, "value"); json_string(json, v.string_value);
+                break;
+            }
+            case HOMEKIT_FORMAT_TLV: {
+                json_string(json, "value");
+                if (!v.tlv_values) {
+                    json_string(json, "");
+                } else {
+                    size_t tlv_size = 0;
+                    tlv_format(v.tlv_values, NULL, &tlv_size);
+                    if (tlv_size == 0) {
+                        json_string(json, "");
+                    } else {
+                        byte *tlv_data = malloc(tlv_size);
+                        tlv_format(v.tlv_values, tlv_data, &tlv_size);
+
+                        size_t encoded_tlv_size = base64_encoded_size(tlv_data, tlv_size);
+                        byte *encoded_tlv_data = malloc(encoded_tlv_size + 1);
+                        base64_encode(tlv_data, tlv_size, encoded_tlv_data);
+                        encoded_tlv_data[encoded_tlv_size] = 0;
 
-void homekit_disconnect_client(client_context_t* context) {
-    context->disconnect = true;
-    homekit_server->pending_close = true;
-}
+                        json_string(json, (char*) encoded_tlv_data);
 
-void IRAM homekit_remove_oldest_client() {
-    if (homekit_server && homekit_server->client_count > HOMEKIT_MIN_CLIENTS) {
-        client_context_t* context = homekit_server->clients;
-        while (context) {
-            if (!context->next) {
-                CLIENT_INFO(context, "Closing oldest");
-                homekit_disconnect_client(context);
+                        free(encoded_tlv_data);
+                        free(tlv_data);
+                    }
+                }
+                break;
             }
-            
-            context = context->next;
+            case HOMEKIT_FORMAT_DATA:
+                json_string(json, "value");
+                if (!v.data_value || v.data_size == 0) {
+                    json_string(json, "");
+                } else {
+                    size_t encoded_data_size = base64_encoded_size(v.data_value, v.data_size);
+                    byte* encoded_data = malloc(encoded_data_size + 1);
+                    if (!encoded_data) {
+                        HOMEKIT_ERROR("Allocate %d bytes for encoding", encoded_data_size + 1);
+                        json_string(json, "");
+                        break;
+                    }
+                    base64_encode(v.data_value, v.data_size, encoded_data);
+                    encoded_data[encoded_data_size] = 0;
+
+                    json_string(json, (char*) encoded_data);
+                    
+                    free(encoded_data);
+                }
+                break;
         }
     }
-}
 
+    if (!value && ch->getter_ex) {
+        // called getter to get value, need to free it
+        homekit_value_destruct(&v);
+    }
+}
 
-typedef enum {
-    characteristic_format_type   = (1 << 1),
-    characteristic_format_meta   = (1 << 2),
-    characteristic_format_perms  = (1 << 3),
-    characteristic_format_events = (1 << 4),
-} characteristic_format_t;
-
+void write_characteristic_events_json(json_stream *json, client_context_t *client, const homekit_characteristic_t *ch) {
+    json_string(json, "ev");
+    json_boolean(json, homekit_characteristic_has_notify_subscription(ch, client->slot));
+}
 
 void write_characteristic_json(json_stream *json, client_context_t *client, const homekit_characteristic_t *ch, characteristic_format_t format, const homekit_value_t *value, const uint16_t override_aid) {
     json_string(json, "aid");
@@ -484,9 +1219,14 @@ void write_characteristic_json(json_stream *json, client_context_t *client, cons
     }
 
     if ((format & characteristic_format_events) && (ch->permissions & HOMEKIT_PERMISSIONS_NOTIFY)) {
-        int events = homekit_characteristic_has_notify_subscription(ch, client);
-        json_string(json, "ev");
-        json_boolean(json, events);
+#ifdef HOMEKIT_ACCESSORIES_TEMPLATE
+        if (format & characteristic_format_template) {
+            accessories_template_add_slot(json, ch, true);
+        } else
+#endif
+        {
+            write_characteristic_events_json(json, client, ch);
+        }
     }
 
     if (format & characteristic_format_meta) {
@@ -576,162 +1316,103 @@ void write_characteristic_json(json_stream *json, client_context_t *client, cons
     }
     
     if (ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ) {
-        homekit_value_t v = value ? *value : ch->getter_ex ? ch->getter_ex(ch) : ch->value;
-        
-        if (v.is_null) {
-            json_string(json, "value"); json_null(json);
-        } else if (v.format != ch->format) {
-            HOMEKIT_ERROR("Ch value format is different from ch format");
-        } else {
-            switch(v.format) {
-                case HOMEKIT_FORMAT_BOOL: {
-                    json_string(json, "value"); json_boolean(json, v.bool_value);
-                    break;
-                }
-                case HOMEKIT_FORMAT_UINT8:
-                case HOMEKIT_FORMAT_UINT16:
-                case HOMEKIT_FORMAT_UINT32:
-                case HOMEKIT_FORMAT_UINT64:
-                case HOMEKIT_FORMAT_INT: {
-                    if (ch->max_value) {
-                        int max_value = (int) *ch->max_value;
-                        if (v.int_value > max_value) {
-                            v.int_value = max_value;
-                        }
-                    }
-                    
-                    if (ch->min_value) {
-                        int min_value = (int) *ch->min_value;
-                        if (v.int_value < min_value) {
-                            v.int_value = min_value;
-                        }
-                    }
-                    
-                    json_string(json, "value"); json_integer(json, v.int_value);
-                    break;
-                }
-                case HOMEKIT_FORMAT_FLOAT: {
-                    // Check for 'nan' float value
-                    if (v.float_value != v.float_value) {
-                        v.float_value = 0;
-                    }
-                    
-                    if (ch->max_value) {
-                        int max_value = (int) *ch->max_value;
-                        if (v.float_value > max_value) {
-                            v.float_value = max_value;
-                        }
-                    }
-                    
-                    if (ch->min_value) {
-                        int min_value = (int) *ch->min_value;
-                        if (v.float_value < min_value) {
-                            v.float_value = min_value;
-                        }
-                    }
-                    
-                    json_string(json, "value"); json_float(json, v.float_value);
-                    break;
-                }
-                case HOMEKIT_FORMAT_STRING: {
-                    json_string(json, "value"); json_string(json, v.string_value);
-                    break;
-                }
-                case HOMEKIT_FORMAT_TLV: {
-                    json_string(json, "value");
-                    if (!v.tlv_values) {
-                        json_string(json, "");
-                    } else {
-                        size_t tlv_size = 0;
-                        tlv_format(v.tlv_values, NULL, &tlv_size);
-                        if (tlv_size == 0) {
-                            json_string(json, "");
-                        } else {
-                            byte *tlv_data = malloc(tlv_size);
-                            tlv_format(v.tlv_values, tlv_data, &tlv_size);
-
-                            size_t encoded_tlv_size = base64_encoded_size(tlv_data, tlv_size);
-                            byte *encoded_tlv_data = malloc(encoded_tlv_size + 1);
-                            base64_encode(tlv_data, tlv_size, encoded_tlv_data);
-                            encoded_tlv_data[encoded_tlv_size] = 0;
-
-                            json_string(json, (char*) encoded_tlv_data);
-
-                            free(encoded_tlv_data);
-                            free(tlv_data);
-                        }
-                    }
-                    break;
-                }
-                case HOMEKIT_FORMAT_DATA:
-                    json_string(json, "value");
-                    if (!v.data_value || v.data_size == 0) {
-                        json_string(json, "");
-                    } else {
-                        size_t encoded_data_size = base64_encoded_size(v.data_value, v.data_size);
-                        byte* encoded_data = malloc(encoded_data_size + 1);
-                        if (!encoded_data) {
-                            CLIENT_ERROR(client, "Allocate %d bytes for encoding", encoded_data_size + 1);
-                            json_string(json, "");
-                            break;
-                        }
-                        base64_encode(v.data_value, v.data_size, encoded_data);
-                        encoded_data[encoded_data_size] = 0;
-
-                        json_string(json, (char*) encoded_data);
-                        
-                        free(encoded_data);
-                    }
-                    break;
-            }
-        }
-
-        if (!value && ch->getter_ex) {
-            // called getter to get value, need to free it
-            homekit_value_destruct(&v);
+#ifdef HOMEKIT_ACCESSORIES_TEMPLATE
+        if (format & characteristic_format_template) {
+            accessories_template_add_slot(json, ch, false);
+        } else
+#endif
+        {
+            write_characteristic_value_json(json, ch, value);
         }
     }
 }
 
-static void network_delay(const uint32_t free_heap) {
-    if (free_heap < HOMEKIT_NETWORK_MIN_FREEHEAP) {
-        unsigned int max_count = HOMEKIT_NETWORK_PAUSE_COUNT;
-        if (free_heap < HOMEKIT_NETWORK_MIN_FREEHEAP_CRITIC) {
-            max_count = HOMEKIT_NETWORK_PAUSE_COUNT_CRITIC;
+// Sends queued frames while socket accepts data, without blocking
+static int client_send_queue_drain(client_context_t *context) {
+    while (context->send_queue) {
+        client_frame_t *frame = context->send_queue;
+        
+        int r = send(context->socket, frame->data + frame->sent, frame->size - frame->sent, MSG_DONTWAIT);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            
+            CLIENT_ERROR(context, "Payload");
+            return r;
         }
         
-        unsigned int count = 0;
-        while (free_heap > xPortGetFreeHeapSize() && count < max_count) {
-            count++;
-            //HOMEKIT_INFO("Net Delay %i", count);
-            vTaskDelay(1);
+        frame->sent += r;
+        if (frame->sent < frame->size) {
+            return 0;
         }
         
-    } else if (free_heap < HOMEKIT_NETWORK_FIRST_MIN_FREEHEAP) {
-        vTaskDelay(1);
+        context->send_queue = frame->next;
+        context->send_queue_size -= frame->size;
+        homekit_server->send_queue_size -= frame->size;
+        free(frame);
     }
+    
+    return 0;
 }
 
-int client_send_encrypted(client_context_t *context, byte *payload, size_t size) {
-    if (!context || !context->encrypted) {
+static int client_send_queue_push(client_context_t *context, const byte *data, const size_t size) {
+    client_frame_t *frame = malloc(sizeof(client_frame_t) + size);
+    if (!frame) {
+        CLIENT_ERROR(context, "Send queue DRAM");
         return -1;
     }
-
-    byte nonce[12];
-    memset(nonce, 0, sizeof(nonce));
     
-    size_t payload_offset = 0;
+    frame->next = NULL;
+    frame->size = size;
+    frame->sent = 0;
+    memcpy(frame->data, data, size);
     
-    while (payload_offset < size) {
-        size_t chunk_size = size - payload_offset;
-        if (chunk_size > sizeof(homekit_server->encrypted) - 16 - 2) {
-            chunk_size = sizeof(homekit_server->encrypted) - 16 - 2;
-        }
-        
-        byte aead[2] = {chunk_size % 256, chunk_size / 256};
+    client_frame_t **last = &context->send_queue;
+    while (*last) {
+        last = &(*last)->next;
+    }
+    *last = frame;
+    
+    context->send_queue_size += size;
+    homekit_server->send_queue_size += size;
+    
+    return 0;
+}
+
+static void client_send_queue_free(client_context_t *context) {
+    while (context->send_queue) {
+        client_frame_t *frame = context->send_queue;
+        context->send_queue = frame->next;
+        homekit_server->send_queue_size -= frame->size;
+        free(frame);
+    }
+    
+    context->send_queue_size = 0;
+}
 
-        memcpy(homekit_server->encrypted, aead, 2);
+// Plaintext is staged in data buffer, after the 2 bytes AAD length, and encrypted in place
+#define FRAME_PAYLOAD_SIZE      (sizeof(homekit_server->data) - 16 - 2)
 
+// Server task never waits for a client: any error, or a send queue overflow, disconnects it
+static int client_send_frame(client_context_t *context) {
+    size_t size = homekit_server->frame_size;
+    homekit_server->frame_size = 0;
+    
+    if (context->disconnect) {
+        return -1;
+    }
+    
+    if (!size) {
+        return 0;
+    }
+    
+    byte *frame = homekit_server->data + 2;
+    
+    if (context->encrypted) {
+        byte nonce[12];
+        memset(nonce, 0, sizeof(nonce));
+        
         byte i = 4;
         int x = context->count_reads++;
         while (x) {
@@ -739,50 +1420,113 @@ int client_send_encrypted(client_context_t *context, byte *payload, size_t size)
             x /= 256;
         }
         
-        size_t available = sizeof(homekit_server->encrypted) - 2;
-        int r = crypto_chacha20poly1305_encrypt(
+        byte *aead = homekit_server->data;
+        aead[0] = size % 256;
+        aead[1] = size / 256;
+        
+        int r = crypto_chacha20poly1305_encrypt_in_place(
             context->read_key, nonce, aead, 2,
-            payload + payload_offset, chunk_size,
-            homekit_server->encrypted + 2, &available
+            frame, size, frame + size
         );
         if (r) {
             CLIENT_ERROR(context, "Enc payload (%d)", r);
+            homekit_disconnect_client(context);
             return -1;
         }
         
-        payload_offset += chunk_size;
-        
-        const uint_fast32_t free_heap = xPortGetFreeHeapSize();
-        
-        r = write(context->socket, homekit_server->encrypted, available + 2);
-        
+        frame = aead;
+        size += 2 + 16;
+    }
+    
+    // Frames must go out in order, so socket is written directly only when nothing is left queued
+    if (context->send_queue && client_send_queue_drain(context) < 0) {
+        homekit_disconnect_client(context);
+        return -1;
+    }
+    
+    if (!context->send_queue) {
+        int r = send(context->socket, frame, size, MSG_DONTWAIT);
         if (r < 0) {
-            CLIENT_ERROR(context, "Payload");
-            return r;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                CLIENT_ERROR(context, "Payload");
+                homekit_disconnect_client(context);
+                return r;
+            }
+            
+            r = 0;
         }
         
-        network_delay(free_heap);
+        frame += r;
+        size -= r;
     }
-
+    
+    if (size > 0) {
+        if (context->send_queue_size + size > HOMEKIT_SEND_QUEUE_CLIENT_MAX ||
+            xPortGetFreeHeapSize() < HOMEKIT_MIN_FREEHEAP + size ||
+            client_send_queue_push(context, frame, size) < 0) {
+            CLIENT_ERROR(context, "Send queue overflow %i", context->send_queue_size);
+            homekit_disconnect_client(context);
+            return -1;
+        }
+    }
+    
     return 0;
 }
 
+// Sends data staged by client_send_buffered()
+static int client_send_flush(client_context_t *context) {
+    if (!context || homekit_server->frame_context != context) {
+        return 0;
+    }
+    
+    homekit_server->frame_context = NULL;
+    
+    return client_send_frame(context);
+}
 
-int client_decrypt(client_context_t *context, byte *payload, size_t payload_size, byte *decrypted, size_t *decrypted_size) {
-    if (!context || !context->encrypted)
-        return -1;
-
-    const size_t block_size = 1024 + 16 + 2;
-    size_t required_decrypted_size = payload_size / block_size * 1024;
-    if (payload_size % block_size > 0)
-        required_decrypted_size += payload_size % block_size - 16 - 2;
+// Stages data to be sent in full frames, so small writes of a response share the same frame and write()
+static int client_send_buffered(client_context_t *context, const byte *data, size_t size) {
+    if (homekit_server->frame_context != context) {
+        client_send_flush(homekit_server->frame_context);
+        homekit_server->frame_context = context;
+    }
     
-    if (*decrypted_size < required_decrypted_size) {
-        *decrypted_size = required_decrypted_size;
-        return -2;
+    while (size > 0) {
+        size_t chunk_size = FRAME_PAYLOAD_SIZE - homekit_server->frame_size;
+        if (chunk_size > size) {
+            chunk_size = size;
+        }
+        
+        memcpy(homekit_server->data + 2 + homekit_server->frame_size, data, chunk_size);
+        homekit_server->frame_size += chunk_size;
+        data += chunk_size;
+        size -= chunk_size;
+        
+        if (homekit_server->frame_size == FRAME_PAYLOAD_SIZE) {
+            int r = client_send_frame(context);
+            if (r < 0) {
+                homekit_server->frame_context = NULL;
+                return r;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+// Staged data of a closing client is discarded
+static void client_send_discard(client_context_t *context) {
+    if (homekit_server->frame_context == context) {
+        homekit_server->frame_context = NULL;
+        homekit_server->frame_size = 0;
     }
+}
+
 
-    *decrypted_size = required_decrypted_size;
+// Frames are decrypted in place, and their plaintexts are joined at payload + 2
+int client_decrypt(client_context_t *context, byte *payload, size_t payload_size, size_t *decrypted_size) {
+    if (!context || !context->encrypted)
+        return -1;
 
     byte nonce[12];
     memset(nonce, 0, sizeof(nonce));
@@ -790,7 +1534,7 @@ int client_decrypt(client_context_t *context, byte *payload, size_t payload_size
     size_t payload_offset = 0;
     size_t decrypted_offset = 0;
 
-    while (payload_offset < payload_size) {
+    while (payload_offset + 2 + 16 <= payload_size) {
         size_t chunk_size = payload[payload_offset] + payload[payload_offset + 1] * 256;
         if (chunk_size+18 > payload_size-payload_offset) {
             // Unfinished chunk
@@ -804,21 +1548,26 @@ int client_decrypt(client_context_t *context, byte *payload, size_t payload_size
             x /= 256;
         }
 
-        size_t decrypted_len = *decrypted_size - decrypted_offset;
-        int r = crypto_chacha20poly1305_decrypt(
+        byte *chunk = payload + payload_offset + 2;
+        int r = crypto_chacha20poly1305_decrypt_in_place(
             context->write_key, nonce, payload + payload_offset, 2,
-            payload + payload_offset + 2, chunk_size + 16,
-            decrypted, &decrypted_len
+            chunk, chunk_size, chunk + chunk_size
         );
         if (r) {
             CLIENT_ERROR(context, "Decrypt payload (%d)", r);
             return -1;
         }
 
-        decrypted_offset += decrypted_len;
+        if (payload + 2 + decrypted_offset != chunk) {
+            memmove(payload + 2 + decrypted_offset, chunk, chunk_size);
+        }
+
+        decrypted_offset += chunk_size;
         payload_offset += chunk_size + 18;
     }
 
+    *decrypted_size = decrypted_offset;
+
     return payload_offset;
 }
 
@@ -835,16 +1584,9 @@ int client_send(client_context_t *context, byte *data, size_t data_size) {
     }
 #endif
 
-    int r = -1;
-    
-    if (context->encrypted) {
-        r = client_send_encrypted(context, data, data_size);
-    } else {
-        const uint_fast32_t free_heap = xPortGetFreeHeapSize();
-        
-        r = write(context->socket, data, data_size);
-        
-        network_delay(free_heap);
+    int r = client_send_buffered(context, data, data_size);
+    if (r == 0) {
+        r = client_send_flush(context);
     }
     
     if (r < 0) {
@@ -856,23 +1598,83 @@ int client_send(client_context_t *context, byte *data, size_t data_size) {
 }
 
 
+// JSON of a response is written straight into staging, after room for its chunk size line
+#define CHUNK_HEADER_SIZE       (5)     // "400\r\n", a chunk is never bigger than a frame
+#define CHUNK_MIN_SIZE          (128)
+
+static int client_json_reserve(client_context_t *context) {
+    int r = 0;
+    if (homekit_server->frame_size + CHUNK_HEADER_SIZE + CHUNK_MIN_SIZE + 2 > FRAME_PAYLOAD_SIZE) {
+        r = client_send_frame(context);
+        if (r < 0) {
+            homekit_server->frame_context = NULL;
+        }
+    }
+    
+    json_stream *json = &homekit_server->json;
+    json->buffer = homekit_server->data + 2 + homekit_server->frame_size + CHUNK_HEADER_SIZE;
+    json->size = FRAME_PAYLOAD_SIZE - homekit_server->frame_size - CHUNK_HEADER_SIZE - 2;
+    
+    return r;
+}
+
+// Response headers must be already staged
+static json_stream *client_json_init(client_context_t *context) {
+    json_stream *json = &homekit_server->json;
+    json_init(json, context);
+    json->on_flush = client_send_chunk;
+    
+    if (homekit_server->frame_context != context) {
+        client_send_flush(homekit_server->frame_context);
+        homekit_server->frame_context = context;
+    }
+    
+    if (client_json_reserve(context) < 0) {
+        json->error = true;
+    }
+    
+    return json;
+}
+
 int client_send_chunk(byte *data, size_t size, void *arg) {
     client_context_t* context = arg;
     
+    byte *staged = homekit_server->data + 2 + homekit_server->frame_size;
+    if (size > 0 && homekit_server->frame_context == context && data == staged + CHUNK_HEADER_SIZE) {
+        char header[CHUNK_HEADER_SIZE + 1];
+        int header_size = snprintf(header, sizeof(header), "%x\r\n", size);
+        
+        // Only chunks under 0x100 bytes have a shorter size line
+        if (header_size < CHUNK_HEADER_SIZE) {
+            memmove(staged + header_size, data, size);
+        }
+        
+        memcpy(staged, header, header_size);
+        staged[header_size + size] = '\r';
+        staged[header_size + size + 1] = '\n';
+        homekit_server->frame_size += header_size + size + 2;
+        
+        return client_json_reserve(context);
+    }
+    
     byte header[9];
     header[0] = 0;
     int header_size = snprintf((char*) header, sizeof(header), "%x\r\n", size);
     
-    int r = client_send(context, header, header_size);
+    int r = client_send_buffered(context, header, header_size);
     
     if (r == 0) {
         if (size > 0) {
             data[size] = '\r';
             data[size + 1] = '\n';
-            r = client_send(context, data, size + 2);
+            r = client_send_buffered(context, data, size + 2);
         } else {
+            // Last chunk
             byte end[2] = { '\r', '\n' };
-            r = client_send(context, end, sizeof(end));
+            r = client_send_buffered(context, end, sizeof(end));
+            if (r == 0) {
+                r = client_send_flush(context);
+            }
         }
     }
     
@@ -893,12 +1695,13 @@ int client_send_chunk(byte *data, size_t size, void *arg) {
      */
 }
 
+// Headers are sent in the same frame as first body chunk
 int send_200_response(client_context_t* context) {
     byte response[] =
         "HTTP/1.1 200 OK\r\n"
         "Content-Type: application/hap+json\r\n"
         "Transfer-Encoding: chunked\r\n\r\n";
-    return client_send(context, response, sizeof(response) - 1);
+    return client_send_buffered(context, response, sizeof(response) - 1);
 }
 
 void send_204_response(client_context_t* context) {
@@ -911,7 +1714,7 @@ int send_207_response(client_context_t* context) {
         "HTTP/1.1 207 Multi-Status\r\n"
         "Content-Type: application/hap+json\r\n"
         "Transfer-Encoding: chunked\r\n\r\n";
-    return client_send(context, response, sizeof(response) - 1);
+    return client_send_buffered(context, response, sizeof(response) - 1);
 }
 
 void send_404_response(client_context_t* context) {
@@ -921,70 +1724,44 @@ void send_404_response(client_context_t* context) {
     client_send(context, response, sizeof(response) - 1);
 }
 
-void send_tlv_response(client_context_t *context, tlv_values_t *values) {
-    CLIENT_DEBUG(context, "Sending TLV response");
-    TLV_DEBUG(values);
+#define TLV_RESPONSE_HEADERS_SIZE       (96)
 
-    size_t payload_size = 0;
-    tlv_format(values, NULL, &payload_size);
+// TLV response is written in request arena, after room for its HTTP headers
+static void tlv_response_init(client_context_t *context, tlv_writer_t *response, size_t payload_size) {
+    byte *buffer = request_alloc(context, TLV_RESPONSE_HEADERS_SIZE + payload_size);
+    tlv_writer_init(response, buffer ? buffer + TLV_RESPONSE_HEADERS_SIZE : NULL, payload_size);
+}
 
-    byte *payload = malloc(payload_size);
+void send_tlv_response(client_context_t *context, tlv_writer_t *response) {
+    CLIENT_DEBUG(context, "Sending TLV response");
     
-    if (!payload) {
-        CLIENT_ERROR(context, "TLV payload DRAM");
-        tlv_free(values);
+    if (response->error) {
+        CLIENT_ERROR(context, "TLV response DRAM");
         homekit_remove_oldest_client();
         return;
     }
     
-    int r = tlv_format(values, payload, &payload_size);
-    if (r) {
-        CLIENT_ERROR(context, "TLV format (%d)", r);
-        free(payload);
-        return;
-    }
-    
-    tlv_free(values);
-    
     const char http_headers[] =
         "HTTP/1.1 200 OK\r\n"
         "Content-Type: application/pairing+tlv8\r\n"
         "Content-Length: %d\r\n\r\n";
     
-    size_t response_size = strlen(http_headers) + payload_size + 32;
-    char *response = malloc(response_size);
-    
-    if (!response) {
-        CLIENT_ERROR(context, "TLV response DRAM");
-        free(payload);
-        homekit_remove_oldest_client();
-        return;
-    }
-    
-    size_t response_len = snprintf(response, response_size, http_headers, payload_size);
-
-    if (response_size - response_len < payload_size + 1) {
-        CLIENT_ERROR(context, "Buffer size %d: headers took %d, payload size %d", response_size, response_len, payload_size);
-        free(response);
-        free(payload);
-        return;
-    }
-    memcpy(response + response_len, payload, payload_size);
-    free(payload);
+    char headers[TLV_RESPONSE_HEADERS_SIZE];
+    size_t headers_len = snprintf(headers, sizeof(headers), http_headers, response->pos);
     
-    response_len += payload_size;
+    byte *data = response->buffer - headers_len;
+    memcpy(data, headers, headers_len);
     
-    client_send(context, (byte*) response, response_len);
-
-    free(response);
+    client_send(context, data, headers_len + response->pos);
 }
 
 void send_tlv_error_response(client_context_t *context, int state, TLVError error) {
-    tlv_values_t *response = tlv_new();
-    tlv_add_integer_value(response, TLVType_State, 1, state);
-    tlv_add_integer_value(response, TLVType_Error, 1, error);
+    tlv_writer_t response;
+    tlv_response_init(context, &response, TLV_ENCODED_SIZE(1) * 2);
+    tlv_write_integer(&response, TLVType_State, 1, state);
+    tlv_write_integer(&response, TLVType_Error, 1, error);
 
-    send_tlv_response(context, response);
+    send_tlv_response(context, &response);
 }
 
 void send_json_response(client_context_t *context, int status_code, byte *payload, size_t payload_size) {
@@ -1103,29 +1880,28 @@ void homekit_server_on_identify(client_context_t *context) {
     }
 }
 
-void homekit_server_on_pair_setup(client_context_t *context, const byte *data, size_t size) {
+void homekit_server_on_pair_setup(client_context_t *context, byte *data, size_t size) {
     homekit_server->is_pairing = true;
     
     HOMEKIT_DEBUG_LOG("Pair Setup");
     DEBUG_HEAP();
 
-    tlv_values_t *message = tlv_new();
-    if (tlv_parse(data, size, message)) {
+    tlv_view_t message;
+    if (tlv_view_parse(data, size, &message)) {
         CLIENT_ERROR(context, "TLV");
-        tlv_free(message);
         send_tlv_error_response(context, 2, TLVError_Unknown);
         homekit_server->is_pairing = false;
         return;
     }
     
-    TLV_DEBUG(message);
+    TLV_DEBUG(&message);
     
 #ifdef HOMEKIT_OVERCLOCK_PAIR_SETUP
     sdk_system_overclock();
     HOMEKIT_DEBUG_LOG("CPU overclock");
 #endif // HOMEKIT_OVERCLOCK_PAIR_SETUP
     
-    switch(tlv_get_integer_value(message, TLVType_State, -1)) {
+    switch(tlv_view_get_integer(&message, TLVType_State, -1)) {
         case 1: {
             CLIENT_INFO(context, "Pairing 1/3");
             DEBUG_HEAP();
@@ -1135,34 +1911,37 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 break;
             }
 
+            int r = 0;
             if (homekit_server->pairing_context) {
                 if (homekit_server->pairing_context->client != context) {
                     CLIENT_INFO(context, "Another pairing in progress");
                     send_tlv_error_response(context, 2, TLVError_Busy);
                     break;
                 }
+                
+                CLIENT_DEBUG(context, "Initializing crypto");
+                DEBUG_HEAP();
+                
+                // Same client starts again, so it gets new keys
+                r = pairing_context_srp_init(homekit_server->pairing_context);
+                
             } else {
-                homekit_server->pairing_context = pairing_context_new();
+#if HOMEKIT_SRP_PRECOMPUTE > 0
+                homekit_server->pairing_context = homekit_server->srp_precomputed;
+                homekit_server->srp_precomputed = NULL;
+#endif
+                
+                if (!homekit_server->pairing_context) {
+                    CLIENT_DEBUG(context, "Initializing crypto");
+                    DEBUG_HEAP();
+                    
+                    homekit_server->pairing_context = pairing_context_new();
+                    r = pairing_context_srp_init(homekit_server->pairing_context);
+                }
+                
                 homekit_server->pairing_context->client = context;
             }
             
-            CLIENT_DEBUG(context, "Initializing crypto");
-            DEBUG_HEAP();
-            
-            crypto_srp_init(
-                homekit_server->pairing_context->srp,
-                "Pair-Setup", "021-82-017"
-            );
-            
-            if (homekit_server->pairing_context->public_key) {
-                free(homekit_server->pairing_context->public_key);
-                homekit_server->pairing_context->public_key = NULL;
-            }
-            homekit_server->pairing_context->public_key_size = 0;
-            crypto_srp_get_public_key(homekit_server->pairing_context->srp, NULL, &homekit_server->pairing_context->public_key_size);
-
-            homekit_server->pairing_context->public_key = malloc(homekit_server->pairing_context->public_key_size);
-            int r = crypto_srp_get_public_key(homekit_server->pairing_context->srp, homekit_server->pairing_context->public_key, &homekit_server->pairing_context->public_key_size);
             if (r) {
                 CLIENT_ERROR(context, "SPR key (%d). DRAM?", r);
 
@@ -1173,16 +1952,15 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 break;
             }
             
-            size_t salt_size = 16;
+            byte salt[16];
+            size_t salt_size = sizeof(salt);
             //size_t salt_size = 0;
             //crypto_srp_get_salt(homekit_server->pairing_context->srp, NULL, &salt_size);
             
-            byte *salt = malloc(salt_size);
             r = crypto_srp_get_salt(homekit_server->pairing_context->srp, salt, &salt_size);
             if (r) {
                 CLIENT_ERROR(context, "Get salt (%d)", r);
 
-                free(salt);
                 pairing_context_free(homekit_server->pairing_context);
                 homekit_server->pairing_context = NULL;
 
@@ -1190,13 +1968,17 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 break;
             }
             
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 2);
-            tlv_add_value(response, TLVType_PublicKey, homekit_server->pairing_context->public_key, homekit_server->pairing_context->public_key_size);
-            tlv_add_value(response, TLVType_Salt, salt, salt_size);
-            free(salt);
+            tlv_writer_t response;
+            tlv_response_init(context, &response,
+                TLV_ENCODED_SIZE(1) +
+                TLV_ENCODED_SIZE(homekit_server->pairing_context->public_key_size) +
+                TLV_ENCODED_SIZE(salt_size)
+            );
+            tlv_write_integer(&response, TLVType_State, 1, 2);
+            tlv_write(&response, TLVType_PublicKey, homekit_server->pairing_context->public_key, homekit_server->pairing_context->public_key_size);
+            tlv_write(&response, TLVType_Salt, salt, salt_size);
             
-            send_tlv_response(context, response);
+            send_tlv_response(context, &response);
             
             CLIENT_INFO(context, "Done 1/3");
             break;
@@ -1205,14 +1987,14 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
         case 3: {
             CLIENT_INFO(context, "Pairing 2/3");
             DEBUG_HEAP();
-            tlv_t *device_public_key = tlv_get_value(message, TLVType_PublicKey);
+            const tlv_item_t *device_public_key = tlv_view_get(&message, TLVType_PublicKey);
             if (!device_public_key) {
                 CLIENT_ERROR(context, "No pub key");
                 send_tlv_error_response(context, 4, TLVError_Authentication);
                 break;
             }
 
-            tlv_t *proof = tlv_get_value(message, TLVType_Proof);
+            const tlv_item_t *proof = tlv_view_get(&message, TLVType_Proof);
             if (!proof) {
                 CLIENT_ERROR(context, "No proof");
                 send_tlv_error_response(context, 4, TLVError_Authentication);
@@ -1268,15 +2050,17 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             size_t server_proof_size = 0;
             crypto_srp_get_proof(homekit_server->pairing_context->srp, NULL, &server_proof_size);
             
-            byte *server_proof = malloc(server_proof_size);
-            crypto_srp_get_proof(homekit_server->pairing_context->srp, server_proof, &server_proof_size);
+            byte *server_proof = request_alloc(context, server_proof_size);
+            if (server_proof) {
+                crypto_srp_get_proof(homekit_server->pairing_context->srp, server_proof, &server_proof_size);
+            }
             
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 4);
-            tlv_add_value(response, TLVType_Proof, server_proof, server_proof_size);
-            free(server_proof);
+            tlv_writer_t response;
+            tlv_response_init(context, &response, TLV_ENCODED_SIZE(1) + TLV_ENCODED_SIZE(server_proof_size));
+            tlv_write_integer(&response, TLVType_State, 1, 4);
+            tlv_write(&response, TLVType_Proof, server_proof, server_proof_size);
             
-            send_tlv_response(context, response);
+            send_tlv_response(context, &response);
             
             CLIENT_INFO(context, "Done 2/3");
             break;
@@ -1306,7 +2090,7 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 break;
             }
 
-            tlv_t *tlv_encrypted_data = tlv_get_value(message, TLVType_EncryptedData);
+            const tlv_item_t *tlv_encrypted_data = tlv_view_get(&message, TLVType_EncryptedData);
             if (!tlv_encrypted_data) {
                 CLIENT_ERROR(context, "No encrypted data");
                 send_tlv_error_response(context, 6, TLVError_Authentication);
@@ -1321,7 +2105,7 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 NULL, &decrypted_data_size
             );
             
-            byte *decrypted_data = malloc(decrypted_data_size);
+            byte *decrypted_data = request_alloc(context, decrypted_data_size);
             if (decrypted_data) {
                 r = crypto_chacha20poly1305_decrypt(
                         shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg05", NULL, 0,
@@ -1334,55 +2118,38 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             
             if (r) {
                 CLIENT_ERROR(context, "Decrypt data (%d)", r);
-                
-                if (decrypted_data) {
-                    free(decrypted_data);
-                }
-                
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            tlv_values_t *decrypted_message = tlv_new();
-            r = tlv_parse(decrypted_data, decrypted_data_size, decrypted_message);
+            tlv_view_t decrypted_message;
+            r = tlv_view_parse(decrypted_data, decrypted_data_size, &decrypted_message);
             if (r) {
                 CLIENT_ERROR(context, "Decrypt TLV (%d)", r);
-
-                tlv_free(decrypted_message);
-                free(decrypted_data);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            free(decrypted_data);
-
-            tlv_t *tlv_device_id = tlv_get_value(decrypted_message, TLVType_Identifier);
+            const tlv_item_t *tlv_device_id = tlv_view_get(&decrypted_message, TLVType_Identifier);
             if (!tlv_device_id) {
                 CLIENT_ERROR(context, "No id");
 
-                tlv_free(decrypted_message);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            tlv_t *tlv_device_public_key = tlv_get_value(decrypted_message, TLVType_PublicKey);
+            const tlv_item_t *tlv_device_public_key = tlv_view_get(&decrypted_message, TLVType_PublicKey);
             if (!tlv_device_public_key) {
                 CLIENT_ERROR(context, "No pub key");
 
-                tlv_free(decrypted_message);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
 
-            tlv_t *tlv_device_signature = tlv_get_value(decrypted_message, TLVType_Signature);
+            const tlv_item_t *tlv_device_signature = tlv_view_get(&decrypted_message, TLVType_Signature);
             if (!tlv_device_signature) {
                 CLIENT_ERROR(context, "No sign");
 
-                tlv_free(decrypted_message);
-
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
             }
@@ -1397,7 +2164,6 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 CLIENT_ERROR(context, "Import pub key (%d)", r);
 
                 crypto_ed25519_free(device_key);
-                tlv_free(decrypted_message);
 
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
@@ -1419,7 +2185,6 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 CLIENT_ERROR(context, "Generate DevX (%d)", r);
 
                 crypto_ed25519_free(device_key);
-                tlv_free(decrypted_message);
 
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
@@ -1450,7 +2215,6 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
                 CLIENT_ERROR(context, "Generate DevX (%d)", r);
                 
                 crypto_ed25519_free(device_key);
-                tlv_free(decrypted_message);
                 
                 send_tlv_error_response(context, 6, TLVError_Authentication);
                 break;
@@ -1469,7 +2233,6 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             }
             
             crypto_ed25519_free(device_key);
-            tlv_free(decrypted_message);
             
             free(device_id);
             
@@ -1528,18 +2291,12 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
 
             CLIENT_DEBUG(context, "Generating accessory sign");
             DEBUG_HEAP();
-            size_t accessory_signature_size = 0;
-            crypto_ed25519_sign(
-                homekit_server->accessory_key,
-                accessory_info, accessory_info_size,
-                NULL, &accessory_signature_size
-            );
-
-            byte *accessory_signature = malloc(accessory_signature_size);
-            r = crypto_ed25519_sign(
-                homekit_server->accessory_key,
+            byte accessory_signature[ED25519_SIGNATURE_SIZE];
+            const size_t accessory_signature_size = sizeof(accessory_signature);
+            r = crypto_ed25519_sign_expanded(
+                homekit_server->accessory_signing_key,
                 accessory_info, accessory_info_size,
-                accessory_signature, &accessory_signature_size
+                accessory_signature
             );
             
             free(accessory_info);
@@ -1547,76 +2304,69 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
             if (r) {
                 CLIENT_ERROR(context, "Generate acc sign (%d)", r);
                 
-                free(accessory_signature);
                 free(accessory_public_key);
                 
                 send_tlv_error_response(context, 6, TLVError_Unknown);
                 break;
             }
-            tlv_values_t *response_message = tlv_new();
-            tlv_add_value(response_message, TLVType_Identifier,
-                          (byte *)homekit_server->accessory_id, accessory_id_size);
+            size_t response_data_size =
+                TLV_ENCODED_SIZE(accessory_id_size) +
+                TLV_ENCODED_SIZE(accessory_public_key_size) +
+                TLV_ENCODED_SIZE(accessory_signature_size);
+
+            tlv_writer_t response_message;
+            tlv_writer_init(&response_message, request_alloc(context, response_data_size), response_data_size);
+            tlv_write(&response_message, TLVType_Identifier,
+                      (byte *)homekit_server->accessory_id, accessory_id_size);
             
-            tlv_add_value(response_message, TLVType_PublicKey,
-                          accessory_public_key, accessory_public_key_size);
+            tlv_write(&response_message, TLVType_PublicKey,
+                      accessory_public_key, accessory_public_key_size);
             free(accessory_public_key);
             
-            tlv_add_value(response_message, TLVType_Signature,
-                          accessory_signature, accessory_signature_size);
-            free(accessory_signature);
-
-            size_t response_data_size = 0;
-            TLV_DEBUG(response_message);
-
-            tlv_format(response_message, NULL, &response_data_size);
+            tlv_write(&response_message, TLVType_Signature,
+                      accessory_signature, accessory_signature_size);
 
-            byte *response_data = malloc(response_data_size);
-            r = tlv_format(response_message, response_data, &response_data_size);
-            if (r) {
-                CLIENT_ERROR(context, "Format TLV response (%d)", r);
-
-                free(response_data);
-                tlv_free(response_message);
+            if (response_message.error) {
+                CLIENT_ERROR(context, "Format TLV response");
 
                 send_tlv_error_response(context, 6, TLVError_Unknown);
                 break;
             }
 
-            tlv_free(response_message);
-
             CLIENT_DEBUG(context, "Encrypting response");
             size_t encrypted_response_data_size = 0;
             crypto_chacha20poly1305_encrypt(
                 shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg06", NULL, 0,
-                response_data, response_data_size,
+                response_message.buffer, response_message.pos,
                 NULL, &encrypted_response_data_size
             );
 
-            byte *encrypted_response_data = malloc(encrypted_response_data_size);
-            r = crypto_chacha20poly1305_encrypt(
-                shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg06", NULL, 0,
-                response_data, response_data_size,
-                encrypted_response_data, &encrypted_response_data_size
-            );
+            tlv_writer_t response;
+            tlv_response_init(context, &response, TLV_ENCODED_SIZE(1) + TLV_ENCODED_SIZE(encrypted_response_data_size));
+            tlv_write_integer(&response, TLVType_State, 1, 6);
 
-            free(response_data);
+            byte *encrypted_response_data = request_alloc(context, encrypted_response_data_size);
+            if (encrypted_response_data) {
+                r = crypto_chacha20poly1305_encrypt(
+                    shared_secret, (byte *)"\x0\x0\x0\x0PS-Msg06", NULL, 0,
+                    response_message.buffer, response_message.pos,
+                    encrypted_response_data, &encrypted_response_data_size
+                );
+            } else {
+                r = -100;
+            }
 
             if (r) {
                 CLIENT_ERROR(context, "Encrypt response (%d)", r);
 
-                free(encrypted_response_data);
-
                 send_tlv_error_response(context, 6, TLVError_Unknown);
                 break;
             }
 
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 6);
-            tlv_add_value(response, TLVType_EncryptedData,
-                          encrypted_response_data, encrypted_response_data_size);
-            free(encrypted_response_data);
+            tlv_write(&response, TLVType_EncryptedData,
+                      encrypted_response_data, encrypted_response_data_size);
             
-            send_tlv_response(context, response);
+            send_tlv_response(context, &response);
             
             pairing_context_free(homekit_server->pairing_context);
             homekit_server->pairing_context = NULL;
@@ -1632,7 +2382,7 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
         }
         
         default: {
-            CLIENT_ERROR(context, "State %d", tlv_get_integer_value(message, TLVType_State, -1));
+            CLIENT_ERROR(context, "State %d", tlv_view_get_integer(&message, TLVType_State, -1));
         }
     }
     
@@ -1643,10 +2393,154 @@ void homekit_server_on_pair_setup(client_context_t *context, const byte *data, s
     HOMEKIT_DEBUG_LOG("CPU restoreclock");
 #endif // HOMEKIT_OVERCLOCK_PAIR_SETUP
     
-    tlv_free(message);
 }
 
-void homekit_server_on_pair_verify(client_context_t *context, const byte *data, size_t size) {
+static int client_derive_control_keys(client_context_t *context, const byte *secret, const size_t secret_size) {
+    const byte salt[] = "Control-Salt";
+
+    size_t read_key_size = 32;
+    const byte read_info[] = "Control-Read-Encryption-Key";
+    int r = crypto_hkdf(
+        secret, secret_size,
+        salt, sizeof(salt)-1,
+        read_info, sizeof(read_info)-1,
+        context->read_key, &read_key_size
+    );
+
+    if (r) {
+        CLIENT_ERROR(context, "Derive read enc key (%d)", r);
+        return r;
+    }
+
+    size_t write_key_size = 32;
+    const byte write_info[] = "Control-Write-Encryption-Key";
+    r = crypto_hkdf(
+        secret, secret_size,
+        salt, sizeof(salt)-1,
+        write_info, sizeof(write_info)-1,
+        context->write_key, &write_key_size
+    );
+    
+    if (r) {
+        CLIENT_ERROR(context, "Derive write enc key (%d)", r);
+    }
+    
+    return r;
+}
+
+// Returns 0 if session was resumed and response was sent. Otherwise, caller must continue with a full Pair Verify.
+static int homekit_server_on_pair_resume(client_context_t *context, const tlv_view_t *message) {
+    const tlv_item_t *tlv_device_public_key = tlv_view_get(message, TLVType_PublicKey);
+    const tlv_item_t *tlv_session_id = tlv_view_get(message, TLVType_SessionID);
+    const tlv_item_t *tlv_encrypted_data = tlv_view_get(message, TLVType_EncryptedData);
+    if (!tlv_device_public_key || tlv_device_public_key->size != PAIR_RESUME_PUBLIC_KEY_SIZE ||
+        !tlv_encrypted_data || !tlv_session_id || tlv_session_id->size != PAIR_RESUME_SESSION_ID_SIZE) {
+        CLIENT_ERROR(context, "Resume data");
+        return -1;
+    }
+    
+    pair_resume_session_t *session = pair_resume_session_find(tlv_session_id->value);
+    if (!session) {
+        CLIENT_INFO(context, "No resume session");
+        return -1;
+    }
+    
+    CLIENT_INFO(context, "Resume 1/1");
+    
+    // Salt is device public key + session ID; request uses the old session ID, and response the new one
+    byte salt[PAIR_RESUME_PUBLIC_KEY_SIZE + PAIR_RESUME_SESSION_ID_SIZE];
+    const size_t salt_size = sizeof(salt);
+    byte *salt_session_id = salt + PAIR_RESUME_PUBLIC_KEY_SIZE;
+    memcpy(salt, tlv_device_public_key->value, PAIR_RESUME_PUBLIC_KEY_SIZE);
+    memcpy(salt_session_id, tlv_session_id->value, PAIR_RESUME_SESSION_ID_SIZE);
+    
+    byte key[HKDF_HASH_SIZE];
+    size_t key_size = sizeof(key);
+    const byte request_info[] = "Pair-Resume-Request-Info";
+    int r = crypto_hkdf(
+        session->secret, PAIR_RESUME_SECRET_SIZE,
+        salt, salt_size,
+        request_info, sizeof(request_info)-1,
+        key, &key_size
+    );
+    if (!r) {
+        r = crypto_chacha20poly1305_verify_tag(
+            key, (byte *)"\x0\x0\x0\x0PR-Msg01",
+            tlv_encrypted_data->value, tlv_encrypted_data->size
+        );
+    }
+    
+    if (r) {
+        CLIENT_ERROR(context, "Resume auth (%d)", r);
+        memset(session, 0, sizeof(*session));
+        return -1;
+    }
+    
+    homekit_random_fill(salt_session_id, PAIR_RESUME_SESSION_ID_SIZE);
+    
+    byte tag[CHACHA20POLY1305_TAG_SIZE];
+    const byte response_info[] = "Pair-Resume-Response-Info";
+    r = crypto_hkdf(
+        session->secret, PAIR_RESUME_SECRET_SIZE,
+        salt, salt_size,
+        response_info, sizeof(response_info)-1,
+        key, &key_size
+    );
+    if (!r) {
+        r = crypto_chacha20poly1305_tag(key, (byte *)"\x0\x0\x0\x0PR-Msg02", tag);
+    }
+    
+    byte secret[PAIR_RESUME_SECRET_SIZE];
+    size_t secret_size = sizeof(secret);
+    const byte secret_info[] = "Pair-Resume-Shared-Secret-Info";
+    if (!r) {
+        r = crypto_hkdf(
+            session->secret, PAIR_RESUME_SECRET_SIZE,
+            salt, salt_size,
+            secret_info, sizeof(secret_info)-1,
+            secret, &secret_size
+        );
+    }
+    
+    if (!r) {
+        r = client_derive_control_keys(context, secret, secret_size);
+    }
+    
+    if (r) {
+        CLIENT_ERROR(context, "Resume keys (%d)", r);
+        memset(session, 0, sizeof(*session));
+        return -1;
+    }
+    
+    // Session IDs are single use; the resumed session replaces the old one
+    memcpy(session->session_id, salt_session_id, PAIR_RESUME_SESSION_ID_SIZE);
+    memcpy(session->secret, secret, PAIR_RESUME_SECRET_SIZE);
+    session->last_used = xTaskGetTickCount();
+    
+    tlv_writer_t response;
+    tlv_response_init(context, &response,
+        TLV_ENCODED_SIZE(1) +
+        TLV_ENCODED_SIZE(PAIR_RESUME_SESSION_ID_SIZE) +
+        TLV_ENCODED_SIZE(sizeof(tag))
+    );
+    tlv_write_integer(&response, TLVType_State, 1, 2);
+    tlv_write(&response, TLVType_SessionID, salt_session_id, PAIR_RESUME_SESSION_ID_SIZE);
+    tlv_write(&response, TLVType_EncryptedData, tag, sizeof(tag));
+    
+    send_tlv_response(context, &response);
+    
+    context->pairing_id = session->pairing_id;
+    context->permissions = session->permissions;
+    context->encrypted = true;
+    
+    HOMEKIT_NOTIFY_EVENT(homekit_server, HOMEKIT_EVENT_CLIENT_VERIFIED);
+    
+    CLIENT_INFO(context, "Resume OK");
+    
+    return 0;
+}
+
+void homekit_server_on_pair_verify(client_context_t *context, byte *data, size_t size) {
 #ifdef HOMEKIT_PAIR_VERIFY_TIME_DEBUG
     uint32_t function_time = sdk_system_get_time_raw();
 #endif
@@ -1654,15 +2548,14 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
     HOMEKIT_DEBUG_LOG("Pair Verify");
     DEBUG_HEAP();
     
-    tlv_values_t *message = tlv_new();
-    if (tlv_parse(data, size, message)) {
+    tlv_view_t message;
+    if (tlv_view_parse(data, size, &message)) {
         CLIENT_ERROR(context, "TLV");
-        tlv_free(message);
         send_tlv_error_response(context, 2, TLVError_Unknown);
         return;
     }
 
-    TLV_DEBUG(message);
+    TLV_DEBUG(&message);
 
 #ifdef HOMEKIT_OVERCLOCK_PAIR_VERIFY
     sdk_system_overclock();
@@ -1671,12 +2564,17 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
     
     int r;
 
-    switch(tlv_get_integer_value(message, TLVType_State, -1)) {
+    switch(tlv_view_get_integer(&message, TLVType_State, -1)) {
         case 1: {
+            if (tlv_view_get_integer(&message, TLVType_Method, -1) == TLVMethod_PairResume &&
+                !homekit_server_on_pair_resume(context, &message)) {
+                break;
+            }
+            
             CLIENT_INFO(context, "Verify 1/2");
 
             CLIENT_DEBUG(context, "Importing device Curve public key");
-            tlv_t *tlv_device_public_key = tlv_get_value(message, TLVType_PublicKey);
+            const tlv_item_t *tlv_device_public_key = tlv_view_get(&message, TLVType_PublicKey);
             if (!tlv_device_public_key) {
                 CLIENT_ERROR(context, "Curve pub key not found");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
@@ -1695,7 +2593,7 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             }
 
             CLIENT_DEBUG(context, "Generating accessory Curve25519 key");
-            curve25519_key *my_key = crypto_curve25519_generate();
+            curve25519_key *my_key = curve25519_pool_take();
             if (!my_key) {
                 CLIENT_ERROR(context, "Generate acc Curve key");
                 crypto_curve25519_free(device_key);
@@ -1747,46 +2645,35 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             memcpy(accessory_info + my_key_public_size + accessory_id_size,
                    tlv_device_public_key->value, tlv_device_public_key->size);
 
-            size_t accessory_signature_size = 0;
-            crypto_ed25519_sign(
-                homekit_server->accessory_key,
-                accessory_info, accessory_info_size,
-                NULL, &accessory_signature_size
-            );
-
-            byte *accessory_signature = malloc(accessory_signature_size);
-            r = crypto_ed25519_sign(
-                homekit_server->accessory_key,
+            byte accessory_signature[ED25519_SIGNATURE_SIZE];
+            const size_t accessory_signature_size = sizeof(accessory_signature);
+            r = crypto_ed25519_sign_expanded(
+                homekit_server->accessory_signing_key,
                 accessory_info, accessory_info_size,
-                accessory_signature, &accessory_signature_size
+                accessory_signature
             );
             free(accessory_info);
             if (r) {
                 CLIENT_ERROR(context, "Generate sign (%d)", r);
-                free(accessory_signature);
                 free(shared_secret);
                 free(my_key_public);
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
 
-            tlv_values_t *sub_response = tlv_new();
-            tlv_add_value(sub_response, TLVType_Identifier,
-                          (const byte *)homekit_server->accessory_id, accessory_id_size);
-            tlv_add_value(sub_response, TLVType_Signature,
-                          accessory_signature, accessory_signature_size);
-            free(accessory_signature);
+            size_t sub_response_data_size =
+                TLV_ENCODED_SIZE(accessory_id_size) +
+                TLV_ENCODED_SIZE(accessory_signature_size);
 
-            size_t sub_response_data_size = 0;
-            tlv_format(sub_response, NULL, &sub_response_data_size);
+            tlv_writer_t sub_response;
+            tlv_writer_init(&sub_response, request_alloc(context, sub_response_data_size), sub_response_data_size);
+            tlv_write(&sub_response, TLVType_Identifier,
+                      (const byte *)homekit_server->accessory_id, accessory_id_size);
+            tlv_write(&sub_response, TLVType_Signature,
+                      accessory_signature, accessory_signature_size);
 
-            byte *sub_response_data = malloc(sub_response_data_size);
-            r = tlv_format(sub_response, sub_response_data, &sub_response_data_size);
-            tlv_free(sub_response);
-
-            if (r) {
-                CLIENT_ERROR(context, "Format sub-TLV message (%d)", r);
-                free(sub_response_data);
+            if (sub_response.error) {
+                CLIENT_ERROR(context, "Format sub-TLV message");
                 free(shared_secret);
                 free(my_key_public);
                 send_tlv_error_response(context, 2, TLVError_Unknown);
@@ -1814,7 +2701,6 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             if (r) {
                 CLIENT_ERROR(context, "Derive session key (%d)", r);
                 free(session_key);
-                free(sub_response_data);
                 free(shared_secret);
                 free(my_key_public);
                 send_tlv_error_response(context, 2, TLVError_Unknown);
@@ -1825,21 +2711,23 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             size_t encrypted_response_data_size = 0;
             crypto_chacha20poly1305_encrypt(
                 session_key, (byte *)"\x0\x0\x0\x0PV-Msg02", NULL, 0,
-                sub_response_data, sub_response_data_size,
+                sub_response.buffer, sub_response.pos,
                 NULL, &encrypted_response_data_size
             );
 
-            byte *encrypted_response_data = malloc(encrypted_response_data_size);
-            r = crypto_chacha20poly1305_encrypt(
-                session_key, (byte *)"\x0\x0\x0\x0PV-Msg02", NULL, 0,
-                sub_response_data, sub_response_data_size,
-                encrypted_response_data, &encrypted_response_data_size
-            );
-            free(sub_response_data);
+            byte *encrypted_response_data = request_alloc(context, encrypted_response_data_size);
+            if (encrypted_response_data) {
+                r = crypto_chacha20poly1305_encrypt(
+                    session_key, (byte *)"\x0\x0\x0\x0PV-Msg02", NULL, 0,
+                    sub_response.buffer, sub_response.pos,
+                    encrypted_response_data, &encrypted_response_data_size
+                );
+            } else {
+                r = -100;
+            }
 
             if (r) {
                 CLIENT_ERROR(context, "Encrypt sub response data (%d)", r);
-                free(encrypted_response_data);
                 free(session_key);
                 free(shared_secret);
                 free(my_key_public);
@@ -1847,15 +2735,19 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 2);
-            tlv_add_value(response, TLVType_PublicKey,
-                          my_key_public, my_key_public_size);
-            tlv_add_value(response, TLVType_EncryptedData,
-                          encrypted_response_data, encrypted_response_data_size);
-            free(encrypted_response_data);
+            tlv_writer_t response;
+            tlv_response_init(context, &response,
+                TLV_ENCODED_SIZE(1) +
+                TLV_ENCODED_SIZE(my_key_public_size) +
+                TLV_ENCODED_SIZE(encrypted_response_data_size)
+            );
+            tlv_write_integer(&response, TLVType_State, 1, 2);
+            tlv_write(&response, TLVType_PublicKey,
+                      my_key_public, my_key_public_size);
+            tlv_write(&response, TLVType_EncryptedData,
+                      encrypted_response_data, encrypted_response_data_size);
             
-            send_tlv_response(context, response);
+            send_tlv_response(context, &response);
             
             if (context->verify_context) {
                 pair_verify_context_free(&context->verify_context);
@@ -1887,7 +2779,7 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            tlv_t *tlv_encrypted_data = tlv_get_value(message, TLVType_EncryptedData);
+            const tlv_item_t *tlv_encrypted_data = tlv_view_get(&message, TLVType_EncryptedData);
             if (!tlv_encrypted_data) {
                 CLIENT_ERROR(context, "No encrypted data");
 
@@ -1905,52 +2797,51 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 NULL, &decrypted_data_size
             );
 
-            byte *decrypted_data = malloc(decrypted_data_size);
-            r = crypto_chacha20poly1305_decrypt(
-                context->verify_context->session_key, (byte *)"\x0\x0\x0\x0PV-Msg03", NULL, 0,
-                tlv_encrypted_data->value, tlv_encrypted_data->size,
-                decrypted_data, &decrypted_data_size
-            );
+            byte *decrypted_data = request_alloc(context, decrypted_data_size);
+            if (decrypted_data) {
+                r = crypto_chacha20poly1305_decrypt(
+                    context->verify_context->session_key, (byte *)"\x0\x0\x0\x0PV-Msg03", NULL, 0,
+                    tlv_encrypted_data->value, tlv_encrypted_data->size,
+                    decrypted_data, &decrypted_data_size
+                );
+            } else {
+                r = -100;
+            }
             if (r) {
                 CLIENT_ERROR(context, "Decrypt data (%d)", r);
 
-                free(decrypted_data);
                 pair_verify_context_free(&context->verify_context);
 
                 send_tlv_error_response(context, 4, TLVError_Authentication);
                 break;
             }
 
-            tlv_values_t *decrypted_message = tlv_new();
-            r = tlv_parse(decrypted_data, decrypted_data_size, decrypted_message);
-            free(decrypted_data);
+            tlv_view_t decrypted_message;
+            r = tlv_view_parse(decrypted_data, decrypted_data_size, &decrypted_message);
 
             if (r) {
                 CLIENT_ERROR(context, "Parse TLV (%d)", r);
 
-                tlv_free(decrypted_message);
                 pair_verify_context_free(&context->verify_context);
 
                 send_tlv_error_response(context, 4, TLVError_Authentication);
                 break;
             }
 
-            tlv_t *tlv_device_id = tlv_get_value(decrypted_message, TLVType_Identifier);
+            const tlv_item_t *tlv_device_id = tlv_view_get(&decrypted_message, TLVType_Identifier);
             if (!tlv_device_id) {
                 CLIENT_ERROR(context, "No id");
 
-                tlv_free(decrypted_message);
                 pair_verify_context_free(&context->verify_context);
 
                 send_tlv_error_response(context, 4, TLVError_Authentication);
                 break;
             }
             
-            tlv_t *tlv_device_signature = tlv_get_value(decrypted_message, TLVType_Signature);
+            const tlv_item_t *tlv_device_signature = tlv_view_get(&decrypted_message, TLVType_Signature);
             if (!tlv_device_signature) {
                 CLIENT_ERROR(context, "No sign");
 
-                tlv_free(decrypted_message);
                 pair_verify_context_free(&context->verify_context);
 
                 send_tlv_error_response(context, 4, TLVError_Authentication);
@@ -1964,7 +2855,6 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 CLIENT_ERROR(context, "No pairing %s", device_id);
 
                 free(device_id);
-                tlv_free(decrypted_message);
                 pair_verify_context_free(&context->verify_context);
 
                 send_tlv_error_response(context, 4, TLVError_Authentication);
@@ -1999,7 +2889,6 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             );
             free(device_info);
             pairing_free(pairing);
-            tlv_free(decrypted_message);
 
             if (r) {
                 CLIENT_ERROR(context, "Verify sign (%d)", r);
@@ -2010,48 +2899,24 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
                 break;
             }
 
-            const byte salt[] = "Control-Salt";
-
-            size_t read_key_size = 32;
-            const byte read_info[] = "Control-Read-Encryption-Key";
-            r = crypto_hkdf(
-                context->verify_context->secret, context->verify_context->secret_size,
-                salt, sizeof(salt)-1,
-                read_info, sizeof(read_info)-1,
-                context->read_key, &read_key_size
-            );
-
-            if (r) {
-                CLIENT_ERROR(context, "Derive read enc key (%d)", r);
-
-                pair_verify_context_free(&context->verify_context);
-
-                send_tlv_error_response(context, 4, TLVError_Unknown);
-                break;
+            r = client_derive_control_keys(context, context->verify_context->secret, context->verify_context->secret_size);
+            
+            if (!r) {
+                pair_resume_session_add(context->verify_context->secret, context->verify_context->secret_size, pairing_id, permissions);
             }
-
-            size_t write_key_size = 32;
-            const byte write_info[] = "Control-Write-Encryption-Key";
-            r = crypto_hkdf(
-                context->verify_context->secret, context->verify_context->secret_size,
-                salt, sizeof(salt)-1,
-                write_info, sizeof(write_info)-1,
-                context->write_key, &write_key_size
-            );
-
+            
             pair_verify_context_free(&context->verify_context);
             
             if (r) {
-                CLIENT_ERROR(context, "Derive write enc key (%d)", r);
-
                 send_tlv_error_response(context, 4, TLVError_Unknown);
                 break;
             }
 
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 4);
+            tlv_writer_t response;
+            tlv_response_init(context, &response, TLV_ENCODED_SIZE(1));
+            tlv_write_integer(&response, TLVType_State, 1, 4);
             
-            send_tlv_response(context, response);
+            send_tlv_response(context, &response);
 
             context->pairing_id = pairing_id;
             context->permissions = permissions;
@@ -2064,7 +2929,7 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
             break;
         }
         default: {
-            CLIENT_ERROR(context, "Unknown state %d", tlv_get_integer_value(message, TLVType_State, -1));
+            CLIENT_ERROR(context, "Unknown state %d", tlv_view_get_integer(&message, TLVType_State, -1));
         }
     }
     
@@ -2073,25 +2938,13 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
     HOMEKIT_DEBUG_LOG("CPU restoreclock");
 #endif // HOMEKIT_OVERCLOCK_PAIR_VERIFY
 
-    tlv_free(message);
-    
 #ifdef HOMEKIT_PAIR_VERIFY_TIME_DEBUG
     CLIENT_INFO(context, "Verify Time %d", sdk_system_get_time_raw() - function_time);
 #endif
 }
 
 
-void homekit_server_on_get_accessories(client_context_t *context) {
-    CLIENT_INFO(context, "Get ACC");
-    DEBUG_HEAP();
-    
-    json_stream* json = &homekit_server->json;
-    json_init(json, context);
-    
-    if (send_200_response(context) < 0) {
-        json->error = true;
-    }
-    
+static void write_accessories_json(json_stream *json, client_context_t *context, characteristic_format_t format) {
     json_object_start(json);
     json_string(json, "accessories"); json_array_start(json);
 
@@ -2130,15 +2983,7 @@ void homekit_server_on_get_accessories(client_context_t *context) {
                 homekit_characteristic_t *ch = *ch_it;
 
                 json_object_start(json);
-                write_characteristic_json(
-                    json, context, ch,
-                      characteristic_format_type
-                    | characteristic_format_meta
-                    | characteristic_format_perms
-                    | characteristic_format_events,
-                    NULL,
-                    accessory->id
-                );
+                write_characteristic_json(json, context, ch, format, NULL, accessory->id);
                 json_object_end(json);
                 
                 if (json->error) {
@@ -2164,6 +3009,93 @@ void homekit_server_on_get_accessories(client_context_t *context) {
     
     json_array_end(json);
     json_object_end(json); // response
+}
+
+#ifdef HOMEKIT_ACCESSORIES_TEMPLATE
+static void homekit_server_accessories_template_build() {
+    HOMEKIT_DEBUG_LOG("Build ACC template");
+    DEBUG_HEAP();
+    
+    accessories_template_t *template = calloc(1, sizeof(accessories_template_t));
+    if (!template) {
+        HOMEKIT_ERROR("ACC template DRAM");
+        return;
+    }
+    
+    json_stream* json = &homekit_server->json;
+    json_init(json, template);
+    json->buffer = homekit_server->data;
+    json->size = HOMEKIT_JSON_BUFFER_SIZE;
+    json->on_flush = accessories_template_append;
+    
+    write_accessories_json(json, NULL,
+          characteristic_format_type
+        | characteristic_format_meta
+        | characteristic_format_perms
+        | characteristic_format_events
+        | characteristic_format_template
+    );
+    
+    json_flush(json);
+    
+    if (json->error) {
+        HOMEKIT_ERROR("ACC template DRAM");
+        accessories_template_free(template);
+        return;
+    }
+    
+    HOMEKIT_INFO("ACC template %i, %i slots", template->size, template->slot_count);
+    
+    homekit_server->accessories_template = template;
+}
+
+static void write_accessories_template_json(json_stream *json, client_context_t *context) {
+    const accessories_template_t *template = homekit_server->accessories_template;
+    
+    size_t offset = 0;
+    for (unsigned int i = 0; i < template->slot_count && !json->error; i++) {
+        const accessories_template_slot_t *slot = &template->slots[i];
+        
+        json_write(json, template->data + offset, slot->offset - offset);
+        offset = slot->offset;
+        
+        // Slots are always placed after "aid" and "iid" keys of a characteristic object
+        json->state = JSON_STATE_OBJECT_VALUE;
+        
+        if (slot->events) {
+            write_characteristic_events_json(json, context, slot->ch);
+        } else {
+            write_characteristic_value_json(json, slot->ch, NULL);
+        }
+    }
+    
+    json_write(json, template->data + offset, template->size - offset);
+}
+#endif // HOMEKIT_ACCESSORIES_TEMPLATE
+
+void homekit_server_on_get_accessories(client_context_t *context) {
+    CLIENT_INFO(context, "Get ACC");
+    DEBUG_HEAP();
+    
+    const int r = send_200_response(context);
+    json_stream* json = client_json_init(context);
+    if (r < 0) {
+        json->error = true;
+    }
+    
+#ifdef HOMEKIT_ACCESSORIES_TEMPLATE
+    if (homekit_server->accessories_template) {
+        write_accessories_template_json(json, context);
+    } else
+#endif
+    {
+        write_accessories_json(json, context,
+              characteristic_format_type
+            | characteristic_format_meta
+            | characteristic_format_perms
+            | characteristic_format_events
+        );
+    }
     
     json_flush(json);
     //json_buffer_free(json);
@@ -2213,42 +3145,23 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
     if (bool_endpoint_param("ev"))
         format |= characteristic_format_events;
 
-    unsigned int success = true;
-
-    char *id = strdup(id_param->value);
-    char *ch_id;
-    char *_id = id;
-    while ((ch_id = strsep(&_id, ","))) {
-        char *dot = strstr(ch_id, ".");
-        if (!dot) {
-            send_json_error_response(context, 400, HAPStatus_InvalidValue);
-            free(id);
-            return;
-        }
-
-        *dot = 0;
-        int aid = atoi(ch_id);
-        int iid = atoi(dot+1);
-
-        CLIENT_DEBUG(context, "Requested characteristic info for %d.%d", aid, iid);
-        homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(homekit_server->config->accessories, aid, iid);
-        if (!ch) {
-            success = false;
-            continue;
-        }
+    characteristic_id_t *ids;
+    const int ids_count = characteristic_ids_parse(id_param->value, homekit_server->config->accessories,
+                                                   &ids, request_params_alloc, context);
+    if (ids_count == CHARACTERISTIC_IDS_NO_MEMORY) {
+        CLIENT_ERROR(context, "ID DRAM");
+        send_json_error_response(context, 500, HAPStatus_OutOfResources);
+        return;
+    }
 
-        if (!(ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ)) {
-            success = false;
-            continue;
-        }
+    if (ids_count < 0) {
+        CLIENT_ERROR(context, "Bad ID");
+        send_json_error_response(context, 400, HAPStatus_InvalidValue);
+        return;
     }
 
-    free(id);
-    id = strdup(id_param->value);
+    const bool success = characteristic_ids_readable(ids, ids_count);
 
-    json_stream* json = &homekit_server->json;
-    json_init(json, context);
-    
     int resul = -1;
     
     if (success) {
@@ -2257,6 +3170,7 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
         resul = send_207_response(context);
     }
     
+    json_stream* json = client_json_init(context);
     if (resul < 0) {
         json->error = true;
     }
@@ -2272,27 +3186,21 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
         json_object_end(json);
     }
 
-    _id = id;
-    while ((ch_id = strsep(&_id, ","))) {
-        char *dot = strstr(ch_id, ".");
-        *dot = 0;
-        int aid = atoi(ch_id);
-        int iid = atoi(dot+1);
+    for (int i = 0; i < ids_count; i++) {
+        homekit_characteristic_t *ch = ids[i].ch;
         
-        CLIENT_DEBUG(context, "for %d.%d", aid, iid);
-        homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(homekit_server->config->accessories, aid, iid);
         if (!ch) {
-            write_characteristic_error(json, aid, iid, HAPStatus_NoResource);
+            write_characteristic_error(json, ids[i].aid, ids[i].iid, HAPStatus_NoResource);
             continue;
         }
 
         if (!(ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ)) {
-            write_characteristic_error(json, aid, iid, HAPStatus_WriteOnly);
+            write_characteristic_error(json, ids[i].aid, ids[i].iid, HAPStatus_WriteOnly);
             continue;
         }
 
         json_object_start(json);
-        write_characteristic_json(json, context, ch, format, NULL, aid);
+        write_characteristic_json(json, context, ch, format, NULL, ids[i].aid);
         if (!success) {
             json_string(json, "status"); json_integer(json, HAPStatus_Success);
         }
@@ -2309,8 +3217,6 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
     json_flush(json);
     //json_buffer_free(json);
     //free(json);
-    
-    free(id);
 
     if (json->error) {
         CLIENT_ERROR(context, "JSON");
@@ -2321,57 +3227,11 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
     //CLIENT_INFO(context, "Time %i", sdk_system_get_time_raw() - time_start);
 }
 
-void homekit_server_on_update_characteristics(client_context_t *context, const byte *data, size_t size) {
+void homekit_server_on_update_characteristics(client_context_t *context, byte *data, size_t size) {
     CLIENT_INFO(context, "Upd CH");
     DEBUG_HEAP();
     
-    cJSON_rsf *json = cJSON_rsf_Parse((char*) data);
-
-    if (!json) {
-        CLIENT_ERROR(context, "Parse JSON");
-        send_json_error_response(context, 400, HAPStatus_InvalidValue);
-        return;
-    }
-
-    cJSON_rsf *characteristics = cJSON_rsf_GetObjectItem(json, "characteristics");
-    if (!characteristics) {
-        CLIENT_ERROR(context, "No \"characteristics\"");
-        cJSON_rsf_Delete(json);
-        send_json_error_response(context, 400, HAPStatus_InvalidValue);
-        return;
-    }
-    
-    if (characteristics->type != cJSON_rsf_Array) {
-        CLIENT_ERROR(context, "\"characteristics\" no list");
-        cJSON_rsf_Delete(json);
-        send_json_error_response(context, 400, HAPStatus_InvalidValue);
-        return;
-    }
-
-    HAPStatus process_characteristics_update(const cJSON_rsf *j_ch) {
-        cJSON_rsf *j_aid = cJSON_rsf_GetObjectItem(j_ch, "aid");
-        if (!j_aid) {
-            CLIENT_ERROR(context, "No \"aid\"");
-            return HAPStatus_NoResource;
-        }
-        if (j_aid->type != cJSON_rsf_Number) {
-            CLIENT_ERROR(context, "\"aid\" no number");
-            return HAPStatus_NoResource;
-        }
-        
-        cJSON_rsf *j_iid = cJSON_rsf_GetObjectItem(j_ch, "iid");
-        if (!j_iid) {
-            CLIENT_ERROR(context, "No \"iid\"");
-            return HAPStatus_NoResource;
-        }
-        if (j_iid->type != cJSON_rsf_Number) {
-            CLIENT_ERROR(context, "\"iid\" no number");
-            return HAPStatus_NoResource;
-        }
-        
-        int aid = j_aid->valuefloat;
-        int iid = j_iid->valuefloat;
-        
+    HAPStatus process_characteristics_update(int aid, int iid, const json_value_t *j_value, const json_value_t *j_events) {
         homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(
             homekit_server->config->accessories, aid, iid
         );
@@ -2380,7 +3240,6 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             return HAPStatus_NoResource;
         }
         
-        cJSON_rsf *j_value = cJSON_rsf_GetObjectItem(j_ch, "value");
         if (j_value) {
             homekit_value_t h_value = HOMEKIT_NULL();
 
@@ -2392,13 +3251,13 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             switch (ch->format) {
                 case HOMEKIT_FORMAT_BOOL: {
                     unsigned int value = false;
-                    if (j_value->type == cJSON_rsf_True) {
+                    if (j_value->type == JSON_VALUE_TRUE) {
                         value = true;
-                    } else if (j_value->type == cJSON_rsf_False) {
+                    } else if (j_value->type == JSON_VALUE_FALSE) {
                         value = false;
-                    } else if (j_value->type == cJSON_rsf_Number &&
-                            (j_value->valuefloat == 0 || j_value->valuefloat == 1)) {
-                        value = j_value->valuefloat == 1;
+                    } else if (j_value->type == JSON_VALUE_NUMBER &&
+                            (j_value->number == 0 || j_value->number == 1)) {
+                        value = j_value->number == 1;
                     } else {
                         CLIENT_ERROR(context, "for %d.%d: no bool or 0/1", aid, iid);
                         return HAPStatus_InvalidValue;
@@ -2420,7 +3279,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                 case HOMEKIT_FORMAT_UINT64:
                 case HOMEKIT_FORMAT_INT: {
                     // We accept boolean values here in order to fix a bug in HomeKit. HomeKit sometimes sends a boolean instead of an integer of value 0 or 1.
-                    if (j_value->type != cJSON_rsf_Number && j_value->type != cJSON_rsf_False && j_value->type != cJSON_rsf_True) {
+                    if (j_value->type != JSON_VALUE_NUMBER && j_value->type != JSON_VALUE_FALSE && j_value->type != JSON_VALUE_TRUE) {
                         CLIENT_ERROR(context, "for %d.%d: no number", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2476,7 +3335,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                         max_value = (int) *ch->max_value;
                     }
 
-                    int value = j_value->valuefloat;
+                    int value = j_value->number;
 
                     // New style
                     /*
@@ -2487,12 +3346,12 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                         max_value = *ch->max_value;
                     }
                     
-                    double value = j_value->valuefloat;
+                    double value = j_value->number;
                     */
                     
-                    if (j_value->type == cJSON_rsf_True) {
+                    if (j_value->type == JSON_VALUE_TRUE) {
                         value = 1;
-                    } else if (j_value->type == cJSON_rsf_False) {
+                    } else if (j_value->type == JSON_VALUE_FALSE) {
                         value = 0;
                     }
                     
@@ -2582,12 +3441,12 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case HOMEKIT_FORMAT_FLOAT: {
-                    if (j_value->type != cJSON_rsf_Number) {
+                    if (j_value->type != JSON_VALUE_NUMBER) {
                         CLIENT_ERROR(context, "for %d.%d: no number", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
 
-                    float value = j_value->valuefloat;
+                    float value = j_value->number;
                     if ((ch->min_value && value < *ch->min_value) ||
                             (ch->max_value && value > *ch->max_value)) {
                         CLIENT_ERROR(context, "for %d.%d: out range", aid, iid);
@@ -2605,7 +3464,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case HOMEKIT_FORMAT_STRING: {
-                    if (j_value->type != cJSON_rsf_String) {
+                    if (j_value->type != JSON_VALUE_STRING) {
                         CLIENT_ERROR(context, "for %d.%d: no string", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2614,7 +3473,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     unsigned int max_len = (ch->max_len) ? *ch->max_len : 64;
 #endif //HOMEKIT_DISABLE_MAXLEN_CHECK
                     
-                    char *value = j_value->valuestring;
+                    char *value = j_value->string;
                     
 #ifndef HOMEKIT_DISABLE_MAXLEN_CHECK
                     if (strlen(value) > max_len) {
@@ -2635,7 +3494,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case HOMEKIT_FORMAT_TLV: {
-                    if (j_value->type != cJSON_rsf_String) {
+                    if (j_value->type != JSON_VALUE_STRING) {
                         CLIENT_ERROR(context, "for %d.%d: no string", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2644,7 +3503,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     unsigned int max_len = (ch->max_len) ? *ch->max_len : 256;
 #endif //HOMEKIT_DISABLE_MAXLEN_CHECK
                     
-                    char *value = j_value->valuestring;
+                    char *value = j_value->string;
                     unsigned int value_len = strlen(value);
                     
 #ifndef HOMEKIT_DISABLE_MAXLEN_CHECK
@@ -2690,7 +3549,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case HOMEKIT_FORMAT_DATA: {
-                    if (j_value->type != cJSON_rsf_String) {
+                    if (j_value->type != JSON_VALUE_STRING) {
                         CLIENT_ERROR(context, "for %d.%d: no string", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2701,7 +3560,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     unsigned int max_len = (ch->max_data_len) ? *ch->max_data_len : 16384;
 #endif //HOMEKIT_DISABLE_MAXLEN_CHECK
                     
-                    char *value = j_value->valuestring;
+                    char *value = j_value->string;
                     unsigned int value_len = strlen(value);
                     
 #ifndef HOMEKIT_DISABLE_MAXLEN_CHECK
@@ -2744,42 +3603,151 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             }
         }
 
-        cJSON_rsf *j_events = cJSON_rsf_GetObjectItem(j_ch, "ev");
         if (j_events) {
             if (!(ch->permissions & HOMEKIT_PERMISSIONS_NOTIFY)) {
                 CLIENT_ERROR(context, "for %d.%d: notif no supported", aid, iid);
                 return HAPStatus_NotificationsUnsupported;
             }
             
-            if ((j_events->type != cJSON_rsf_True) && (j_events->type != cJSON_rsf_False)) {
+            if ((j_events->type != JSON_VALUE_TRUE) && (j_events->type != JSON_VALUE_FALSE)) {
                 CLIENT_ERROR(context, "for %d.%d: notif invalid state", aid, iid);
             }
 
-            if (j_events->type == cJSON_rsf_True) {
-                homekit_characteristic_add_notify_subscription(ch, context);
+            if (j_events->type == JSON_VALUE_TRUE) {
+                homekit_characteristic_add_notify_subscription(ch, context->slot);
             } else {
-                homekit_characteristic_remove_notify_subscription(ch, context);
+                homekit_characteristic_remove_notify_subscription(ch, context->slot);
             }
         }
 
         return HAPStatus_Success;
     }
 
-    HAPStatus *statuses = malloc(sizeof(HAPStatus) * cJSON_rsf_GetArraySize(characteristics));
+    typedef struct {
+        int aid;
+        int iid;
+        HAPStatus status;
+    } write_status_t;
+
+    write_status_t *statuses = NULL;
+    unsigned int statuses_count = 0;
+    unsigned int statuses_size = 0;
     unsigned int has_errors = false;
-    for (unsigned int i = 0; i < cJSON_rsf_GetArraySize(characteristics); i++) {
-        cJSON_rsf *j_ch = cJSON_rsf_GetArrayItem(characteristics, i);
+    unsigned int has_characteristics = false;
+
+    // Each write is applied as soon as its object is closed, reading body in place
+    json_reader_t reader;
+    json_reader_init(&reader, (char *) data);
+
+    json_value_t j_value;
+    char *key;
+    if (json_reader_value(&reader, &j_value) && j_value.type == JSON_VALUE_OBJECT) {
+        while ((key = json_reader_next_key(&reader)) && json_reader_value(&reader, &j_value)) {
+            if (strcmp(key, "characteristics") || j_value.type != JSON_VALUE_ARRAY) {
+                if (j_value.type == JSON_VALUE_OBJECT || j_value.type == JSON_VALUE_ARRAY) {
+                    json_reader_skip(&reader);
+                }
+                continue;
+            }
 
-#ifdef HOMEKIT_DEBUG
-        char *s = cJSON_rsf_Print(j_ch);
-        CLIENT_INFO(context, "Processing Ch: %s", s);
-        free(s);
-#endif
-        
-        statuses[i] = process_characteristics_update(j_ch);
+            has_characteristics = true;
+
+            while (json_reader_next_item(&reader) && json_reader_value(&reader, &j_value)) {
+                json_value_t j_aid = { .type = JSON_VALUE_NULL }, j_iid = { .type = JSON_VALUE_NULL };
+                json_value_t j_ch_value, j_events;
+                bool has_aid = false, has_iid = false, has_value = false, has_events = false;
+
+                if (j_value.type == JSON_VALUE_OBJECT) {
+                    while ((key = json_reader_next_key(&reader))) {
+                        json_value_t *j_field = &j_value;
+                        if (!strcmp(key, "aid")) {
+                            j_field = &j_aid;
+                            has_aid = true;
+                        } else if (!strcmp(key, "iid")) {
+                            j_field = &j_iid;
+                            has_iid = true;
+                        } else if (!strcmp(key, "value")) {
+                            j_field = &j_ch_value;
+                            has_value = true;
+                        } else if (!strcmp(key, "ev")) {
+                            j_field = &j_events;
+                            has_events = true;
+                        }
+
+                        if (!json_reader_value(&reader, j_field)) {
+                            break;
+                        }
+
+                        if (j_field->type == JSON_VALUE_OBJECT || j_field->type == JSON_VALUE_ARRAY) {
+                            json_reader_skip(&reader);
+                        }
+                    }
+                } else if (j_value.type == JSON_VALUE_ARRAY) {
+                    json_reader_skip(&reader);
+                }
+
+                if (reader.error) {
+                    break;
+                }
+
+                if (statuses_count == statuses_size) {
+                    unsigned int new_size = statuses_size ? statuses_size * 2 : 8;
+                    write_status_t *new_statuses = request_realloc(context, statuses,
+                        statuses_size * sizeof(write_status_t), new_size * sizeof(write_status_t));
+                    if (!new_statuses) {
+                        CLIENT_ERROR(context, "Statuses DRAM");
+                        send_json_error_response(context, 500, HAPStatus_OutOfResources);
+                        return;
+                    }
+
+                    statuses = new_statuses;
+                    statuses_size = new_size;
+                }
+
+                write_status_t *status = &statuses[statuses_count++];
+                status->aid = (j_aid.type == JSON_VALUE_NUMBER) ? j_aid.number : 0;
+                status->iid = (j_iid.type == JSON_VALUE_NUMBER) ? j_iid.number : 0;
+
+                CLIENT_DEBUG(context, "Processing Ch %d.%d", status->aid, status->iid);
+
+                if (!has_aid) {
+                    CLIENT_ERROR(context, "No \"aid\"");
+                    status->status = HAPStatus_NoResource;
+                } else if (j_aid.type != JSON_VALUE_NUMBER) {
+                    CLIENT_ERROR(context, "\"aid\" no number");
+                    status->status = HAPStatus_NoResource;
+                } else if (!has_iid) {
+                    CLIENT_ERROR(context, "No \"iid\"");
+                    status->status = HAPStatus_NoResource;
+                } else if (j_iid.type != JSON_VALUE_NUMBER) {
+                    CLIENT_ERROR(context, "\"iid\" no number");
+                    status->status = HAPStatus_NoResource;
+                } else {
+                    status->status = process_characteristics_update(
+                        status->aid, status->iid,
+                        has_value ? &j_ch_value : NULL,
+                        has_events ? &j_events : NULL
+                    );
+                }
+
+                if (status->status != HAPStatus_Success)
+                    has_errors = true;
+            }
+        }
+    } else {
+        reader.error = true;
+    }
 
-        if (statuses[i] != HAPStatus_Success)
-            has_errors = true;
+    if (!json_reader_end(&reader)) {
+        CLIENT_ERROR(context, "Parse JSON");
+        send_json_error_response(context, 400, HAPStatus_InvalidValue);
+        return;
+    }
+
+    if (!has_characteristics) {
+        CLIENT_ERROR(context, "No \"characteristics\" list");
+        send_json_error_response(context, 400, HAPStatus_InvalidValue);
+        return;
     }
 
     if (!has_errors) {
@@ -2789,23 +3757,20 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
     } else {
         CLIENT_DEBUG(context, "There were processing errors, sending Multi-Status response");
         
-        json_stream* json1 = &homekit_server->json;
-        json_init(json1, context);
-        
-        if (send_207_response(context) < 0) {
+        const int r = send_207_response(context);
+        json_stream* json1 = client_json_init(context);
+        if (r < 0) {
             json1->error = true;
         }
         
         json_object_start(json1);
         json_string(json1, "characteristics"); json_array_start(json1);
 
-        for (unsigned int i = 0; i < cJSON_rsf_GetArraySize(characteristics); i++) {
-            cJSON_rsf *j_ch = cJSON_rsf_GetArrayItem(characteristics, i);
-
+        for (unsigned int i = 0; i < statuses_count; i++) {
             json_object_start(json1);
-            json_string(json1, "aid"); json_integer(json1, cJSON_rsf_GetObjectItem(j_ch, "aid")->valuefloat);
-            json_string(json1, "iid"); json_integer(json1, cJSON_rsf_GetObjectItem(j_ch, "iid")->valuefloat);
-            json_string(json1, "status"); json_integer(json1, statuses[i]);
+            json_string(json1, "aid"); json_integer(json1, statuses[i].aid);
+            json_string(json1, "iid"); json_integer(json1, statuses[i].iid);
+            json_string(json1, "status"); json_integer(json1, statuses[i].status);
             json_object_end(json1);
             
             if (json1->error) {
@@ -2826,34 +3791,29 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
         
         client_send_chunk(NULL, 0, context);
     }
-
-    free(statuses);
-    cJSON_rsf_Delete(json);
 }
 
-void homekit_server_on_pairings(client_context_t *context, const byte *data, size_t size) {
+void homekit_server_on_pairings(client_context_t *context, byte *data, size_t size) {
     HOMEKIT_DEBUG_LOG("Pairings");
     DEBUG_HEAP();
 
-    tlv_values_t *message = tlv_new();
-    if (tlv_parse(data, size, message)) {
+    tlv_view_t message;
+    if (tlv_view_parse(data, size, &message)) {
         CLIENT_ERROR(context, "TLV");
-        tlv_free(message);
         send_tlv_error_response(context, 2, TLVError_Unknown);
         return;
     }
 
-    TLV_DEBUG(message);
+    TLV_DEBUG(&message);
 
     int r;
     
-    if (tlv_get_integer_value(message, TLVType_State, -1) != 1) {
+    if (tlv_view_get_integer(&message, TLVType_State, -1) != 1) {
         send_tlv_error_response(context, 2, TLVError_Unknown);
-        tlv_free(message);
         return;
     }
 
-    switch(tlv_get_integer_value(message, TLVType_Method, -1)) {
+    switch(tlv_view_get_integer(&message, TLVType_Method, -1)) {
         case TLVMethod_AddPairing: {
             CLIENT_INFO(context, "Adding pairing");
 
@@ -2863,19 +3823,19 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 break;
             }
 
-            tlv_t *tlv_device_identifier = tlv_get_value(message, TLVType_Identifier);
+            const tlv_item_t *tlv_device_identifier = tlv_view_get(&message, TLVType_Identifier);
             if (!tlv_device_identifier) {
                 CLIENT_ERROR(context, "No id");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
-            tlv_t *tlv_device_public_key = tlv_get_value(message, TLVType_PublicKey);
+            const tlv_item_t *tlv_device_public_key = tlv_view_get(&message, TLVType_PublicKey);
             if (!tlv_device_public_key) {
                 CLIENT_ERROR(context, "No pub key");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
                 break;
             }
-            int device_permissions = tlv_get_integer_value(message, TLVType_Permissions, -1);
+            int device_permissions = tlv_view_get_integer(&message, TLVType_Permissions, -1);
             if (device_permissions == -1) {
                 CLIENT_ERROR(context, "No perm");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
@@ -2937,6 +3897,8 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                         break;
                     }
                     
+                    pair_resume_sessions_clear();
+                    
                     CLIENT_INFO(context, "Updated %s, %i", device_identifier, device_permissions);
                 } else {
                     pairing_free(pairing);
@@ -2960,6 +3922,9 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                     break;
                 }
                 
+                // Storage compaction can change pairing IDs
+                pair_resume_sessions_clear();
+                
                 CLIENT_INFO(context, "Added %s, %i", device_identifier, device_permissions);
 
                 HOMEKIT_NOTIFY_EVENT(homekit_server, HOMEKIT_EVENT_PAIRING_ADDED);
@@ -2968,10 +3933,11 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
             free(device_identifier);
             crypto_ed25519_free(device_key);
 
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 2);
+            tlv_writer_t response;
+            tlv_response_init(context, &response, TLV_ENCODED_SIZE(1));
+            tlv_write_integer(&response, TLVType_State, 1, 2);
 
-            send_tlv_response(context, response);
+            send_tlv_response(context, &response);
 
             break;
         }
@@ -2984,7 +3950,7 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 break;
             }
 
-            tlv_t *tlv_device_identifier = tlv_get_value(message, TLVType_Identifier);
+            const tlv_item_t *tlv_device_identifier = tlv_view_get(&message, TLVType_Identifier);
             if (!tlv_device_identifier) {
                 CLIENT_ERROR(context, "No id");
                 send_tlv_error_response(context, 2, TLVError_Unknown);
@@ -3001,6 +3967,7 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 
                 if (pairing) {
                     unsigned int is_admin = pairing->permissions & pairing_permissions_admin;
+                    const int pairing_id = pairing->id;
                     pairing_free(pairing);
                     
                     r = homekit_storage_remove_pairing(device_identifier);
@@ -3015,9 +3982,11 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                     
                     HOMEKIT_NOTIFY_EVENT(homekit_server, HOMEKIT_EVENT_PAIRING_REMOVED);
                     
+                    pair_resume_sessions_remove(pairing_id);
+                    
                     client_context_t *c = homekit_server->clients;
                     while (c) {
-                        if (c->pairing_id == pairing->id) {
+                        if (c->pairing_id == pairing_id) {
                             homekit_disconnect_client(c);
                         }
                         c = c->next;
@@ -3051,10 +4020,11 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 free(device_identifier);
             }
             
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 2);
+            tlv_writer_t response;
+            tlv_response_init(context, &response, TLV_ENCODED_SIZE(1));
+            tlv_write_integer(&response, TLVType_State, 1, 2);
             
-            send_tlv_response(context, response);
+            send_tlv_response(context, &response);
             
             break;
         }
@@ -3067,8 +4037,18 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 break;
             }
             
-            tlv_values_t *response = tlv_new();
-            tlv_add_integer_value(response, TLVType_State, 1, 2);
+            // Each pairing: separator, identifier (36), public key (32) and permissions
+            tlv_writer_t response;
+            tlv_response_init(context, &response,
+                TLV_ENCODED_SIZE(1) +
+                homekit_storage_pairing_count() * (
+                    TLV_ENCODED_SIZE(0) +
+                    TLV_ENCODED_SIZE(36) +
+                    TLV_ENCODED_SIZE(32) +
+                    TLV_ENCODED_SIZE(1)
+                )
+            );
+            tlv_write_integer(&response, TLVType_State, 1, 2);
             
             unsigned int first = true;
             unsigned int error = false;
@@ -3084,12 +4064,12 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
                 r = crypto_ed25519_export_public_key(pairing->device_key, public_key, &public_key_size);
                 if (!r) {
                     if (!first) {
-                        tlv_add_value(response, TLVType_Separator, NULL, 0);
+                        tlv_write(&response, TLVType_Separator, NULL, 0);
                     }
                     
-                    tlv_add_string_value(response, TLVType_Identifier, pairing->device_id);
-                    tlv_add_value(response, TLVType_PublicKey, public_key, public_key_size);
-                    tlv_add_integer_value(response, TLVType_Permissions, 1, pairing->permissions);
+                    tlv_write(&response, TLVType_Identifier, (const byte *)pairing->device_id, strlen(pairing->device_id));
+                    tlv_write(&response, TLVType_PublicKey, public_key, public_key_size);
+                    tlv_write_integer(&response, TLVType_Permissions, 1, pairing->permissions);
                     
                     first = false;
                     
@@ -3109,10 +4089,9 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
             free(it);
 
             if (error) {
-                tlv_free(response);
                 send_tlv_error_response(context, 2, TLVError_Unknown);
             } else {
-                send_tlv_response(context, response);
+                send_tlv_response(context, &response);
             }
             
             break;
@@ -3123,7 +4102,6 @@ void homekit_server_on_pairings(client_context_t *context, const byte *data, siz
         }
     }
 
-    tlv_free(message);
 }
 
 void homekit_server_on_reset(client_context_t *context) {
@@ -3175,9 +4153,10 @@ int homekit_server_on_url(http_parser *parser, const char *data, size_t length)
             {
                 context->endpoint = HOMEKIT_ENDPOINT_GET_CHARACTERISTICS;
                 if (data[url_len] == '?') {
-                    char *query = strndup(data + url_len + 1, length - url_len - 1);
-                    context->endpoint_params = query_params_parse(query);
-                    free(query);
+                    char *query = request_strndup(context, data + url_len + 1, length - url_len - 1);
+                    if (query) {
+                        context->endpoint_params = query_params_parse(query, request_params_alloc, context);
+                    }
                 }
             }
         }
@@ -3215,7 +4194,7 @@ int homekit_server_on_url(http_parser *parser, const char *data, size_t length)
 
 int homekit_server_on_body(http_parser *parser, const char *data, size_t length) {
     client_context_t *context = parser->data;
-    char* new_body = realloc(context->body, context->body_length + length + 1);
+    char* new_body = request_realloc(context, context->body, context->body_length ? context->body_length + 1 : 0, context->body_length + length + 1);
     if (!new_body) {
         CLIENT_ERROR(context, "Body");
         return -1;
@@ -3228,16 +4207,16 @@ int homekit_server_on_body(http_parser *parser, const char *data, size_t length)
     return 0;
 }
 
-int homekit_server_on_message_complete(http_parser *parser) {
-    client_context_t *context = parser->data;
+static void homekit_server_on_request(client_context_t *context) {
+    const uint32_t start_time = sdk_system_get_time_raw();
     
     switch(context->endpoint) {
         case HOMEKIT_ENDPOINT_PAIR_SETUP: {
-            homekit_server_on_pair_setup(context, (const byte *)context->body, context->body_length);
+            homekit_server_on_pair_setup(context, (byte *)context->body, context->body_length);
             break;
         }
         case HOMEKIT_ENDPOINT_PAIR_VERIFY: {
-            homekit_server_on_pair_verify(context, (const byte *)context->body, context->body_length);
+            homekit_server_on_pair_verify(context, (byte *)context->body, context->body_length);
             break;
         }
         case HOMEKIT_ENDPOINT_IDENTIFY: {
@@ -3260,13 +4239,13 @@ int homekit_server_on_message_complete(http_parser *parser) {
         }
         case HOMEKIT_ENDPOINT_UPDATE_CHARACTERISTICS: {
             if (context->encrypted || homekit_server->config->insecure) {
-                homekit_server_on_update_characteristics(context, (const byte *)context->body, context->body_length);
+                homekit_server_on_update_characteristics(context, (byte *)context->body, context->body_length);
             }
             break;
         }
         case HOMEKIT_ENDPOINT_PAIRINGS: {
             if (context->encrypted || homekit_server->config->insecure) {
-                homekit_server_on_pairings(context, (const byte *)context->body, context->body_length);
+                homekit_server_on_pairings(context, (byte *)context->body, context->body_length);
             }
             break;
         }
@@ -3290,18 +4269,27 @@ int homekit_server_on_message_complete(http_parser *parser) {
             break;
         }
     }
-
-    if (context->endpoint_params) {
-        query_params_free(context->endpoint_params);
-        context->endpoint_params = NULL;
+    
+    homekit_request_stats_t *stats = &homekit_server->request_stats[context->endpoint];
+    const uint32_t time = sdk_system_get_time_raw() - start_time;
+    stats->count++;
+    stats->time_total += time;
+    if (time > stats->time_max) {
+        stats->time_max = time;
     }
-
-    if (context->body) {
-        free(context->body);
-        context->body = NULL;
-        context->body_length = 0;
+    
+    const uint32_t free_heap = xPortGetFreeHeapSize();
+    if (!homekit_server->request_heap_min || free_heap < homekit_server->request_heap_min) {
+        homekit_server->request_heap_min = free_heap;
     }
 
+    request_reset(context);
+}
+
+// Parser stops after each request, which is handled once rest of received data is kept aside
+int homekit_server_on_message_complete(http_parser *parser) {
+    http_parser_pause(parser, 1);
+    
     return 0;
 }
 
@@ -3320,16 +4308,16 @@ static inline void homekit_client_process(client_context_t *context) {
     
     if (data_len > 0) {
         CLIENT_DEBUG(context, "Got %d incomming data", data_len);
+        context->last_activity = xTaskGetTickCount();
         byte *payload = (byte*) homekit_server->data;
         size_t payload_size = (size_t) data_len;
         CLIENT_DEBUG(context, "Received Payload:\n%s", (char*) payload);
         
-        size_t decrypted_size = sizeof(homekit_server->data) - 16 - 2;
-        
         if (context->encrypted) {
             CLIENT_DEBUG(context, "Decrypting data");
             
-            int r = client_decrypt(context, homekit_server->data, data_len, homekit_server->data + 2, &decrypted_size);
+            size_t decrypted_size = 0;
+            int r = client_decrypt(context, homekit_server->data, data_len, &decrypted_size);
             if (r < 0) {
                 CLIENT_ERROR(context, "Client data");
                 return;
@@ -3345,9 +4333,44 @@ static inline void homekit_client_process(client_context_t *context) {
             }
         }
         
-        http_parser_execute(context->parser, &homekit_http_parser_settings,
-                            (char*) payload, payload_size
-                            );
+        // Responses are staged over payload, so data of pipelined requests after a complete one
+        // is copied to heap while it is handled, and put back once its response is sent
+        while (payload_size > 0) {
+            size_t parsed = http_parser_execute(context->parser, &homekit_http_parser_settings,
+                                                (char*) payload, payload_size
+                                                );
+            if (HTTP_PARSER_ERRNO(context->parser) != HPE_PAUSED) {
+                break;
+            }
+            
+            http_parser_pause(context->parser, 0);
+            payload += parsed;
+            payload_size -= parsed;
+            
+            byte *pipelined = NULL;
+            if (payload_size > 0) {
+                pipelined = malloc(payload_size);
+                if (!pipelined) {
+                    CLIENT_ERROR(context, "Pipelined DRAM");
+                    homekit_disconnect_client(context);
+                    return;
+                }
+                
+                memcpy(pipelined, payload, payload_size);
+            }
+            
+            homekit_server_on_request(context);
+            
+            if (pipelined) {
+                client_send_flush(context);
+                
+                payload = homekit_server->data + 2;
+                memcpy(payload, pipelined, payload_size);
+                free(pipelined);
+            }
+        }
+        
+        client_send_flush(context);
         
     } else if (data_len == 0) {
         CLIENT_INFO(context, "Closing");
@@ -3370,8 +4393,15 @@ void homekit_server_close_client(client_context_t *context) {
         homekit_server->client_count--;
     }
     
+    if (context->send_queue) {
+        client_send_queue_drain(context);
+        client_send_queue_free(context);
+    }
+    
     close(context->socket);
     
+    client_send_discard(context);
+    
     CLIENT_INFO(context, "Closed %i/%i", homekit_server->client_count, homekit_server->config->max_clients);
     
     if (homekit_server->pairing_context && homekit_server->pairing_context->client == context) {
@@ -3379,7 +4409,9 @@ void homekit_server_close_client(client_context_t *context) {
         homekit_server->pairing_context = NULL;
     }
     
-    homekit_accessories_clear_notify_subscriptions(homekit_server->config->accessories, context);
+    homekit_accessories_clear_notify_subscriptions(homekit_server->config->accessories, context->slot);
+    event_states_clear_client(context->slot);
+    homekit_server->client_slots &= ~(1U << context->slot);
     
     HOMEKIT_NOTIFY_EVENT(homekit_server, HOMEKIT_EVENT_CLIENT_DISCONNECTED);
 
@@ -3387,6 +4419,17 @@ void homekit_server_close_client(client_context_t *context) {
 }
 
 
+static int homekit_server_client_slot_new() {
+    for (unsigned int i = 0; i < 32; i++) {
+        if (!(homekit_server->client_slots & (1U << i))) {
+            homekit_server->client_slots |= (1U << i);
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
 static inline void homekit_server_accept_client() {
     int s = accept(homekit_server->listen_fd, (struct sockaddr*) NULL, (socklen_t*) NULL);
     if (s < 0) {
@@ -3406,7 +4449,39 @@ static inline void homekit_server_accept_client() {
         return;
     }
     
-    client_context_t* new_context = client_context_new();
+    // Clients marked to disconnect are closed first, so client_count only counts clients which stay
+    homekit_server_close_clients();
+    
+    // A new client on a full server, or whose predicted heap cost does not fit, makes room first
+    // by evicting another client, or is refused when only clients which must stay are connected
+    bool admit = true;
+    if (homekit_server->client_count >= homekit_server->config->max_clients) {
+        admit = homekit_server_evict_client(NULL, HOMEKIT_CLIENT_EVICTION_MAX_CLIENTS);
+    } else if (homekit_server->client_count >= HOMEKIT_MIN_CLIENTS &&
+               xPortGetFreeHeapSize() < HOMEKIT_MIN_FREEHEAP + homekit_client_heap_cost()) {
+        admit = homekit_server_evict_client(NULL, HOMEKIT_CLIENT_EVICTION_HEAP);
+    }
+    
+    if (admit) {
+        // Evicted client is closed before new one is counted
+        homekit_server_close_clients();
+    } else {
+        close(s);
+        homekit_server->clients_refused++;
+        HOMEKIT_ERROR("[%i] Refused %s:%d %i/%i HEAP %"HK_LONGINT_F, s, address_buffer, addr.sin_port, homekit_server->client_count, homekit_server->config->max_clients, (uint_fast32_t) xPortGetFreeHeapSize());
+        return;
+    }
+    
+    client_context_t* new_context = NULL;
+    const int slot = homekit_server_client_slot_new();
+    if (slot >= 0) {
+        new_context = client_context_new();
+        if (new_context) {
+            new_context->slot = slot;
+        } else {
+            homekit_server->client_slots &= ~(1U << slot);
+        }
+    }
     
     const uint_fast32_t free_heap = xPortGetFreeHeapSize();
     
@@ -3416,9 +4491,6 @@ static inline void homekit_server_accept_client() {
         setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
         */
         
-        const struct timeval sndtimeout = { 3, 0 };
-        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &sndtimeout, sizeof(sndtimeout));
-        
         const struct timeval rcvtimeout = { 13, 0 };
         setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &rcvtimeout, sizeof(rcvtimeout));
         
@@ -3426,6 +4498,7 @@ static inline void homekit_server_accept_client() {
         setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
 
         new_context->socket = s;
+        new_context->last_activity = xTaskGetTickCount();
         new_context->next = homekit_server->clients;
 
         homekit_server->clients = new_context;
@@ -3446,105 +4519,291 @@ static inline void homekit_server_accept_client() {
         HOMEKIT_ERROR("[%i] DRAM %s:%d %i/%i HEAP %"HK_LONGINT_F, s, address_buffer, addr.sin_port, homekit_server->client_count, homekit_server->config->max_clients, free_heap);
     }
     
-    if (homekit_server->client_count >= homekit_server->config->max_clients || !new_context) {
-        homekit_remove_oldest_client();
+    if (!new_context) {
+        homekit_server_evict_client(NULL, HOMEKIT_CLIENT_EVICTION_LOW_DRAM);
+    }
+}
+
+#if LWIP_NETIF_LOOPBACK
+static void homekit_server_wakeup_init() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        HOMEKIT_ERROR("Wakeup socket");
+        return;
+    }
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    
+    socklen_t addr_len = sizeof(addr);
+    
+    // Socket is connected to itself, so send() from notify reaches its own select() read set
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        getsockname(fd, (struct sockaddr*) &addr, &addr_len) < 0 ||
+        connect(fd, (struct sockaddr*) &addr, addr_len) < 0) {
+        HOMEKIT_ERROR("Wakeup socket");
+        close(fd);
+        return;
+    }
+    
+    homekit_server->wakeup_fd = fd;
+    
+    FD_SET(fd, &homekit_server->fds);
+    if (fd > homekit_server->max_fd) {
+        homekit_server->max_fd = fd;
+    }
+}
+
+static void homekit_server_wakeup() {
+    if (homekit_server->wakeup_fd >= 0 && !homekit_server->wakeup_pending) {
+        homekit_server->wakeup_pending = true;
+        
+        // A datagram lost for lack of pbufs must not stop next wakeups
+        const byte signal = 0;
+        if (send(homekit_server->wakeup_fd, &signal, sizeof(signal), MSG_DONTWAIT) < 0) {
+            homekit_server->wakeup_pending = false;
+        }
     }
 }
 
+static void homekit_server_wakeup_clear() {
+    homekit_server->wakeup_pending = false;
+    
+    byte signal[8];
+    while (recv(homekit_server->wakeup_fd, signal, sizeof(signal), MSG_DONTWAIT) > 0);
+}
+#endif // LWIP_NETIF_LOOPBACK
+
 void homekit_characteristic_notify(homekit_characteristic_t *ch) {
-    if (homekit_server) {
-        notification_t* notification = homekit_server->notifications;
-        if (notification) {
-            for (;;) {
-                if (notification->ch == ch) {
-                    return;
-                }
-                
-                if (notification->next) {
-                    notification = notification->next;
-                } else {
-                    break;
-                }
+    if (homekit_server && ch->ordinal && ch->ordinal <= homekit_server->notify_count) {
+        if (homekit_server->notify_pending[ch->ordinal]) {
+            // Value is read when event is rendered, so pending event will carry this change too
+            homekit_server->events_coalesced++;
+            return;
+        }
+        
+        homekit_server->notify_pending[ch->ordinal] = true;
+        homekit_server->notify_pending_any = true;
+        
+        homekit_server_wakeup();
+    }
+}
+
+typedef struct {
+    byte *data;
+    size_t size;
+    uint32_t clients_up_to_date;    // Clients which already got every value in event
+} event_buffer_t;
+
+static int event_buffer_append_chunk(byte *data, size_t size, void *arg) {
+    event_buffer_t *event = arg;
+    
+    char header[9];
+    int header_size = snprintf(header, sizeof(header), "%x\r\n", size);
+    
+    byte *new_data = realloc(event->data, event->size + header_size + size + 2);
+    if (!new_data) {
+        HOMEKIT_ERROR("Ev buffer DRAM");
+        return -1;
+    }
+    
+    event->data = new_data;
+    
+    memcpy(event->data + event->size, header, header_size);
+    event->size += header_size;
+    
+    if (size > 0) {
+        memcpy(event->data + event->size, data, size);
+        event->size += size;
+    }
+    
+    event->data[event->size++] = '\r';
+    event->data[event->size++] = '\n';
+    
+    return 0;
+}
+
+#define notify_batch_get(ordinal)       (homekit_server->notify_batch[(ordinal) >> 3] & (1 << ((ordinal) & 7)))
+#define notify_batch_set(ordinal)       homekit_server->notify_batch[(ordinal) >> 3] |= (1 << ((ordinal) & 7))
+
+// Moves pending notifications to batch. Pending flag is cleared before value is rendered,
+// so a notify racing with this only causes one more event, never a lost one.
+// Returns bitmask of client slots subscribed to any batched characteristic
+static uint32_t homekit_server_take_notifications() {
+    uint32_t subscriptions = 0;
+    const TickType_t now = xTaskGetTickCount();
+    
+    homekit_server->notify_pending_any = false;
+    homekit_server->notify_deferred = false;
+    memset(homekit_server->notify_batch, 0, (homekit_server->notify_count >> 3) + 1);
+    
+    for (unsigned int ordinal = 1; ordinal <= homekit_server->notify_count; ordinal++) {
+        if (!homekit_server->notify_pending[ordinal]) {
+            continue;
+        }
+        
+        homekit_characteristic_t *ch = homekit_characteristic_by_ordinal(ordinal);
+        
+        if (homekit_server->event_states) {
+            const event_policy_t policy = event_policy_check(&homekit_server->event_states[ordinal - 1], ch,
+                                                             ch->min_event_interval / portTICK_PERIOD_MS, now);
+            if (policy == event_policy_defer) {
+                homekit_server->notify_deferred = true;
+                continue;
             }
+            
+            homekit_server->notify_pending[ordinal] = false;
+            
+            if (policy == event_policy_suppress) {
+                homekit_server->events_suppressed++;
+                continue;
+            }
+        } else {
+            homekit_server->notify_pending[ordinal] = false;
+        }
+        
+        notify_batch_set(ordinal);
+        subscriptions |= ch->subscriptions;
+    }
+    
+    return subscriptions;
+}
+
+// Records which clients got rendered values, for event policy
+static void homekit_server_update_event_states(const uint32_t clients) {
+    const TickType_t now = xTaskGetTickCount();
+    
+    for (unsigned int ordinal = 1; ordinal <= homekit_server->notify_count; ordinal++) {
+        if (notify_batch_get(ordinal)) {
+            event_policy_sent(&homekit_server->event_states[ordinal - 1],
+                              homekit_characteristic_by_ordinal(ordinal)->subscriptions & clients, now);
+        }
+    }
+}
+
+// Event body does not depend on the client, so it is rendered only once as a complete
+// chunked HTTP message and then sent to every subscribed client, which only pays for encryption.
+static int homekit_server_render_notifications(event_buffer_t *event) {
+    const byte http_headers[] =
+        "EVENT/1.0 200 OK\r\n"
+        "Content-Type: application/hap+json\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n";
+    
+    event->size = sizeof(http_headers) - 1;
+    event->data = malloc(event->size);
+    if (!event->data) {
+        HOMEKIT_ERROR("Ev buffer DRAM");
+        return -1;
+    }
+    
+    memcpy(event->data, http_headers, event->size);
+    
+    event->clients_up_to_date = UINT32_MAX;
+    
+    // Nothing is staged between client requests, so data buffer is free
+    json_stream* json = &homekit_server->json;
+    json_init(json, event);
+    json->buffer = homekit_server->data;
+    json->size = HOMEKIT_JSON_BUFFER_SIZE;
+    json->on_flush = event_buffer_append_chunk;
+    
+    json_object_start(json);
+    json_string(json, "characteristics"); json_array_start(json);
+    
+    for (unsigned int ordinal = 1; ordinal <= homekit_server->notify_count; ordinal++) {
+        if (!notify_batch_get(ordinal)) {
+            continue;
         }
         
-        notification_t* notification_new = calloc(1, sizeof(notification_t));
+        homekit_characteristic_t *ch = homekit_characteristic_by_ordinal(ordinal);
+        if (!ch->subscriptions) {
+            continue;
+        }
         
-        notification_new->ch = ch;
+        homekit_value_t *value = &ch->value;
         
-        if (notification) {
-            notification->next = notification_new;
+        // Value can be changed by other tasks, so state keeps exactly what is sent
+        if (homekit_server->event_states) {
+            event_state_t *state = &homekit_server->event_states[ordinal - 1];
+            value = event_policy_render(state, value);
+            event->clients_up_to_date &= event_policy_clients_up_to_date(state, ch);
         } else {
-            homekit_server->notifications = notification_new;
+            event->clients_up_to_date = 0;
+        }
+        
+        json_object_start(json);
+        write_characteristic_json(json, NULL, ch, 0, value, 0);
+        json_object_end(json);
+        
+        if (json->error) {
+            break;
         }
     }
+    
+    json_array_end(json);
+    json_object_end(json);
+    
+    json_flush(json);
+    
+    if (json->error || event_buffer_append_chunk(NULL, 0, event) < 0) {
+        HOMEKIT_ERROR("Ev JSON");
+        free(event->data);
+        event->data = NULL;
+        return -1;
+    }
+    
+    return 0;
 }
 
 static inline void IRAM homekit_server_process_notifications() {
-    notification_t *notifications = homekit_server->notifications;
-    homekit_server->notifications = NULL;
+    const uint32_t subscriptions = homekit_server_take_notifications();
+    uint32_t clients = 0;
     
-    client_context_t *context = homekit_server->clients;
-    while (context) {
-        notification_t *notification = notifications;
-        while (notification) {
-            if (homekit_characteristic_has_notify_subscription(notification->ch, context)) {
-                CLIENT_INFO(context, "Send Ev");
-                DEBUG_HEAP();
-                
-                json_stream* json = &homekit_server->json;
-                json_init(json, context);
-                
-                byte http_headers[] =
-                    "EVENT/1.0 200 OK\r\n"
-                    "Content-Type: application/hap+json\r\n"
-                    "Transfer-Encoding: chunked\r\n\r\n";
-                
-                if (client_send(context, http_headers, sizeof(http_headers) - 1) < 0) {
-                    json->error = true;
-                }
-                
-                json_object_start(json);
-                json_string(json, "characteristics"); json_array_start(json);
-                
-                notification = notifications;
-                while (notification) {
-                    json_object_start(json);
-                    write_characteristic_json(json, context, notification->ch, 0, &notification->ch->value, 0);
-                    json_object_end(json);
-                    
-                    if (json->error) {
-                        break;
-                    }
-                    
-                    notification = notification->next;
-                }
-                
-                json_array_end(json);
-                json_object_end(json);
-                
-                json_flush(json);
-                
-                if (json->error) {
-                    CLIENT_ERROR(context, "JSON");
-                }
-                
-                client_send_chunk(NULL, 0, context);
-                
-                break;
-            }
-
-            notification = notification->next;
+    event_buffer_t event = { NULL, 0, 0 };
+    
+    for (client_context_t *context = homekit_server->clients; context; context = context->next) {
+        if (!(subscriptions & (1U << context->slot))) {
+            continue;
         }
         
-        context = context->next;
+        if (!event.data && homekit_server_render_notifications(&event) < 0) {
+            break;
+        }
+        
+        // Event is sent again only to clients which missed a value, as when their events were dropped
+        if (event.clients_up_to_date & (1U << context->slot)) {
+            continue;
+        }
+        
+        // Slow client: its queue would only grow, and waiting for it would delay everyone else
+        if (context->send_queue &&
+            (context->send_queue_size + event.size > HOMEKIT_SEND_QUEUE_CLIENT_SIZE / 2 ||
+             homekit_server->send_queue_size + event.size > HOMEKIT_SEND_QUEUE_BUDGET)) {
+            homekit_server->event_drops++;
+            CLIENT_ERROR(context, "Ev dropped, queue %i", context->send_queue_size);
+            
+        } else {
+            CLIENT_INFO(context, "Send Ev");
+            DEBUG_HEAP();
+            
+            if (client_send(context, event.data, event.size) < 0) {
+                homekit_disconnect_client(context);
+            } else {
+                homekit_server->events_emitted++;
+                clients |= (1U << context->slot);
+            }
+        }
     }
     
-    // Remove sent notifications
-    while (notifications) {
-        notification_t* notification_old = notifications;
-        notifications = notifications->next;
-        free(notification_old);
+    if (event.data) {
+        free(event.data);
+        
+        if (homekit_server->event_states) {
+            homekit_server_update_event_states(clients);
+        }
     }
 }
 
@@ -3553,6 +4812,11 @@ static inline void homekit_server_close_clients() {
         homekit_server->pending_close = false;
         
         int max_fd = homekit_server->listen_fd;
+#if LWIP_NETIF_LOOPBACK
+        if (homekit_server->wakeup_fd > max_fd) {
+            max_fd = homekit_server->wakeup_fd;
+        }
+#endif
 
         client_context_t head;
         head.next = homekit_server->clients;
@@ -3603,21 +4867,79 @@ static void IRAM homekit_run_server() {
     FD_SET(homekit_server->listen_fd, &homekit_server->fds);
     homekit_server->max_fd = homekit_server->listen_fd;
     
+#if LWIP_NETIF_LOOPBACK
+    homekit_server_wakeup_init();
+#endif
+    
     struct timeval timeout = { 0, 80000 }; /* 0.08 seconds timeout (orig: 1s) */
+#if LWIP_NETIF_LOOPBACK
+    struct timeval idle_timeout = { HOMEKIT_IDLE_TIMEOUT / 1000, (HOMEKIT_IDLE_TIMEOUT % 1000) * 1000 };
+#endif
+    struct timeval *select_timeout;
     int triggered_nfds;
     fd_set read_fds;
+    fd_set write_fds;
     
     for (;;) {
         memcpy(&read_fds, &homekit_server->fds, sizeof(read_fds));
         
-        triggered_nfds = select(homekit_server->max_fd + 1, &read_fds, NULL, NULL, &timeout);
+        FD_ZERO(&write_fds);
+        bool pending_writes = false;
+        client_context_t *context = homekit_server->clients;
+        while (context) {
+            if (context->send_queue) {
+                FD_SET(context->socket, &write_fds);
+                pending_writes = true;
+            }
+            
+            context = context->next;
+        }
+        
+        // With wakeup socket, notifications do not need polling, and server only waits long while idle
+        select_timeout = &timeout;
+#if LWIP_NETIF_LOOPBACK
+        if (homekit_server->wakeup_fd >= 0 && !homekit_server->notify_deferred
+#if HOMEKIT_CURVE25519_POOL_SIZE > 0
+            && (!homekit_server->paired || curve25519_pool_full())
+#endif
+#if HOMEKIT_SRP_PRECOMPUTE > 0
+            && (homekit_server->paired || homekit_server->pairing_context || homekit_server->srp_precomputed)
+#endif
+            ) {
+            select_timeout = &idle_timeout;
+        }
+#endif
+        
+        triggered_nfds = select(homekit_server->max_fd + 1, &read_fds, pending_writes ? &write_fds : NULL, NULL, select_timeout);
         if (triggered_nfds > 0) {
+#if LWIP_NETIF_LOOPBACK
+            if (homekit_server->wakeup_fd >= 0 && FD_ISSET(homekit_server->wakeup_fd, &read_fds)) {
+                homekit_server_wakeup_clear();
+                triggered_nfds--;
+            }
+#endif
+            
+
+            if (pending_writes) {
+                context = homekit_server->clients;
+                while (context && triggered_nfds) {
+                    if (FD_ISSET(context->socket, &write_fds)) {
+                        if (client_send_queue_drain(context) < 0) {
+                            homekit_disconnect_client(context);
+                        }
+                        triggered_nfds--;
+                    }
+                    
+                    context = context->next;
+                }
+            }
+            
             if (FD_ISSET(homekit_server->listen_fd, &read_fds)) {
                 homekit_server_accept_client();
                 triggered_nfds--;
             }
             
-            client_context_t *context = homekit_server->clients;
+            context = homekit_server->clients;
             while (context && triggered_nfds) {
                 if (FD_ISSET(context->socket, &read_fds)) {
                     homekit_client_process(context);
@@ -3628,15 +4950,36 @@ static void IRAM homekit_run_server() {
             }
             
             if (homekit_low_dram()) {
-                homekit_remove_oldest_client();
+                homekit_server_evict_client(NULL, HOMEKIT_CLIENT_EVICTION_LOW_DRAM);
             }
             
             homekit_server_close_clients();
         }
+#if HOMEKIT_CURVE25519_POOL_SIZE > 0
+        else if (triggered_nfds == 0 && homekit_server->paired && !homekit_server->notify_pending_any &&
+                 xPortGetFreeHeapSize() > HOMEKIT_NETWORK_MIN_FREEHEAP) {
+            curve25519_pool_fill();
+        }
+#endif
+#if HOMEKIT_SRP_PRECOMPUTE > 0
+        else if (triggered_nfds == 0 && !homekit_server->paired && !homekit_server->pairing_context &&
+                 !homekit_server->srp_precomputed && xPortGetFreeHeapSize() > HOMEKIT_NETWORK_MIN_FREEHEAP) {
+            srp_precompute();
+        }
+#endif
         
-        if (homekit_server->notifications) {
+        // Requests from other tasks are served even when no socket is ready
+        if (homekit_server->evict_requested) {
+            homekit_server->evict_requested = false;
+            homekit_server_evict_client(NULL, HOMEKIT_CLIENT_EVICTION_LOW_DRAM);
+        }
+        
+        if (homekit_server->notify_pending_any || homekit_server->notify_deferred) {
             homekit_server_process_notifications();
         }
+        
+        // Clients disconnected by eviction requests or event sends
+        homekit_server_close_clients();
     }
     
     //server_free();
@@ -3725,8 +5068,8 @@ void homekit_setup_mdns() {
     snprintf(data, data_size, "%s%s", homekit_server->config->setup_id, homekit_server->accessory_id);
     //data[data_size - 1] = 0;
     
-    unsigned char shaHash[SHA512_DIGEST_SIZE];
-    wc_Sha512Hash((const unsigned char*) data, data_size - 1, shaHash);
+    byte shaHash[SHA512_HASH_SIZE];
+    crypto_sha512((const byte *) data, data_size - 1, shaHash);
     
     free(data);
     free(homekit_server->config->setup_id);
@@ -3734,8 +5077,7 @@ void homekit_setup_mdns() {
     unsigned char encodedHash[9];
     memset(encodedHash, 0, sizeof(encodedHash));
     
-    word32 len = sizeof(encodedHash);
-    Base64_Encode_NoNl((const unsigned char *)shaHash, 4, encodedHash, &len);
+    base64_encode(shaHash, 4, encodedHash);
     
     homekit_mdns_add_txt("sh", "%s", encodedHash);
     
@@ -3795,6 +5137,10 @@ void homekit_server_init(homekit_server_config_t *config) {
     homekit_server = server_new();
     homekit_server->config = config;
     
+#ifdef HOMEKIT_ACCESSORIES_TEMPLATE
+    homekit_server_accessories_template_build();
+#endif
+    
     if (homekit_server->config->max_clients == 0) {
         homekit_server->config->max_clients = HOMEKIT_MAX_CLIENTS_DEFAULT;
     }
@@ -3816,6 +5162,8 @@ void homekit_server_init(homekit_server_config_t *config) {
         HOMEKIT_INFO("HK ID: %s", homekit_server->accessory_id);
     }
     
+    homekit_server->accessory_signing_key = crypto_ed25519_expand(homekit_server->accessory_key);
+    
     if (!homekit_server->config->re_pair) {
         pairing_iterator_t *pairing_it = homekit_storage_pairing_iterator();
         pairing_t *pairing = NULL;
@@ -3848,10 +5196,18 @@ void homekit_server_init(homekit_server_config_t *config) {
 
 void homekit_server_reset() {
     homekit_storage_reset();
+    
+    if (homekit_server) {
+        pair_resume_sessions_clear();
+    }
 }
 
 void homekit_remove_extra_pairing(const unsigned int last_keep) {
     homekit_storage_remove_extra_pairing(last_keep);
+    
+    if (homekit_server) {
+        pair_resume_sessions_clear();
+    }
 }
 
 unsigned int homekit_pairing_count() {
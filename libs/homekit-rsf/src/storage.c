@@ -34,6 +34,9 @@
 
 const char magic1[] = "HAP";    // Must be size of 4 (3 chars + null terminator)
 
+static void pairings_cache_clear();
+static void pairings_cache_load();
+
 #ifdef ESP_PLATFORM
 esp_partition_t* hap_partition = NULL;
 
@@ -65,6 +68,8 @@ int homekit_storage_reset() {
     char magic[sizeof(magic1)];
     strncpy(magic, magic1, sizeof(magic));
     
+    pairings_cache_clear();
+    
     if (!spiflash_write(MAGIC_ADDR, (byte*) magic, sizeof(magic))) {
         ERROR("Init sec");
         return -2;
@@ -88,6 +93,8 @@ int homekit_storage_init() {
         return homekit_storage_reset();
     }
     
+    pairings_cache_load();
+    
     return 0;
 }
 
@@ -169,14 +176,179 @@ typedef struct {
                                     // Align record to be 80 bytes!!!
 } pairing_data_t;
 
+// RAM mirror of pairing records, indexed by flash block, so lookups never read flash.
+// It is loaded by homekit_storage_init() and written through on every change. Records
+// which did not fit in DRAM are read again from flash on next lookup.
+typedef struct {
+    uint32_t device_id_hash;
+    byte permissions;
+    char device_id[36];
+    byte device_public_key[32];
+    ed25519_key *device_key;        // Imported on first use, and lent to pairings
+} pairing_cache_t;
+
+static pairing_cache_t *pairings_cache[MAX_PAIRINGS];
+static uint64_t pairings_blocks_used = 0;   // Blocks not erased in flash, including removed ones
+static bool pairings_cache_loaded = false;
+
+static uint32_t device_id_hash(const char *device_id) {
+    // FNV-1a
+    uint32_t hash = 2166136261UL;
+    for (unsigned int i = 0; i < sizeof(((pairing_data_t *) 0)->device_id) && device_id[i]; i++) {
+        hash ^= (byte) device_id[i];
+        hash *= 16777619UL;
+    }
+    
+    return hash;
+}
 
-bool homekit_storage_can_add_pairing() {
+static void pairings_cache_remove(const unsigned int idx) {
+    if (pairings_cache[idx]) {
+        if (pairings_cache[idx]->device_key) {
+            crypto_ed25519_free(pairings_cache[idx]->device_key);
+        }
+        
+        free(pairings_cache[idx]);
+        pairings_cache[idx] = NULL;
+    }
+}
+
+static void pairings_cache_clear() {
+    for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
+        pairings_cache_remove(i);
+    }
+    
+    pairings_blocks_used = 0;
+    pairings_cache_loaded = true;
+}
+
+static int pairings_cache_set(const unsigned int idx, const pairing_data_t *data) {
+    pairing_cache_t *pairing_cache = pairings_cache[idx];
+    if (!pairing_cache) {
+        pairing_cache = malloc(sizeof(pairing_cache_t));
+        if (!pairing_cache) {
+            // Block stays reserved, and record is loaded again from flash on next lookup
+            ERROR("Pairing %i cache DRAM", idx);
+            pairings_blocks_used |= ((uint64_t) 1) << idx;
+            pairings_cache_loaded = false;
+            return -1;
+        }
+        
+        pairings_cache[idx] = pairing_cache;
+        
+    } else if (pairing_cache->device_key) {
+        crypto_ed25519_free(pairing_cache->device_key);
+    }
+    
+    pairing_cache->device_key = NULL;
+    
+    memcpy(pairing_cache->device_id, data->device_id, sizeof(pairing_cache->device_id));
+    memcpy(pairing_cache->device_public_key, data->device_public_key, sizeof(pairing_cache->device_public_key));
+    pairing_cache->permissions = data->permissions;
+    pairing_cache->device_id_hash = device_id_hash(pairing_cache->device_id);
+    
+    pairings_blocks_used |= ((uint64_t) 1) << idx;
+    
+    return 0;
+}
+
+// Only records missing in mirror are read, so pairings lent by it stay valid
+static void pairings_cache_load() {
+    if (pairings_cache_loaded) {
+        return;
+    }
+    
+    pairings_cache_loaded = true;
+    
     pairing_data_t data;
     for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
+        if (pairings_cache[i]) {
+            continue;
+        }
+        
         if (spiflash_read(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-            if (strncmp(data.magic, magic1, sizeof(magic1))) {
-                return true;
+            if (!strncmp(data.magic, magic1, sizeof(magic1))) {
+                if (pairings_cache_set(i, &data) < 0) {
+                    ERROR("Pairing %i left in flash", i);
+                }
+                continue;
             }
+            
+            for (unsigned int j = 0; j < sizeof(data); j++) {
+                if (((byte *) &data)[j] != 0xff) {
+                    pairings_blocks_used |= ((uint64_t) 1) << i;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static int pairings_cache_find(const char *device_id) {
+    pairings_cache_load();
+    
+    const uint32_t hash = device_id_hash(device_id);
+    
+    for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
+        const pairing_cache_t *pairing_cache = pairings_cache[i];
+        if (pairing_cache && pairing_cache->device_id_hash == hash &&
+            !strncmp(pairing_cache->device_id, device_id, sizeof(pairing_cache->device_id))) {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+static pairing_t *pairings_cache_get(const unsigned int idx) {
+    pairing_cache_t *pairing_cache = pairings_cache[idx];
+    
+    if (!pairing_cache->device_key) {
+        ed25519_key *device_key = crypto_ed25519_new();
+        if (!device_key) {
+            ERROR("Dev pub key DRAM");
+            return NULL;
+        }
+        
+        int r = crypto_ed25519_import_public_key(device_key, pairing_cache->device_public_key, sizeof(pairing_cache->device_public_key));
+        if (r) {
+            ERROR("Import dev pub key (%d)", r);
+            crypto_ed25519_free(device_key);
+            return NULL;
+        }
+        
+        pairing_cache->device_key = device_key;
+    }
+    
+    pairing_t *pairing = pairing_new();
+    pairing->id = idx;
+    pairing->device_id = strndup(pairing_cache->device_id, sizeof(pairing_cache->device_id));
+    pairing->device_key = pairing_cache->device_key;
+    pairing->device_key_shared = true;
+    pairing->permissions = pairing_cache->permissions;
+    
+    return pairing;
+}
+
+static int pairing_erase(const unsigned int idx) {
+    pairing_data_t data;
+    memset(&data, 0, sizeof(data));
+    if (!spiflash_write(PAIRINGS_ADDR + sizeof(data) * idx, (byte *)&data, sizeof(data))) {
+        return -1;
+    }
+    
+    pairings_cache_remove(idx);
+    
+    return 0;
+}
+
+
+bool homekit_storage_can_add_pairing() {
+    pairings_cache_load();
+    
+    for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
+        if (!pairings_cache[i]) {
+            return true;
         }
     }
     return false;
@@ -206,6 +378,7 @@ static int compact_data() {
 
     if (next_pairing_idx == MAX_PAIRINGS) {
         // We are full, no compaction possible, do not waste flash erase cycle
+        free(data);
         return 0;
     }
 
@@ -220,27 +393,21 @@ static int compact_data() {
         free(data);
         return -1;
     }
+    
+    for (unsigned int i = 0; i < next_pairing_idx; i++) {
+        if (pairings_cache_set(i, (pairing_data_t *)&data[PAIRINGS_OFFSET + sizeof(pairing_data_t) * i]) < 0) {
+            ERROR("Pairing %i left in flash", i);
+        }
+    }
 
     free(data);
     return 0;
 }
 
 static int find_empty_block() {
-    byte data[sizeof(pairing_data_t)];
-
     for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
-        if (spiflash_read(PAIRINGS_ADDR + sizeof(data) * i, data, sizeof(data))) {
-            
-            bool block_empty = true;
-            for (unsigned int j = 0; j < sizeof(data); j++)
-                if (data[j] != 0xff) {
-                    block_empty = false;
-                    break;
-                }
-            
-            if (block_empty) {
-                return i;
-            }
+        if (!(pairings_blocks_used & (((uint64_t) 1) << i))) {
+            return i;
         }
     }
 
@@ -280,56 +447,39 @@ int homekit_storage_add_pairing(const char *device_id, const ed25519_key *device
         return -1;
     }
     
+    // Pairing is saved; a failed cache entry is read again from flash on next lookup
+    if (pairings_cache_set(next_block_idx, &data) < 0) {
+        ERROR("Pairing %i left in flash", next_block_idx);
+    }
+    
     return 0;
 }
 
 
 int homekit_storage_update_pairing(const char *device_id, const ed25519_key *device_key, byte permissions) {
-    pairing_data_t data;
-    for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
-        if (spiflash_read(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-            if (strncmp(data.magic, magic1, sizeof(magic1))) {
-                continue;
-            }
-            
-            if (!strncmp(data.device_id, device_id, sizeof(data.device_id))) {
-                if (data.permissions != permissions) {
-                    memset(&data, 0, sizeof(data));
-                    if (!spiflash_write(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-                        ERROR("Erase old pairing");
-                        return -2;
-                    }
-                    
-                    return homekit_storage_add_pairing(device_id, device_key, permissions);
-                }
-                
-                return 0;
-            }
+    const int idx = pairings_cache_find(device_id);
+    if (idx < 0) {
+        return -1;
+    }
+    
+    if (pairings_cache[idx]->permissions != permissions) {
+        if (pairing_erase(idx)) {
+            ERROR("Erase old pairing");
+            return -2;
         }
+        
+        return homekit_storage_add_pairing(device_id, device_key, permissions);
     }
     
-    return -1;
+    return 0;
 }
 
 
 int homekit_storage_remove_pairing(const char *device_id) {
-    pairing_data_t data;
-    for (int i = 0; i<MAX_PAIRINGS; i++) {
-        if (spiflash_read(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-            if (strncmp(data.magic, magic1, sizeof(magic1))) {
-                continue;
-            }
-            
-            if (!strncmp(data.device_id, device_id, sizeof(data.device_id))) {
-                memset(&data, 0, sizeof(data));
-                if (!spiflash_write(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-                    ERROR("Remove pairing");
-                    return -2;
-                }
-                
-                return 0;
-            }
-        }
+    const int idx = pairings_cache_find(device_id);
+    if (idx >= 0 && pairing_erase(idx)) {
+        ERROR("Remove pairing");
+        return -2;
     }
     
     return 0;
@@ -338,14 +488,9 @@ int homekit_storage_remove_pairing(const char *device_id) {
 unsigned int homekit_storage_pairing_count() {
     homekit_storage_init();
     
-    pairing_data_t data;
     unsigned int count = 0;
     for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
-        if (spiflash_read(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-            if (strncmp(data.magic, magic1, sizeof(magic1))) {
-                continue;
-            }
-            
+        if (pairings_cache[i]) {
             count++;
         }
     }
@@ -356,22 +501,18 @@ unsigned int homekit_storage_pairing_count() {
 int homekit_storage_remove_extra_pairing(const unsigned int last_keep) {
     homekit_storage_init();
     
-    pairing_data_t data;
     unsigned int count = 0;
     for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
-        if (spiflash_read(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-            if (strncmp(data.magic, magic1, sizeof(magic1))) {
-                continue;
-            }
-            
-            count++;
-            
-            if (count > last_keep) {
-                memset(&data, 0, sizeof(data));
-                if (!spiflash_write(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-                    ERROR("Remove pairing");
-                    return -2;
-                }
+        if (!pairings_cache[i]) {
+            continue;
+        }
+        
+        count++;
+        
+        if (count > last_keep) {
+            if (pairing_erase(i)) {
+                ERROR("Remove pairing");
+                return -2;
             }
         }
     }
@@ -381,33 +522,12 @@ int homekit_storage_remove_extra_pairing(const unsigned int last_keep) {
 
 
 pairing_t *homekit_storage_find_pairing(const char *device_id) {
-    pairing_data_t data;
-    for (unsigned int i = 0; i < MAX_PAIRINGS; i++) {
-        if (spiflash_read(PAIRINGS_ADDR + sizeof(data) * i, (byte *)&data, sizeof(data))) {
-            if (strncmp(data.magic, magic1, sizeof(magic1))) {
-                continue;
-            }
-            
-            if (!strncmp(data.device_id, device_id, sizeof(data.device_id))) {
-                ed25519_key *device_key = crypto_ed25519_new();
-                int r = crypto_ed25519_import_public_key(device_key, data.device_public_key, sizeof(data.device_public_key));
-                if (r) {
-                    ERROR("Import dev pub key (%d)", r);
-                    return NULL;
-                }
-                
-                pairing_t *pairing = pairing_new();
-                pairing->id = i;
-                pairing->device_id = strndup(data.device_id, sizeof(data.device_id));
-                pairing->device_key = device_key;
-                pairing->permissions = data.permissions;
-                
-                return pairing;
-            }
-        }
+    const int idx = pairings_cache_find(device_id);
+    if (idx < 0) {
+        return NULL;
     }
-
-    return NULL;
+    
+    return pairings_cache_get(idx);
 }
 
 
@@ -417,6 +537,8 @@ typedef struct {
 
 
 pairing_iterator_t *homekit_storage_pairing_iterator() {
+    pairings_cache_load();
+    
     pairing_iterator_t *it = malloc(sizeof(pairing_iterator_t));
     it->idx = 0;
     return it;
@@ -424,27 +546,13 @@ pairing_iterator_t *homekit_storage_pairing_iterator() {
 
 
 pairing_t *homekit_storage_next_pairing(pairing_iterator_t *it) {
-    pairing_data_t data;
     while(it->idx < MAX_PAIRINGS) {
         int id = it->idx;
         it->idx++;
 
-        if (spiflash_read(PAIRINGS_ADDR + sizeof(data) * id, (byte *)&data, sizeof(data))) {
-            if (!strncmp(data.magic, magic1, sizeof(magic1))) {
-                ed25519_key *device_key = crypto_ed25519_new();
-                int r = crypto_ed25519_import_public_key(device_key, data.device_public_key, sizeof(data.device_public_key));
-                if (r) {
-                    ERROR("Import dev pub key (%d)", r);
-                    crypto_ed25519_free(device_key);
-                    continue;
-                }
-                
-                pairing_t *pairing = pairing_new();
-                pairing->id = id;
-                pairing->device_id = strndup(data.device_id, sizeof(data.device_id));
-                pairing->device_key = device_key;
-                pairing->permissions = data.permissions;
-                
+        if (pairings_cache[id]) {
+            pairing_t *pairing = pairings_cache_get(id);
+            if (pairing) {
                 return pairing;
             }
         }
@@ -452,4 +560,3 @@ pairing_t *homekit_storage_next_pairing(pairing_iterator_t *it) {
 
     return NULL;
 }
-
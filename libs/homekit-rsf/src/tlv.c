@@ -232,3 +232,120 @@ int tlv_parse(const byte *buffer, size_t length, tlv_values_t *values) {
 
     return 0;
 }
+
+
+int tlv_view_parse(byte *buffer, size_t length, tlv_view_t *view) {
+    view->count = 0;
+
+    if (length < 2) {
+        return -1;
+    }
+
+    tlv_item_t *item = NULL;
+    size_t last_chunk_size = 0;
+    size_t i = 0;
+    byte *p = buffer;
+
+    while (i < length) {
+        if (i + 2 > length) {
+            return -1;
+        }
+
+        byte type = buffer[i];
+        size_t chunk_size = buffer[i + 1];
+        if (i + 2 + chunk_size > length) {
+            return -1;
+        }
+
+        // Only a fragment following a full one of same type continues an item
+        if (!item || item->type != type || last_chunk_size != 255) {
+            if (view->count == TLV_VIEW_ITEMS_MAX) {
+                return -2;
+            }
+
+            item = &view->items[view->count++];
+            item->type = type;
+            item->value = p;
+            item->size = 0;
+        }
+
+        memmove(p, buffer + i + 2, chunk_size);
+        p += chunk_size;
+        item->size += chunk_size;
+
+        last_chunk_size = chunk_size;
+        i += chunk_size + 2;
+    }
+
+    return 0;
+}
+
+
+const tlv_item_t *tlv_view_get(const tlv_view_t *view, byte type) {
+    for (unsigned int i = 0; i < view->count; i++) {
+        if (view->items[i].type == type)
+            return &view->items[i];
+    }
+
+    return NULL;
+}
+
+
+int tlv_view_get_integer(const tlv_view_t *view, byte type, int def) {
+    const tlv_item_t *item = tlv_view_get(view, type);
+    if (!item)
+        return def;
+
+    int x = 0;
+    for (int i = item->size - 1; i >= 0; i--) {
+        x = (x << 8) + item->value[i];
+    }
+    return x;
+}
+
+
+void tlv_writer_init(tlv_writer_t *writer, byte *buffer, size_t size) {
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->pos = 0;
+    writer->error = !buffer;
+}
+
+
+void tlv_write(tlv_writer_t *writer, byte type, const byte *value, size_t size) {
+    if (writer->error || (size && !value) || writer->size - writer->pos < TLV_ENCODED_SIZE(size)) {
+        writer->error = true;
+        return;
+    }
+
+    byte *buffer = writer->buffer + writer->pos;
+    writer->pos += TLV_ENCODED_SIZE(size);
+
+    if (!size) {
+        buffer[0] = type;
+        buffer[1] = 0;
+        return;
+    }
+
+    while (size) {
+        size_t chunk_size = (size > 255) ? 255 : size;
+        buffer[0] = type;
+        buffer[1] = chunk_size;
+        memmove(&buffer[2], value, chunk_size);
+        size -= chunk_size;
+        buffer += chunk_size + 2;
+        value += chunk_size;
+    }
+}
+
+
+void tlv_write_integer(tlv_writer_t *writer, byte type, size_t size, int value) {
+    byte data[8];
+
+    for (size_t i=0; i<size; i++) {
+        data[i] = value & 0xff;
+        value >>= 8;
+    }
+
+    tlv_write(writer, type, data, size);
+}
@@ -0,0 +1,185 @@
+// Crypto backend that provides every symbol of crypto_backend.h and fails every
+// operation. It is linked with crypto.c built with HOMEKIT_CRYPTO_EXTERNAL, so a
+// backend missing from the contract, or crypto.c not left out, breaks the link.
+
+#include "crypto_backend.h"
+
+int crypto_sha512(const byte *data, size_t size, byte *hash) {
+    return -1;
+}
+
+int crypto_hkdf(
+    const byte *key, size_t key_size,
+    const byte *salt, size_t salt_size,
+    const byte *info, size_t info_size,
+    byte *output, size_t *output_size
+) {
+    return -1;
+}
+
+Srp *crypto_srp_new() {
+    return NULL;
+}
+
+void crypto_srp_free(Srp *srp) {
+}
+
+int crypto_srp_init(Srp *srp, const char *username, const char *password) {
+    return -1;
+}
+
+int crypto_srp_get_salt(Srp *srp, byte *buffer, size_t *buffer_length) {
+    return -1;
+}
+
+int crypto_srp_get_public_key(Srp *srp, byte *buffer, size_t *buffer_length) {
+    return -1;
+}
+
+int crypto_srp_compute_key(
+    Srp *srp,
+    const byte *client_public_key, size_t client_public_key_size,
+    const byte *server_public_key, size_t server_public_key_size
+) {
+    return -1;
+}
+
+int crypto_srp_verify(Srp *srp, const byte *proof, size_t proof_size) {
+    return -1;
+}
+
+int crypto_srp_get_proof(Srp *srp, byte *proof, size_t *proof_size) {
+    return -1;
+}
+
+int crypto_srp_hkdf(
+    Srp *srp,
+    const byte *salt, size_t salt_size,
+    const byte *info, size_t info_size,
+    byte *output, size_t *output_size
+) {
+    return -1;
+}
+
+int crypto_chacha20poly1305_encrypt(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    const byte *message, size_t message_size,
+    byte *encrypted, size_t *encrypted_size
+) {
+    return -1;
+}
+
+int crypto_chacha20poly1305_decrypt(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    const byte *message, size_t message_size,
+    byte *decrypted, size_t *descrypted_size
+) {
+    return -1;
+}
+
+int crypto_chacha20poly1305_encrypt_in_place(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    byte *data, size_t data_size, byte *tag
+) {
+    return -1;
+}
+
+int crypto_chacha20poly1305_decrypt_in_place(
+    const byte *key, const byte *nonce, const byte *aad, size_t aad_size,
+    byte *data, size_t data_size, const byte *tag
+) {
+    return -1;
+}
+
+int crypto_chacha20poly1305_tag(const byte *key, const byte *nonce, byte *tag) {
+    return -1;
+}
+
+int crypto_chacha20poly1305_verify_tag(const byte *key, const byte *nonce, const byte *tag, size_t tag_size) {
+    return -1;
+}
+
+ed25519_key *crypto_ed25519_new() {
+    return NULL;
+}
+
+ed25519_key *crypto_ed25519_generate() {
+    return NULL;
+}
+
+void crypto_ed25519_free(ed25519_key *key) {
+}
+
+int crypto_ed25519_import_key(ed25519_key *key, const byte *data, size_t size) {
+    return -1;
+}
+
+int crypto_ed25519_export_key(const ed25519_key *key, byte *buffer, size_t *size) {
+    return -1;
+}
+
+int crypto_ed25519_import_public_key(ed25519_key *key, const byte *data, size_t size) {
+    return -1;
+}
+
+int crypto_ed25519_export_public_key(const ed25519_key *key, byte *buffer, size_t *size) {
+    return -1;
+}
+
+int crypto_ed25519_sign(
+    const ed25519_key *key,
+    const byte *message, size_t message_size,
+    byte *signature, size_t *signature_size
+) {
+    return -1;
+}
+
+int crypto_ed25519_verify(
+    const ed25519_key *key,
+    const byte *message, size_t message_size,
+    const byte *signature, size_t signature_size
+) {
+    return -1;
+}
+
+ed25519_expanded_key *crypto_ed25519_expand(const ed25519_key *key) {
+    return NULL;
+}
+
+void crypto_ed25519_expanded_free(ed25519_expanded_key *expanded_key) {
+}
+
+int crypto_ed25519_sign_expanded(
+    const ed25519_expanded_key *expanded_key,
+    const byte *message, size_t message_size,
+    byte *signature
+) {
+    return -1;
+}
+
+curve25519_key *crypto_curve25519_new() {
+    return NULL;
+}
+
+curve25519_key *crypto_curve25519_generate() {
+    return NULL;
+}
+
+void crypto_curve25519_free(curve25519_key *key) {
+}
+
+int crypto_curve25519_import_public(curve25519_key *key, const byte *data, size_t size) {
+    return -1;
+}
+
+int crypto_curve25519_export_public(const curve25519_key *key, byte *buffer, size_t *size) {
+    return -1;
+}
+
+int crypto_curve25519_shared_secret(
+    const curve25519_key *private_key,
+    const curve25519_key *public_key,
+    byte *buffer, size_t *size
+) {
+    return -1;
+}
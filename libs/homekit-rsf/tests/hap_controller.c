@@ -0,0 +1,793 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <homekit/tlv.h>
+#include "crypto.h"
+#include "hap_srp.h"
+#include "hap_controller.h"
+
+#define HAP_SETUP_USER              "Pair-Setup"
+
+#define HAP_CONTROLLER_ID_SIZE      (36)
+#define HAP_FRAME_SIZE              (1024)
+#define HAP_RESPONSE_TIMEOUT        (10000)     // Milliseconds
+#define HAP_RECEIVE_SIZE            (4096)
+
+struct _hap_controller {
+    char id[HAP_CONTROLLER_ID_SIZE + 1];
+    ed25519_key *key;
+    byte public_key[HAP_PUBLIC_KEY_SIZE];
+
+    int socket;
+    int receive_buffer;
+
+    bool encrypted;
+    byte read_key[32];
+    byte write_key[32];
+    uint64_t read_count;
+    uint64_t write_count;
+
+    // Bytes received and not yet decrypted
+    byte received[HAP_RECEIVE_SIZE];
+    size_t received_size;
+
+    // Plaintext of messages not yet parsed
+    byte *plain;
+    size_t plain_size;
+    size_t plain_capacity;
+
+    // Body of last parsed message
+    byte *body;
+    size_t body_size;
+    size_t body_capacity;
+
+    hap_event_callback_t on_event;
+    void *on_event_arg;
+};
+
+
+static uint64_t now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int buffer_reserve(byte **buffer, size_t *capacity, const size_t size) {
+    if (size <= *capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = *capacity ? *capacity : 1024;
+    while (new_capacity < size) {
+        new_capacity *= 2;
+    }
+
+    byte *new_buffer = realloc(*buffer, new_capacity);
+    if (!new_buffer) {
+        return -1;
+    }
+
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+
+    return 0;
+}
+
+static void nonce_set(byte *nonce, const uint64_t count) {
+    memset(nonce, 0, 12);
+    for (unsigned int i = 0; i < 8; i++) {
+        nonce[4 + i] = count >> (8 * i);
+    }
+}
+
+hap_controller_t *hap_controller_new(const char *id) {
+    hap_controller_t *controller = calloc(1, sizeof(hap_controller_t));
+    if (!controller) {
+        return NULL;
+    }
+
+    strncpy(controller->id, id, HAP_CONTROLLER_ID_SIZE);
+    controller->socket = -1;
+
+    controller->key = crypto_ed25519_generate();
+    size_t public_key_size = sizeof(controller->public_key);
+    if (!controller->key ||
+        crypto_ed25519_export_public_key(controller->key, controller->public_key, &public_key_size)) {
+        hap_controller_free(controller);
+        return NULL;
+    }
+
+    return controller;
+}
+
+void hap_controller_free(hap_controller_t *controller) {
+    hap_controller_close(controller);
+
+    if (controller->key) {
+        crypto_ed25519_free(controller->key);
+    }
+
+    free(controller->plain);
+    free(controller->body);
+    free(controller);
+}
+
+void hap_controller_set_event_callback(hap_controller_t *controller, hap_event_callback_t callback, void *arg) {
+    controller->on_event = callback;
+    controller->on_event_arg = arg;
+}
+
+void hap_controller_set_receive_buffer(hap_controller_t *controller, const int size) {
+    controller->receive_buffer = size;
+}
+
+int hap_controller_connect(hap_controller_t *controller, const uint16_t port) {
+    hap_controller_close(controller);
+
+    const int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) {
+        return -1;
+    }
+
+    // Must be set before connecting to limit TCP window
+    if (controller->receive_buffer) {
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, &controller->receive_buffer, sizeof(controller->receive_buffer));
+    }
+
+    const int nodelay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (connect(s, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        close(s);
+        return -2;
+    }
+
+    controller->socket = s;
+
+    return 0;
+}
+
+void hap_controller_close(hap_controller_t *controller) {
+    if (controller->socket >= 0) {
+        close(controller->socket);
+        controller->socket = -1;
+    }
+
+    controller->encrypted = false;
+    controller->read_count = 0;
+    controller->write_count = 0;
+    controller->received_size = 0;
+    controller->plain_size = 0;
+}
+
+static int send_all(hap_controller_t *controller, const byte *data, size_t size) {
+    while (size > 0) {
+        const ssize_t r = send(controller->socket, data, size, MSG_NOSIGNAL);
+        if (r <= 0) {
+            return -1;
+        }
+
+        data += r;
+        size -= r;
+    }
+
+    return 0;
+}
+
+static int send_message(hap_controller_t *controller, const byte *data, size_t size) {
+    if (!controller->encrypted) {
+        return send_all(controller, data, size);
+    }
+
+    byte frame[2 + HAP_FRAME_SIZE + CHACHA20POLY1305_TAG_SIZE];
+    while (size > 0) {
+        const size_t frame_size = size < HAP_FRAME_SIZE ? size : HAP_FRAME_SIZE;
+        frame[0] = frame_size % 256;
+        frame[1] = frame_size / 256;
+
+        byte nonce[12];
+        nonce_set(nonce, controller->write_count++);
+
+        size_t encrypted_size = frame_size + CHACHA20POLY1305_TAG_SIZE;
+        if (crypto_chacha20poly1305_encrypt(controller->write_key, nonce, frame, 2, data, frame_size,
+                                            frame + 2, &encrypted_size) ||
+            send_all(controller, frame, 2 + encrypted_size) < 0) {
+            return -1;
+        }
+
+        data += frame_size;
+        size -= frame_size;
+    }
+
+    return 0;
+}
+
+static int plain_append(hap_controller_t *controller, const byte *data, const size_t size) {
+    if (buffer_reserve(&controller->plain, &controller->plain_capacity, controller->plain_size + size + 1) < 0) {
+        return -1;
+    }
+
+    memcpy(controller->plain + controller->plain_size, data, size);
+    controller->plain_size += size;
+
+    return 0;
+}
+
+// Reads what socket has within timeout. Returns bytes read, 0 on timeout, negative value when
+// connection is closed or a frame does not decrypt.
+static int receive(hap_controller_t *controller, const unsigned int timeout_ms) {
+    struct pollfd fd = { .fd = controller->socket, .events = POLLIN };
+    const int ready = poll(&fd, 1, timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+
+    const ssize_t r = recv(controller->socket, controller->received + controller->received_size,
+                           sizeof(controller->received) - controller->received_size, 0);
+    if (r <= 0) {
+        return -1;
+    }
+    controller->received_size += r;
+
+    if (!controller->encrypted) {
+        controller->received_size = 0;
+        return plain_append(controller, controller->received, r) < 0 ? -1 : r;
+    }
+
+    size_t offset = 0;
+    while (offset + 2 + CHACHA20POLY1305_TAG_SIZE <= controller->received_size) {
+        byte *frame = controller->received + offset;
+        const size_t frame_size = frame[0] + frame[1] * 256;
+        if (offset + 2 + frame_size + CHACHA20POLY1305_TAG_SIZE > controller->received_size) {
+            break;
+        }
+
+        byte nonce[12];
+        nonce_set(nonce, controller->read_count++);
+
+        if (crypto_chacha20poly1305_decrypt_in_place(controller->read_key, nonce, frame, 2,
+                                                     frame + 2, frame_size, frame + 2 + frame_size) ||
+            plain_append(controller, frame + 2, frame_size) < 0) {
+            return -1;
+        }
+
+        offset += 2 + frame_size + CHACHA20POLY1305_TAG_SIZE;
+    }
+
+    controller->received_size -= offset;
+    memmove(controller->received, controller->received + offset, controller->received_size);
+
+    return r;
+}
+
+static int body_append(hap_controller_t *controller, const byte *data, const size_t size) {
+    if (buffer_reserve(&controller->body, &controller->body_capacity, controller->body_size + size + 1) < 0) {
+        return -1;
+    }
+
+    memcpy(controller->body + controller->body_size, data, size);
+    controller->body_size += size;
+
+    return 0;
+}
+
+// Decodes chunked body starting at data. Returns bytes of body on wire, 0 if it is not all
+// received yet, or negative value if it is malformed.
+static int chunked_body_parse(hap_controller_t *controller, const char *data, const size_t size) {
+    size_t offset = 0;
+    for (;;) {
+        const char *line_end = memmem(data + offset, size - offset, "\r\n", 2);
+        if (!line_end) {
+            return 0;
+        }
+
+        char *end;
+        const size_t chunk_size = strtoul(data + offset, &end, 16);
+        if (end == data + offset) {
+            return -1;
+        }
+
+        offset = line_end + 2 - data;
+        if (offset + chunk_size + 2 > size) {
+            return 0;
+        }
+
+        if (!chunk_size) {
+            return offset + 2;
+        }
+
+        if (body_append(controller, (const byte*) data + offset, chunk_size) < 0) {
+            return -1;
+        }
+        offset += chunk_size + 2;
+    }
+}
+
+// Parses a message from plaintext received. Returns 1 when a whole message was parsed and taken
+// out of plaintext, 0 if more data is needed, or negative value if message is malformed.
+static int message_parse(hap_controller_t *controller, bool *event, int *status) {
+    char *plain = (char*) controller->plain;
+    if (!controller->plain_size) {
+        return 0;
+    }
+    plain[controller->plain_size] = 0;
+
+    char *header_end = strstr(plain, "\r\n\r\n");
+    if (!header_end) {
+        return 0;
+    }
+    const size_t header_size = header_end + 4 - plain;
+
+    const char *status_code = strchr(plain, ' ');
+    if (!status_code || status_code > header_end) {
+        return -1;
+    }
+    *event = !strncmp(plain, "EVENT/", 6);
+    *status = atoi(status_code + 1);
+
+    header_end[2] = 0;
+    const bool chunked = strcasestr(plain, "\r\nTransfer-Encoding: chunked\r\n");
+    const char *content_length = strcasestr(plain, "\r\nContent-Length:");
+    header_end[2] = '\r';
+
+    controller->body_size = 0;
+
+    size_t message_size = header_size;
+    if (chunked) {
+        const int r = chunked_body_parse(controller, plain + header_size, controller->plain_size - header_size);
+        if (r <= 0) {
+            return r;
+        }
+        message_size += r;
+    } else if (content_length) {
+        const size_t body_size = strtoul(content_length + 17, NULL, 10);
+        if (controller->plain_size < header_size + body_size) {
+            return 0;
+        }
+        if (body_append(controller, (byte*) plain + header_size, body_size) < 0) {
+            return -1;
+        }
+        message_size += body_size;
+    }
+
+    controller->plain_size -= message_size;
+    memmove(controller->plain, controller->plain + message_size, controller->plain_size);
+
+    return 1;
+}
+
+static void event_dispatch(hap_controller_t *controller) {
+    if (controller->on_event) {
+        controller->on_event(controller, (const char*) controller->body, controller->body_size, controller->on_event_arg);
+    }
+}
+
+int hap_controller_request(hap_controller_t *controller, const char *method, const char *path,
+                           const char *content_type, const char *body, const size_t body_size,
+                           hap_response_t *response) {
+    if (controller->socket < 0) {
+        return -1;
+    }
+
+    char header[256];
+    int header_size;
+    if (body) {
+        header_size = snprintf(header, sizeof(header),
+                               "%s %s HTTP/1.1\r\nHost: hap.local\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                               method, path, content_type, body_size);
+    } else {
+        header_size = snprintf(header, sizeof(header), "%s %s HTTP/1.1\r\nHost: hap.local\r\n\r\n", method, path);
+    }
+    if (header_size >= sizeof(header)) {
+        return -1;
+    }
+
+    // Header and body go in same frames, as a controller sends them
+    byte *message = malloc(header_size + body_size);
+    if (!message) {
+        return -1;
+    }
+    memcpy(message, header, header_size);
+    if (body) {
+        memcpy(message + header_size, body, body_size);
+    }
+
+    int r = send_message(controller, message, header_size + (body ? body_size : 0));
+    free(message);
+    if (r < 0) {
+        return -2;
+    }
+
+    const uint64_t deadline = now_ms() + HAP_RESPONSE_TIMEOUT;
+    for (;;) {
+        bool event;
+        int status;
+        r = message_parse(controller, &event, &status);
+        if (r < 0) {
+            return -3;
+        }
+
+        if (r > 0) {
+            if (event) {
+                event_dispatch(controller);
+                continue;
+            }
+
+            response->status = status;
+            response->body = (const char*) controller->body;
+            response->body_size = controller->body_size;
+            return 0;
+        }
+
+        const uint64_t now = now_ms();
+        if (now >= deadline || receive(controller, deadline - now) <= 0) {
+            return -4;
+        }
+    }
+}
+
+int hap_controller_wait_events(hap_controller_t *controller, const unsigned int timeout_ms) {
+    if (controller->socket < 0) {
+        return -1;
+    }
+
+    int events = 0;
+    const uint64_t deadline = now_ms() + timeout_ms;
+    for (;;) {
+        bool event;
+        int status;
+        const int r = message_parse(controller, &event, &status);
+        if (r < 0) {
+            return -3;
+        }
+
+        if (r > 0) {
+            if (event) {
+                event_dispatch(controller);
+                events++;
+            }
+            continue;
+        }
+
+        const uint64_t now = now_ms();
+        if (now >= deadline) {
+            return events;
+        }
+
+        const int received = receive(controller, deadline - now);
+        if (received < 0) {
+            return -4;
+        }
+    }
+}
+
+// Sends TLV request and parses TLV response, which must have expected state and no error
+static int tlv_request(hap_controller_t *controller, const char *path, const tlv_values_t *request,
+                       const int state, tlv_values_t *response) {
+    size_t size = 0;
+    tlv_format(request, NULL, &size);
+    byte *data = malloc(size);
+    if (!data || tlv_format(request, data, &size)) {
+        free(data);
+        return -1;
+    }
+
+    hap_response_t http_response;
+    int r = hap_controller_request(controller, "POST", path, "application/pairing+tlv8",
+                                   (const char*) data, size, &http_response);
+    free(data);
+    if (r < 0) {
+        return r;
+    }
+
+    if (http_response.status != 200 ||
+        tlv_parse((const byte*) http_response.body, http_response.body_size, response) ||
+        tlv_get_integer_value(response, TLVType_State, -1) != state ||
+        tlv_get_value(response, TLVType_Error)) {
+        return -5;
+    }
+
+    return 0;
+}
+
+// Encrypts TLV into EncryptedData of message
+static int tlv_encrypt(const byte *key, const char *nonce_text, const tlv_values_t *values, tlv_values_t *message) {
+    byte data[512];
+    size_t size = sizeof(data);
+    if (tlv_format(values, data, &size)) {
+        return -1;
+    }
+
+    byte nonce[12] = { 0 };
+    memcpy(nonce + 4, nonce_text, 8);
+
+    byte encrypted[sizeof(data) + CHACHA20POLY1305_TAG_SIZE];
+    size_t encrypted_size = sizeof(encrypted);
+    if (crypto_chacha20poly1305_encrypt(key, nonce, NULL, 0, data, size, encrypted, &encrypted_size)) {
+        return -1;
+    }
+
+    return tlv_add_value(message, TLVType_EncryptedData, encrypted, encrypted_size);
+}
+
+// Decrypts EncryptedData of message into values
+static int tlv_decrypt(const byte *key, const char *nonce_text, const tlv_values_t *message, tlv_values_t *values) {
+    const tlv_t *encrypted = tlv_get_value(message, TLVType_EncryptedData);
+    if (!encrypted || encrypted->size < CHACHA20POLY1305_TAG_SIZE || encrypted->size > 512) {
+        return -1;
+    }
+
+    byte nonce[12] = { 0 };
+    memcpy(nonce + 4, nonce_text, 8);
+
+    byte data[512];
+    size_t size = sizeof(data);
+    if (crypto_chacha20poly1305_decrypt(key, nonce, NULL, 0, encrypted->value, encrypted->size, data, &size)) {
+        return -1;
+    }
+
+    return tlv_parse(data, size, values);
+}
+
+static void tlv_reset(tlv_values_t **values) {
+    tlv_free(*values);
+    *values = tlv_new();
+}
+
+int hap_controller_pair_setup(hap_controller_t *controller, const char *setup_code, hap_accessory_t *accessory) {
+    tlv_values_t *request = tlv_new();
+    tlv_values_t *response = tlv_new();
+    tlv_values_t *sub = tlv_new();
+    hap_srp_t *srp = NULL;
+
+    // M1, M2
+    tlv_add_integer_value(request, TLVType_State, 1, 1);
+    tlv_add_integer_value(request, TLVType_Method, 1, 0);
+    int r = tlv_request(controller, "/pair-setup", request, 2, response);
+
+    if (!r) {
+        const tlv_t *salt = tlv_get_value(response, TLVType_Salt);
+        const tlv_t *server_public_key = tlv_get_value(response, TLVType_PublicKey);
+        r = !salt || !server_public_key;
+        if (!r) {
+            srp = hap_srp_new(HAP_SETUP_USER, setup_code, salt->value, salt->size);
+            r = !srp || hap_srp_compute_key(srp, server_public_key->value, server_public_key->size);
+        }
+    }
+
+    // M3, M4
+    if (!r) {
+        byte public_key[384];
+        size_t public_key_size = sizeof(public_key);
+        byte proof[64];
+        size_t proof_size = sizeof(proof);
+        r = hap_srp_get_public_key(srp, public_key, &public_key_size) ||
+            hap_srp_get_proof(srp, proof, &proof_size);
+
+        tlv_reset(&request);
+        tlv_reset(&response);
+        tlv_add_integer_value(request, TLVType_State, 1, 3);
+        tlv_add_value(request, TLVType_PublicKey, public_key, public_key_size);
+        tlv_add_value(request, TLVType_Proof, proof, proof_size);
+        r = r || tlv_request(controller, "/pair-setup", request, 4, response);
+    }
+
+    if (!r) {
+        const tlv_t *server_proof = tlv_get_value(response, TLVType_Proof);
+        r = !server_proof || hap_srp_verify(srp, server_proof->value, server_proof->size);
+    }
+
+    // M5, M6
+    byte key[32];
+    if (!r) {
+        byte device_x[32];
+        r = hap_srp_hkdf(srp, "Pair-Setup-Encrypt-Salt", "Pair-Setup-Encrypt-Info", key) ||
+            hap_srp_hkdf(srp, "Pair-Setup-Controller-Sign-Salt", "Pair-Setup-Controller-Sign-Info", device_x);
+
+        // Controller signs its DeviceX, its id and its long term public key
+        const size_t id_size = strlen(controller->id);
+        byte device_info[sizeof(device_x) + HAP_CONTROLLER_ID_SIZE + HAP_PUBLIC_KEY_SIZE];
+        memcpy(device_info, device_x, sizeof(device_x));
+        memcpy(device_info + sizeof(device_x), controller->id, id_size);
+        memcpy(device_info + sizeof(device_x) + id_size, controller->public_key, HAP_PUBLIC_KEY_SIZE);
+
+        byte signature[ED25519_SIGNATURE_SIZE];
+        size_t signature_size = sizeof(signature);
+        r = r || crypto_ed25519_sign(controller->key, device_info, sizeof(device_x) + id_size + HAP_PUBLIC_KEY_SIZE,
+                                     signature, &signature_size);
+
+        tlv_add_string_value(sub, TLVType_Identifier, controller->id);
+        tlv_add_value(sub, TLVType_PublicKey, controller->public_key, HAP_PUBLIC_KEY_SIZE);
+        tlv_add_value(sub, TLVType_Signature, signature, signature_size);
+
+        tlv_reset(&request);
+        tlv_reset(&response);
+        tlv_add_integer_value(request, TLVType_State, 1, 5);
+        r = r || tlv_encrypt(key, "PS-Msg05", sub, request) ||
+            tlv_request(controller, "/pair-setup", request, 6, response);
+    }
+
+    tlv_reset(&sub);
+    r = r || tlv_decrypt(key, "PS-Msg06", response, sub);
+
+    // Accessory signed its AccessoryX, its id and its long term public key
+    if (!r) {
+        const tlv_t *accessory_id = tlv_get_value(sub, TLVType_Identifier);
+        const tlv_t *accessory_public_key = tlv_get_value(sub, TLVType_PublicKey);
+        const tlv_t *signature = tlv_get_value(sub, TLVType_Signature);
+        r = !accessory_id || accessory_id->size != HAP_ACCESSORY_ID_SIZE ||
+            !accessory_public_key || accessory_public_key->size != HAP_PUBLIC_KEY_SIZE || !signature;
+
+        byte accessory_info[32 + HAP_ACCESSORY_ID_SIZE + HAP_PUBLIC_KEY_SIZE];
+        r = r || hap_srp_hkdf(srp, "Pair-Setup-Accessory-Sign-Salt", "Pair-Setup-Accessory-Sign-Info", accessory_info);
+
+        ed25519_key *accessory_key = crypto_ed25519_new();
+        if (!r) {
+            memcpy(accessory_info + 32, accessory_id->value, HAP_ACCESSORY_ID_SIZE);
+            memcpy(accessory_info + 32 + HAP_ACCESSORY_ID_SIZE, accessory_public_key->value, HAP_PUBLIC_KEY_SIZE);
+            r = crypto_ed25519_import_public_key(accessory_key, accessory_public_key->value, HAP_PUBLIC_KEY_SIZE) ||
+                crypto_ed25519_verify(accessory_key, accessory_info, sizeof(accessory_info),
+                                      signature->value, signature->size);
+        }
+        crypto_ed25519_free(accessory_key);
+
+        if (!r) {
+            memcpy(accessory->id, accessory_id->value, HAP_ACCESSORY_ID_SIZE);
+            accessory->id[HAP_ACCESSORY_ID_SIZE] = 0;
+            memcpy(accessory->public_key, accessory_public_key->value, HAP_PUBLIC_KEY_SIZE);
+        }
+    }
+
+    tlv_free(sub);
+    tlv_free(request);
+    tlv_free(response);
+    if (srp) {
+        hap_srp_free(srp);
+    }
+
+    return r ? -1 : 0;
+}
+
+int hap_controller_pair_verify(hap_controller_t *controller, const hap_accessory_t *accessory) {
+    curve25519_key *my_key = crypto_curve25519_generate();
+    curve25519_key *accessory_session_key = crypto_curve25519_new();
+    ed25519_key *accessory_key = crypto_ed25519_new();
+    tlv_values_t *request = tlv_new();
+    tlv_values_t *response = tlv_new();
+    tlv_values_t *sub = tlv_new();
+
+    byte my_public[32];
+    size_t my_public_size = sizeof(my_public);
+    byte shared[32];
+    size_t shared_size = sizeof(shared);
+    byte session_key[32];
+    size_t session_key_size = sizeof(session_key);
+
+    // M1, M2
+    int r = !my_key || !accessory_session_key || !accessory_key ||
+            crypto_curve25519_export_public(my_key, my_public, &my_public_size);
+    if (!r) {
+        tlv_add_integer_value(request, TLVType_State, 1, 1);
+        tlv_add_value(request, TLVType_PublicKey, my_public, my_public_size);
+        r = tlv_request(controller, "/pair-verify", request, 2, response);
+    }
+
+    const tlv_t *accessory_public = r ? NULL : tlv_get_value(response, TLVType_PublicKey);
+    r = !accessory_public || accessory_public->size != 32 ||
+        crypto_curve25519_import_public(accessory_session_key, accessory_public->value, accessory_public->size) ||
+        crypto_curve25519_shared_secret(my_key, accessory_session_key, shared, &shared_size) ||
+        crypto_hkdf(shared, shared_size, (const byte*) "Pair-Verify-Encrypt-Salt", 24,
+                    (const byte*) "Pair-Verify-Encrypt-Info", 24, session_key, &session_key_size) ||
+        tlv_decrypt(session_key, "PV-Msg02", response, sub);
+
+    // Accessory signed its session key, its id and controller session key
+    const size_t id_size = strlen(controller->id);
+    byte info[32 + HAP_CONTROLLER_ID_SIZE + 32];
+    if (!r) {
+        const tlv_t *accessory_id = tlv_get_value(sub, TLVType_Identifier);
+        const tlv_t *signature = tlv_get_value(sub, TLVType_Signature);
+        r = !accessory_id || accessory_id->size != HAP_ACCESSORY_ID_SIZE ||
+            memcmp(accessory_id->value, accessory->id, HAP_ACCESSORY_ID_SIZE) || !signature;
+
+        if (!r) {
+            memcpy(info, accessory_public->value, 32);
+            memcpy(info + 32, accessory->id, HAP_ACCESSORY_ID_SIZE);
+            memcpy(info + 32 + HAP_ACCESSORY_ID_SIZE, my_public, 32);
+            r = crypto_ed25519_import_public_key(accessory_key, accessory->public_key, HAP_PUBLIC_KEY_SIZE) ||
+                crypto_ed25519_verify(accessory_key, info, 32 + HAP_ACCESSORY_ID_SIZE + 32,
+                                      signature->value, signature->size);
+        }
+    }
+
+    // M3, M4
+    if (!r) {
+        memcpy(info, my_public, 32);
+        memcpy(info + 32, controller->id, id_size);
+        memcpy(info + 32 + id_size, accessory_public->value, 32);
+
+        byte signature[ED25519_SIGNATURE_SIZE];
+        size_t signature_size = sizeof(signature);
+        r = crypto_ed25519_sign(controller->key, info, 32 + id_size + 32, signature, &signature_size);
+
+        tlv_free(sub);
+        sub = tlv_new();
+        tlv_add_string_value(sub, TLVType_Identifier, controller->id);
+        tlv_add_value(sub, TLVType_Signature, signature, signature_size);
+
+        tlv_free(request);
+        request = tlv_new();
+        tlv_add_integer_value(request, TLVType_State, 1, 3);
+        if (!r) {
+            r = tlv_encrypt(session_key, "PV-Msg03", sub, request);
+        }
+
+        tlv_free(response);
+        response = tlv_new();
+        if (!r) {
+            r = tlv_request(controller, "/pair-verify", request, 4, response);
+        }
+    }
+
+    if (!r) {
+        size_t key_size = sizeof(controller->read_key);
+        r = crypto_hkdf(shared, shared_size, (const byte*) "Control-Salt", 12,
+                        (const byte*) "Control-Read-Encryption-Key", 27, controller->read_key, &key_size);
+        key_size = sizeof(controller->write_key);
+        r = r || crypto_hkdf(shared, shared_size, (const byte*) "Control-Salt", 12,
+                             (const byte*) "Control-Write-Encryption-Key", 28, controller->write_key, &key_size);
+    }
+
+    if (!r) {
+        controller->encrypted = true;
+        controller->read_count = 0;
+        controller->write_count = 0;
+    }
+
+    tlv_free(sub);
+    tlv_free(request);
+    tlv_free(response);
+    if (accessory_key) {
+        crypto_ed25519_free(accessory_key);
+    }
+    if (accessory_session_key) {
+        crypto_curve25519_free(accessory_session_key);
+    }
+    if (my_key) {
+        crypto_curve25519_free(my_key);
+    }
+
+    return r ? -1 : 0;
+}
+
+int hap_controller_add_pairing(hap_controller_t *controller, const hap_controller_t *other, const bool admin) {
+    tlv_values_t *request = tlv_new();
+    tlv_values_t *response = tlv_new();
+
+    tlv_add_integer_value(request, TLVType_State, 1, 1);
+    tlv_add_integer_value(request, TLVType_Method, 1, TLVMethod_AddPairing);
+    tlv_add_string_value(request, TLVType_Identifier, other->id);
+    tlv_add_value(request, TLVType_PublicKey, other->public_key, HAP_PUBLIC_KEY_SIZE);
+    tlv_add_integer_value(request, TLVType_Permissions, 1, admin ? 1 : 0);
+
+    const int r = tlv_request(controller, "/pairings", request, 2, response);
+
+    tlv_free(request);
+    tlv_free(response);
+
+    return r;
+}
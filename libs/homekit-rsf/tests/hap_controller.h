@@ -0,0 +1,58 @@
+#ifndef __HAP_CONTROLLER_H__
+#define __HAP_CONTROLLER_H__
+
+// HAP controller for host tests: Pair Setup, Pair Verify and HTTP requests over encrypted
+// session, as an iOS device talks to HomeKit server. One controller is used by one thread.
+// Functions returning int return 0 on success, and negative value on error.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HAP_ACCESSORY_ID_SIZE       (17)
+#define HAP_PUBLIC_KEY_SIZE         (32)
+
+// Accessory learnt in Pair Setup, needed by every controller to check Pair Verify
+typedef struct {
+    char id[HAP_ACCESSORY_ID_SIZE + 1];
+    uint8_t public_key[HAP_PUBLIC_KEY_SIZE];
+} hap_accessory_t;
+
+typedef struct _hap_controller hap_controller_t;
+
+// Body of an event is JSON, not null terminated
+typedef void (*hap_event_callback_t)(hap_controller_t *controller, const char *body, size_t size, void *arg);
+
+typedef struct {
+    int status;
+    const char *body;       // Valid until next call on same controller, not null terminated
+    size_t body_size;
+} hap_response_t;
+
+// Controller with id (pairing identifier) and a new long term key
+hap_controller_t *hap_controller_new(const char *id);
+void hap_controller_free(hap_controller_t *controller);
+
+void hap_controller_set_event_callback(hap_controller_t *controller, hap_event_callback_t callback, void *arg);
+// Socket receive buffer of next connections, 0 keeps system default
+void hap_controller_set_receive_buffer(hap_controller_t *controller, const int size);
+
+int hap_controller_connect(hap_controller_t *controller, const uint16_t port);
+void hap_controller_close(hap_controller_t *controller);
+
+// Pairs as admin and fills accessory. Connection stays unencrypted, as after Pair Setup of iOS.
+int hap_controller_pair_setup(hap_controller_t *controller, const char *setup_code, hap_accessory_t *accessory);
+// Starts encrypted session on connection
+int hap_controller_pair_verify(hap_controller_t *controller, const hap_accessory_t *accessory);
+// Controller, an admin, adds pairing of other controller
+int hap_controller_add_pairing(hap_controller_t *controller, const hap_controller_t *other, const bool admin);
+
+// Sends request (body may be NULL) and waits for its response. Events received meanwhile go to callback.
+int hap_controller_request(hap_controller_t *controller, const char *method, const char *path,
+                           const char *content_type, const char *body, const size_t body_size,
+                           hap_response_t *response);
+
+// Waits up to timeout_ms for events, returns events received
+int hap_controller_wait_events(hap_controller_t *controller, const unsigned int timeout_ms);
+
+#endif // __HAP_CONTROLLER_H__
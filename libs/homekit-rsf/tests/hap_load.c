@@ -0,0 +1,503 @@
+// Load generator of host build: starts host_server, pairs controllers with it as iOS devices do,
+// then runs a mix of requests from all controllers at once while sensors and writes of other
+// controllers send events. Reports latency percentiles, throughput, and heap and flash use of
+// server. Exits with failure if any pairing or request failed.
+//
+// Usage: hap_load [-c controllers] [-d seconds] [-a accessories] [-e sensor_period_ms]
+//                 [-m accessories:get:put] [-r requests_per_second] [-H heap_size] [-s host_server]
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <homekit/homekit.h>
+
+#include "hap_controller.h"
+#include "host_bridge.h"
+#include "host_control.h"
+
+#define CONTROLLERS_MAX             (30)
+
+enum {
+    OP_PAIR_SETUP,
+    OP_ADD_PAIRING,
+    OP_PAIR_VERIFY,
+    OP_ACCESSORIES,
+    OP_GET,
+    OP_PUT,
+    OP_EVENT,
+    OPS
+};
+
+static const char *op_names[OPS] = {
+    [OP_PAIR_SETUP] = "pair setup",
+    [OP_ADD_PAIRING] = "add pairing",
+    [OP_PAIR_VERIFY] = "pair verify",
+    [OP_ACCESSORIES] = "GET /accessories",
+    [OP_GET] = "GET /characteristics",
+    [OP_PUT] = "PUT /characteristics",
+    [OP_EVENT] = "event after PUT",
+};
+
+static const char *endpoint_names[HOMEKIT_ENDPOINTS_COUNT] = {
+    "unknown", "pair-setup", "pair-verify", "identify", "accessories",
+    "get characteristics", "put characteristics", "pairings", "prepare", "resource",
+};
+
+typedef struct {
+    uint32_t *values;       // Microseconds
+    size_t count;
+    size_t capacity;
+} samples_t;
+
+typedef struct {
+    unsigned int index;
+    hap_controller_t *controller;
+    pthread_t thread;
+    unsigned int seed;
+    unsigned int brightness;
+
+    samples_t samples[OPS];
+    unsigned int requests;
+    unsigned int errors;
+    unsigned int events;
+    unsigned int sensor_events;
+} worker_t;
+
+static unsigned int controllers_count = 4;
+static unsigned int duration = 10;
+static unsigned int accessories_count = HOST_BRIDGE_ACCESSORIES_DEFAULT;
+static unsigned int sensor_period = 1000;
+static unsigned int mix[3] = { 1, 50, 50 };
+static unsigned int rate = 0;
+
+static hap_accessory_t accessory;
+static worker_t workers[CONTROLLERS_MAX];
+static pthread_barrier_t barrier;
+static volatile bool stopping = false;
+
+// Last value written to brightness of each accessory, to time events it causes
+static struct {
+    int value;
+    uint64_t time;
+} writes[HOST_BRIDGE_AID_FIRST + HOST_BRIDGE_ACCESSORIES_MAX];
+static pthread_mutex_t writes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint64_t now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void samples_add(samples_t *samples, const uint64_t value) {
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 256;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(uint32_t));
+    }
+
+    samples->values[samples->count++] = value;
+}
+
+static int samples_compare(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t*) a;
+    const uint32_t y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+static double samples_percentile(const samples_t *samples, const unsigned int percent) {
+    if (!samples->count) {
+        return 0;
+    }
+
+    size_t i = (samples->count * percent + 99) / 100;
+    if (i) {
+        i--;
+    }
+
+    return samples->values[i] / 1000.;
+}
+
+static void samples_print(const char *name, samples_t *samples) {
+    if (!samples->count) {
+        return;
+    }
+
+    qsort(samples->values, samples->count, sizeof(uint32_t), samples_compare);
+    printf("  %-22s %8zu %9.2f %9.2f %9.2f %9.2f\n", name, samples->count,
+           samples_percentile(samples, 50), samples_percentile(samples, 90),
+           samples_percentile(samples, 99), samples_percentile(samples, 100));
+}
+
+static void samples_merge(samples_t *to, const samples_t *from) {
+    for (size_t i = 0; i < from->count; i++) {
+        samples_add(to, from->values[i]);
+    }
+}
+
+static void on_event(hap_controller_t *controller, const char *body, size_t size, void *arg) {
+    worker_t *worker = arg;
+    const uint64_t now = now_us();
+    const char *end = body + size;
+
+    const char *p = body;
+    while ((p = memmem(p, end - p, "\"aid\":", 6))) {
+        const int aid = strtol(p + 6, NULL, 10);
+        const char *iid = memmem(p, end - p, "\"iid\":", 6);
+        const char *value = memmem(p, end - p, "\"value\":", 8);
+        if (!iid || !value) {
+            break;
+        }
+        p = value + 8;
+
+        worker->events++;
+        switch (strtol(iid + 6, NULL, 10)) {
+            case HOST_BRIDGE_IID_TEMPERATURE:
+                worker->sensor_events++;
+                break;
+
+            case HOST_BRIDGE_IID_BRIGHTNESS:
+                if (aid >= HOST_BRIDGE_AID_FIRST && aid < HOST_BRIDGE_AID_FIRST + accessories_count) {
+                    pthread_mutex_lock(&writes_lock);
+                    if (writes[aid].time && writes[aid].value == strtol(value + 8, NULL, 10)) {
+                        samples_add(&worker->samples[OP_EVENT], now - writes[aid].time);
+                        writes[aid].time = 0;
+                    }
+                    pthread_mutex_unlock(&writes_lock);
+                }
+                break;
+        }
+    }
+}
+
+// Accessory written by a worker. Each worker has its own accessories, while there are enough.
+static unsigned int worker_aid(worker_t *worker) {
+    const unsigned int own = (accessories_count + controllers_count - 1 - worker->index) / controllers_count;
+    if (!own) {
+        return HOST_BRIDGE_AID_FIRST + rand_r(&worker->seed) % accessories_count;
+    }
+
+    return HOST_BRIDGE_AID_FIRST + worker->index + controllers_count * (rand_r(&worker->seed) % own);
+}
+
+static int request(worker_t *worker, const unsigned int op, const char *method, const char *path,
+                   const char *body, const int expected_status) {
+    hap_response_t response;
+    const uint64_t start = now_us();
+    const int r = hap_controller_request(worker->controller, method, path, "application/hap+json",
+                                         body, body ? strlen(body) : 0, &response);
+    if (r < 0 || response.status != expected_status) {
+        worker->errors++;
+        return -1;
+    }
+
+    samples_add(&worker->samples[op], now_us() - start);
+    worker->requests++;
+
+    return 0;
+}
+
+static int worker_subscribe(worker_t *worker) {
+    const size_t size = 32 + accessories_count * 3 * 40;
+    char *body = malloc(size);
+    size_t length = snprintf(body, size, "{\"characteristics\":[");
+    for (unsigned int i = 0; i < accessories_count; i++) {
+        const unsigned int aid = HOST_BRIDGE_AID_FIRST + i;
+        length += snprintf(body + length, size - length,
+                           "%s{\"aid\":%u,\"iid\":%u,\"ev\":true},{\"aid\":%u,\"iid\":%u,\"ev\":true},"
+                           "{\"aid\":%u,\"iid\":%u,\"ev\":true}",
+                           i ? "," : "", aid, HOST_BRIDGE_IID_ON, aid, HOST_BRIDGE_IID_BRIGHTNESS,
+                           aid, HOST_BRIDGE_IID_TEMPERATURE);
+    }
+    snprintf(body + length, size - length, "]}");
+
+    hap_response_t response;
+    const int r = hap_controller_request(worker->controller, "PUT", "/characteristics", "application/hap+json",
+                                         body, strlen(body), &response);
+    free(body);
+
+    return r < 0 || response.status != 204 ? -1 : 0;
+}
+
+static void worker_step(worker_t *worker) {
+    const unsigned int pick = rand_r(&worker->seed) % (mix[0] + mix[1] + mix[2]);
+    char text[128];
+
+    if (pick < mix[0]) {
+        request(worker, OP_ACCESSORIES, "GET", "/accessories", NULL, 200);
+    } else if (pick < mix[0] + mix[1]) {
+        const unsigned int aid = HOST_BRIDGE_AID_FIRST + rand_r(&worker->seed) % accessories_count;
+        snprintf(text, sizeof(text), "/characteristics?id=%u.%u,%u.%u,%u.%u", aid, HOST_BRIDGE_IID_ON,
+                 aid, HOST_BRIDGE_IID_BRIGHTNESS, aid, HOST_BRIDGE_IID_TEMPERATURE);
+        request(worker, OP_GET, "GET", text, NULL, 200);
+    } else {
+        const unsigned int aid = worker_aid(worker);
+        worker->brightness = (worker->brightness + 1) % 101;
+        snprintf(text, sizeof(text), "{\"characteristics\":[{\"aid\":%u,\"iid\":%u,\"value\":%u}]}",
+                 aid, HOST_BRIDGE_IID_BRIGHTNESS, worker->brightness);
+
+        pthread_mutex_lock(&writes_lock);
+        writes[aid].value = worker->brightness;
+        writes[aid].time = now_us();
+        pthread_mutex_unlock(&writes_lock);
+
+        request(worker, OP_PUT, "PUT", "/characteristics", text, 204);
+    }
+}
+
+static void *worker_thread(void *arg) {
+    worker_t *worker = arg;
+
+    // All controllers verify at once, as after a restart of accessory
+    pthread_barrier_wait(&barrier);
+
+    const uint64_t start = now_us();
+    if (host_control_connect(worker->controller) < 0 ||
+        hap_controller_pair_verify(worker->controller, &accessory) < 0) {
+        worker->errors++;
+        hap_controller_close(worker->controller);
+    } else {
+        samples_add(&worker->samples[OP_PAIR_VERIFY], now_us() - start);
+    }
+
+    if (!worker->errors) {
+        request(worker, OP_ACCESSORIES, "GET", "/accessories", NULL, 200);
+        if (worker_subscribe(worker) < 0) {
+            worker->errors++;
+        }
+    }
+
+    pthread_barrier_wait(&barrier);
+
+    const uint64_t interval = rate ? 1000000ULL * controllers_count / rate : 0;
+    uint64_t next = now_us();
+    while (!stopping && !worker->errors) {
+        worker_step(worker);
+
+        // Events keep coming between requests
+        if (interval) {
+            next += interval;
+            const uint64_t now = now_us();
+            if (next > now && hap_controller_wait_events(worker->controller, (next - now) / 1000) < 0) {
+                worker->errors++;
+            }
+        }
+    }
+
+    hap_controller_close(worker->controller);
+
+    return NULL;
+}
+
+static int pair(samples_t *samples) {
+    hap_controller_t *admin = workers[0].controller;
+
+    uint64_t start = now_us();
+    if (host_control_connect(admin) < 0 ||
+        hap_controller_pair_setup(admin, HOST_BRIDGE_SETUP_CODE, &accessory) < 0) {
+        fprintf(stderr, "Pair Setup failed\n");
+        return -1;
+    }
+    samples_add(&samples[OP_PAIR_SETUP], now_us() - start);
+
+    // As iOS, admin verifies on a new connection and shares accessory with other controllers
+    hap_controller_close(admin);
+    if (host_control_connect(admin) < 0 || hap_controller_pair_verify(admin, &accessory) < 0) {
+        fprintf(stderr, "Pair Verify of admin failed\n");
+        return -1;
+    }
+
+    for (unsigned int i = 1; i < controllers_count; i++) {
+        start = now_us();
+        if (hap_controller_add_pairing(admin, workers[i].controller, false) < 0) {
+            fprintf(stderr, "Add pairing %u failed\n", i);
+            return -1;
+        }
+        samples_add(&samples[OP_ADD_PAIRING], now_us() - start);
+    }
+
+    hap_controller_close(admin);
+
+    return 0;
+}
+
+static void report(samples_t *samples, const double elapsed, const host_server_stats_t *idle,
+                   const host_server_stats_t *pairing, const host_server_stats_t *load) {
+    unsigned int requests = 0, errors = 0, events = 0, sensor_events = 0;
+    for (unsigned int i = 0; i < controllers_count; i++) {
+        requests += workers[i].requests;
+        errors += workers[i].errors;
+        events += workers[i].events;
+        sensor_events += workers[i].sensor_events;
+    }
+
+    printf("%u controllers, %u accessories, %u s, mix %u:%u:%u, sensors every %u ms, %s\n",
+           controllers_count, accessories_count, duration, mix[0], mix[1], mix[2], sensor_period,
+           rate ? "rate limited" : "closed loop");
+
+    printf("\n  %-22s %8s %9s %9s %9s %9s\n", "latency (ms)", "count", "p50", "p90", "p99", "max");
+    for (unsigned int op = 0; op < OPS; op++) {
+        samples_print(op_names[op], &samples[op]);
+    }
+
+    printf("\n  throughput     %.1f requests/s\n", requests / elapsed);
+    printf("  events         %.1f/s received, %.1f/s of sensors\n", events / elapsed, sensor_events / elapsed);
+    printf("  errors         %u\n", errors);
+
+    printf("\nServer heap of %zu bytes (host sizes, task stacks not counted)\n", load->heap_size);
+    printf("  used at start  %zu\n", idle->heap_used);
+    printf("  peak pairing   %zu\n", pairing->heap_peak);
+    printf("  peak load      %zu\n", load->heap_peak);
+    printf("  min free       %u, when a request ended\n", load->heap_min_free);
+
+    printf("\nServer flash\n  writes %u, erases %u, reads %u\n",
+           load->flash_writes, load->flash_erases, load->flash_reads);
+
+    printf("\nServer request time (ms)\n  %-22s %8s %9s %9s\n", "endpoint", "count", "avg", "max");
+    for (unsigned int i = 0; i < HOMEKIT_ENDPOINTS_COUNT; i++) {
+        const homekit_request_stats_t *stats = &load->endpoints[i];
+        if (stats->count) {
+            printf("  %-22s %8u %9.2f %9.2f\n", endpoint_names[i], stats->count,
+                   stats->time_total / 1000. / stats->count, stats->time_max / 1000.);
+        }
+    }
+
+    printf("\nServer events\n  emitted %u, coalesced %u, suppressed %u, dropped %u, queued %u bytes\n",
+           load->emitted, load->coalesced, load->suppressed, load->event_drops, load->queued);
+    printf("  evicted clients %u, refused %u\n", load->evictions, load->refused);
+}
+
+int main(int argc, char **argv) {
+    const char *server_path = "./host_server";
+    unsigned int heap_size = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:a:e:m:r:H:s:")) != -1) {
+        switch (opt) {
+            case 'c':
+                controllers_count = atoi(optarg);
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'a':
+                accessories_count = atoi(optarg);
+                break;
+            case 'e':
+                sensor_period = atoi(optarg);
+                break;
+            case 'm':
+                if (sscanf(optarg, "%u:%u:%u", &mix[0], &mix[1], &mix[2]) != 3) {
+                    mix[0] = mix[1] = mix[2] = 0;
+                }
+                break;
+            case 'r':
+                rate = atoi(optarg);
+                break;
+            case 'H':
+                heap_size = atoi(optarg);
+                break;
+            case 's':
+                server_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c controllers] [-d seconds] [-a accessories] [-e sensor_period_ms]\n"
+                        "       [-m accessories:get:put] [-r requests_per_second] [-H heap_size] [-s host_server]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (!controllers_count || controllers_count > CONTROLLERS_MAX || !duration ||
+        !accessories_count || accessories_count > HOST_BRIDGE_ACCESSORIES_MAX || !(mix[0] + mix[1] + mix[2])) {
+        fprintf(stderr, "Controllers 1-%u, accessories 1-%u, duration and mix not 0\n",
+                CONTROLLERS_MAX, HOST_BRIDGE_ACCESSORIES_MAX);
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned int i = 0; i < controllers_count; i++) {
+        char id[40];
+        snprintf(id, sizeof(id), "%08X-0000-4000-8000-%012X", i + 1, (unsigned int) getpid());
+        workers[i].index = i;
+        workers[i].seed = i + 1;
+        workers[i].controller = hap_controller_new(id);
+        if (!workers[i].controller) {
+            fprintf(stderr, "Controller key failed\n");
+            return EXIT_FAILURE;
+        }
+        hap_controller_set_event_callback(workers[i].controller, on_event, &workers[i]);
+    }
+
+    char accessories_arg[8], sensor_arg[12], heap_arg[12], clients_arg[8];
+    snprintf(accessories_arg, sizeof(accessories_arg), "%u", accessories_count);
+    snprintf(sensor_arg, sizeof(sensor_arg), "%u", sensor_period);
+    snprintf(heap_arg, sizeof(heap_arg), "%u", heap_size);
+    // Server default is 8 clients
+    snprintf(clients_arg, sizeof(clients_arg), "%u", controllers_count > 8 ? controllers_count : 0);
+    const char *options[] = { "-a", accessories_arg, "-e", sensor_arg, "-c", clients_arg,
+                              heap_size ? "-H" : NULL, heap_arg, NULL };
+
+    host_server_stats_t idle, pairing, load;
+    samples_t samples[OPS] = { { 0 } };
+    int r = host_control_start(server_path, options);
+    if (r < 0) {
+        fprintf(stderr, "Server start failed\n");
+    }
+
+    if (!r) {
+        r = host_control_stats(&idle) || host_control_command("peak");
+        r = r || pair(samples);
+        r = r || host_control_stats(&pairing) || host_control_command("peak");
+    }
+
+    double elapsed = 0;
+    if (!r) {
+        pthread_barrier_init(&barrier, NULL, controllers_count + 1);
+        for (unsigned int i = 0; i < controllers_count; i++) {
+            pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+        }
+
+        pthread_barrier_wait(&barrier);
+        pthread_barrier_wait(&barrier);
+
+        const uint64_t start = now_us();
+        sleep(duration);
+        stopping = true;
+
+        for (unsigned int i = 0; i < controllers_count; i++) {
+            pthread_join(workers[i].thread, NULL);
+            for (unsigned int op = 0; op < OPS; op++) {
+                samples_merge(&samples[op], &workers[i].samples[op]);
+            }
+            if (workers[i].errors) {
+                r = -1;
+            }
+        }
+        elapsed = (now_us() - start) / 1000000.;
+
+        if (host_control_stats(&load) < 0) {
+            r = -1;
+        } else {
+            report(samples, elapsed, &idle, &pairing, &load);
+        }
+    }
+
+    for (unsigned int op = 0; op < OPS; op++) {
+        free(samples[op].values);
+        for (unsigned int i = 0; i < controllers_count; i++) {
+            free(workers[i].samples[op].values);
+        }
+    }
+    for (unsigned int i = 0; i < controllers_count; i++) {
+        hap_controller_free(workers[i].controller);
+    }
+
+    host_control_stop();
+
+    return r ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/hmac.h>
+#include <wolfssl/wolfcrypt/srp.h>
+
+#include "hap_srp.h"
+
+#define SRP_PUBLIC_KEY_SIZE     (384)
+
+// Group and key derivation of server, from crypto.c
+extern const byte N[SRP_PUBLIC_KEY_SIZE];
+extern const byte g[1];
+int wc_SrpSetKeyH(Srp *srp, byte *secret, word32 size);
+
+struct _hap_srp {
+    Srp srp;
+    byte public_key[SRP_PUBLIC_KEY_SIZE];
+    word32 public_key_size;
+};
+
+
+hap_srp_t *hap_srp_new(const char *username, const char *password, const uint8_t *salt, const size_t salt_size) {
+    hap_srp_t *srp = calloc(1, sizeof(hap_srp_t));
+    if (!srp) {
+        return NULL;
+    }
+
+    if (wc_SrpInit(&srp->srp, SRP_TYPE_SHA512, SRP_CLIENT_SIDE)) {
+        free(srp);
+        return NULL;
+    }
+    srp->srp.keyGenFunc_cb = wc_SrpSetKeyH;
+
+    srp->public_key_size = sizeof(srp->public_key);
+    if (wc_SrpSetUsername(&srp->srp, (byte*) username, strlen(username)) ||
+        wc_SrpSetParams(&srp->srp, N, sizeof(N), g, sizeof(g), salt, salt_size) ||
+        wc_SrpSetPassword(&srp->srp, (byte*) password, strlen(password)) ||
+        wc_SrpGetPublic(&srp->srp, srp->public_key, &srp->public_key_size)) {
+        hap_srp_free(srp);
+        return NULL;
+    }
+
+    return srp;
+}
+
+void hap_srp_free(hap_srp_t *srp) {
+    wc_SrpTerm(&srp->srp);
+    free(srp);
+}
+
+int hap_srp_get_public_key(hap_srp_t *srp, uint8_t *buffer, size_t *size) {
+    if (*size < srp->public_key_size) {
+        return -1;
+    }
+
+    memcpy(buffer, srp->public_key, srp->public_key_size);
+    *size = srp->public_key_size;
+
+    return 0;
+}
+
+int hap_srp_compute_key(hap_srp_t *srp, const uint8_t *server_public_key, const size_t size) {
+    return wc_SrpComputeKey(&srp->srp, srp->public_key, srp->public_key_size, (byte*) server_public_key, size);
+}
+
+int hap_srp_get_proof(hap_srp_t *srp, uint8_t *proof, size_t *size) {
+    word32 proof_size = *size;
+    const int r = wc_SrpGetProof(&srp->srp, proof, &proof_size);
+    *size = proof_size;
+
+    return r;
+}
+
+int hap_srp_verify(hap_srp_t *srp, const uint8_t *proof, const size_t size) {
+    return wc_SrpVerifyPeersProof(&srp->srp, (byte*) proof, size);
+}
+
+int hap_srp_hkdf(hap_srp_t *srp, const char *salt, const char *info, uint8_t *output) {
+    return wc_HKDF(SHA512, srp->srp.key, srp->srp.keySz,
+                   (const byte*) salt, strlen(salt), (const byte*) info, strlen(info), output, 32);
+}
@@ -0,0 +1,27 @@
+#ifndef __HAP_SRP_H__
+#define __HAP_SRP_H__
+
+// Controller side of SRP in Pair Setup. It is apart from hap_controller.c, because wolfCrypt
+// srp.h and crypto.h can not be included together: both declare type Srp.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct _hap_srp hap_srp_t;
+
+// Salt comes from Pair Setup M2
+hap_srp_t *hap_srp_new(const char *username, const char *password, const uint8_t *salt, const size_t salt_size);
+void hap_srp_free(hap_srp_t *srp);
+
+// Public key A sent in M3, up to 384 bytes
+int hap_srp_get_public_key(hap_srp_t *srp, uint8_t *buffer, size_t *size);
+int hap_srp_compute_key(hap_srp_t *srp, const uint8_t *server_public_key, const size_t size);
+
+// Proof of controller sent in M3 (64 bytes), and proof of accessory got in M4
+int hap_srp_get_proof(hap_srp_t *srp, uint8_t *proof, size_t *size);
+int hap_srp_verify(hap_srp_t *srp, const uint8_t *proof, const size_t size);
+
+// 32 bytes derived from SRP shared secret, as crypto_srp_hkdf()
+int hap_srp_hkdf(hap_srp_t *srp, const char *salt, const char *info, uint8_t *output);
+
+#endif // __HAP_SRP_H__
@@ -0,0 +1,31 @@
+#ifndef __HOST_BRIDGE_H__
+#define __HOST_BRIDGE_H__
+
+// Bridge built by host_server, and known to hap_load without parsing GET /accessories.
+// Accessory 1 is bridge itself, with information service only. Accessories from
+// HOST_BRIDGE_AID_FIRST on are a lightbulb and a temperature sensor each.
+
+// Setup code is fixed in server.c
+#define HOST_BRIDGE_SETUP_CODE          "021-82-017"
+
+#define HOST_BRIDGE_ACCESSORIES_DEFAULT (10)
+#define HOST_BRIDGE_ACCESSORIES_MAX     (100)
+
+#define HOST_BRIDGE_AID_FIRST           (2)
+
+#define HOST_BRIDGE_IID_NAME            (5)
+#define HOST_BRIDGE_IID_LIGHTBULB       (8)
+#define HOST_BRIDGE_IID_ON              (9)
+#define HOST_BRIDGE_IID_BRIGHTNESS      (10)
+#define HOST_BRIDGE_IID_SENSOR          (11)
+#define HOST_BRIDGE_IID_TEMPERATURE     (12)
+
+// Control of host_server on its stdin, answers on its stdout. Lines end in '\n'.
+//   stats   Heap, flash, request and event counters, one "<name> <values>" line each,
+//           ended with "end"
+//   peak    Restarts heap high-water mark from heap used now, answers "ok"
+// host_server writes HOST_BRIDGE_READY line when server is initialized, and exits when its
+// stdin is closed.
+#define HOST_BRIDGE_READY               "ready"
+
+#endif // __HOST_BRIDGE_H__
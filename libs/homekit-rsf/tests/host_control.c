@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "host_control.h"
+#include "host_bridge.h"
+
+#define OPTIONS_MAX                 (16)
+#define CONNECT_TIMEOUT             (5000)      // Milliseconds, server task starts 500 ms after server
+
+static uint16_t port = 0;
+static pid_t server_pid = 0;
+static char flash_file[] = "/tmp/host_server.XXXXXX";
+static bool flash_created = false;
+static FILE *server_in = NULL;
+static FILE *server_out = NULL;
+
+
+int host_control_start(const char *path, const char *const *options) {
+    // Free port from system, so runs do not collide
+    const int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_size = sizeof(addr);
+    if (s < 0 || bind(s, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        getsockname(s, (struct sockaddr*) &addr, &addr_size) < 0) {
+        return -1;
+    }
+    port = ntohs(addr.sin_port);
+    close(s);
+
+    const int flash_fd = mkstemp(flash_file);
+    if (flash_fd < 0) {
+        return -1;
+    }
+    close(flash_fd);
+    flash_created = true;
+
+    char port_arg[8];
+    snprintf(port_arg, sizeof(port_arg), "%u", port);
+
+    const char *argv[OPTIONS_MAX + 7] = { path, "-q", "-p", port_arg, "-f", flash_file };
+    unsigned int argc = 6;
+    while (options && *options && argc < OPTIONS_MAX + 6) {
+        argv[argc++] = *options++;
+    }
+
+    int to_server[2], from_server[2];
+    if (pipe(to_server) < 0 || pipe(from_server) < 0) {
+        return -1;
+    }
+
+    // Clients of server gone or closed must not end process
+    signal(SIGPIPE, SIG_IGN);
+
+    server_pid = fork();
+    if (server_pid < 0) {
+        return -1;
+    }
+
+    if (!server_pid) {
+        dup2(to_server[0], STDIN_FILENO);
+        dup2(from_server[1], STDOUT_FILENO);
+        close(to_server[1]);
+        close(from_server[0]);
+
+        execv(path, (char *const*) argv);
+        perror(path);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(to_server[0]);
+    close(from_server[1]);
+    server_in = fdopen(to_server[1], "w");
+    server_out = fdopen(from_server[0], "r");
+
+    char line[64];
+    if (!fgets(line, sizeof(line), server_out) || strcmp(line, HOST_BRIDGE_READY "\n")) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void host_control_stop() {
+    if (server_in) {
+        fclose(server_in);
+        server_in = NULL;
+    }
+    if (server_out) {
+        fclose(server_out);
+        server_out = NULL;
+    }
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+        server_pid = 0;
+    }
+    if (flash_created) {
+        unlink(flash_file);
+        flash_created = false;
+    }
+}
+
+uint16_t host_control_port() {
+    return port;
+}
+
+int host_control_command(const char *command) {
+    fprintf(server_in, "%s\n", command);
+    fflush(server_in);
+
+    char line[64];
+    return fgets(line, sizeof(line), server_out) && !strcmp(line, "ok\n") ? 0 : -1;
+}
+
+int host_control_stats(host_server_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    fprintf(server_in, "stats\n");
+    fflush(server_in);
+
+    char line[128];
+    while (fgets(line, sizeof(line), server_out)) {
+        unsigned int endpoint, count, total, max, evictions[3];
+        if (!strcmp(line, "end\n")) {
+            return 0;
+        } else if (sscanf(line, "endpoint %u %u %u %u", &endpoint, &count, &total, &max) == 4) {
+            if (endpoint < HOMEKIT_ENDPOINTS_COUNT) {
+                stats->endpoints[endpoint] = (homekit_request_stats_t) { count, total, max };
+            }
+        } else if (sscanf(line, "eviction %u %u %u %u", &evictions[0], &evictions[1], &evictions[2], &stats->refused) == 4) {
+            stats->evictions = evictions[0] + evictions[1] + evictions[2];
+        } else {
+            sscanf(line, "heap %zu %zu %zu %u %u", &stats->heap_size, &stats->heap_used, &stats->heap_peak,
+                   &stats->heap_allocs, &stats->heap_min_free);
+            sscanf(line, "flash %u %u %u", &stats->flash_reads, &stats->flash_writes, &stats->flash_erases);
+            sscanf(line, "notify %u %u %u", &stats->coalesced, &stats->emitted, &stats->suppressed);
+            sscanf(line, "queue %u %u", &stats->queued, &stats->event_drops);
+        }
+    }
+
+    return -1;
+}
+
+int host_control_connect(hap_controller_t *controller) {
+    for (unsigned int waited = 0; hap_controller_connect(controller, port) < 0; waited += 20) {
+        if (waited >= CONNECT_TIMEOUT) {
+            return -1;
+        }
+        usleep(20000);
+    }
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef __HOST_CONTROL_H__
+#define __HOST_CONTROL_H__
+
+// Runs host_server as a child process and talks its control protocol (see host_bridge.h), for
+// hap_load and host tests. One server per process. Functions returning int return 0 on
+// success, and negative value on error.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <homekit/homekit.h>
+
+#include "hap_controller.h"
+
+typedef struct {
+    size_t heap_size;
+    size_t heap_used;
+    size_t heap_peak;
+    unsigned int heap_allocs;
+    unsigned int heap_min_free;
+    unsigned int flash_reads;
+    unsigned int flash_writes;
+    unsigned int flash_erases;
+    homekit_request_stats_t endpoints[HOMEKIT_ENDPOINTS_COUNT];
+    unsigned int coalesced;
+    unsigned int emitted;
+    unsigned int suppressed;
+    unsigned int queued;
+    unsigned int event_drops;
+    unsigned int evictions;
+    unsigned int refused;
+} host_server_stats_t;
+
+// Starts server at path on a free port, with flash on a temporary file. Options are more
+// host_server options, NULL terminated. Returns when server is ready.
+int host_control_start(const char *path, const char *const *options);
+// Stops server and removes its flash file
+void host_control_stop();
+
+uint16_t host_control_port();
+
+int host_control_command(const char *command);
+int host_control_stats(host_server_stats_t *stats);
+
+// Connects to server, waiting while its task starts
+int host_control_connect(hap_controller_t *controller);
+
+#endif // __HOST_CONTROL_H__
@@ -0,0 +1,107 @@
+// Heap of host build: malloc() family is wrapped at link time (-Wl,--wrap=malloc and others,
+// see Makefile), and every block is counted against a fixed heap size, like free heap of device
+// when server starts. Free heap seen by server and high-water mark come from these counts.
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <FreeRTOS.h>
+#include "host_port.h"
+
+#ifndef HOST_HEAP_SIZE_DEFAULT
+#define HOST_HEAP_SIZE_DEFAULT      (96 * 1024)
+#endif
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static size_t heap_size = HOST_HEAP_SIZE_DEFAULT;
+static size_t heap_used = 0;
+static size_t heap_peak = 0;
+static uint32_t heap_allocs = 0;
+
+
+static void heap_add(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    
+    const size_t used = __atomic_add_fetch(&heap_used, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    while (used > peak &&
+           !__atomic_compare_exchange_n(&heap_peak, &peak, used, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    
+    __atomic_add_fetch(&heap_allocs, 1, __ATOMIC_RELAXED);
+}
+
+static void heap_sub(void *ptr) {
+    if (ptr) {
+        __atomic_sub_fetch(&heap_used, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    }
+}
+
+void *__wrap_malloc(size_t size) {
+    void *ptr = __real_malloc(size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    void *ptr = __real_calloc(count, size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    const size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    void *new_ptr = __real_realloc(ptr, size);
+    if (new_ptr || !size) {
+        __atomic_sub_fetch(&heap_used, old_size, __ATOMIC_RELAXED);
+        heap_add(new_ptr);
+    }
+    return new_ptr;
+}
+
+void __wrap_free(void *ptr) {
+    heap_sub(ptr);
+    __real_free(ptr);
+}
+
+// libc copies strings with a malloc() which is not wrapped
+char *__wrap_strndup(const char *s, size_t size) {
+    const size_t len = strnlen(s, size);
+    char *copy = __wrap_malloc(len + 1);
+    if (copy) {
+        memcpy(copy, s, len);
+        copy[len] = 0;
+    }
+    return copy;
+}
+
+char *__wrap_strdup(const char *s) {
+    return __wrap_strndup(s, strlen(s));
+}
+
+size_t xPortGetFreeHeapSize() {
+    const size_t used = __atomic_load_n(&heap_used, __ATOMIC_RELAXED);
+    return used < heap_size ? heap_size - used : 0;
+}
+
+void host_heap_set_size(const size_t size) {
+    heap_size = size;
+}
+
+void host_heap_get_stats(host_heap_stats_t *stats) {
+    stats->size = heap_size;
+    stats->used = __atomic_load_n(&heap_used, __ATOMIC_RELAXED);
+    stats->peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    stats->allocs = __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+}
+
+void host_heap_reset_peak() {
+    __atomic_store_n(&heap_peak, __atomic_load_n(&heap_used, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
@@ -0,0 +1,239 @@
+// FreeRTOS, ESP SDK, lwIP and mDNS shims of host build. Headers are in stubs/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <sysparam.h>
+#include <esp/hwrand.h>
+#include <espressif/esp_common.h>
+#include <esplibs/libmain.h>
+#include <lwip/sockets.h>
+#undef bind
+#undef accept
+
+#include "mdnsresponder.h"
+#include "host_port.h"
+
+#define SYSPARAM_MAX_KEYS       (8)
+#define SYSPARAM_KEY_SIZE       (16)
+
+
+static uint64_t monotonic_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Ticks and system time count from program start, as on device they count from boot
+static uint64_t boot_time;
+
+__attribute__((constructor)) static void host_port_init() {
+    boot_time = monotonic_us();
+}
+
+uint32_t sdk_system_get_time() {
+    return monotonic_us() - boot_time;
+}
+
+uint32_t sdk_system_get_time_raw() {
+    return sdk_system_get_time();
+}
+
+void sdk_system_restart() {
+    printf("Restart\n");
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
+}
+
+bool sdk_system_overclock() {
+    return true;
+}
+
+bool sdk_system_restoreclock() {
+    return true;
+}
+
+TickType_t xTaskGetTickCount() {
+    return (monotonic_us() - boot_time) / 1000 / portTICK_PERIOD_MS;
+}
+
+void vTaskDelay(const TickType_t ticks) {
+    const uint64_t us = (uint64_t) ticks * portTICK_PERIOD_MS * 1000;
+    struct timespec delay = { us / 1000000, (us % 1000000) * 1000 };
+    while (nanosleep(&delay, &delay) < 0);
+}
+
+typedef struct {
+    TaskFunction_t task;
+    void *parameters;
+} task_start_t;
+
+static void *task_thread(void *arg) {
+    task_start_t start = *(task_start_t*) arg;
+    free(arg);
+    
+    start.task(start.parameters);
+    return NULL;
+}
+
+// Stack depth and priority are not used: server task is a thread of its own
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, const uint32_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task) {
+    task_start_t *start = malloc(sizeof(task_start_t));
+    if (!start) {
+        return pdFAIL;
+    }
+    
+    start->task = task;
+    start->parameters = parameters;
+    
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, task_thread, start)) {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    
+    if (created_task) {
+        *created_task = (TaskHandle_t) thread;
+    }
+    
+    return pdPASS;
+}
+
+// Only a task deleting itself is supported
+void vTaskDelete(TaskHandle_t task) {
+    if (!task) {
+        pthread_exit(NULL);
+    }
+}
+
+uint32_t hwrand() {
+    uint32_t value;
+    hwrand_fill((uint8_t*) &value, sizeof(value));
+    return value;
+}
+
+void hwrand_fill(uint8_t *buf, size_t len) {
+    while (len) {
+        const ssize_t r = getrandom(buf, len, 0);
+        if (r > 0) {
+            buf += r;
+            len -= r;
+        }
+    }
+}
+
+static struct {
+    char key[SYSPARAM_KEY_SIZE];
+    int32_t value;
+} sysparams[SYSPARAM_MAX_KEYS];
+static pthread_mutex_t sysparams_lock = PTHREAD_MUTEX_INITIALIZER;
+
+sysparam_status_t sysparam_get_int32(const char *key, int32_t *result) {
+    sysparam_status_t status = SYSPARAM_NOTFOUND;
+    
+    pthread_mutex_lock(&sysparams_lock);
+    for (unsigned int i = 0; i < SYSPARAM_MAX_KEYS; i++) {
+        if (!strncmp(sysparams[i].key, key, SYSPARAM_KEY_SIZE)) {
+            *result = sysparams[i].value;
+            status = SYSPARAM_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sysparams_lock);
+    
+    return status;
+}
+
+sysparam_status_t sysparam_set_int32(const char *key, int32_t value) {
+    sysparam_status_t status = SYSPARAM_ERR_NOMEM;
+    
+    pthread_mutex_lock(&sysparams_lock);
+    for (unsigned int i = 0; i < SYSPARAM_MAX_KEYS; i++) {
+        if (!sysparams[i].key[0] || !strncmp(sysparams[i].key, key, SYSPARAM_KEY_SIZE)) {
+            strncpy(sysparams[i].key, key, SYSPARAM_KEY_SIZE - 1);
+            sysparams[i].value = value;
+            status = SYSPARAM_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sysparams_lock);
+    
+    return status;
+}
+
+static uint16_t host_port = 0;
+
+void host_port_set(const uint16_t port) {
+    host_port = port;
+}
+
+int host_bind(int s, const struct sockaddr *name, socklen_t namelen) {
+    struct sockaddr_in addr;
+    if (host_port && name->sa_family == AF_INET && namelen == sizeof(addr)) {
+        memcpy(&addr, name, sizeof(addr));
+        if (addr.sin_port) {
+            addr.sin_port = htons(host_port);
+            name = (struct sockaddr*) &addr;
+            
+            // Connections closed by a previous server must not keep port busy
+            const int reuse = 1;
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        }
+    }
+    
+    return bind(s, name, namelen);
+}
+
+int host_accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
+    const int client = accept(s, addr, addrlen);
+    if (client >= 0) {
+        const int size = HOST_SEND_BUFFER;
+        setsockopt(client, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+    
+    return client;
+}
+
+// No mDNS on host: load generator connects to known port
+void mdns_init() {
+}
+
+void mdns_clear() {
+}
+
+void mdns_announce_start() {
+}
+
+void mdns_announce_stop() {
+}
+
+void mdns_add_facility(const char* instanceName, const char* serviceName, const char* addText,
+                       mdns_flags flags, u16_t onPort, u32_t ttl, u32_t ttl_period) {
+}
+
+int mdns_buffer_init(uint16_t new_size) {
+    return 0;
+}
+
+void mdns_buffer_deinit() {
+}
+
+void mdns_TXT_append(char* txt, size_t txt_size, const char* record, size_t record_size) {
+    const size_t txt_len = strlen(txt);
+    if (record_size > 255 || txt_len + record_size + 2 > txt_size) {
+        return;
+    }
+    
+    txt[txt_len] = record_size;
+    memcpy(txt + txt_len + 1, record, record_size);
+    txt[txt_len + record_size + 1] = 0;
+}
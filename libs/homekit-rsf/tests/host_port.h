@@ -0,0 +1,35 @@
+#ifndef __HOST_PORT_H__
+#define __HOST_PORT_H__
+
+// Controls of host build of HomeKit server: platform shims in host_port.c, heap accounting in
+// host_heap.c and flash emulator in host_spiflash.c
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Port server listens on instead of its fixed PORT. 0 keeps PORT.
+void host_port_set(const uint16_t port);
+
+typedef struct {
+    size_t size;        // Heap size, as free heap of device when server starts
+    size_t used;
+    size_t peak;        // Highest use since start or last host_heap_reset_peak()
+    uint32_t allocs;
+} host_heap_stats_t;
+
+// Only in programs linked with malloc() wrapped, see Makefile
+void host_heap_set_size(const size_t size);
+void host_heap_get_stats(host_heap_stats_t *stats);
+void host_heap_reset_peak();
+
+typedef struct {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+} host_spiflash_stats_t;
+
+// Flash of size bytes kept in file at path, which is created erased when missing
+int host_spiflash_open(const char *path, const uint32_t size);
+void host_spiflash_get_stats(host_spiflash_stats_t *stats);
+
+#endif // __HOST_PORT_H__
@@ -0,0 +1,244 @@
+// HomeKit server built for host: server.c and storage.c on POSIX sockets, with flash emulated on a
+// file and heap counted against device size. Serves a bridge (see host_bridge.h) to hap_load.
+//
+// Usage: host_server [-p port] [-f flash_file] [-a accessories] [-e sensor_period_ms]
+//                    [-H heap_size] [-c max_clients] [-q]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <spiflash.h>
+#include <homekit/homekit.h>
+#include <homekit/characteristics.h>
+
+#include "host_port.h"
+#include "host_bridge.h"
+
+#define FLASH_FILE_DEFAULT      "host_server.flash"
+#define FLASH_SIZE              (SPI_FLASH_SECTOR_SIZE)
+
+static FILE *control = NULL;
+
+static unsigned int accessories_count = HOST_BRIDGE_ACCESSORIES_DEFAULT;
+static homekit_characteristic_t **temperatures = NULL;
+static unsigned int sensor_period = 0;
+
+
+static void identify(homekit_characteristic_t *ch, const homekit_value_t value) {
+}
+
+// Same as a real accessory: value is applied and every subscribed controller is told
+static void light_set(homekit_characteristic_t *ch, const homekit_value_t value) {
+    ch->value = value;
+    homekit_characteristic_notify(ch);
+}
+
+// IDENTIFY declaration takes no more fields, its id is set by bridge_new()
+static homekit_characteristic_t identify_ch = HOMEKIT_CHARACTERISTIC_(IDENTIFY, identify);
+static homekit_characteristic_t manufacturer = HOMEKIT_CHARACTERISTIC_(MANUFACTURER_STATIC, "HomeKit", .id = 3);
+static homekit_characteristic_t model = HOMEKIT_CHARACTERISTIC_(MODEL_STATIC, "Host", .id = 4);
+static homekit_characteristic_t firmware = HOMEKIT_CHARACTERISTIC_(FIRMWARE_REVISION_STATIC, "1.0.0", .id = 7);
+
+static homekit_service_t *service_new(const uint16_t id, const char *type, const unsigned int characteristics) {
+    homekit_service_t *service = calloc(1, sizeof(homekit_service_t));
+    service->id = id;
+    service->type = type;
+    service->characteristics = calloc(characteristics + 1, sizeof(homekit_characteristic_t*));
+
+    return service;
+}
+
+static homekit_accessory_t *accessory_new(const unsigned int aid, const char *name, const unsigned int services) {
+    char serial[16];
+    snprintf(serial, sizeof(serial), "HOST-%u", aid);
+
+    homekit_accessory_t *accessory = calloc(1, sizeof(homekit_accessory_t));
+    accessory->id = aid;
+    accessory->services = calloc(services + 1, sizeof(homekit_service_t*));
+
+    homekit_service_t *info = service_new(1, HOMEKIT_SERVICE_ACCESSORY_INFORMATION, 6);
+    info->characteristics[0] = &identify_ch;
+    info->characteristics[1] = &manufacturer;
+    info->characteristics[2] = &model;
+    info->characteristics[3] = NEW_HOMEKIT_CHARACTERISTIC(NAME_STATIC, strdup(name), .id = HOST_BRIDGE_IID_NAME);
+    info->characteristics[4] = NEW_HOMEKIT_CHARACTERISTIC(SERIAL_NUMBER_STATIC, strdup(serial), .id = 6);
+    info->characteristics[5] = &firmware;
+    accessory->services[0] = info;
+
+    return accessory;
+}
+
+static homekit_accessory_t **bridge_new() {
+    homekit_accessory_t **accessories = calloc(accessories_count + 2, sizeof(homekit_accessory_t*));
+    temperatures = calloc(accessories_count, sizeof(homekit_characteristic_t*));
+    identify_ch.id = 2;
+
+    accessories[0] = accessory_new(1, "Host Bridge", 1);
+
+    for (unsigned int i = 0; i < accessories_count; i++) {
+        const unsigned int aid = HOST_BRIDGE_AID_FIRST + i;
+        char name[16];
+        snprintf(name, sizeof(name), "Device %u", aid);
+
+        homekit_accessory_t *accessory = accessory_new(aid, name, 3);
+
+        homekit_service_t *light = service_new(HOST_BRIDGE_IID_LIGHTBULB, HOMEKIT_SERVICE_LIGHTBULB, 2);
+        light->primary = true;
+        light->characteristics[0] = NEW_HOMEKIT_CHARACTERISTIC(ON, false, .id = HOST_BRIDGE_IID_ON, .setter_ex = light_set);
+        light->characteristics[1] = NEW_HOMEKIT_CHARACTERISTIC(BRIGHTNESS, 100, .id = HOST_BRIDGE_IID_BRIGHTNESS, .setter_ex = light_set);
+        accessory->services[1] = light;
+
+        homekit_service_t *sensor = service_new(HOST_BRIDGE_IID_SENSOR, HOMEKIT_SERVICE_TEMPERATURE_SENSOR, 1);
+        temperatures[i] = NEW_HOMEKIT_CHARACTERISTIC(CURRENT_TEMPERATURE, 20, .id = HOST_BRIDGE_IID_TEMPERATURE);
+        sensor->characteristics[0] = temperatures[i];
+        accessory->services[2] = sensor;
+
+        accessories[i + 1] = accessory;
+    }
+
+    return accessories;
+}
+
+// Sensor readings come from another task, as on device
+static void *sensor_thread(void *arg) {
+    unsigned int step = 0;
+
+    for (;;) {
+        vTaskDelay(sensor_period / portTICK_PERIOD_MS);
+
+        step++;
+        for (unsigned int i = 0; i < accessories_count; i++) {
+            temperatures[i]->value.float_value = 20 + ((step + i) % 50) / 10.f;
+            homekit_characteristic_notify(temperatures[i]);
+        }
+    }
+
+    return NULL;
+}
+
+static void stats_print() {
+    host_heap_stats_t heap;
+    host_heap_get_stats(&heap);
+    fprintf(control, "heap %zu %zu %zu %u %u\n", heap.size, heap.used, heap.peak, heap.allocs,
+            homekit_get_request_heap_min());
+
+    host_spiflash_stats_t flash;
+    host_spiflash_get_stats(&flash);
+    fprintf(control, "flash %u %u %u\n", flash.reads, flash.writes, flash.erases);
+
+    for (unsigned int endpoint = 0; endpoint < HOMEKIT_ENDPOINTS_COUNT; endpoint++) {
+        homekit_request_stats_t request;
+        homekit_get_request_stats(endpoint, &request);
+        fprintf(control, "endpoint %u %u %u %u\n", endpoint, request.count, request.time_total, request.time_max);
+    }
+
+    uint32_t coalesced, emitted, suppressed;
+    homekit_get_notify_stats(&coalesced, &emitted, &suppressed);
+    fprintf(control, "notify %u %u %u\n", coalesced, emitted, suppressed);
+
+    uint32_t queued, event_drops;
+    homekit_get_send_queue_stats(&queued, &event_drops);
+    fprintf(control, "queue %u %u\n", queued, event_drops);
+
+    uint32_t evictions[HOMEKIT_CLIENT_EVICTION_REASONS], refused;
+    homekit_get_client_eviction_stats(evictions, &refused);
+    fprintf(control, "eviction %u %u %u %u\n", evictions[HOMEKIT_CLIENT_EVICTION_MAX_CLIENTS],
+            evictions[HOMEKIT_CLIENT_EVICTION_HEAP], evictions[HOMEKIT_CLIENT_EVICTION_LOW_DRAM], refused);
+
+    fprintf(control, "end\n");
+    fflush(control);
+}
+
+int main(int argc, char **argv) {
+    const char *flash_file = FLASH_FILE_DEFAULT;
+    unsigned int max_clients = 0;
+    bool quiet = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:f:a:e:H:c:q")) != -1) {
+        switch (opt) {
+            case 'p':
+                host_port_set(atoi(optarg));
+                break;
+            case 'f':
+                flash_file = optarg;
+                break;
+            case 'a':
+                accessories_count = atoi(optarg);
+                break;
+            case 'e':
+                sensor_period = atoi(optarg);
+                break;
+            case 'H':
+                host_heap_set_size(atoi(optarg));
+                break;
+            case 'c':
+                max_clients = atoi(optarg);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-p port] [-f flash_file] [-a accessories] [-e sensor_period_ms] "
+                        "[-H heap_size] [-c max_clients] [-q]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (!accessories_count || accessories_count > HOST_BRIDGE_ACCESSORIES_MAX || max_clients > 31) {
+        fprintf(stderr, "Accessories 1-%u, max clients up to 31\n", HOST_BRIDGE_ACCESSORIES_MAX);
+        return EXIT_FAILURE;
+    }
+
+    if (host_spiflash_open(flash_file, FLASH_SIZE) < 0) {
+        fprintf(stderr, "Can not open flash file %s\n", flash_file);
+        return EXIT_FAILURE;
+    }
+
+    // Control answers keep stdout, server log goes to stderr
+    control = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(quiet ? open("/dev/null", O_WRONLY) : STDERR_FILENO, STDOUT_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    // Clients gone while server writes must not end process
+    signal(SIGPIPE, SIG_IGN);
+
+    static homekit_server_config_t config = {
+        .setup_id = "HOST",
+        .category = HOMEKIT_DEVICE_CATEGORY_BRIDGE,
+        .config_number = 1,
+    };
+    config.accessories = bridge_new();
+    config.max_clients = max_clients;
+
+    homekit_server_init(&config);
+
+    if (sensor_period) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, sensor_thread, NULL);
+        pthread_detach(thread);
+    }
+
+    fprintf(control, HOST_BRIDGE_READY "\n");
+    fflush(control);
+
+    char line[64];
+    while (fgets(line, sizeof(line), stdin)) {
+        if (!strcmp(line, "stats\n")) {
+            stats_print();
+        } else if (!strcmp(line, "peak\n")) {
+            host_heap_reset_peak();
+            fprintf(control, "ok\n");
+            fflush(control);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+// Flash emulator of host build: NOR flash as a file mapped in memory, which is not counted in heap.
+// As on device, erase sets a sector to 0xFF and write can only clear bits, so data written
+// without erasing first reads back wrong, like it would on device.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <spiflash.h>
+#include "host_port.h"
+
+static uint8_t *flash = NULL;
+static uint32_t flash_size = 0;
+static host_spiflash_stats_t flash_stats;
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+int host_spiflash_open(const char *path, const uint32_t size) {
+    if (size % SPI_FLASH_SECTOR_SIZE) {
+        return -1;
+    }
+    
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        return -1;
+    }
+    
+    // Part missing in file is erased flash
+    uint8_t erased[SPI_FLASH_SECTOR_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (off_t offset = st.st_size; offset < size; offset += sizeof(erased)) {
+        if (pwrite(fd, erased, sizeof(erased), offset) != sizeof(erased)) {
+            close(fd);
+            return -1;
+        }
+    }
+    
+    uint8_t *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    
+    flash = data;
+    flash_size = size;
+    
+    return 0;
+}
+
+void host_spiflash_get_stats(host_spiflash_stats_t *stats) {
+    pthread_mutex_lock(&flash_lock);
+    *stats = flash_stats;
+    pthread_mutex_unlock(&flash_lock);
+}
+
+static bool flash_range_valid(const uint32_t addr, const uint32_t size) {
+    return flash && addr <= flash_size && size <= flash_size - addr;
+}
+
+bool spiflash_read(uint32_t addr, uint8_t *buf, uint32_t size) {
+    pthread_mutex_lock(&flash_lock);
+    const bool valid = flash_range_valid(addr, size);
+    if (valid) {
+        memcpy(buf, flash + addr, size);
+        flash_stats.reads++;
+    }
+    pthread_mutex_unlock(&flash_lock);
+    
+    return valid;
+}
+
+bool spiflash_write(uint32_t addr, uint8_t *buf, uint32_t size) {
+    pthread_mutex_lock(&flash_lock);
+    const bool valid = flash_range_valid(addr, size);
+    if (valid) {
+        for (uint32_t i = 0; i < size; i++) {
+            flash[addr + i] &= buf[i];
+        }
+        flash_stats.writes++;
+    }
+    pthread_mutex_unlock(&flash_lock);
+    
+    return valid;
+}
+
+bool spiflash_erase_sector(uint32_t addr) {
+    pthread_mutex_lock(&flash_lock);
+    const bool valid = !(addr % SPI_FLASH_SECTOR_SIZE) && flash_range_valid(addr, SPI_FLASH_SECTOR_SIZE);
+    if (valid) {
+        memset(flash + addr, 0xFF, SPI_FLASH_SECTOR_SIZE);
+        flash_stats.erases++;
+    }
+    pthread_mutex_unlock(&flash_lock);
+    
+    return valid;
+}
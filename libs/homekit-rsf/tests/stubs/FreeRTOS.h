@@ -0,0 +1,28 @@
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+// FreeRTOS shim of host build: tasks are threads, ticks come from monotonic clock and heap is
+// malloc() counted against a fixed size. See host_port.c
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 (0)
+#define pdTRUE                  (1)
+#define pdFAIL                  (pdFALSE)
+#define pdPASS                  (pdTRUE)
+
+#define configTICK_RATE_HZ      (100)
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY           ((TickType_t) 0xFFFFFFFF)
+#define tskIDLE_PRIORITY        (0)
+
+#define IRAM
+
+size_t xPortGetFreeHeapSize();
+
+#endif // __HOST_FREERTOS_H__
@@ -0,0 +1 @@
+// Host tests log with printf, see debug.h
@@ -0,0 +1,10 @@
+#ifndef __HOST_HWRAND_H__
+#define __HOST_HWRAND_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t hwrand();
+void hwrand_fill(uint8_t *buf, size_t len);
+
+#endif // __HOST_HWRAND_H__
@@ -0,0 +1,11 @@
+#ifndef __HOST_LIBMAIN_H__
+#define __HOST_LIBMAIN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool sdk_system_overclock();
+bool sdk_system_restoreclock();
+uint32_t sdk_system_get_time_raw();
+
+#endif // __HOST_LIBMAIN_H__
@@ -0,0 +1,9 @@
+#ifndef __HOST_ESP_COMMON_H__
+#define __HOST_ESP_COMMON_H__
+
+#include <stdint.h>
+
+uint32_t sdk_system_get_time();     // Microseconds
+void sdk_system_restart();
+
+#endif // __HOST_ESP_COMMON_H__
@@ -0,0 +1,13 @@
+#ifndef __HOST_LWIP_IP_ADDR_H__
+#define __HOST_LWIP_IP_ADDR_H__
+
+#include <stdint.h>
+
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+
+typedef struct {
+    u32_t addr;
+} ip4_addr_t;
+
+#endif // __HOST_LWIP_IP_ADDR_H__
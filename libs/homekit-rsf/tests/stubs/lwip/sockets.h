@@ -0,0 +1,29 @@
+#ifndef __HOST_LWIP_SOCKETS_H__
+#define __HOST_LWIP_SOCKETS_H__
+
+// lwIP socket API is BSD sockets of host
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define LWIP_NETIF_LOOPBACK     1
+
+#define lwip_fcntl              fcntl
+
+// Server binds its fixed PORT, host_bind() moves it to port given by host_port_set(),
+// so several servers can run at once
+int host_bind(int s, const struct sockaddr *name, socklen_t namelen);
+#define bind                    host_bind
+
+// Accepted sockets get send buffer of device lwIP, TCP_SND_BUF of 2 * TCP_MSS, instead of
+// megabytes of host, so a client that reads slowly fills server send queue as on device
+#define HOST_SEND_BUFFER        (2 * 1460)
+int host_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
+#define accept                  host_accept
+
+#endif // __HOST_LWIP_SOCKETS_H__
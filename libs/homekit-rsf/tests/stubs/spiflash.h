@@ -0,0 +1,15 @@
+#ifndef __HOST_SPIFLASH_H__
+#define __HOST_SPIFLASH_H__
+
+// Flash emulated on a file, see host_spiflash.c
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SPI_FLASH_SECTOR_SIZE      4096
+
+bool spiflash_read(uint32_t addr, uint8_t *buf, uint32_t size);
+bool spiflash_write(uint32_t addr, uint8_t *buf, uint32_t size);
+bool spiflash_erase_sector(uint32_t addr);
+
+#endif // __HOST_SPIFLASH_H__
@@ -0,0 +1,16 @@
+#ifndef __HOST_SYSPARAM_H__
+#define __HOST_SYSPARAM_H__
+
+#include <stdint.h>
+
+typedef enum {
+    SYSPARAM_OK           = 0,
+    SYSPARAM_NOTFOUND     = 1,
+    SYSPARAM_ERR_NOMEM    = -6,
+} sysparam_status_t;
+
+// Kept in memory only
+sysparam_status_t sysparam_get_int32(const char *key, int32_t *result);
+sysparam_status_t sysparam_set_int32(const char *key, int32_t value);
+
+#endif // __HOST_SYSPARAM_H__
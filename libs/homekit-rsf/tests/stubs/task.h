@@ -0,0 +1,15 @@
+#ifndef __HOST_TASK_H__
+#define __HOST_TASK_H__
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, const uint32_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(const TickType_t ticks);
+TickType_t xTaskGetTickCount();
+
+#endif // __HOST_TASK_H__
@@ -0,0 +1,11 @@
+#ifndef __HOST_TIMERS_H__
+#define __HOST_TIMERS_H__
+
+// Types only: server does not use timers
+
+#include "FreeRTOS.h"
+
+typedef void *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+#endif // __HOST_TIMERS_H__
@@ -0,0 +1,34 @@
+#ifndef __HOMEKIT_TEST__
+#define __HOMEKIT_TEST__
+
+#include <stdio.h>
+#include <string.h>
+
+// Minimal checks for host tests: a failed check is reported and counted, and test goes on
+
+static unsigned int test_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_STR(actual, expected) \
+    do { \
+        const char *_actual = (actual); \
+        const char *_expected = (expected); \
+        if (strcmp(_actual, _expected)) { \
+            printf("%s:%d: \"%s\" != \"%s\"\n", __FILE__, __LINE__, _actual, _expected); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_MEM(actual, expected, size) CHECK(!memcmp((actual), (expected), (size)))
+
+#define TEST_RESULT() \
+    (printf("%s: %s\n", __FILE__, test_failures ? "FAILED" : "OK"), test_failures ? 1 : 0)
+
+#endif // __HOMEKIT_TEST__
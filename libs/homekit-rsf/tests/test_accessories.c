@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <time.h>
+#include <homekit/types.h>
+#include "test.h"
+
+// HAA style bridge: every accessory has an information service whose manufacturer, model,
+// firmware and identify characteristics are same objects, plus its own services.
+#define ACCESSORIES             (50)
+#define SERVICES                (5)     // Besides information service, 550 characteristics in total
+#define SERVICE_CHARACTERISTICS (1)
+#define LOOKUPS                 (200000)
+
+static homekit_characteristic_t manufacturer = { .type = "20", .permissions = HOMEKIT_PERMISSIONS_PAIRED_READ };
+static homekit_characteristic_t model = { .type = "21", .permissions = HOMEKIT_PERMISSIONS_PAIRED_READ };
+static homekit_characteristic_t firmware = { .type = "52", .permissions = HOMEKIT_PERMISSIONS_PAIRED_READ };
+static homekit_characteristic_t identify = { .type = "14", .permissions = HOMEKIT_PERMISSIONS_PAIRED_WRITE };
+
+static unsigned int characteristics_count = 0;
+
+static homekit_characteristic_t *characteristic_new(const homekit_permissions_t permissions) {
+    homekit_characteristic_t *ch = calloc(1, sizeof(homekit_characteristic_t));
+    ch->type = "25";
+    ch->permissions = permissions;
+    characteristics_count++;
+    return ch;
+}
+
+static homekit_service_t *service_new(const uint16_t id, homekit_characteristic_t **characteristics) {
+    homekit_service_t *service = calloc(1, sizeof(homekit_service_t));
+    service->id = id;
+    service->type = "49";
+    service->characteristics = characteristics;
+    return service;
+}
+
+static homekit_accessory_t **bridge_new() {
+    homekit_accessory_t **accessories = calloc(ACCESSORIES + 1, sizeof(homekit_accessory_t*));
+    
+    for (unsigned int a = 0; a < ACCESSORIES; a++) {
+        homekit_accessory_t *accessory = calloc(1, sizeof(homekit_accessory_t));
+        accessory->id = a + 1;
+        accessory->services = calloc(SERVICES + 2, sizeof(homekit_service_t*));
+        
+        homekit_characteristic_t **info = calloc(7, sizeof(homekit_characteristic_t*));
+        info[0] = characteristic_new(HOMEKIT_PERMISSIONS_PAIRED_READ);     // Name
+        info[1] = &manufacturer;
+        info[2] = characteristic_new(HOMEKIT_PERMISSIONS_PAIRED_READ);     // Serial number
+        info[3] = &model;
+        info[4] = &firmware;
+        info[5] = &identify;
+        characteristics_count += 4;
+        accessory->services[0] = service_new(1, info);
+        
+        for (unsigned int s = 0; s < SERVICES; s++) {
+            homekit_characteristic_t **characteristics = calloc(SERVICE_CHARACTERISTICS + 1, sizeof(homekit_characteristic_t*));
+            for (unsigned int c = 0; c < SERVICE_CHARACTERISTICS; c++) {
+                characteristics[c] = characteristic_new(HOMEKIT_PERMISSIONS_PAIRED_READ | HOMEKIT_PERMISSIONS_NOTIFY);
+            }
+            accessory->services[s + 1] = service_new(0, characteristics);
+        }
+        
+        accessories[a] = accessory;
+    }
+    
+    return accessories;
+}
+
+// Nested scan used before index
+static homekit_characteristic_t *scan_by_aid_and_iid(homekit_accessory_t **accessories, int aid, int iid) {
+    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
+        homekit_accessory_t *accessory = *accessory_it;
+        if (accessory->id != aid)
+            continue;
+        
+        for (homekit_service_t **service_it = accessory->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                if ((*ch_it)->id == iid)
+                    return *ch_it;
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+static homekit_accessory_t **accessories;
+
+static void test_hits() {
+    unsigned int found = 0;
+    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
+        for (homekit_service_t **service_it = (*accessory_it)->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                const int aid = (*accessory_it)->id;
+                const int iid = (*ch_it)->id;
+                homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(accessories, aid, iid);
+                CHECK(ch == *ch_it);
+                CHECK(ch == scan_by_aid_and_iid(accessories, aid, iid));
+                found++;
+            }
+        }
+    }
+    
+    CHECK(found == characteristics_count);
+    CHECK(found == ACCESSORIES * (6 + SERVICES * SERVICE_CHARACTERISTICS));
+}
+
+static void test_shared() {
+    // Shared characteristics keep iid given in first accessory, and are found in every one
+    CHECK(manufacturer.id == 3 && model.id == 5 && firmware.id == 6 && identify.id == 7);
+    for (int aid = 1; aid <= ACCESSORIES; aid++) {
+        CHECK(homekit_characteristic_by_aid_and_iid(accessories, aid, 3) == &manufacturer);
+        CHECK(homekit_characteristic_by_aid_and_iid(accessories, aid, 5) == &model);
+        CHECK(homekit_characteristic_by_aid_and_iid(accessories, aid, 7) == &identify);
+        
+        homekit_characteristic_t *name = homekit_characteristic_by_aid_and_iid(accessories, aid, 2);
+        CHECK(name == accessories[aid - 1]->services[0]->characteristics[0]);
+    }
+    
+    // Only characteristics with notify permission get an ordinal, and each one gets only one
+    CHECK(homekit_characteristics_count() == ACCESSORIES * SERVICES * SERVICE_CHARACTERISTICS);
+    CHECK(manufacturer.ordinal == 0);
+    for (unsigned int ordinal = 1; ordinal <= homekit_characteristics_count(); ordinal++) {
+        CHECK(homekit_characteristic_by_ordinal(ordinal)->ordinal == ordinal);
+    }
+}
+
+static void test_misses() {
+    const int aids[] = { 0, 1, 25, ACCESSORIES, ACCESSORIES + 1, 65535, -1 };
+    const int iids[] = { 0, 1, 8, 9, 12, 13, 19, 20, 100, 65535, -1 };
+    
+    for (unsigned int a = 0; a < sizeof(aids) / sizeof(*aids); a++) {
+        for (unsigned int i = 0; i < sizeof(iids) / sizeof(*iids); i++) {
+            CHECK(homekit_characteristic_by_aid_and_iid(accessories, aids[a], iids[i]) ==
+                  scan_by_aid_and_iid(accessories, aids[a], iids[i]));
+        }
+    }
+    
+    CHECK(!homekit_characteristic_by_aid_and_iid(accessories, 1, 1));      // Service iid
+    CHECK(!homekit_characteristic_by_aid_and_iid(accessories, ACCESSORIES + 1, 2));
+}
+
+static void test_foreign_array() {
+    // Another accessories array is not indexed, so its lookups scan it
+    homekit_accessory_t *subset[] = { accessories[4], accessories[9], NULL };
+    
+    CHECK(homekit_characteristic_by_aid_and_iid(subset, 5, 2) == accessories[4]->services[0]->characteristics[0]);
+    CHECK(homekit_characteristic_by_aid_and_iid(subset, 10, 3) == &manufacturer);
+    CHECK(!homekit_characteristic_by_aid_and_iid(subset, 1, 2));
+    
+    for (int iid = 0; iid < 20; iid++) {
+        CHECK(homekit_characteristic_by_aid_and_iid(subset, 10, iid) == scan_by_aid_and_iid(subset, 10, iid));
+    }
+}
+
+static void test_clear_subscriptions() {
+    homekit_characteristic_t *ch = homekit_characteristic_by_ordinal(1);
+    homekit_characteristic_t *last = homekit_characteristic_by_ordinal(homekit_characteristics_count());
+    
+    homekit_characteristic_add_notify_subscription(ch, 0);
+    homekit_characteristic_add_notify_subscription(ch, 31);
+    homekit_characteristic_add_notify_subscription(last, 31);
+    CHECK(homekit_characteristic_has_notify_subscription(ch, 31));
+    
+    homekit_accessories_clear_notify_subscriptions(accessories, 31);
+    CHECK(homekit_characteristic_has_notify_subscription(ch, 0));
+    CHECK(!homekit_characteristic_has_notify_subscription(ch, 31));
+    CHECK(!homekit_characteristic_has_notify_subscription(last, 31));
+    
+    homekit_accessories_clear_notify_subscriptions(accessories, 0);
+    CHECK(ch->subscriptions == 0);
+}
+
+static bool slot_pattern(const unsigned int ordinal, const unsigned int slot) {
+    return (ordinal + slot) % 3 == 0;
+}
+
+static void test_subscription_slots() {
+    const unsigned int count = homekit_characteristics_count();
+    unsigned int subscriptions = 0;
+    for (unsigned int slot = 0; slot < 32; slot++) {
+        for (unsigned int ordinal = 1; ordinal <= count; ordinal++) {
+            if (slot_pattern(ordinal, slot)) {
+                homekit_characteristic_add_notify_subscription(homekit_characteristic_by_ordinal(ordinal), slot);
+                subscriptions++;
+            }
+        }
+    }
+    
+    // Every slot, top bit too, is kept apart from others
+    unsigned int mismatches = 0;
+    for (unsigned int ordinal = 1; ordinal <= count; ordinal++) {
+        homekit_characteristic_t *ch = homekit_characteristic_by_ordinal(ordinal);
+        for (unsigned int slot = 0; slot < 32; slot++) {
+            mismatches += homekit_characteristic_has_notify_subscription(ch, slot) != slot_pattern(ordinal, slot);
+        }
+    }
+    CHECK(mismatches == 0);
+    
+    // Unsubscribing twice is same as once
+    homekit_characteristic_t *second = homekit_characteristic_by_ordinal(2);
+    homekit_characteristic_remove_notify_subscription(second, 31);
+    homekit_characteristic_remove_notify_subscription(second, 31);
+    CHECK(!homekit_characteristic_has_notify_subscription(second, 31));
+    CHECK(homekit_characteristic_has_notify_subscription(second, 1));
+    homekit_characteristic_add_notify_subscription(second, 31);
+    
+    // Disconnect of slot 7 touches no other slot, whether array is indexed or scanned
+    homekit_accessory_t *subset[] = { accessories[0], accessories[1], NULL };
+    homekit_accessories_clear_notify_subscriptions(subset, 7);
+    homekit_characteristic_t *first = accessories[0]->services[1]->characteristics[0];
+    homekit_characteristic_t *other = accessories[2]->services[1]->characteristics[0];
+    CHECK(!homekit_characteristic_has_notify_subscription(first, 7));
+    CHECK(homekit_characteristic_has_notify_subscription(other, 7) == slot_pattern(other->ordinal, 7));
+    
+    homekit_accessories_clear_notify_subscriptions(accessories, 7);
+    mismatches = 0;
+    for (unsigned int ordinal = 1; ordinal <= count; ordinal++) {
+        homekit_characteristic_t *ch = homekit_characteristic_by_ordinal(ordinal);
+        for (unsigned int slot = 0; slot < 32; slot++) {
+            mismatches += homekit_characteristic_has_notify_subscription(ch, slot) != (slot != 7 && slot_pattern(ordinal, slot));
+        }
+    }
+    CHECK(mismatches == 0);
+    
+    for (unsigned int slot = 0; slot < 32; slot++) {
+        homekit_accessories_clear_notify_subscriptions(accessories, slot);
+    }
+    for (unsigned int ordinal = 1; ordinal <= count; ordinal++) {
+        CHECK(homekit_characteristic_by_ordinal(ordinal)->subscriptions == 0);
+    }
+    
+    // Former list took a node of context and next pointers per subscription, bitmasks take no heap
+    printf("%u subscriptions of 32 clients: list nodes %zu bytes, bitmasks 0 bytes of heap\n",
+           subscriptions, subscriptions * 2 * sizeof(void*));
+}
+
+static void test_sparse_aids() {
+    // Few accessories with far apart aids are searched in whole index, without per aid table
+    static homekit_characteristic_t ch1 = { .type = "25" }, ch2 = { .type = "25" }, ch3 = { .type = "25" };
+    homekit_accessory_t *sparse[] = {
+        &(homekit_accessory_t) { .id = 1, .services = (homekit_service_t*[]) {
+            service_new(1, (homekit_characteristic_t*[]) { &ch1, NULL }), NULL } },
+        &(homekit_accessory_t) { .id = 40000, .services = (homekit_service_t*[]) {
+            service_new(1, (homekit_characteristic_t*[]) { &ch2, &ch3, NULL }), NULL } },
+        NULL
+    };
+    homekit_accessories_init(sparse);
+    
+    CHECK(homekit_characteristic_by_aid_and_iid(sparse, 1, 2) == &ch1);
+    CHECK(homekit_characteristic_by_aid_and_iid(sparse, 40000, 2) == &ch2);
+    CHECK(homekit_characteristic_by_aid_and_iid(sparse, 40000, 3) == &ch3);
+    CHECK(!homekit_characteristic_by_aid_and_iid(sparse, 40000, 4));
+    CHECK(!homekit_characteristic_by_aid_and_iid(sparse, 2, 2));
+    CHECK(!homekit_characteristic_by_aid_and_iid(sparse, 65535, 2));
+    
+    // Old array is not indexed anymore, and is scanned
+    CHECK(homekit_characteristic_by_aid_and_iid(accessories, 3, 3) == &manufacturer);
+}
+
+static double elapsed_ns(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+// Same pseudo-random ids for both, mostly hits with some misses
+static void benchmark() {
+    static int ids[4096][2];
+    srand(1);
+    for (unsigned int i = 0; i < 4096; i++) {
+        ids[i][0] = rand() % (ACCESSORIES + 2);
+        ids[i][1] = rand() % 14;
+    }
+    
+    struct timespec start;
+    volatile uintptr_t sink = 0;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < LOOKUPS; i++) {
+        sink += (uintptr_t) homekit_characteristic_by_aid_and_iid(accessories, ids[i % 4096][0], ids[i % 4096][1]);
+    }
+    const double index_ns = elapsed_ns(&start) / LOOKUPS;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < LOOKUPS; i++) {
+        sink += (uintptr_t) scan_by_aid_and_iid(accessories, ids[i % 4096][0], ids[i % 4096][1]);
+    }
+    const double scan_ns = elapsed_ns(&start) / LOOKUPS;
+    
+    printf("%u accessories, %u characteristics: index %.0f ns, scan %.0f ns per lookup\n",
+           ACCESSORIES, characteristics_count, index_ns, scan_ns);
+}
+
+int main() {
+    accessories = bridge_new();
+    homekit_accessories_init(accessories);
+    
+    test_hits();
+    test_shared();
+    test_misses();
+    test_foreign_array();
+    test_clear_subscriptions();
+    test_subscription_slots();
+    benchmark();
+    test_sparse_aids();
+    
+    return TEST_RESULT();
+}
@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "chacha20poly1305.h"
+#include "test.h"
+
+static size_t hex(const char *text, uint8_t *output) {
+    size_t size = 0;
+    while (text[0] && text[1]) {
+        sscanf(text, "%2hhx", &output[size++]);
+        text += 2;
+    }
+    
+    return size;
+}
+
+// RFC 8439 section 2.8.2
+static void test_encrypt_vector() {
+    uint8_t key[32], nonce[12], aad[12], expected[114], expected_tag[16];
+    hex("808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f", key);
+    hex("070000004041424344454647", nonce);
+    hex("50515253c0c1c2c3c4c5c6c7", aad);
+    hex("d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+        "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+        "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+        "3ff4def08e4b7a9de576d26586cec64b6116", expected);
+    hex("1ae10b594f09e26a7e902ecbd0600691", expected_tag);
+    
+    const char *plaintext = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip "
+                            "for the future, sunscreen would be it.";
+    CHECK(strlen(plaintext) == sizeof(expected));
+    
+    uint32_t aligned[32];
+    uint8_t *output = (uint8_t *) aligned;
+    uint8_t tag[16];
+    chacha20poly1305_encrypt(key, nonce, aad, sizeof(aad), (const uint8_t *) plaintext, sizeof(expected), output, tag);
+    CHECK_MEM(output, expected, sizeof(expected));
+    CHECK_MEM(tag, expected_tag, sizeof(tag));
+    
+    // In place, and not word aligned
+    uint8_t *unaligned = (uint8_t *) aligned + 1;
+    memcpy(unaligned, plaintext, sizeof(expected));
+    chacha20poly1305_encrypt(key, nonce, aad, sizeof(aad), unaligned, sizeof(expected), unaligned, tag);
+    CHECK_MEM(unaligned, expected, sizeof(expected));
+    CHECK_MEM(tag, expected_tag, sizeof(tag));
+    
+    CHECK(!chacha20poly1305_decrypt(key, nonce, aad, sizeof(aad), unaligned, sizeof(expected), tag, unaligned));
+    CHECK_MEM(unaligned, plaintext, sizeof(expected));
+}
+
+// RFC 8439 appendix A.5
+static void test_decrypt_vector() {
+    uint8_t key[32], nonce[12], aad[12], tag[16], ciphertext[265], plaintext[265];
+    hex("1c9240a5eb55d38af333888604f6b5f0473917c1402b80099dca5cbc207075c0", key);
+    hex("000000000102030405060708", nonce);
+    hex("f33388860000000000004e91", aad);
+    const size_t size = hex(
+        "64a0861575861af460f062c79be643bd5e805cfd345cf389f108670ac76c8cb2"
+        "4c6cfc18755d43eea09ee94e382d26b0bdb7b73c321b0100d4f03b7f355894cf"
+        "332f830e710b97ce98c8a84abd0b948114ad176e008d33bd60f982b1ff37c855"
+        "9797a06ef4f0ef61c186324e2b3506383606907b6a7c02b0f9f6157b53c867e4"
+        "b9166c767b804d46a59b5216cde7a4e99040c5a40433225ee282a1b0a06c523e"
+        "af4534d7f83fa1155b0047718cbc546a0d072b04b3564eea1b422273f548271a"
+        "0bb2316053fa76991955ebd63159434ecebb4e466dae5a1073a6727627097a10"
+        "49e617d91d361094fa68f0ff77987130305beaba2eda04df997b714d6c6f2c29"
+        "a6ad5cb4022b02709b", ciphertext);
+    hex("eead9d67890cbb22392336fea1851f38", tag);
+    CHECK(size == sizeof(ciphertext));
+    
+    CHECK(!chacha20poly1305_decrypt(key, nonce, aad, sizeof(aad), ciphertext, size, tag, plaintext));
+    const char *expected = "Internet-Drafts are draft documents valid for a maximum of six months";
+    CHECK_MEM(plaintext, expected, strlen(expected));
+    
+    // Wrong tag leaves output untouched
+    tag[15] ^= 1;
+    memset(plaintext, 0x5a, sizeof(plaintext));
+    CHECK(chacha20poly1305_decrypt(key, nonce, aad, sizeof(aad), ciphertext, size, tag, plaintext) == -1);
+    CHECK(plaintext[0] == 0x5a && plaintext[size - 1] == 0x5a);
+}
+
+// Word and byte paths give same result for every size around block boundaries
+static void test_sizes() {
+    uint8_t key[32], nonce[12], aad[2] = { 0x10, 0x04 };
+    for (unsigned int i = 0; i < sizeof(key); i++) {
+        key[i] = i * 3;
+    }
+    memset(nonce, 0, sizeof(nonce));
+    nonce[4] = 1;
+    
+    uint32_t input_words[160], output_words[160];
+    uint8_t *input = (uint8_t *) input_words;
+    uint8_t *output = (uint8_t *) output_words;
+    uint8_t reference[600], tag[16], reference_tag[16];
+    
+    for (size_t size = 0; size <= 520; size++) {
+        for (size_t i = 0; i < size; i++) {
+            input[i + 3] = i ^ size;
+        }
+        
+        chacha20poly1305_encrypt(key, nonce, aad, sizeof(aad), input + 3, size, reference, reference_tag);
+        chacha20poly1305_encrypt(key, nonce, aad, sizeof(aad), input + 3, size, output, tag);
+        memmove(input, input + 3, size);
+        chacha20poly1305_encrypt(key, nonce, aad, sizeof(aad), input, size, input, tag);
+        CHECK_MEM(input, reference, size);
+        CHECK_MEM(tag, reference_tag, sizeof(tag));
+        CHECK_MEM(output, reference, size);
+        
+        CHECK(!chacha20poly1305_decrypt(key, nonce, aad, sizeof(aad), input, size, tag, input));
+        for (size_t i = 0; i < size; i++) {
+            if (input[i] != (uint8_t) (i ^ size)) {
+                CHECK(input[i] == (uint8_t) (i ^ size));
+                break;
+            }
+        }
+    }
+}
+
+int main() {
+    test_encrypt_vector();
+    test_decrypt_vector();
+    test_sizes();
+    
+    return TEST_RESULT();
+}
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <time.h>
+#include <homekit/types.h>
+#include "characteristic_ids.h"
+#include "query_params.h"
+#include "test.h"
+
+#define ACCESSORIES             (10)
+#define ITERATIONS              (100000)
+
+// Same default as server.c
+#ifndef HOMEKIT_REQUEST_ARENA_SIZE
+#define HOMEKIT_REQUEST_ARENA_SIZE              (768)
+#endif
+
+// Request arena of server: query string and params are taken from it first, bigger ones spill to heap
+static uint8_t arena[HOMEKIT_REQUEST_ARENA_SIZE] __attribute__((aligned(sizeof(void*))));
+static size_t arena_used;
+static void *spills[8];
+static unsigned int spills_count;
+static bool alloc_fails;
+
+// Same alignment as server request arena
+#define arena_align(size)   (((size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+static void *arena_alloc(size_t size, void *arg) {
+    if (alloc_fails)
+        return NULL;
+
+    if (arena_used + arena_align(size) <= HOMEKIT_REQUEST_ARENA_SIZE) {
+        void *ptr = arena + arena_used;
+        arena_used += arena_align(size);
+        return ptr;
+    }
+
+    if (spills_count >= sizeof(spills) / sizeof(*spills))
+        return NULL;
+
+    return spills[spills_count++] = malloc(size);
+}
+
+static void arena_reset() {
+    while (spills_count) {
+        free(spills[--spills_count]);
+    }
+    arena_used = 0;
+    alloc_fails = false;
+}
+
+static homekit_accessory_t **accessories;
+
+// Every accessory has one service with 5 readable characteristics, iids 2 to 6, and write only one, iid 7
+static homekit_accessory_t **accessories_new() {
+    homekit_accessory_t **accessories = calloc(ACCESSORIES + 1, sizeof(homekit_accessory_t*));
+
+    for (unsigned int a = 0; a < ACCESSORIES; a++) {
+        homekit_characteristic_t **characteristics = calloc(7, sizeof(homekit_characteristic_t*));
+        for (unsigned int c = 0; c < 6; c++) {
+            characteristics[c] = calloc(1, sizeof(homekit_characteristic_t));
+            characteristics[c]->type = "25";
+            characteristics[c]->permissions = c < 5 ? HOMEKIT_PERMISSIONS_PAIRED_READ : HOMEKIT_PERMISSIONS_PAIRED_WRITE;
+        }
+
+        homekit_service_t *service = calloc(1, sizeof(homekit_service_t));
+        service->type = "49";
+        service->characteristics = characteristics;
+
+        accessories[a] = calloc(1, sizeof(homekit_accessory_t));
+        accessories[a]->id = a + 1;
+        accessories[a]->services = calloc(2, sizeof(homekit_service_t*));
+        accessories[a]->services[0] = service;
+    }
+
+    return accessories;
+}
+
+// Query string as server gets it: copied to arena, then parsed into params and ids
+static int parse(const char *query, characteristic_id_t **ids) {
+    arena_reset();
+
+    char *s = arena_alloc(strlen(query) + 1, NULL);
+    strcpy(s, query);
+
+    query_param_t *id_param = query_params_find(query_params_parse(s, arena_alloc, NULL), "id");
+    if (!id_param || !id_param->value)
+        return CHARACTERISTIC_IDS_MALFORMED;
+
+    return characteristic_ids_parse(id_param->value, accessories, ids, arena_alloc, NULL);
+}
+
+// Every readable characteristic: 1.2,1.3,...,10.6
+static void query_of_ids(char *query, const unsigned int count) {
+    char *s = query + sprintf(query, "id=");
+    for (unsigned int i = 0; i < count; i++) {
+        s += sprintf(s, "%s%u.%u", i ? "," : "", i / 5 + 1, i % 5 + 2);
+    }
+    strcpy(s, "&meta=1&perms=1&type=1&ev=1");
+}
+
+static void test_readable() {
+    characteristic_id_t *ids;
+    CHECK(parse("id=1.2,2.6,10.4&ev=1", &ids) == 3);
+    CHECK(ids[0].aid == 1 && ids[0].iid == 2 && ids[0].ch == accessories[0]->services[0]->characteristics[0]);
+    CHECK(ids[1].aid == 2 && ids[1].iid == 6 && ids[1].ch == accessories[1]->services[0]->characteristics[4]);
+    CHECK(ids[2].aid == 10 && ids[2].iid == 4 && ids[2].ch == accessories[9]->services[0]->characteristics[2]);
+    CHECK(characteristic_ids_readable(ids, 3));     // 200
+}
+
+static void test_not_readable() {
+    characteristic_id_t *ids;
+
+    // Missing accessory or characteristic: 207, with NoResource status for id
+    CHECK(parse("id=1.2,11.2", &ids) == 2);
+    CHECK(ids[0].ch && !ids[1].ch && ids[1].aid == 11 && ids[1].iid == 2);
+    CHECK(!characteristic_ids_readable(ids, 2));
+
+    CHECK(parse("id=1.8", &ids) == 1);
+    CHECK(!ids[0].ch);
+    CHECK(!characteristic_ids_readable(ids, 1));
+
+    CHECK(parse("id=0.0", &ids) == 1);
+    CHECK(!ids[0].ch);
+
+    // Write only: 207, with WriteOnly status for id
+    CHECK(parse("id=3.7,3.6", &ids) == 2);
+    CHECK(ids[0].ch && !(ids[0].ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ));
+    CHECK(!characteristic_ids_readable(ids, 2));
+    CHECK(characteristic_ids_readable(ids + 1, 1));
+}
+
+static void test_malformed() {
+    const char *queries[] = {
+        "id=", "id=1", "id=1.", "id=.2", "id=.", "id=1.2,", "id=,1.2", "id=1.2,,1.3", "id=a.b", "id=1.2x",
+        "id=1x.2", "id=1.2.3", "id=-1.2", "id=1.-2", "id=1.99999999999", "id= 1.2",
+    };
+
+    for (unsigned int i = 0; i < sizeof(queries) / sizeof(*queries); i++) {
+        characteristic_id_t *ids;
+        const int count = parse(queries[i], &ids);
+        if (count != CHARACTERISTIC_IDS_MALFORMED) {
+            printf("%s: %d ids\n", queries[i], count);
+        }
+        CHECK(count == CHARACTERISTIC_IDS_MALFORMED);     // 400
+    }
+}
+
+static void test_duplicates() {
+    // Kept, and answered once per id as requested
+    characteristic_id_t *ids;
+    CHECK(parse("id=4.3,4.3,4.03,4.7,4.7", &ids) == 5);
+    CHECK(ids[0].ch && ids[0].ch == ids[1].ch && ids[1].ch == ids[2].ch);
+    CHECK(ids[3].ch && ids[3].ch == ids[4].ch);
+    CHECK(!characteristic_ids_readable(ids, 5));
+    CHECK(characteristic_ids_readable(ids, 3));
+}
+
+static void test_arena_spill() {
+    static char query[1024];
+    query_of_ids(query, 50);
+
+    characteristic_id_t *ids;
+    CHECK(parse(query, &ids) == 50);
+    CHECK(spills_count == 1);
+    CHECK(spills_count && (void*) ids == spills[0]);
+    for (unsigned int i = 0; i < 50; i++) {
+        CHECK(ids[i].aid == (int) (i / 5 + 1) && ids[i].iid == (int) (i % 5 + 2));
+        CHECK(ids[i].ch == accessories[i / 5]->services[0]->characteristics[i % 5]);
+    }
+    CHECK(characteristic_ids_readable(ids, 50));
+
+    // 10 ids stay in arena
+    query_of_ids(query, 10);
+    CHECK(parse(query, &ids) == 10);
+    CHECK(spills_count == 0);
+    CHECK((uint8_t*) ids >= arena && (uint8_t*) ids < arena + HOMEKIT_REQUEST_ARENA_SIZE);
+
+    // 500 OutOfResources
+    arena_reset();
+    alloc_fails = true;
+    char s[] = "1.2,1.3";
+    CHECK(characteristic_ids_parse(s, accessories, &ids, arena_alloc, NULL) == CHARACTERISTIC_IDS_NO_MEMORY);
+    arena_reset();
+}
+
+static double elapsed_ns(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void benchmark() {
+    const unsigned int counts[] = { 1, 10, 50 };
+    static char query[1024];
+
+    for (unsigned int c = 0; c < sizeof(counts) / sizeof(*counts); c++) {
+        query_of_ids(query, counts[c]);
+
+        struct timespec start;
+        volatile unsigned int sink = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (unsigned int i = 0; i < ITERATIONS; i++) {
+            characteristic_id_t *ids;
+            const int count = parse(query, &ids);
+            sink += characteristic_ids_readable(ids, count);
+        }
+        const double ns = elapsed_ns(&start) / ITERATIONS;
+
+        printf("%2u ids: %.0f ns per query, %.0f ns per id\n", counts[c], ns, ns / counts[c]);
+    }
+    arena_reset();
+}
+
+int main() {
+    accessories = accessories_new();
+    homekit_accessories_init(accessories);
+
+    test_readable();
+    test_not_readable();
+    test_malformed();
+    test_duplicates();
+    test_arena_spill();
+    benchmark();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <client_eviction.h>
+#include "test.h"
+
+#define MAX_CLIENTS     (8)
+#define STORM_ARRIVALS  (20000)
+
+static void test_rank() {
+    client_eviction_t clients[] = {
+        { .last_activity = 10, .verified = true, .subscribed = true },     // Hub
+        { .last_activity = 5,  .verified = true, .subscribed = true },
+        { .last_activity = 8,  .verified = true },
+        { .last_activity = 9 },
+        { .last_activity = 7 },
+    };
+    
+    // Oldest unverified client first
+    CHECK(client_eviction_candidate(clients, 5) == 4);
+    clients[4].pinned = true;
+    CHECK(client_eviction_candidate(clients, 5) == 3);
+    clients[3].pinned = true;
+    
+    // Then verified clients without subscriptions, then subscribers other than hub
+    CHECK(client_eviction_candidate(clients, 5) == 2);
+    clients[2].pinned = true;
+    CHECK(client_eviction_candidate(clients, 5) == 1);
+    clients[1].pinned = true;
+    
+    // Hub is never evicted
+    CHECK(client_eviction_candidate(clients, 5) == -1);
+    CHECK(client_eviction_candidate(clients, 0) == -1);
+}
+
+static void test_hub() {
+    // Most recently active subscriber is hub, even if it is older than other clients
+    client_eviction_t clients[] = {
+        { .last_activity = 3, .verified = true, .subscribed = true },
+        { .last_activity = 4, .verified = true, .subscribed = true },
+        { .last_activity = 1, .verified = true, .subscribed = false },
+    };
+    
+    CHECK(client_eviction_candidate(clients, 3) == 2);
+    clients[2].pinned = true;
+    CHECK(client_eviction_candidate(clients, 3) == 0);
+    
+    // Unverified client is not hub even if subscribed flag is set
+    client_eviction_t unverified[] = {
+        { .last_activity = 9, .subscribed = true },
+    };
+    CHECK(client_eviction_candidate(unverified, 1) == 0);
+}
+
+static void test_tick_wrap() {
+    // Activity ticks are compared as differences, so they stay ordered across overflow
+    client_eviction_t clients[] = {
+        { .last_activity = 0xFFFFFFF0 },
+        { .last_activity = 0x10 },
+    };
+    
+    CHECK(client_eviction_candidate(clients, 2) == 0);
+    
+    client_eviction_t subscribers[] = {
+        { .last_activity = 0x10, .verified = true, .subscribed = true },
+        { .last_activity = 0xFFFFFFF0, .verified = true, .subscribed = true },
+    };
+    
+    CHECK(client_eviction_candidate(subscribers, 2) == 1);
+}
+
+// Connection storm: clients arrive on a full server while others verify, subscribe and send
+// requests. Server admits a client only after evicting another one, as in accept.
+typedef struct {
+    client_eviction_t info;
+} storm_client_t;
+
+static storm_client_t storm[MAX_CLIENTS];
+static unsigned int storm_count = 0;
+
+static int storm_hub() {
+    int hub = -1;
+    for (unsigned int i = 0; i < storm_count; i++) {
+        if (storm[i].info.verified && storm[i].info.subscribed &&
+            (hub < 0 || (int32_t) (storm[i].info.last_activity - storm[hub].info.last_activity) > 0)) {
+            hub = i;
+        }
+    }
+    
+    return hub;
+}
+
+static void test_storm() {
+    unsigned int admitted = 0, refused = 0, evicted = 0;
+    uint32_t tick = 0;
+    
+    srand(1);
+    
+    for (unsigned int id = 1; id <= STORM_ARRIVALS; id++) {
+        tick += rand() % 3;
+        
+        // Some connected clients advance: verify, subscribe, send a request or start Pair Setup
+        for (unsigned int i = 0; i < storm_count; i++) {
+            switch (rand() % 8) {
+                case 0:
+                    storm[i].info.verified = true;
+                    break;
+                case 1:
+                    storm[i].info.subscribed = storm[i].info.verified;
+                    break;
+                case 2:
+                    storm[i].info.last_activity = tick;
+                    break;
+                case 3:
+                    storm[i].info.pinned = rand() % 2;
+                    break;
+            }
+        }
+        
+        if (storm_count == MAX_CLIENTS) {
+            client_eviction_t clients[MAX_CLIENTS];
+            for (unsigned int i = 0; i < storm_count; i++) {
+                clients[i] = storm[i].info;
+            }
+            
+            const int hub = storm_hub();
+            const int victim = client_eviction_candidate(clients, storm_count);
+            if (victim < 0) {
+                // Only hub and pinned clients are left
+                for (unsigned int i = 0; i < storm_count; i++) {
+                    CHECK((int) i == hub || storm[i].info.pinned);
+                }
+                refused++;
+                continue;
+            }
+            
+            CHECK(victim != hub);
+            CHECK(!storm[victim].info.pinned);
+            
+            // No client of lower rank, or same rank and less recently active, was kept
+            for (unsigned int i = 0; i < storm_count; i++) {
+                if ((int) i == victim || (int) i == hub || storm[i].info.pinned) {
+                    continue;
+                }
+                const unsigned int rank = storm[i].info.verified + (storm[i].info.verified && storm[i].info.subscribed);
+                const unsigned int victim_rank = storm[victim].info.verified + (storm[victim].info.verified && storm[victim].info.subscribed);
+                CHECK(rank >= victim_rank);
+                if (rank == victim_rank) {
+                    CHECK((int32_t) (storm[i].info.last_activity - storm[victim].info.last_activity) >= 0);
+                }
+            }
+            
+            storm[victim] = storm[--storm_count];
+            evicted++;
+        }
+        
+        CHECK(storm_count < MAX_CLIENTS);
+        
+        storm[storm_count].info = (client_eviction_t) { .last_activity = tick };
+        storm_count++;
+        admitted++;
+    }
+    
+    CHECK(admitted + refused == STORM_ARRIVALS);
+    CHECK(evicted + MAX_CLIENTS == admitted);
+    CHECK(refused > 0);
+    
+    printf("Storm of %u clients on %u slots: %u admitted, %u evicted, %u refused\n",
+           STORM_ARRIVALS, MAX_CLIENTS, admitted, evicted, refused);
+}
+
+int main() {
+    test_rank();
+    test_hub();
+    test_tick_wrap();
+    test_storm();
+    
+    return TEST_RESULT();
+}
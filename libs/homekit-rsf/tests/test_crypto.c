@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "crypto.h"
+#include "test.h"
+
+// crypto.c over wolfCrypt of host build, see Makefile
+#define SIGN_MESSAGES           (64)
+#define SIGN_ROUNDS             (500)
+#define FRAME_SIZE              (1024)      // Largest HAP frame payload
+#define RESPONSE_SIZE           (40 * 1024) // /accessories of a big bridge
+#define RESPONSE_ROUNDS         (50)
+
+static double elapsed_ns(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void random_bytes(byte *buffer, size_t size) {
+    while (size--) {
+        *buffer++ = rand();
+    }
+}
+
+static void test_sign_expanded() {
+    ed25519_key *key = crypto_ed25519_generate();
+    CHECK(key != NULL);
+    if (!key) {
+        return;
+    }
+    
+    ed25519_expanded_key *expanded_key = crypto_ed25519_expand(key);
+    CHECK(expanded_key != NULL);
+    if (!expanded_key) {
+        crypto_ed25519_free(key);
+        return;
+    }
+    
+    // Pair Setup M6 and Pair Verify M2 sign 81 bytes, other sizes are random
+    static byte messages[SIGN_MESSAGES][200];
+    size_t sizes[SIGN_MESSAGES];
+    srand(1);
+    for (unsigned int i = 0; i < SIGN_MESSAGES; i++) {
+        sizes[i] = i % 2 ? 81 : rand() % sizeof(messages[i]);
+        random_bytes(messages[i], sizes[i]);
+    }
+    
+    // Same signature as wc_ed25519_sign_msg() behind crypto_ed25519_sign(), and it verifies
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < SIGN_MESSAGES; i++) {
+        byte signature[ED25519_SIGNATURE_SIZE], expected[ED25519_SIGNATURE_SIZE];
+        size_t size = sizeof(expected);
+        CHECK(!crypto_ed25519_sign(key, messages[i], sizes[i], expected, &size));
+        CHECK(size == ED25519_SIGNATURE_SIZE);
+        CHECK(!crypto_ed25519_sign_expanded(expanded_key, messages[i], sizes[i], signature));
+        mismatches += memcmp(signature, expected, sizeof(signature)) != 0;
+        CHECK(!crypto_ed25519_verify(key, messages[i], sizes[i], signature, sizeof(signature)));
+    }
+    CHECK(mismatches == 0);
+    
+    CHECK(crypto_ed25519_sign_expanded(NULL, messages[0], sizes[0], messages[1]) != 0);
+    
+    struct timespec start;
+    byte signature[ED25519_SIGNATURE_SIZE];
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < SIGN_ROUNDS; i++) {
+        size_t size = sizeof(signature);
+        crypto_ed25519_sign(key, messages[1], sizes[1], signature, &size);
+    }
+    const double sign_ns = elapsed_ns(&start) / SIGN_ROUNDS;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < SIGN_ROUNDS; i++) {
+        crypto_ed25519_sign_expanded(expanded_key, messages[1], sizes[1], signature);
+    }
+    const double expanded_ns = elapsed_ns(&start) / SIGN_ROUNDS;
+    
+    printf("Ed25519 sign of %zu bytes: %.1f us, with expanded key %.1f us\n",
+           sizes[1], sign_ns / 1000, expanded_ns / 1000);
+    
+    crypto_ed25519_expanded_free(expanded_key);
+    crypto_ed25519_free(key);
+}
+
+// Frame as server sends it: 2 bytes of length as AAD, nonce of 4 zero bytes and counter
+static void frame_nonce(byte *nonce, const uint64_t counter) {
+    memset(nonce, 0, 12);
+    for (unsigned int i = 0; i < 8; i++) {
+        nonce[4 + i] = counter >> (8 * i);
+    }
+}
+
+static void test_aead_in_place() {
+    byte key[32];
+    static byte response[RESPONSE_SIZE];
+    static byte frames[RESPONSE_SIZE / FRAME_SIZE][2 + FRAME_SIZE + 16];
+    static byte copied[2 + FRAME_SIZE + 16];
+    srand(2);
+    random_bytes(key, sizeof(key));
+    random_bytes(response, sizeof(response));
+    
+    // In place gives same frames as copying encryption, and they decrypt back in place
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < RESPONSE_SIZE / FRAME_SIZE; i++) {
+        byte *frame = frames[i];
+        const size_t size = FRAME_SIZE - i;
+        byte nonce[12];
+        frame_nonce(nonce, i);
+        frame[0] = size % 256;
+        frame[1] = size / 256;
+        
+        memcpy(frame + 2, response + i * FRAME_SIZE, size);
+        CHECK(!crypto_chacha20poly1305_encrypt_in_place(key, nonce, frame, 2, frame + 2, size, frame + 2 + size));
+        
+        size_t copied_size = sizeof(copied) - 2;
+        CHECK(!crypto_chacha20poly1305_encrypt(key, nonce, frame, 2, response + i * FRAME_SIZE, size,
+                                               copied + 2, &copied_size));
+        CHECK(copied_size == size + 16);
+        mismatches += memcmp(frame + 2, copied + 2, size + 16) != 0;
+        
+        CHECK(!crypto_chacha20poly1305_decrypt_in_place(key, nonce, frame, 2, frame + 2, size, frame + 2 + size));
+        mismatches += memcmp(frame + 2, response + i * FRAME_SIZE, size) != 0;
+    }
+    CHECK(mismatches == 0);
+    
+    // Tampered frame is rejected
+    byte *frame = frames[0];
+    byte nonce[12];
+    frame_nonce(nonce, 0);
+    CHECK(!crypto_chacha20poly1305_encrypt_in_place(key, nonce, frame, 2, frame + 2, FRAME_SIZE, frame + 2 + FRAME_SIZE));
+    frame[2 + 100] ^= 1;
+    CHECK(crypto_chacha20poly1305_decrypt_in_place(key, nonce, frame, 2, frame + 2, FRAME_SIZE, frame + 2 + FRAME_SIZE) != 0);
+    
+    // Whole response framed as before, ciphertext written to a second buffer, and in place
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int r = 0; r < RESPONSE_ROUNDS; r++) {
+        for (unsigned int i = 0; i < RESPONSE_SIZE / FRAME_SIZE; i++) {
+            frame_nonce(nonce, i);
+            copied[0] = FRAME_SIZE % 256;
+            copied[1] = FRAME_SIZE / 256;
+            size_t copied_size = sizeof(copied) - 2;
+            crypto_chacha20poly1305_encrypt(key, nonce, copied, 2, response + i * FRAME_SIZE, FRAME_SIZE,
+                                            copied + 2, &copied_size);
+        }
+    }
+    const double copy_ns = elapsed_ns(&start) / RESPONSE_ROUNDS;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int r = 0; r < RESPONSE_ROUNDS; r++) {
+        for (unsigned int i = 0; i < RESPONSE_SIZE / FRAME_SIZE; i++) {
+            frame_nonce(nonce, i);
+            frame[0] = FRAME_SIZE % 256;
+            frame[1] = FRAME_SIZE / 256;
+            crypto_chacha20poly1305_encrypt_in_place(key, nonce, frame, 2, frame + 2, FRAME_SIZE, frame + 2 + FRAME_SIZE);
+        }
+    }
+    const double in_place_ns = elapsed_ns(&start) / RESPONSE_ROUNDS;
+    
+    printf("%u KB response in %u byte frames: %.0f MB/s copied, %.0f MB/s in place\n",
+           RESPONSE_SIZE / 1024, FRAME_SIZE, RESPONSE_SIZE * 1e3 / copy_ns, RESPONSE_SIZE * 1e3 / in_place_ns);
+}
+
+int main() {
+    test_sign_expanded();
+    test_aead_in_place();
+    
+    return TEST_RESULT();
+}
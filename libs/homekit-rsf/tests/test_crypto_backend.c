@@ -0,0 +1,34 @@
+#include <crypto_backend.h>
+#include "test.h"
+
+// Taking address of every symbol of the contract makes linker resolve all of them
+#define BACKEND_SYMBOL(name) (const void *) name,
+static const void *const backend[] = {
+    HOMEKIT_CRYPTO_BACKEND(BACKEND_SYMBOL)
+};
+
+static void test_symbols() {
+    for (size_t i = 0; i < sizeof(backend) / sizeof(*backend); i++) {
+        CHECK(backend[i] != NULL);
+    }
+}
+
+// Stub backend fails closed, and server sees it through crypto.h
+static void test_stub() {
+    byte buffer[SHA512_HASH_SIZE];
+    size_t size = sizeof(buffer);
+
+    CHECK(crypto_sha512((const byte *) "abc", 3, buffer) != 0);
+    CHECK(crypto_srp_new() == NULL);
+    CHECK(crypto_ed25519_generate() == NULL);
+    CHECK(crypto_curve25519_generate() == NULL);
+    CHECK(crypto_chacha20poly1305_verify_tag(buffer, buffer, buffer, CHACHA20POLY1305_TAG_SIZE) != 0);
+    CHECK(crypto_hkdf(buffer, 32, NULL, 0, NULL, 0, buffer, &size) != 0);
+}
+
+int main() {
+    test_symbols();
+    test_stub();
+
+    return TEST_RESULT();
+}
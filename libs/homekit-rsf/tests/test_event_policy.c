@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <math.h>
+#include <event_policy.h>
+#include "test.h"
+
+// Server loop simulated with 10 ms ticks, as on ESP8266. Sensors notify at 100 Hz.
+#define TICK_MS             (10)
+#define CLIENTS             (3)
+#define STREAM_TICKS        (1000)      // 10 s of 100 Hz values
+#define SIMULATION_TICKS    (1300)
+
+enum { POWER, TEMPERATURE, SWITCH, CHARACTERISTICS };
+
+static homekit_characteristic_t characteristics[CHARACTERISTICS] = {
+    // Changes every sample, limited to one event per second
+    [POWER] = { .format = HOMEKIT_FORMAT_FLOAT, .min_event_interval = 1000, .event_dedupe = true },
+    // Notified at every sample, but changes only now and then
+    [TEMPERATURE] = { .format = HOMEKIT_FORMAT_FLOAT, .event_dedupe = true },
+    // No policy
+    [SWITCH] = { .format = HOMEKIT_FORMAT_BOOL },
+};
+
+static event_state_t states[CHARACTERISTICS];
+static bool pending[CHARACTERISTICS];
+
+static unsigned int events[CLIENTS][CHARACTERISTICS];
+static uint32_t last_event_time[CLIENTS][CHARACTERISTICS];
+static uint32_t min_event_gap[CLIENTS][CHARACTERISTICS];
+static float last_float[CLIENTS][CHARACTERISTICS];
+static unsigned int repeats[CLIENTS][CHARACTERISTICS];  // Events with value client already had
+static unsigned int suppressed = 0;
+
+static bool client_drops(const unsigned int client, const uint32_t now) {
+    // Client 1 is slow for 2 s, and its events are dropped as with a full send queue
+    return client == 1 && now >= 300 && now < 500;
+}
+
+static void notify(const unsigned int c, const homekit_value_t value) {
+    characteristics[c].value = value;
+    pending[c] = true;
+}
+
+// Same steps as homekit_server_process_notifications()
+static void process_notifications(const uint32_t now) {
+    bool batch[CHARACTERISTICS] = { false };
+    
+    for (unsigned int c = 0; c < CHARACTERISTICS; c++) {
+        if (!pending[c]) {
+            continue;
+        }
+        
+        homekit_characteristic_t *ch = &characteristics[c];
+        const event_policy_t policy = event_policy_check(&states[c], ch, ch->min_event_interval / TICK_MS, now);
+        if (policy == event_policy_defer) {
+            continue;
+        }
+        
+        pending[c] = false;
+        
+        if (policy == event_policy_suppress) {
+            suppressed++;
+            continue;
+        }
+        
+        batch[c] = true;
+    }
+    
+    homekit_value_t *values[CHARACTERISTICS];
+    uint32_t clients_up_to_date = UINT32_MAX;
+    for (unsigned int c = 0; c < CHARACTERISTICS; c++) {
+        if (batch[c] && characteristics[c].subscriptions) {
+            values[c] = event_policy_render(&states[c], &characteristics[c].value);
+            clients_up_to_date &= event_policy_clients_up_to_date(&states[c], &characteristics[c]);
+        }
+    }
+    
+    uint32_t clients = 0;
+    for (unsigned int client = 0; client < CLIENTS; client++) {
+        bool subscribed = false;
+        for (unsigned int c = 0; c < CHARACTERISTICS; c++) {
+            subscribed |= batch[c] && (characteristics[c].subscriptions & (1U << client));
+        }
+        
+        if (!subscribed || (clients_up_to_date & (1U << client)) || client_drops(client, now)) {
+            continue;
+        }
+        
+        clients |= 1U << client;
+        
+        for (unsigned int c = 0; c < CHARACTERISTICS; c++) {
+            if (batch[c] && (characteristics[c].subscriptions & (1U << client))) {
+                if (events[client][c]) {
+                    const uint32_t gap = now - last_event_time[client][c];
+                    if (gap < min_event_gap[client][c]) {
+                        min_event_gap[client][c] = gap;
+                    }
+                }
+                if (events[client][c] && last_float[client][c] == values[c]->float_value) {
+                    repeats[client][c]++;
+                }
+                events[client][c]++;
+                last_event_time[client][c] = now;
+                last_float[client][c] = values[c]->float_value;
+            }
+        }
+    }
+    
+    for (unsigned int c = 0; c < CHARACTERISTICS; c++) {
+        if (batch[c]) {
+            event_policy_sent(&states[c], characteristics[c].subscriptions & clients, now);
+        }
+    }
+}
+
+static void test_stream() {
+    memset(min_event_gap, 0xff, sizeof(min_event_gap));
+    
+    // Clients 0 and 1 are subscribed from start, client 2 subscribes at 5 s
+    for (unsigned int c = 0; c < CHARACTERISTICS; c++) {
+        characteristics[c].subscriptions = 0x3;
+    }
+    
+    float power = 0;
+    float temperature = 20;
+    unsigned int temperature_changes = 0;
+    
+    srand(1);
+    
+    for (uint32_t now = 1; now <= SIMULATION_TICKS; now++) {
+        if (now == 500) {
+            for (unsigned int c = 0; c < CHARACTERISTICS; c++) {
+                characteristics[c].subscriptions |= 1U << 2;
+            }
+        }
+        
+        if (now <= STREAM_TICKS) {
+            power = 100 + (rand() % 1000) / 10.f;
+            notify(POWER, HOMEKIT_FLOAT(power));
+            
+            if (rand() % 100 == 0) {
+                temperature = roundf((temperature + 0.1f) * 10) / 10;
+                temperature_changes++;
+            }
+            notify(TEMPERATURE, HOMEKIT_FLOAT(temperature));
+            
+            if (now % 250 == 0) {
+                notify(SWITCH, HOMEKIT_BOOL(now % 500 == 0));
+            }
+        }
+        
+        process_notifications(now);
+    }
+    
+    const uint32_t interval = characteristics[POWER].min_event_interval / TICK_MS;
+    
+    for (unsigned int client = 0; client < CLIENTS; client++) {
+        // Power: at most one event per interval, and latest value once stream is over
+        CHECK(min_event_gap[client][POWER] >= interval);
+        CHECK(last_float[client][POWER] == power);
+        CHECK(events[client][SWITCH] == (client == 2 ? 3 : 4));
+    }
+    
+    // 10 s stream with 1 s interval, client 0 gets every one and trailing value
+    CHECK(events[0][POWER] >= 10 && events[0][POWER] <= 11);
+    CHECK(events[2][POWER] >= 5 && events[2][POWER] <= 6);
+    
+    // Temperature: only changes are sent, and clients which missed a value get it again.
+    // Event body has every batched value, so a repeat only comes with a power or switch event.
+    CHECK(events[0][TEMPERATURE] - repeats[0][TEMPERATURE] == temperature_changes + 1);
+    for (unsigned int client = 0; client < CLIENTS; client++) {
+        CHECK(repeats[client][TEMPERATURE] <= events[client][POWER] + events[client][SWITCH]);
+    }
+    CHECK(last_float[0][TEMPERATURE] == temperature);
+    CHECK(last_float[1][TEMPERATURE] == temperature);
+    CHECK(last_float[2][TEMPERATURE] == temperature);
+    CHECK(events[2][TEMPERATURE] <= temperature_changes + 1);
+    CHECK(suppressed >= STREAM_TICKS - 2 * (temperature_changes + CLIENTS));
+    
+    printf("%u notifies at 100 Hz per characteristic, %u suppressed, %u temperature changes\n", STREAM_TICKS, suppressed, temperature_changes);
+    for (unsigned int client = 0; client < CLIENTS; client++) {
+        printf("Client %u events: power %u, temperature %u (%u repeated), switch %u\n", client,
+               events[client][POWER], events[client][TEMPERATURE], repeats[client][TEMPERATURE], events[client][SWITCH]);
+    }
+}
+
+static void test_state() {
+    homekit_characteristic_t ch = { .format = HOMEKIT_FORMAT_INT, .event_dedupe = true, .subscriptions = 0x5 };
+    event_state_t state = { 0 };
+    
+    ch.value = HOMEKIT_INT(7);
+    CHECK(event_policy_check(&state, &ch, 0, 0) == event_policy_send);
+    
+    homekit_value_t *value = event_policy_render(&state, &ch.value);
+    CHECK(value == &state.value && state.value.int_value == 7);
+    event_policy_sent(&state, 0x5, 10);
+    CHECK(state.clients == 0x5 && state.time == 10);
+    CHECK(event_policy_check(&state, &ch, 0, 11) == event_policy_suppress);
+    
+    // New subscriber has not got value yet, and only it needs event
+    ch.subscriptions |= 0x2;
+    CHECK(event_policy_check(&state, &ch, 0, 11) == event_policy_send);
+    CHECK(event_policy_clients_up_to_date(&state, &ch) == ~0x2U);
+    event_policy_sent(&state, 0x2, 11);
+    CHECK(event_policy_check(&state, &ch, 0, 12) == event_policy_suppress);
+    
+    // Rendering another value forgets clients which got previous one
+    ch.value = HOMEKIT_INT(8);
+    CHECK(event_policy_check(&state, &ch, 0, 12) == event_policy_send);
+    event_policy_render(&state, &ch.value);
+    CHECK(state.clients == 0 && state.value.int_value == 8);
+    
+    // Closed client is cleared from every state
+    event_state_t states[3] = { { .clients = 0x7 }, { .clients = 0x4 }, { .clients = 0x1 } };
+    event_policy_clear_client(states, 3, 2);
+    CHECK(states[0].clients == 0x3 && states[1].clients == 0 && states[2].clients == 0x1);
+    
+    // Interval is measured from last event with ticks wrapping around
+    homekit_characteristic_t limited = { .format = HOMEKIT_FORMAT_INT, .min_event_interval = 100, .subscriptions = 0x1 };
+    event_state_t wrapped = { .clients = 0x1, .time = 0xFFFFFFFC };
+    CHECK(event_policy_check(&wrapped, &limited, 10, 0xFFFFFFFF) == event_policy_defer);
+    CHECK(event_policy_check(&wrapped, &limited, 10, 0x00000005) == event_policy_defer);
+    CHECK(event_policy_check(&wrapped, &limited, 10, 0x00000006) == event_policy_send);
+    
+    // Nobody got a value yet, so interval does not hold first event
+    wrapped.clients = 0;
+    CHECK(event_policy_check(&wrapped, &limited, 10, 0xFFFFFFF5) == event_policy_send);
+    
+    // Strings are not compared, so they are never suppressed
+    homekit_characteristic_t name = { .format = HOMEKIT_FORMAT_STRING, .event_dedupe = true, .subscriptions = 0x1 };
+    name.value = HOMEKIT_STRING("a");
+    event_state_t name_state = { .clients = 0x1 };
+    CHECK(event_policy_render(&name_state, &name.value) == &name.value);
+    CHECK(event_policy_check(&name_state, &name, 0, 0) == event_policy_send);
+}
+
+int main() {
+    test_state();
+    test_stream();
+    
+    return TEST_RESULT();
+}
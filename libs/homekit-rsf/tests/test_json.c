@@ -0,0 +1,196 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include "json.h"
+#include "test.h"
+
+#define NUMBERS             (200000)
+
+// JSON streamed through a small buffer, so output is also split across flushes
+static char output[256];
+static size_t output_size;
+
+static int on_flush(uint8_t *buffer, size_t size, void *context) {
+    memcpy(output + output_size, buffer, size);
+    output_size += size;
+    return 0;
+}
+
+static void json_start(json_stream *json, uint8_t *buffer, size_t size) {
+    output_size = 0;
+    json->buffer = buffer;
+    json->size = size;
+    json->on_flush = on_flush;
+    json_init(json, NULL);
+}
+
+static const char *json_end(json_stream *json) {
+    json_flush(json);
+    output[output_size] = 0;
+    return output;
+}
+
+static const char *integer_text(long int x) {
+    uint8_t buffer[8];
+    json_stream json;
+    json_start(&json, buffer, sizeof(buffer));
+    json_integer(&json, x);
+    return json_end(&json);
+}
+
+static const char *float_text(float x) {
+    uint8_t buffer[64];
+    json_stream json;
+    json_start(&json, buffer, sizeof(buffer));
+    json_float(&json, x);
+    return json_end(&json);
+}
+
+static void test_integer() {
+    CHECK_STR(integer_text(0), "0");
+    CHECK_STR(integer_text(7), "7");
+    CHECK_STR(integer_text(-42), "-42");
+    CHECK_STR(integer_text(1234567890), "1234567890");
+    
+    char expected[32];
+    snprintf(expected, sizeof(expected), "%ld", LONG_MAX);
+    CHECK_STR(integer_text(LONG_MAX), expected);
+    snprintf(expected, sizeof(expected), "%ld", LONG_MIN);
+    CHECK_STR(integer_text(LONG_MIN), expected);
+}
+
+static void test_float() {
+    CHECK_STR(float_text(0), "0");
+    CHECK_STR(float_text(1), "1");
+    CHECK_STR(float_text(-2.5f), "-2.5");
+    CHECK_STR(float_text(0.1f), "0.1");
+    CHECK_STR(float_text(21.35f), "21.35");
+    CHECK_STR(float_text(100), "100");
+    CHECK_STR(float_text(0.0001f), "0.0001");
+    CHECK_STR(float_text(1e-5f), "1e-05");
+    CHECK_STR(float_text(12345678), "1.234568e+07");
+    
+    // Fast path must print same text as "%1.7g"
+    srand(1);
+    char expected[32];
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < 200000; i++) {
+        const float x = (rand() % 2 ? -1 : 1) * (rand() / (float) RAND_MAX) * powf(10, rand() % 16 - 8);
+        snprintf(expected, sizeof(expected), "%1.7g", x);
+        if (strcmp(float_text(x), expected) && mismatches++ < 5) {
+            printf("%s != %s\n", float_text(x), expected);
+        }
+    }
+    CHECK(mismatches == 0);
+}
+
+static void test_structure() {
+    uint8_t buffer[16];
+    json_stream json;
+    json_start(&json, buffer, sizeof(buffer));
+    
+    json_object_start(&json);
+    json_string(&json, "characteristics");
+    json_array_start(&json);
+    json_object_start(&json);
+    json_string(&json, "aid");
+    json_integer(&json, 1);
+    json_string(&json, "value");
+    json_float(&json, 22.5f);
+    json_string(&json, "on");
+    json_boolean(&json, true);
+    json_object_end(&json);
+    json_array_end(&json);
+    json_object_end(&json);
+    
+    CHECK_STR(json_end(&json), "{\"characteristics\":[{\"aid\":1,\"value\":22.5,\"on\":true}]}");
+    CHECK(!json.error);
+}
+
+static int on_flush_discard(uint8_t *buffer, size_t size, void *context) {
+    return 0;
+}
+
+static double elapsed_ns(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+// Number written as json_integer() and json_float() did before: size, malloc, format, write
+static void snprintf_number(json_stream *json, const char *format, ...) {
+    va_list arg_list;
+    va_start(arg_list, format);
+    size_t len = vsnprintf(NULL, 0, format, arg_list);
+    va_end(arg_list);
+    
+    char *buffer = malloc(len + 1);
+    if (buffer) {
+        va_start(arg_list, format);
+        vsnprintf(buffer, len + 1, format, arg_list);
+        va_end(arg_list);
+        
+        json_write(json, ",", 1);
+        json_write(json, buffer, len);
+        free(buffer);
+    }
+}
+
+// Ids and values as in /accessories and /characteristics responses
+static void benchmark() {
+    static long int integers[4096];
+    static float floats[4096];
+    srand(1);
+    for (unsigned int i = 0; i < 4096; i++) {
+        integers[i] = rand() % 200;
+        floats[i] = (rand() % 1000) / 10.f;
+    }
+    
+    uint8_t buffer[HOMEKIT_JSON_BUFFER_SIZE];
+    json_stream json = { .buffer = buffer, .size = sizeof(buffer), .on_flush = on_flush_discard };
+    struct timespec start;
+    double ns[4];
+    
+    json_init(&json, NULL);
+    json_array_start(&json);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < NUMBERS; i++) {
+        json_integer(&json, integers[i % 4096]);
+    }
+    ns[0] = elapsed_ns(&start) / NUMBERS;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < NUMBERS; i++) {
+        snprintf_number(&json, "%ld", integers[i % 4096]);
+    }
+    ns[1] = elapsed_ns(&start) / NUMBERS;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < NUMBERS; i++) {
+        json_float(&json, floats[i % 4096]);
+    }
+    ns[2] = elapsed_ns(&start) / NUMBERS;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < NUMBERS; i++) {
+        snprintf_number(&json, "%1.7g", floats[i % 4096]);
+    }
+    ns[3] = elapsed_ns(&start) / NUMBERS;
+    
+    CHECK(!json.error);
+    printf("json_integer %.0f ns, snprintf and malloc %.0f ns per number\n", ns[0], ns[1]);
+    printf("json_float %.0f ns, snprintf and malloc %.0f ns per number\n", ns[2], ns[3]);
+}
+
+int main() {
+    test_integer();
+    test_float();
+    test_structure();
+    benchmark();
+    
+    return TEST_RESULT();
+}
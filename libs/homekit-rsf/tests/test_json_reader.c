@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include "json_reader.h"
+#include "test.h"
+
+// Body of PUT /characteristics, walked as server does
+static void test_characteristics_body() {
+    char body[] = " {\"characteristics\": [\n"
+                  "  {\"aid\": 1, \"iid\": 10, \"value\": true},\n"
+                  "  {\"aid\": 2, \"iid\": 11, \"ev\": false, \"extra\": {\"a\": [1, {\"b\": \"}\"}]}},\n"
+                  "  {\"aid\": 3, \"iid\": 12, \"value\": -21.5e1, \"pid\": null}\n"
+                  "]}";
+    
+    json_reader_t reader;
+    json_reader_init(&reader, body);
+    
+    json_value_t value;
+    CHECK(json_reader_value(&reader, &value) && value.type == JSON_VALUE_OBJECT);
+    
+    char *key = json_reader_next_key(&reader);
+    CHECK(key && !strcmp(key, "characteristics"));
+    CHECK(json_reader_value(&reader, &value) && value.type == JSON_VALUE_ARRAY);
+    
+    unsigned int count = 0;
+    float values[3] = { 0 };
+    bool events_off = false;
+    while (json_reader_next_item(&reader)) {
+        CHECK(json_reader_value(&reader, &value) && value.type == JSON_VALUE_OBJECT);
+        
+        while ((key = json_reader_next_key(&reader))) {
+            CHECK(json_reader_value(&reader, &value));
+            if (!strcmp(key, "value")) {
+                values[count] = (value.type == JSON_VALUE_TRUE) ? 1 : value.number;
+            } else if (!strcmp(key, "ev")) {
+                events_off = value.type == JSON_VALUE_FALSE;
+            } else if (!strcmp(key, "extra")) {
+                CHECK(value.type == JSON_VALUE_OBJECT);
+                CHECK(json_reader_skip(&reader));
+            } else if (!strcmp(key, "pid")) {
+                CHECK(value.type == JSON_VALUE_NULL);
+            } else if (!strcmp(key, "iid")) {
+                CHECK(value.type == JSON_VALUE_NUMBER && value.number == 10 + count);
+            }
+        }
+        
+        count++;
+    }
+    
+    CHECK(!json_reader_next_key(&reader));
+    CHECK(json_reader_end(&reader));
+    CHECK(!reader.error);
+    CHECK(count == 3);
+    CHECK(values[0] == 1);
+    CHECK(values[2] == -215);
+    CHECK(events_off);
+}
+
+static void test_strings() {
+    char body[] = "\"a\\\"b\\\\c\\/\\n\\u00e9\\u20ac\\ud83d\\ude00\"";
+    json_reader_t reader;
+    json_reader_init(&reader, body);
+    
+    json_value_t value;
+    CHECK(json_reader_value(&reader, &value) && value.type == JSON_VALUE_STRING);
+    CHECK_STR(value.string, "a\"b\\c/\n\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+    
+    // Unescaped in place
+    CHECK(value.string == body + 1);
+    CHECK(json_reader_end(&reader));
+}
+
+static bool parse_fails(const char *text) {
+    char body[64];
+    strcpy(body, text);
+    
+    json_reader_t reader;
+    json_reader_init(&reader, body);
+    json_value_t value;
+    if (!json_reader_value(&reader, &value)) {
+        return true;
+    }
+    
+    if (value.type == JSON_VALUE_OBJECT) {
+        while (json_reader_next_key(&reader)) {
+            if (!json_reader_value(&reader, &value) ||
+                ((value.type == JSON_VALUE_OBJECT || value.type == JSON_VALUE_ARRAY) && !json_reader_skip(&reader))) {
+                break;
+            }
+        }
+    }
+    
+    return reader.error || !json_reader_end(&reader);
+}
+
+static void test_errors() {
+    CHECK(!parse_fails("{\"a\": 1, \"b\": [1, 2]}"));
+    CHECK(parse_fails("{\"a\": 1 \"b\": 2}"));
+    CHECK(parse_fails("{\"a\" 1}"));
+    CHECK(parse_fails("{a: 1}"));
+    CHECK(parse_fails("{\"a\": tru}"));
+    CHECK(parse_fails("{\"a\": 0x10}"));
+    CHECK(parse_fails("{\"a\": nan}"));
+    CHECK(parse_fails("{\"a\": \"\\q\"}"));
+    CHECK(parse_fails("{\"a\": \"open"));
+    CHECK(parse_fails("{\"a\": [1, 2}"));
+    CHECK(parse_fails("{\"a\": 1} x"));
+    
+    json_reader_t reader;
+    json_reader_init(&reader, NULL);
+    CHECK(reader.error);
+}
+
+int main() {
+    test_characteristics_body();
+    test_strings();
+    test_errors();
+    
+    return TEST_RESULT();
+}
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include "query_params.h"
+#include "test.h"
+
+// Params come from a fixed arena, as server takes them from request arena
+static query_param_t arena[8];
+static unsigned int arena_used;
+static unsigned int arena_size;
+
+static void *arena_alloc(size_t size, void *arg) {
+    if (size != sizeof(query_param_t) || arena_used >= arena_size) {
+        return NULL;
+    }
+    
+    return &arena[arena_used++];
+}
+
+static query_param_t *parse(char *s, unsigned int size) {
+    arena_used = 0;
+    arena_size = size;
+    return query_params_parse(s, arena_alloc, NULL);
+}
+
+static void test_characteristics_query() {
+    char s[] = "id=1.10,1.11&meta=1&ev=0";
+    query_param_t *params = parse(s, 8);
+    
+    CHECK(arena_used == 3);
+    
+    query_param_t *id = query_params_find(params, "id");
+    CHECK(id && id->value);
+    if (id && id->value) {
+        CHECK_STR(id->value, "1.10,1.11");
+    }
+    
+    query_param_t *meta = query_params_find(params, "meta");
+    CHECK(meta && meta->value && !strcmp(meta->value, "1"));
+    
+    query_param_t *ev = query_params_find(params, "ev");
+    CHECK(ev && ev->value && !strcmp(ev->value, "0"));
+    
+    CHECK(!query_params_find(params, "perms"));
+    
+    // Parsed in place
+    CHECK(id && id->name == s);
+}
+
+static void test_empty_values() {
+    char s[] = "a=&b&&=x&c=3#d=4";
+    query_param_t *params = parse(s, 8);
+    
+    query_param_t *a = query_params_find(params, "a");
+    CHECK(a && !a->value);
+    
+    query_param_t *b = query_params_find(params, "b");
+    CHECK(b && !b->value);
+    
+    query_param_t *c = query_params_find(params, "c");
+    CHECK(c && c->value && !strcmp(c->value, "3"));
+    
+    // Fragment is not part of query
+    CHECK(!query_params_find(params, "d"));
+}
+
+static void test_empty() {
+    char s[] = "";
+    CHECK(!parse(s, 8));
+    
+    char t[] = "&&#";
+    CHECK(!parse(t, 8));
+}
+
+static void test_alloc_failure() {
+    char s[] = "a=1&b=2&c=3";
+    query_param_t *params = parse(s, 2);
+    
+    CHECK(arena_used == 2);
+    CHECK(query_params_find(params, "a"));
+    CHECK(query_params_find(params, "b"));
+    CHECK(!query_params_find(params, "c"));
+}
+
+int main() {
+    test_characteristics_query();
+    test_empty_values();
+    test_empty();
+    test_alloc_failure();
+    
+    return TEST_RESULT();
+}
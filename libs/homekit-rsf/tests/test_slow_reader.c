@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hap_controller.h"
+#include "host_bridge.h"
+#include "host_control.h"
+#include "test.h"
+
+// A controller subscribes to events and stops reading its socket, while other controllers keep
+// sending requests and receiving events. Server must drop events of the slow one (or disconnect
+// it) instead of blocking in send(), so latency seen by the others stays as it was before.
+#define ACCESSORIES             "10"
+#define SENSOR_PERIOD           "10"        // Milliseconds, every sensor sends an event each period
+#define CONTROLLERS             (3)         // Besides admin and slow one
+#define SLOW_RECEIVE_BUFFER     (2048)
+#define PHASE_TIME              (2)         // Seconds measured before and while slow controller stalls
+#define FILL_TIMEOUT            (10000)     // Milliseconds for slow controller to fill its queue
+
+// Loopback latency includes about 40 ms of Nagle and delayed ACK now and then (TCP_NODELAY is off
+// in server), so limits leave room for it. Blocking on slow socket would add seconds.
+#define P99_MARGIN              (50)        // Milliseconds over p99 before stall
+#define MAX_LATENCY             (500)
+
+enum {
+    PHASE_BASELINE,
+    PHASE_FILL,
+    PHASE_STALLED,
+    PHASES
+};
+
+typedef struct {
+    uint32_t *values;       // Microseconds
+    size_t count;
+    size_t capacity;
+} samples_t;
+
+typedef struct {
+    hap_controller_t *controller;
+    pthread_t thread;
+    unsigned int seed;
+    samples_t samples[PHASES];
+    unsigned int events[PHASES];
+    unsigned int errors;
+} worker_t;
+
+static hap_accessory_t accessory;
+static worker_t workers[CONTROLLERS];
+static volatile unsigned int phase = PHASE_BASELINE;
+static volatile bool stopping = false;
+
+
+static uint64_t now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void samples_add(samples_t *samples, const uint64_t value) {
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 1024;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(uint32_t));
+    }
+
+    samples->values[samples->count++] = value;
+}
+
+static int samples_compare(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t*) a;
+    const uint32_t y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+// Samples of all workers in a phase, sorted
+static samples_t samples_of_phase(const unsigned int p) {
+    samples_t all = { 0 };
+    for (unsigned int i = 0; i < CONTROLLERS; i++) {
+        for (size_t j = 0; j < workers[i].samples[p].count; j++) {
+            samples_add(&all, workers[i].samples[p].values[j]);
+        }
+    }
+
+    if (all.count) {
+        qsort(all.values, all.count, sizeof(uint32_t), samples_compare);
+    }
+
+    return all;
+}
+
+static double samples_percentile(const samples_t *samples, const unsigned int percent) {
+    if (!samples->count) {
+        return 0;
+    }
+
+    size_t i = (samples->count * percent + 99) / 100;
+    return samples->values[i ? i - 1 : 0] / 1000.;
+}
+
+static void on_event(hap_controller_t *controller, const char *body, size_t size, void *arg) {
+    worker_t *worker = arg;
+    worker->events[phase]++;
+}
+
+static int subscribe(hap_controller_t *controller) {
+    char body[32 + HOST_BRIDGE_ACCESSORIES_MAX * 40];
+    size_t length = snprintf(body, sizeof(body), "{\"characteristics\":[");
+    for (unsigned int i = 0; i < atoi(ACCESSORIES); i++) {
+        length += snprintf(body + length, sizeof(body) - length, "%s{\"aid\":%u,\"iid\":%u,\"ev\":true}",
+                           i ? "," : "", HOST_BRIDGE_AID_FIRST + i, HOST_BRIDGE_IID_TEMPERATURE);
+    }
+    snprintf(body + length, sizeof(body) - length, "]}");
+
+    hap_response_t response;
+    const int r = hap_controller_request(controller, "PUT", "/characteristics", "application/hap+json",
+                                         body, strlen(body), &response);
+
+    return r < 0 || response.status != 204 ? -1 : 0;
+}
+
+static void *worker_thread(void *arg) {
+    worker_t *worker = arg;
+
+    while (!stopping && !worker->errors) {
+        char path[64];
+        const unsigned int aid = HOST_BRIDGE_AID_FIRST + rand_r(&worker->seed) % atoi(ACCESSORIES);
+        snprintf(path, sizeof(path), "/characteristics?id=%u.%u,%u.%u", aid, HOST_BRIDGE_IID_ON,
+                 aid, HOST_BRIDGE_IID_TEMPERATURE);
+
+        hap_response_t response;
+        const unsigned int p = phase;
+        const uint64_t start = now_us();
+        if (hap_controller_request(worker->controller, "GET", path, NULL, NULL, 0, &response) < 0 ||
+            response.status != 200) {
+            worker->errors++;
+        } else {
+            samples_add(&worker->samples[p], now_us() - start);
+        }
+    }
+
+    return NULL;
+}
+
+static int pair(hap_controller_t *admin, hap_controller_t *slow) {
+    if (host_control_connect(admin) < 0 ||
+        hap_controller_pair_setup(admin, HOST_BRIDGE_SETUP_CODE, &accessory) < 0) {
+        return -1;
+    }
+
+    hap_controller_close(admin);
+    if (host_control_connect(admin) < 0 || hap_controller_pair_verify(admin, &accessory) < 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < CONTROLLERS; i++) {
+        if (hap_controller_add_pairing(admin, workers[i].controller, false) < 0) {
+            return -1;
+        }
+    }
+
+    const int r = hap_controller_add_pairing(admin, slow, false);
+    hap_controller_close(admin);
+
+    return r;
+}
+
+static int connect_verified(hap_controller_t *controller) {
+    return host_control_connect(controller) < 0 ||
+           hap_controller_pair_verify(controller, &accessory) < 0 ||
+           subscribe(controller) < 0 ? -1 : 0;
+}
+
+int main() {
+    const char *options[] = { "-a", ACCESSORIES, "-e", SENSOR_PERIOD, NULL };
+    CHECK(!host_control_start("./host_server", options));
+
+    char id[40];
+    snprintf(id, sizeof(id), "A0000000-0000-4000-8000-%012X", (unsigned int) getpid());
+    hap_controller_t *admin = hap_controller_new(id);
+    snprintf(id, sizeof(id), "B0000000-0000-4000-8000-%012X", (unsigned int) getpid());
+    hap_controller_t *slow = hap_controller_new(id);
+    hap_controller_set_receive_buffer(slow, SLOW_RECEIVE_BUFFER);
+    for (unsigned int i = 0; i < CONTROLLERS; i++) {
+        snprintf(id, sizeof(id), "%08X-0000-4000-8000-%012X", i + 1, (unsigned int) getpid());
+        workers[i].controller = hap_controller_new(id);
+        workers[i].seed = i + 1;
+        hap_controller_set_event_callback(workers[i].controller, on_event, &workers[i]);
+    }
+
+    CHECK(!pair(admin, slow));
+    for (unsigned int i = 0; i < CONTROLLERS; i++) {
+        CHECK(!connect_verified(workers[i].controller));
+    }
+
+    if (!test_failures) {
+        for (unsigned int i = 0; i < CONTROLLERS; i++) {
+            pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+        }
+        sleep(PHASE_TIME);
+
+        // Slow controller reads nothing after its subscription, until its socket and queue are full
+        phase = PHASE_FILL;
+        CHECK(!connect_verified(slow));
+
+        host_server_stats_t stats;
+        unsigned int waited = 0;
+        while (!host_control_stats(&stats) && !stats.event_drops && !stats.evictions && waited < FILL_TIMEOUT) {
+            usleep(100000);
+            waited += 100;
+        }
+        CHECK(stats.event_drops || stats.evictions);
+
+        phase = PHASE_STALLED;
+        sleep(PHASE_TIME);
+        stopping = true;
+
+        for (unsigned int i = 0; i < CONTROLLERS; i++) {
+            pthread_join(workers[i].thread, NULL);
+            CHECK(!workers[i].errors);
+            // Others keep getting events at about rate before stall
+            CHECK(workers[i].events[PHASE_STALLED] * 2 > workers[i].events[PHASE_BASELINE]);
+        }
+
+        samples_t baseline = samples_of_phase(PHASE_BASELINE);
+        samples_t stalled = samples_of_phase(PHASE_STALLED);
+        printf("GET latency before stall: %zu requests, p50 %.2f, p99 %.2f, max %.2f ms\n",
+               baseline.count, samples_percentile(&baseline, 50), samples_percentile(&baseline, 99),
+               samples_percentile(&baseline, 100));
+        printf("GET latency while stalled: %zu requests, p50 %.2f, p99 %.2f, max %.2f ms\n",
+               stalled.count, samples_percentile(&stalled, 50), samples_percentile(&stalled, 99),
+               samples_percentile(&stalled, 100));
+        host_control_stats(&stats);
+        printf("Slow controller after %u ms: %u events dropped, %u evicted, %u bytes queued\n",
+               waited, stats.event_drops, stats.evictions, stats.queued);
+
+        CHECK(stalled.count * 2 > baseline.count);
+        CHECK(samples_percentile(&stalled, 99) < samples_percentile(&baseline, 99) + P99_MARGIN);
+        CHECK(samples_percentile(&stalled, 100) < MAX_LATENCY);
+
+        free(baseline.values);
+        free(stalled.values);
+    }
+
+    host_control_stop();
+
+    for (unsigned int i = 0; i < CONTROLLERS; i++) {
+        for (unsigned int p = 0; p < PHASES; p++) {
+            free(workers[i].samples[p].values);
+        }
+        hap_controller_free(workers[i].controller);
+    }
+    hap_controller_free(slow);
+    hap_controller_free(admin);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <homekit/tlv.h>
+#include "test.h"
+
+#define TYPE_STATE          (6)
+#define TYPE_PUBLIC_KEY     (3)
+#define TYPE_PROOF          (4)
+#define TYPE_SEPARATOR      (0xff)
+
+static byte public_key[384];
+static byte proof[64];
+
+static void test_round_trip() {
+    byte buffer[512];
+    tlv_writer_t writer;
+    tlv_writer_init(&writer, buffer, sizeof(buffer));
+    tlv_write_integer(&writer, TYPE_STATE, 1, 2);
+    tlv_write(&writer, TYPE_PUBLIC_KEY, public_key, sizeof(public_key));
+    tlv_write(&writer, TYPE_PROOF, proof, sizeof(proof));
+    tlv_write(&writer, TYPE_SEPARATOR, NULL, 0);
+    
+    CHECK(!writer.error);
+    CHECK(writer.pos == TLV_ENCODED_SIZE(1) + TLV_ENCODED_SIZE(sizeof(public_key)) +
+                        TLV_ENCODED_SIZE(sizeof(proof)) + TLV_ENCODED_SIZE(0));
+    
+    // Same bytes as allocating encoder
+    tlv_values_t *values = tlv_new();
+    tlv_add_integer_value(values, TYPE_STATE, 1, 2);
+    tlv_add_value(values, TYPE_PUBLIC_KEY, public_key, sizeof(public_key));
+    tlv_add_value(values, TYPE_PROOF, proof, sizeof(proof));
+    tlv_add_value(values, TYPE_SEPARATOR, NULL, 0);
+    
+    byte formatted[512];
+    size_t formatted_size = sizeof(formatted);
+    CHECK(!tlv_format(values, formatted, &formatted_size));
+    CHECK(formatted_size == writer.pos);
+    CHECK_MEM(formatted, buffer, writer.pos);
+    tlv_free(values);
+    
+    // Fragments of public key are joined in place
+    tlv_view_t view;
+    CHECK(!tlv_view_parse(buffer, writer.pos, &view));
+    CHECK(view.count == 4);
+    CHECK(tlv_view_get_integer(&view, TYPE_STATE, -1) == 2);
+    CHECK(tlv_view_get_integer(&view, 0x42, -1) == -1);
+    
+    const tlv_item_t *item = tlv_view_get(&view, TYPE_PUBLIC_KEY);
+    CHECK(item && item->size == sizeof(public_key) && !memcmp(item->value, public_key, sizeof(public_key)));
+    CHECK(item && item->value >= buffer && item->value < buffer + sizeof(buffer));
+    
+    item = tlv_view_get(&view, TYPE_PROOF);
+    CHECK(item && item->size == sizeof(proof) && !memcmp(item->value, proof, sizeof(proof)));
+    
+    item = tlv_view_get(&view, TYPE_SEPARATOR);
+    CHECK(item && item->size == 0);
+}
+
+static void test_writer_overflow() {
+    byte buffer[300];
+    tlv_writer_t writer;
+    tlv_writer_init(&writer, buffer, sizeof(buffer));
+    tlv_write(&writer, TYPE_PUBLIC_KEY, public_key, 255);
+    CHECK(!writer.error);
+    
+    // Fragmented item needs 2 headers, and does not fit
+    tlv_write(&writer, TYPE_PROOF, proof, 42);
+    CHECK(writer.error);
+    CHECK(writer.pos == 257);
+    
+    // Later writes are ignored
+    tlv_write_integer(&writer, TYPE_STATE, 1, 1);
+    CHECK(writer.pos == 257);
+    
+    tlv_writer_init(&writer, NULL, 0);
+    CHECK(writer.error);
+}
+
+static void test_parse_errors() {
+    tlv_view_t view;
+    
+    byte truncated_header[] = { TYPE_STATE, 1, 2, TYPE_PROOF };
+    CHECK(tlv_view_parse(truncated_header, sizeof(truncated_header), &view) == -1);
+    
+    byte truncated_value[] = { TYPE_PROOF, 4, 1, 2 };
+    CHECK(tlv_view_parse(truncated_value, sizeof(truncated_value), &view) == -1);
+    
+    CHECK(tlv_view_parse(truncated_value, 1, &view) == -1);
+    
+    byte too_many[2 * (TLV_VIEW_ITEMS_MAX + 1)];
+    for (unsigned int i = 0; i < TLV_VIEW_ITEMS_MAX + 1; i++) {
+        too_many[2 * i] = i;
+        too_many[2 * i + 1] = 0;
+    }
+    CHECK(tlv_view_parse(too_many, sizeof(too_many), &view) == -2);
+    CHECK(!tlv_view_parse(too_many, sizeof(too_many) - 2, &view));
+    CHECK(view.count == TLV_VIEW_ITEMS_MAX);
+}
+
+int main() {
+    for (unsigned int i = 0; i < sizeof(public_key); i++) {
+        public_key[i] = i * 7 + 1;
+    }
+    
+    for (unsigned int i = 0; i < sizeof(proof); i++) {
+        proof[i] = 0xA0 ^ i;
+    }
+    
+    test_round_trip();
+    test_writer_overflow();
+    test_parse_errors();
+    
+    return TEST_RESULT();
+}